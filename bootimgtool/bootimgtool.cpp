@@ -120,7 +120,12 @@ typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
     "  unpack         Unpack a boot image\n" \
     "  pack           Assemble boot image from unpacked files\n" \
     "\n" \
-    "Pass -h/--help as a argument to a command to see it's available options.\n"
+    "Pass -h/--help as a argument to a command to see it's available options.\n" \
+    "\n" \
+    "Environment variables:\n" \
+    "  MBP_FILE_TRACE Append an I/O trace of the boot image to the given path\n" \
+    "                 (Chrome trace JSON if it ends in .json, a summary\n" \
+    "                 otherwise, or a summary on stderr if it is \"-\")\n"
 
 #define HELP_UNPACK_USAGE \
     "Usage: bootimgtool unpack <input file> [<option>...]\n" \
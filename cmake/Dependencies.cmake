@@ -19,6 +19,7 @@ if(${MBP_BUILD_TARGET} STREQUAL android)
 endif()
 
 if(${MBP_BUILD_TARGET} STREQUAL desktop)
+    include(cmake/dependencies/benchmark.cmake)
     include(cmake/dependencies/gtest.cmake)
     include(cmake/dependencies/libarchive.cmake)
     include(cmake/dependencies/liblzma.cmake)
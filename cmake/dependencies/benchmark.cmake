@@ -0,0 +1,3 @@
+if(MBP_ENABLE_BENCHMARKS)
+    find_package(benchmark REQUIRED)
+endif()
@@ -26,6 +26,7 @@
 #include <jansson.h>
 #include <yaml-cpp/yaml.h>
 
+#include "mbdevice/database.h"
 #include "mbdevice/json.h"
 #include "mbdevice/validate.h"
 
@@ -201,6 +202,53 @@ static bool validate(const char *path, const char *json, bool is_array)
     return true;
 }
 
+static bool write_database(const char *path, const char *json)
+{
+    MbDeviceJsonError error;
+    Device **devices = mb_device_new_list_from_json(json, &error);
+    if (!devices) {
+        print_json_error(path, &error);
+        return false;
+    }
+
+    size_t size;
+    void *data = mb_device_database_build(devices, &size);
+
+    for (Device **iter = devices; *iter; ++iter) {
+        mb_device_free(*iter);
+    }
+    free(devices);
+
+    if (!data) {
+        fprintf(stderr, "%s: Failed to build database: %s\n",
+                path, strerror(errno));
+        return false;
+    }
+
+    bool ret = true;
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open file: %s\n",
+                path, strerror(errno));
+        ret = false;
+    } else {
+        if (fwrite(data, 1, size, fp) != size) {
+            fprintf(stderr, "%s: Failed to write database: %s\n",
+                    path, strerror(errno));
+            ret = false;
+        }
+        if (fclose(fp) != 0) {
+            fprintf(stderr, "%s: Failed to close file: %s\n",
+                    path, strerror(errno));
+            ret = false;
+        }
+    }
+
+    free(data);
+    return ret;
+}
+
 static void usage(FILE *stream)
 {
     fprintf(stream,
@@ -209,6 +257,8 @@ static void usage(FILE *stream)
             "Options:\n"
             "  -o, --output <file>\n"
             "                   Output file (outputs to stdout if omitted)\n"
+            "  -b, --binary-output <file>\n"
+            "                   Also write compiled device database to file\n"
             "  -h, --help       Display this help message\n"
             "  --styled         Output in human-readable format\n");
 }
@@ -221,11 +271,12 @@ int main(int argc, char *argv[])
         OPT_STYLED             = 1000,
     };
 
-    static const char short_options[] = "o:h";
+    static const char short_options[] = "o:b:h";
 
     static struct option long_options[] = {
         {"styled", no_argument, 0, OPT_STYLED},
         {"output", required_argument, 0, 'o'},
+        {"binary-output", required_argument, 0, 'b'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -233,6 +284,7 @@ int main(int argc, char *argv[])
     int long_index = 0;
 
     const char *output_file = nullptr;
+    const char *binary_output_file = nullptr;
     bool styled = false;
 
     while ((opt = getopt_long(argc, argv, short_options,
@@ -246,6 +298,10 @@ int main(int argc, char *argv[])
             output_file = optarg;
             break;
 
+        case 'b':
+            binary_output_file = optarg;
+            break;
+
         case 'h':
             usage(stdout);
             return EXIT_SUCCESS;
@@ -314,15 +370,28 @@ int main(int argc, char *argv[])
     }
 
     free(output);
-    json_decref(json_root);
 
     if (output_file) {
         if (fclose(fp) != 0) {
             fprintf(stderr, "%s: Failed to close file: %s\n",
                     output_file, strerror(errno));
+            json_decref(json_root);
             return EXIT_FAILURE;
         }
     }
 
+    if (binary_output_file) {
+        output = json_dumps(json_root, JSON_COMPACT);
+        bool ret = write_database(binary_output_file, output);
+        free(output);
+
+        if (!ret) {
+            json_decref(json_root);
+            return EXIT_FAILURE;
+        }
+    }
+
+    json_decref(json_root);
+
     return EXIT_SUCCESS;
 }
@@ -22,6 +22,7 @@
 
 #include <cassert>
 
+#include <mbdevice/database.h>
 #include <mbdevice/json.h>
 #include <mbdevice/validate.h>
 #include <mbp/errors.h>
@@ -426,6 +427,33 @@ void MainWindow::populateDevices()
     Q_D(MainWindow);
 
     // TODO: This shouldn't be done in the GUI thread
+    QString dbPath(QString::fromStdString(d->pc->dataDirectory())
+            % QStringLiteral("/devices.bin"));
+    MbDeviceDatabase *db = mb_device_database_open(dbPath.toUtf8().data());
+
+    if (db) {
+        size_t count = mb_device_database_count(db);
+
+        for (size_t i = 0; i < count; ++i) {
+            Device *device = mb_device_database_get(db, i);
+            if (!device) {
+                qWarning("%s: Failed to load device %zu",
+                         dbPath.toUtf8().data(), i);
+            } else if (mb_device_validate(device) == 0) {
+                d->deviceSel->addItem(QStringLiteral("%1 - %2")
+                        .arg(QString::fromUtf8(mb_device_id(device)))
+                        .arg(QString::fromUtf8(mb_device_name(device))));
+                d->devices.emplace_back(device, mb_device_free);
+            } else {
+                mb_device_free(device);
+            }
+        }
+
+        mb_device_database_close(db);
+        return;
+    }
+
+    // Fall back to the JSON definitions
     QString path(QString::fromStdString(d->pc->dataDirectory())
             % QStringLiteral("/devices.json"));
     QFile file(path);
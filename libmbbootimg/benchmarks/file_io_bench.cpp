@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Counts the number of backend calls (which are syscalls for the fd backend)
+// needed to write and then read back a boot image, with and without a
+// buffered MbFile layer between libmbbootimg and the file descriptor. The
+// callers use small chunks, as mbtool and the patcher do, so that the effect of
+// the format readers' and writers' own header and padding I/O is visible.
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/fd.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+#define KERNEL_SIZE     (8 * 1024 * 1024)
+#define RAMDISK_SIZE    (4 * 1024 * 1024 + 123)
+#define SECOND_SIZE     (64 * 1024 + 7)
+#define DT_SIZE         (256 * 1024 + 45)
+#define CHUNK_SIZE      4096
+
+struct Counts
+{
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long seeks;
+    unsigned long truncates;
+};
+
+struct CountingFile
+{
+    MbFile *inner;
+    Counts counts;
+};
+
+static int counting_close_cb(MbFile *file, void *userdata)
+{
+    CountingFile *cf = static_cast<CountingFile *>(userdata);
+    int ret = mb_file_close(cf->inner);
+    if (ret != MB_FILE_OK) {
+        mb_file_set_error(file, mb_file_error(cf->inner), "%s",
+                          mb_file_error_string(cf->inner));
+    }
+    mb_file_free(cf->inner);
+    cf->inner = nullptr;
+    return ret;
+}
+
+static int counting_read_cb(MbFile *file, void *userdata,
+                            void *buf, size_t size, size_t *bytes_read)
+{
+    CountingFile *cf = static_cast<CountingFile *>(userdata);
+    ++cf->counts.reads;
+    int ret = mb_file_read(cf->inner, buf, size, bytes_read);
+    if (ret != MB_FILE_OK) {
+        mb_file_set_error(file, mb_file_error(cf->inner), "%s",
+                          mb_file_error_string(cf->inner));
+    }
+    return ret;
+}
+
+static int counting_write_cb(MbFile *file, void *userdata,
+                             const void *buf, size_t size,
+                             size_t *bytes_written)
+{
+    CountingFile *cf = static_cast<CountingFile *>(userdata);
+    ++cf->counts.writes;
+    int ret = mb_file_write(cf->inner, buf, size, bytes_written);
+    if (ret != MB_FILE_OK) {
+        mb_file_set_error(file, mb_file_error(cf->inner), "%s",
+                          mb_file_error_string(cf->inner));
+    }
+    return ret;
+}
+
+static int counting_seek_cb(MbFile *file, void *userdata,
+                            int64_t offset, int whence, uint64_t *new_offset)
+{
+    CountingFile *cf = static_cast<CountingFile *>(userdata);
+    ++cf->counts.seeks;
+    int ret = mb_file_seek(cf->inner, offset, whence, new_offset);
+    if (ret != MB_FILE_OK) {
+        mb_file_set_error(file, mb_file_error(cf->inner), "%s",
+                          mb_file_error_string(cf->inner));
+    }
+    return ret;
+}
+
+static int counting_truncate_cb(MbFile *file, void *userdata, uint64_t size)
+{
+    CountingFile *cf = static_cast<CountingFile *>(userdata);
+    ++cf->counts.truncates;
+    int ret = mb_file_truncate(cf->inner, size);
+    if (ret != MB_FILE_OK) {
+        mb_file_set_error(file, mb_file_error(cf->inner), "%s",
+                          mb_file_error_string(cf->inner));
+    }
+    return ret;
+}
+
+struct Payload
+{
+    int type;
+    std::vector<unsigned char> data;
+};
+
+static std::vector<Payload> payloads;
+
+static void fill_payloads()
+{
+    const struct {
+        int type;
+        size_t size;
+    } entries[] = {
+        { MB_BI_ENTRY_KERNEL, KERNEL_SIZE },
+        { MB_BI_ENTRY_RAMDISK, RAMDISK_SIZE },
+        { MB_BI_ENTRY_SECONDBOOT, SECOND_SIZE },
+        { MB_BI_ENTRY_DEVICE_TREE, DT_SIZE },
+    };
+
+    srand(1);
+    for (auto const &e : entries) {
+        Payload p;
+        p.type = e.type;
+        p.data.resize(e.size);
+        for (auto &b : p.data) {
+            b = rand() & 0xff;
+        }
+        payloads.push_back(std::move(p));
+    }
+}
+
+static const Payload * find_payload(int type)
+{
+    for (auto const &p : payloads) {
+        if (p.type == type) {
+            return &p;
+        }
+    }
+    return nullptr;
+}
+
+// Opens fd <- counting <- [buffered] file stack. Freeing the outermost handle
+// frees the rest.
+static MbFile * open_file(int fd, size_t buf_size, CountingFile *cf)
+{
+    MbFile *fd_file = mb_file_new();
+    MbFile *counting = mb_file_new();
+
+    memset(&cf->counts, 0, sizeof(cf->counts));
+    cf->inner = fd_file;
+
+    if (!fd_file || !counting
+            || mb_file_open_fd(fd_file, fd, false) != MB_FILE_OK
+            || mb_file_open_callbacks(counting, nullptr, &counting_close_cb,
+                                      &counting_read_cb, &counting_write_cb,
+                                      &counting_seek_cb, &counting_truncate_cb,
+                                      cf) != MB_FILE_OK) {
+        fprintf(stderr, "Failed to open file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (buf_size == 0) {
+        return counting;
+    }
+
+    MbFile *buffered = mb_file_new();
+    if (!buffered || mb_file_open_buffered(buffered, counting, true, buf_size)
+            != MB_FILE_OK) {
+        fprintf(stderr, "Failed to open buffered file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return buffered;
+}
+
+static bool write_image(MbFile *file, const char *format)
+{
+    MbBiWriter *biw = mb_bi_writer_new();
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    size_t n;
+    int ret;
+    bool ok = false;
+
+    if (mb_bi_writer_set_format_by_name(biw, format) != MB_BI_OK
+            || mb_bi_writer_open(biw, file, false) != MB_BI_OK
+            || mb_bi_writer_get_header(biw, &header) != MB_BI_OK
+            || mb_bi_header_set_page_size(header, 2048) != MB_BI_OK
+            || mb_bi_header_set_kernel_cmdline(header, "console=null")
+                    != MB_BI_OK
+            || mb_bi_writer_write_header(biw, header) != MB_BI_OK) {
+        goto done;
+    }
+
+    while ((ret = mb_bi_writer_get_entry(biw, &entry)) == MB_BI_OK) {
+        if (mb_bi_writer_write_entry(biw, entry) != MB_BI_OK) {
+            goto done;
+        }
+
+        const Payload *p = find_payload(mb_bi_entry_type(entry));
+        if (!p) {
+            continue;
+        }
+
+        for (size_t i = 0; i < p->data.size(); i += CHUNK_SIZE) {
+            size_t size = std::min<size_t>(CHUNK_SIZE, p->data.size() - i);
+            if (mb_bi_writer_write_data(biw, p->data.data() + i, size, &n)
+                    != MB_BI_OK) {
+                goto done;
+            }
+        }
+    }
+
+    ok = ret == MB_BI_EOF && mb_bi_writer_close(biw) == MB_BI_OK;
+
+done:
+    if (!ok) {
+        fprintf(stderr, "Failed to write %s image: %s\n",
+                format, mb_bi_writer_error_string(biw));
+    }
+    mb_bi_writer_free(biw);
+    return ok;
+}
+
+static bool read_image(MbFile *file, const char *format)
+{
+    MbBiReader *bir = mb_bi_reader_new();
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    std::vector<unsigned char> buf(CHUNK_SIZE);
+    size_t n;
+    int ret;
+    bool ok = false;
+
+    if (mb_bi_reader_enable_format_all(bir) != MB_BI_OK
+            || mb_bi_reader_open(bir, file, false) != MB_BI_OK
+            || mb_bi_reader_read_header(bir, &header) != MB_BI_OK) {
+        goto done;
+    }
+
+    while ((ret = mb_bi_reader_read_entry(bir, &entry)) == MB_BI_OK) {
+        const Payload *p = find_payload(mb_bi_entry_type(entry));
+        size_t total = 0;
+
+        while ((ret = mb_bi_reader_read_data(bir, buf.data(), buf.size(), &n))
+                == MB_BI_OK) {
+            if (p && (total + n > p->data.size()
+                    || memcmp(p->data.data() + total, buf.data(), n) != 0)) {
+                fprintf(stderr, "Data mismatch in entry %d\n",
+                        mb_bi_entry_type(entry));
+                goto done;
+            }
+            total += n;
+        }
+        if (ret != MB_BI_EOF) {
+            goto done;
+        }
+    }
+
+    ok = ret == MB_BI_EOF;
+
+done:
+    if (!ok) {
+        fprintf(stderr, "Failed to read %s image: %s\n",
+                format, mb_bi_reader_error_string(bir));
+    }
+    mb_bi_reader_free(bir);
+    return ok;
+}
+
+static void print_result(const char *format, const char *op, size_t buf_size,
+                         const Counts &counts, double secs)
+{
+    char name[32];
+    if (buf_size == 0) {
+        snprintf(name, sizeof(name), "unbuffered");
+    } else {
+        snprintf(name, sizeof(name), "buffered/%zuK", buf_size / 1024);
+    }
+
+    printf("%-8s %-5s %-14s %7lu read %7lu write %7lu seek %9.3f ms\n",
+           format, op, name, counts.reads, counts.writes, counts.seeks,
+           secs * 1000);
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    const char *formats[] = { "android", "bump" };
+    const size_t buf_sizes[] = { 0, 4 * 1024, 64 * 1024, 1024 * 1024 };
+
+    char path[] = "/tmp/mbbootimg_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    unlink(path);
+
+    fill_payloads();
+
+    for (const char *format : formats) {
+        for (size_t buf_size : buf_sizes) {
+            CountingFile cf;
+            MbFile *file;
+
+            if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+                perror("ftruncate");
+                return EXIT_FAILURE;
+            }
+
+            file = open_file(fd, buf_size, &cf);
+
+            auto start = std::chrono::steady_clock::now();
+            bool ok = write_image(file, format)
+                    && mb_file_close(file) == MB_FILE_OK;
+            auto end = std::chrono::steady_clock::now();
+            mb_file_free(file);
+            if (!ok) {
+                return EXIT_FAILURE;
+            }
+
+            print_result(format, "write", buf_size, cf.counts,
+                         std::chrono::duration<double>(end - start).count());
+
+            if (lseek(fd, 0, SEEK_SET) < 0) {
+                perror("lseek");
+                return EXIT_FAILURE;
+            }
+
+            file = open_file(fd, buf_size, &cf);
+
+            start = std::chrono::steady_clock::now();
+            ok = read_image(file, format);
+            end = std::chrono::steady_clock::now();
+            mb_file_free(file);
+            if (!ok) {
+                return EXIT_FAILURE;
+            }
+
+            print_result(format, "read", buf_size, cf.counts,
+                         std::chrono::duration<double>(end - start).count());
+        }
+    }
+
+    close(fd);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Throughput of writing and reading each boot image format. The images are
+// kept in memory files, so the numbers cover the format readers and writers
+// (header handling, padding, checksums) rather than the disk. Loki is not
+// included because writing a Loki image requires a real aboot image to patch.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <benchmark/benchmark.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/defs.h"
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+#include "mbbootimg/format/mtk_p.h"
+
+#define KERNEL_SIZE     (8 * 1024 * 1024)
+#define RAMDISK_SIZE    (4 * 1024 * 1024 + 123)
+#define SECOND_SIZE     (64 * 1024 + 7)
+#define DT_SIZE         (256 * 1024 + 45)
+#define CHUNK_SIZE      (64 * 1024)
+
+struct Payload
+{
+    int type;
+    std::vector<unsigned char> data;
+};
+
+// std::mt19937 is specified exactly by the standard, so the inputs are the
+// same on every platform and across releases
+static const std::vector<Payload> & payloads()
+{
+    static std::vector<Payload> payloads;
+
+    if (payloads.empty()) {
+        const struct {
+            int type;
+            size_t size;
+        } entries[] = {
+            { MB_BI_ENTRY_KERNEL, KERNEL_SIZE },
+            { MB_BI_ENTRY_RAMDISK, RAMDISK_SIZE },
+            { MB_BI_ENTRY_SECONDBOOT, SECOND_SIZE },
+            { MB_BI_ENTRY_DEVICE_TREE, DT_SIZE },
+        };
+
+        std::mt19937 gen(5);
+        for (auto const &e : entries) {
+            Payload p;
+            p.type = e.type;
+            p.data.resize(e.size);
+            for (auto &b : p.data) {
+                b = static_cast<unsigned char>(gen());
+            }
+            payloads.push_back(std::move(p));
+        }
+
+        // The MTK writer fills in the size fields
+        MtkHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, MTK_MAGIC, MTK_MAGIC_SIZE);
+        memset(hdr.unused, 0xff, sizeof(hdr.unused));
+
+        auto const *hdr_ptr = reinterpret_cast<const unsigned char *>(&hdr);
+
+        for (int type : { MB_BI_ENTRY_MTK_KERNEL_HEADER,
+                          MB_BI_ENTRY_MTK_RAMDISK_HEADER }) {
+            Payload p;
+            p.type = type;
+            p.data.assign(hdr_ptr, hdr_ptr + sizeof(hdr));
+            payloads.push_back(std::move(p));
+        }
+    }
+
+    return payloads;
+}
+
+static const Payload * find_payload(int type)
+{
+    for (auto const &p : payloads()) {
+        if (p.type == type) {
+            return &p;
+        }
+    }
+    return nullptr;
+}
+
+// Writes an image containing the payloads supported by the format to a new
+// memory buffer. Returns the number of payload bytes written or -1 on failure.
+static int64_t write_image(const char *format, void **buf, size_t *size)
+{
+    MbFile *file = mb_file_new();
+    MbBiWriter *biw = mb_bi_writer_new();
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    int64_t total = 0;
+    size_t n;
+    int ret;
+    bool ok = false;
+
+    *buf = nullptr;
+    *size = 0;
+
+    if (mb_file_open_memory_dynamic(file, buf, size) != MB_FILE_OK
+            || mb_bi_writer_set_format_by_name(biw, format) != MB_BI_OK
+            || mb_bi_writer_open(biw, file, false) != MB_BI_OK
+            || mb_bi_writer_get_header(biw, &header) != MB_BI_OK) {
+        goto done;
+    }
+
+    // Not every format has a page size
+    ret = mb_bi_header_set_page_size(header, 2048);
+    if ((ret != MB_BI_OK && ret != MB_BI_UNSUPPORTED)
+            || mb_bi_header_set_kernel_cmdline(header, "console=null")
+                    != MB_BI_OK
+            || mb_bi_writer_write_header(biw, header) != MB_BI_OK) {
+        goto done;
+    }
+
+    while ((ret = mb_bi_writer_get_entry(biw, &entry)) == MB_BI_OK) {
+        if (mb_bi_writer_write_entry(biw, entry) != MB_BI_OK) {
+            goto done;
+        }
+
+        const Payload *p = find_payload(mb_bi_entry_type(entry));
+        if (!p) {
+            continue;
+        }
+
+        for (size_t i = 0; i < p->data.size(); i += CHUNK_SIZE) {
+            size_t to_write = std::min<size_t>(CHUNK_SIZE, p->data.size() - i);
+            if (mb_bi_writer_write_data(biw, p->data.data() + i, to_write, &n)
+                    != MB_BI_OK) {
+                goto done;
+            }
+        }
+
+        total += p->data.size();
+    }
+
+    ok = ret == MB_BI_EOF && mb_bi_writer_close(biw) == MB_BI_OK;
+
+done:
+    if (!ok) {
+        fprintf(stderr, "Failed to write %s image: %s\n",
+                format, mb_bi_writer_error_string(biw));
+    }
+    mb_bi_writer_free(biw);
+    mb_file_free(file);
+    if (!ok) {
+        free(*buf);
+        *buf = nullptr;
+        return -1;
+    }
+    return total;
+}
+
+// Reads every entry of an image. Returns the number of bytes of entry data
+// read or -1 on failure.
+static int64_t read_image(const char *format, const void *buf, size_t size)
+{
+    MbFile *file = mb_file_new();
+    MbBiReader *bir = mb_bi_reader_new();
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    std::vector<unsigned char> chunk(CHUNK_SIZE);
+    int64_t total = 0;
+    size_t n;
+    int ret;
+    bool ok = false;
+
+    if (mb_file_open_memory_static(file, buf, size) != MB_FILE_OK
+            || mb_bi_reader_set_format_by_name(bir, format) != MB_BI_OK
+            || mb_bi_reader_open(bir, file, false) != MB_BI_OK
+            || mb_bi_reader_read_header(bir, &header) != MB_BI_OK) {
+        goto done;
+    }
+
+    while ((ret = mb_bi_reader_read_entry(bir, &entry)) == MB_BI_OK) {
+        while ((ret = mb_bi_reader_read_data(bir, chunk.data(), chunk.size(),
+                                             &n)) == MB_BI_OK) {
+            total += n;
+        }
+        if (ret != MB_BI_EOF) {
+            goto done;
+        }
+    }
+
+    ok = ret == MB_BI_EOF;
+
+done:
+    if (!ok) {
+        fprintf(stderr, "Failed to read %s image: %s\n",
+                format, mb_bi_reader_error_string(bir));
+    }
+    mb_bi_reader_free(bir);
+    mb_file_free(file);
+    return ok ? total : -1;
+}
+
+static void BM_WriteImage(benchmark::State &state, const char *format)
+{
+    int64_t total = 0;
+
+    for (auto _ : state) {
+        void *buf;
+        size_t size;
+
+        total = write_image(format, &buf, &size);
+        if (total < 0) {
+            state.SkipWithError("Failed to write image");
+            break;
+        }
+
+        state.PauseTiming();
+        free(buf);
+        state.ResumeTiming();
+    }
+
+    state.SetBytesProcessed(state.iterations() * total);
+}
+
+static void BM_ReadImage(benchmark::State &state, const char *format)
+{
+    void *buf;
+    size_t size;
+    int64_t total = 0;
+
+    if (write_image(format, &buf, &size) < 0) {
+        state.SkipWithError("Failed to write image");
+        return;
+    }
+
+    for (auto _ : state) {
+        total = read_image(format, buf, size);
+        if (total < 0) {
+            state.SkipWithError("Failed to read image");
+            break;
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * total);
+    free(buf);
+}
+
+#define FORMAT_BENCHMARKS(name, format) \
+    BENCHMARK_CAPTURE(BM_WriteImage, name, format) \
+        ->Unit(benchmark::kMillisecond); \
+    BENCHMARK_CAPTURE(BM_ReadImage, name, format) \
+        ->Unit(benchmark::kMillisecond);
+
+FORMAT_BENCHMARKS(android, MB_BI_FORMAT_NAME_ANDROID)
+FORMAT_BENCHMARKS(bump, MB_BI_FORMAT_NAME_BUMP)
+FORMAT_BENCHMARKS(mtk, MB_BI_FORMAT_NAME_MTK)
+FORMAT_BENCHMARKS(sony_elf, MB_BI_FORMAT_NAME_SONY_ELF)
@@ -21,7 +21,7 @@
 
 #include "mbbootimg/guard_p.h"
 
-#include <openssl/sha.h>
+#include "mbcommon/file.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/format/android_p.h"
@@ -42,11 +42,15 @@ struct AndroidWriterCtx
 
     bool is_bump;
 
-    SHA_CTX sha_ctx;
+    // Write-only MbFile computing the SHA1 of the image data and sizes
+    struct MbFile *sha1_file;
 
     struct SegmentWriterCtx segctx;
 };
 
+int _android_writer_open_sha1_file(struct MbBiWriter *biw,
+                                   struct MbFile **file_out);
+
 int android_writer_get_header(struct MbBiWriter *biw, void *userdata,
                               struct MbBiHeader *header);
 int android_writer_write_header(struct MbBiWriter *biw, void *userdata,
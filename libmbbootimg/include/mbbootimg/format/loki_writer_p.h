@@ -21,7 +21,7 @@
 
 #include "mbbootimg/guard_p.h"
 
-#include <openssl/sha.h>
+#include "mbcommon/file.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/format/android_p.h"
@@ -43,7 +43,8 @@ struct LokiWriterCtx
     unsigned char *aboot;
     size_t aboot_size;
 
-    SHA_CTX sha_ctx;
+    // Write-only MbFile computing the SHA1 of the image data and sizes
+    struct MbFile *sha1_file;
 
     struct SegmentWriterCtx segctx;
 };
@@ -21,7 +21,7 @@
 
 #include "mbbootimg/guard_p.h"
 
-#include <openssl/sha.h>
+#include "mbcommon/file.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/format/android_p.h"
@@ -41,6 +41,14 @@ struct MtkWriterCtx
     bool have_file_size;
     uint64_t file_size;
 
+    // Write-only MbFile computing the SHA1 as the entries are written. It can
+    // only be used if the MTK header size fields were already correct when
+    // they were written and every entry was written in full.
+    struct MbFile *sha1_file;
+    size_t finished_entries;
+    uint32_t kernel_mtkhdr_size;
+    uint32_t ramdisk_mtkhdr_size;
+
     struct SegmentWriterCtx segctx;
 };
 
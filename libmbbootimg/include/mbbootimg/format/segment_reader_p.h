@@ -58,9 +58,8 @@ struct SegmentReaderCtx
     size_t entries_len;
     struct SegmentReaderEntry *entry;
 
-    uint64_t read_start_offset;
-    uint64_t read_end_offset;
-    uint64_t read_cur_offset;
+    // Window into the boot image for the current entry
+    struct MbFile *entry_file;
 };
 
 int _segment_reader_init(struct SegmentReaderCtx *ctx);
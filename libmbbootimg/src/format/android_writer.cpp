@@ -26,10 +26,9 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
+#include "mbcommon/file/digest.h"
 #include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
 
@@ -43,6 +42,34 @@
 
 MB_BEGIN_C_DECLS
 
+/*!
+ * \brief Open write-only MbFile that computes the SHA1 of the data written to it
+ *
+ * The Android-based writers use this for the ID field of the header.
+ */
+int _android_writer_open_sha1_file(MbBiWriter *biw, MbFile **file_out)
+{
+    MbFile *file = mb_file_new();
+    if (!file) {
+        mb_bi_writer_set_error(biw, -errno,
+                               "Failed to allocate MbFile: %s",
+                               strerror(errno));
+        return MB_BI_FAILED;
+    }
+
+    if (mb_file_open_digest(file, nullptr, false, nullptr,
+                            MB_FILE_DIGEST_SHA1) != MB_FILE_OK) {
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                               "Failed to open SHA1 file: %s",
+                               mb_file_error_string(file));
+        mb_file_free(file);
+        return MB_BI_FAILED;
+    }
+
+    *file_out = file;
+    return MB_BI_OK;
+}
+
 int android_writer_get_header(MbBiWriter *biw, void *userdata,
                               MbBiHeader *header)
 {
@@ -182,6 +209,7 @@ int android_writer_write_data(MbBiWriter *biw, void *userdata,
                               size_t *bytes_written)
 {
     AndroidWriterCtx *const ctx = static_cast<AndroidWriterCtx *>(userdata);
+    size_t n;
     int ret;
 
     ret = _segment_writer_write_data(&ctx->segctx, biw->file, buf, buf_size,
@@ -192,9 +220,11 @@ int android_writer_write_data(MbBiWriter *biw, void *userdata,
 
     // We always include the image in the hash. The size is sometimes included
     // and is handled in android_writer_finish_entry().
-    if (!SHA1_Update(&ctx->sha_ctx, buf, buf_size)) {
+    ret = mb_file_write_fully(ctx->sha1_file, buf, buf_size, &n);
+    if (ret != MB_FILE_OK) {
         mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                               "Failed to update SHA1 hash");
+                               "Failed to update SHA1 hash: %s",
+                               mb_file_error_string(ctx->sha1_file));
         // This must be fatal as the write already happened and cannot be
         // reattempted
         return MB_BI_FATAL;
@@ -207,6 +237,7 @@ int android_writer_finish_entry(MbBiWriter *biw, void *userdata)
 {
     AndroidWriterCtx *const ctx = static_cast<AndroidWriterCtx *>(userdata);
     SegmentWriterEntry *swentry;
+    size_t n;
     int ret;
 
     ret = _segment_writer_finish_entry(&ctx->segctx, biw->file, biw);
@@ -220,11 +251,15 @@ int android_writer_finish_entry(MbBiWriter *biw, void *userdata)
     uint32_t le32_size = mb_htole32(swentry->size);
 
     // Include size for everything except empty DT images
-    if ((swentry->type != MB_BI_ENTRY_DEVICE_TREE || swentry->size > 0)
-            && !SHA1_Update(&ctx->sha_ctx, &le32_size, sizeof(le32_size))) {
-        mb_bi_writer_set_error(biw, mb_file_error(biw->file),
-                               "Failed to update SHA1 hash");
-        return MB_BI_FATAL;
+    if (swentry->type != MB_BI_ENTRY_DEVICE_TREE || swentry->size > 0) {
+        ret = mb_file_write_fully(ctx->sha1_file, &le32_size,
+                                  sizeof(le32_size), &n);
+        if (ret != MB_FILE_OK) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                   "Failed to update SHA1 hash: %s",
+                                   mb_file_error_string(ctx->sha1_file));
+            return MB_BI_FATAL;
+        }
     }
 
     switch (swentry->type) {
@@ -299,13 +334,16 @@ int android_writer_close(MbBiWriter *biw, void *userdata)
         }
 
         // Set ID
-        unsigned char digest[SHA_DIGEST_LENGTH];
-        if (!SHA1_Final(digest, &ctx->sha_ctx)) {
+        unsigned char digest[MB_FILE_DIGEST_SHA1_SIZE];
+        ret = mb_file_digest(ctx->sha1_file, MB_FILE_DIGEST_SHA1,
+                             digest, sizeof(digest), nullptr);
+        if (ret != MB_FILE_OK) {
             mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                                   "Failed to update SHA1 hash");
+                                   "Failed to finalize SHA1 hash: %s",
+                                   mb_file_error_string(ctx->sha1_file));
             return MB_BI_FATAL;
         }
-        memcpy(ctx->hdr.id, digest, SHA_DIGEST_LENGTH);
+        memcpy(ctx->hdr.id, digest, sizeof(digest));
 
         // Convert fields back to little-endian
         AndroidHeader hdr = ctx->hdr;
@@ -338,6 +376,7 @@ int android_writer_free(MbBiWriter *bir, void *userdata)
     (void) bir;
     AndroidWriterCtx *const ctx = static_cast<AndroidWriterCtx *>(userdata);
     _segment_writer_deinit(&ctx->segctx);
+    mb_file_free(ctx->sha1_file);
     free(ctx);
     return MB_BI_OK;
 }
@@ -354,6 +393,8 @@ int android_writer_free(MbBiWriter *bir, void *userdata)
  */
 int mb_bi_writer_set_format_android(MbBiWriter *biw)
 {
+    int ret;
+
     AndroidWriterCtx *const ctx = static_cast<AndroidWriterCtx *>(
             calloc(1, sizeof(AndroidWriterCtx)));
     if (!ctx) {
@@ -363,11 +404,10 @@ int mb_bi_writer_set_format_android(MbBiWriter *biw)
         return MB_BI_FAILED;
     }
 
-    if (!SHA1_Init(&ctx->sha_ctx)) {
-        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                               "Failed to initialize SHA_CTX");
+    ret = _android_writer_open_sha1_file(biw, &ctx->sha1_file);
+    if (ret != MB_BI_OK) {
         free(ctx);
-        return false;
+        return ret;
     }
 
     _segment_writer_init(&ctx->segctx);
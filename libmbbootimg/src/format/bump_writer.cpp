@@ -39,6 +39,8 @@ MB_BEGIN_C_DECLS
  */
 int mb_bi_writer_set_format_bump(MbBiWriter *biw)
 {
+    int ret;
+
     AndroidWriterCtx *const ctx = static_cast<AndroidWriterCtx *>(
             calloc(1, sizeof(AndroidWriterCtx)));
     if (!ctx) {
@@ -48,11 +50,10 @@ int mb_bi_writer_set_format_bump(MbBiWriter *biw)
         return MB_BI_FAILED;
     }
 
-    if (!SHA1_Init(&ctx->sha_ctx)) {
-        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                               "Failed to initialize SHA_CTX");
+    ret = _android_writer_open_sha1_file(biw, &ctx->sha1_file);
+    if (ret != MB_BI_OK) {
         free(ctx);
-        return false;
+        return ret;
     }
 
     _segment_writer_init(&ctx->segctx);
@@ -26,15 +26,15 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
+#include "mbcommon/file/digest.h"
 #include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/format/align_p.h"
+#include "mbbootimg/format/android_writer_p.h"
 #include "mbbootimg/format/loki_defs.h"
 #include "mbbootimg/format/loki_p.h"
 #include "mbbootimg/header.h"
@@ -186,6 +186,7 @@ int loki_writer_write_data(MbBiWriter *biw, void *userdata,
 {
     LokiWriterCtx *const ctx = static_cast<LokiWriterCtx *>(userdata);
     SegmentWriterEntry *swentry;
+    size_t n;
     int ret;
 
     swentry = _segment_writer_entry(&ctx->segctx);
@@ -223,9 +224,11 @@ int loki_writer_write_data(MbBiWriter *biw, void *userdata,
 
         // We always include the image in the hash. The size is sometimes
         // included and is handled in loki_writer_finish_entry().
-        if (!SHA1_Update(&ctx->sha_ctx, buf, buf_size)) {
+        ret = mb_file_write_fully(ctx->sha1_file, buf, buf_size, &n);
+        if (ret != MB_FILE_OK) {
             mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                                   "Failed to update SHA1 hash");
+                                   "Failed to update SHA1 hash: %s",
+                                   mb_file_error_string(ctx->sha1_file));
             // This must be fatal as the write already happened and cannot be
             // reattempted
             return MB_BI_FATAL;
@@ -239,6 +242,7 @@ int loki_writer_finish_entry(MbBiWriter *biw, void *userdata)
 {
     LokiWriterCtx *const ctx = static_cast<LokiWriterCtx *>(userdata);
     SegmentWriterEntry *swentry;
+    size_t n;
     int ret;
 
     ret = _segment_writer_finish_entry(&ctx->segctx, biw->file, biw);
@@ -252,20 +256,27 @@ int loki_writer_finish_entry(MbBiWriter *biw, void *userdata)
     uint32_t le32_size = mb_htole32(swentry->size);
 
     // Include fake 0 size for unsupported secondboot image
-    if (swentry->type == MB_BI_ENTRY_DEVICE_TREE
-            && !SHA1_Update(&ctx->sha_ctx, "\x00\x00\x00\x00", 4)) {
-        mb_bi_writer_set_error(biw, mb_file_error(biw->file),
-                               "Failed to update SHA1 hash");
-        return MB_BI_FATAL;
+    if (swentry->type == MB_BI_ENTRY_DEVICE_TREE) {
+        ret = mb_file_write_fully(ctx->sha1_file, "\x00\x00\x00\x00", 4, &n);
+        if (ret != MB_FILE_OK) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                   "Failed to update SHA1 hash: %s",
+                                   mb_file_error_string(ctx->sha1_file));
+            return MB_BI_FATAL;
+        }
     }
 
     // Include size for everything except empty DT images
     if (swentry->type != MB_BI_ENTRY_ABOOT
-            && (swentry->type != MB_BI_ENTRY_DEVICE_TREE || swentry->size > 0)
-            && !SHA1_Update(&ctx->sha_ctx, &le32_size, sizeof(le32_size))) {
-        mb_bi_writer_set_error(biw, mb_file_error(biw->file),
-                               "Failed to update SHA1 hash");
-        return MB_BI_FATAL;
+            && (swentry->type != MB_BI_ENTRY_DEVICE_TREE || swentry->size > 0)) {
+        ret = mb_file_write_fully(ctx->sha1_file, &le32_size,
+                                  sizeof(le32_size), &n);
+        if (ret != MB_FILE_OK) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                   "Failed to update SHA1 hash: %s",
+                                   mb_file_error_string(ctx->sha1_file));
+            return MB_BI_FATAL;
+        }
     }
 
     switch (swentry->type) {
@@ -324,13 +335,16 @@ int loki_writer_close(MbBiWriter *biw, void *userdata)
         }
 
         // Set ID
-        unsigned char digest[SHA_DIGEST_LENGTH];
-        if (!SHA1_Final(digest, &ctx->sha_ctx)) {
+        unsigned char digest[MB_FILE_DIGEST_SHA1_SIZE];
+        ret = mb_file_digest(ctx->sha1_file, MB_FILE_DIGEST_SHA1,
+                             digest, sizeof(digest), nullptr);
+        if (ret != MB_FILE_OK) {
             mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                                   "Failed to update SHA1 hash");
+                                   "Failed to finalize SHA1 hash: %s",
+                                   mb_file_error_string(ctx->sha1_file));
             return MB_BI_FATAL;
         }
-        memcpy(ctx->hdr.id, digest, SHA_DIGEST_LENGTH);
+        memcpy(ctx->hdr.id, digest, sizeof(digest));
 
         // Convert fields back to little-endian
         AndroidHeader hdr = ctx->hdr;
@@ -369,6 +383,7 @@ int loki_writer_free(MbBiWriter *bir, void *userdata)
     (void) bir;
     LokiWriterCtx *const ctx = static_cast<LokiWriterCtx *>(userdata);
     _segment_writer_deinit(&ctx->segctx);
+    mb_file_free(ctx->sha1_file);
     free(ctx->aboot);
     free(ctx);
     return MB_BI_OK;
@@ -386,6 +401,8 @@ int loki_writer_free(MbBiWriter *bir, void *userdata)
  */
 int mb_bi_writer_set_format_loki(MbBiWriter *biw)
 {
+    int ret;
+
     LokiWriterCtx *const ctx = static_cast<LokiWriterCtx *>(
             calloc(1, sizeof(LokiWriterCtx)));
     if (!ctx) {
@@ -395,11 +412,10 @@ int mb_bi_writer_set_format_loki(MbBiWriter *biw)
         return MB_BI_FAILED;
     }
 
-    if (!SHA1_Init(&ctx->sha_ctx)) {
-        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                               "Failed to initialize SHA_CTX");
+    ret = _android_writer_open_sha1_file(biw, &ctx->sha1_file);
+    if (ret != MB_BI_OK) {
         free(ctx);
-        return false;
+        return ret;
     }
 
     _segment_writer_init(&ctx->segctx);
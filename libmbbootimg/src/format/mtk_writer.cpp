@@ -26,14 +26,14 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
+#include "mbcommon/file/digest.h"
 #include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
 
 #include "mbbootimg/entry.h"
+#include "mbbootimg/format/android_writer_p.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/writer.h"
 #include "mbbootimg/writer_p.h"
@@ -41,10 +41,17 @@
 
 MB_BEGIN_C_DECLS
 
+/*!
+ * \brief Set the size field of an MTK header that was already written
+ *
+ * \param[out] changed Whether the size field had a different value
+ */
 static int _mtk_header_update_size(MbBiWriter *biw, MbFile *file,
-                                   uint64_t offset, uint32_t size)
+                                   uint64_t offset, uint32_t size,
+                                   bool *changed)
 {
     uint32_t le32_size = mb_htole32(size);
+    uint32_t old_le32_size;
     size_t n;
     int ret;
 
@@ -54,20 +61,46 @@ static int _mtk_header_update_size(MbBiWriter *biw, MbFile *file,
         return MB_BI_FATAL;
     }
 
-    ret = mb_file_seek(biw->file, offset + offsetof(MtkHeader, size),
+    ret = mb_file_seek(file, offset + offsetof(MtkHeader, size),
                        SEEK_SET, nullptr);
     if (ret != MB_FILE_OK) {
-        mb_bi_writer_set_error(biw, mb_file_error(biw->file),
+        mb_bi_writer_set_error(biw, mb_file_error(file),
                                "Failed to seek to MTK size field: %s",
-                               mb_file_error_string(biw->file));
+                               mb_file_error_string(file));
+        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+    }
+
+    ret = mb_file_read_fully(file, &old_le32_size, sizeof(old_le32_size), &n);
+    if (ret != MB_FILE_OK) {
+        mb_bi_writer_set_error(biw, mb_file_error(file),
+                               "Failed to read MTK size field: %s",
+                               mb_file_error_string(file));
+        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+    } else if (n != sizeof(old_le32_size)) {
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_FILE_FORMAT,
+                               "Unexpected EOF when reading MTK size field");
+        return MB_BI_FAILED;
+    }
+
+    *changed = old_le32_size != le32_size;
+    if (!*changed) {
+        return MB_BI_OK;
+    }
+
+    ret = mb_file_seek(file, offset + offsetof(MtkHeader, size),
+                       SEEK_SET, nullptr);
+    if (ret != MB_FILE_OK) {
+        mb_bi_writer_set_error(biw, mb_file_error(file),
+                               "Failed to seek to MTK size field: %s",
+                               mb_file_error_string(file));
         return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
     }
 
     ret = mb_file_write_fully(file, &le32_size, sizeof(le32_size), &n);
     if (ret != MB_FILE_OK) {
-        mb_bi_writer_set_error(biw, mb_file_error(biw->file),
+        mb_bi_writer_set_error(biw, mb_file_error(file),
                                "Failed to write MTK size field: %s",
-                               mb_file_error_string(biw->file));
+                               mb_file_error_string(file));
         return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
     } else if (n != sizeof(le32_size)) {
         mb_bi_writer_set_error(biw, MB_BI_ERROR_FILE_FORMAT,
@@ -78,11 +111,57 @@ static int _mtk_header_update_size(MbBiWriter *biw, MbFile *file,
     return MB_BI_OK;
 }
 
+/*!
+ * \brief Add the size of an entry to the SHA1 hash
+ *
+ * The size of an MTK header is included in the size of the following kernel
+ * or ramdisk instead of being hashed separately.
+ */
+static int _mtk_hash_entry_size(MbBiWriter *biw, MbFile *sha1_file,
+                                int type, uint32_t size,
+                                uint32_t kernel_mtkhdr_size,
+                                uint32_t ramdisk_mtkhdr_size)
+{
+    uint32_t le32_size;
+    size_t n;
+    int ret;
+
+    switch (type) {
+    case MB_BI_ENTRY_KERNEL:
+        le32_size = mb_htole32(size + kernel_mtkhdr_size);
+        break;
+    case MB_BI_ENTRY_RAMDISK:
+        le32_size = mb_htole32(size + ramdisk_mtkhdr_size);
+        break;
+    case MB_BI_ENTRY_SECONDBOOT:
+        le32_size = mb_htole32(size);
+        break;
+    case MB_BI_ENTRY_DEVICE_TREE:
+        if (size == 0) {
+            return MB_BI_OK;
+        }
+        le32_size = mb_htole32(size);
+        break;
+    default:
+        return MB_BI_OK;
+    }
+
+    ret = mb_file_write_fully(sha1_file, &le32_size, sizeof(le32_size), &n);
+    if (ret != MB_FILE_OK) {
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                               "Failed to update SHA1 hash: %s",
+                               mb_file_error_string(sha1_file));
+        return MB_BI_FATAL;
+    }
+
+    return MB_BI_OK;
+}
+
 static int _mtk_compute_sha1(MbBiWriter *biw, SegmentWriterCtx *segctx,
                              MbFile *file,
-                             unsigned char digest[SHA_DIGEST_LENGTH])
+                             unsigned char digest[MB_FILE_DIGEST_SHA1_SIZE])
 {
-    SHA_CTX sha_ctx;
+    MbFile *sha1_file;
     char buf[10240];
     size_t n;
     int ret;
@@ -90,10 +169,9 @@ static int _mtk_compute_sha1(MbBiWriter *biw, SegmentWriterCtx *segctx,
     uint32_t kernel_mtkhdr_size = 0;
     uint32_t ramdisk_mtkhdr_size = 0;
 
-    if (!SHA1_Init(&sha_ctx)) {
-        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                               "Failed to initialize SHA_CTX");
-        return MB_BI_FAILED;
+    ret = _android_writer_open_sha1_file(biw, &sha1_file);
+    if (ret != MB_BI_OK) {
+        return ret;
     }
 
     for (size_t i = 0; i < _segment_writer_entries_size(segctx); ++i) {
@@ -105,6 +183,7 @@ static int _mtk_compute_sha1(MbBiWriter *biw, SegmentWriterCtx *segctx,
             mb_bi_writer_set_error(biw, mb_file_error(file),
                                    "Failed to seek to entry %" MB_PRIzu ": %s",
                                    i, mb_file_error_string(file));
+            mb_file_free(sha1_file);
             return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
         }
 
@@ -117,24 +196,27 @@ static int _mtk_compute_sha1(MbBiWriter *biw, SegmentWriterCtx *segctx,
                 mb_bi_writer_set_error(biw, mb_file_error(file),
                                        "Failed to read entry %" MB_PRIzu ": %s",
                                        i, mb_file_error_string(file));
+                mb_file_free(sha1_file);
                 return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
             } else if (n != to_read) {
                 mb_bi_writer_set_error(biw, mb_file_error(file),
                                        "Unexpected EOF when reading entry");
+                mb_file_free(sha1_file);
                 return MB_BI_FAILED;
             }
 
-            if (!SHA1_Update(&sha_ctx, buf, n)) {
+            ret = mb_file_write_fully(sha1_file, buf, n, &n);
+            if (ret != MB_FILE_OK) {
                 mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                                       "Failed to update SHA1 hash");
+                                       "Failed to update SHA1 hash: %s",
+                                       mb_file_error_string(sha1_file));
+                mb_file_free(sha1_file);
                 return MB_BI_FAILED;
             }
 
             remain -= to_read;
         }
 
-        uint32_t le32_size;
-
         // Update checksum with size
         switch (entry->type) {
         case MB_BI_ENTRY_MTK_KERNEL_HEADER:
@@ -143,38 +225,27 @@ static int _mtk_compute_sha1(MbBiWriter *biw, SegmentWriterCtx *segctx,
         case MB_BI_ENTRY_MTK_RAMDISK_HEADER:
             ramdisk_mtkhdr_size = entry->size;
             continue;
-        case MB_BI_ENTRY_KERNEL:
-            le32_size = mb_htole32(entry->size + kernel_mtkhdr_size);
-            break;
-        case MB_BI_ENTRY_RAMDISK:
-            le32_size = mb_htole32(entry->size + ramdisk_mtkhdr_size);
-            break;
-        case MB_BI_ENTRY_SECONDBOOT:
-            le32_size = mb_htole32(entry->size);
-            break;
-        case MB_BI_ENTRY_DEVICE_TREE:
-            if (entry->size == 0) {
-                continue;
-            }
-            le32_size = mb_htole32(entry->size);
-            break;
-        default:
-            continue;
         }
 
-        if (!SHA1_Update(&sha_ctx, &le32_size, sizeof(le32_size))) {
-            mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                                   "Failed to update SHA1 hash");
-            return MB_BI_FAILED;
+        ret = _mtk_hash_entry_size(biw, sha1_file, entry->type, entry->size,
+                                   kernel_mtkhdr_size, ramdisk_mtkhdr_size);
+        if (ret != MB_BI_OK) {
+            mb_file_free(sha1_file);
+            return ret;
         }
     }
 
-    if (!SHA1_Final(digest, &sha_ctx)) {
+    ret = mb_file_digest(sha1_file, MB_FILE_DIGEST_SHA1, digest,
+                         MB_FILE_DIGEST_SHA1_SIZE, nullptr);
+    if (ret != MB_FILE_OK) {
         mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
-                               "Failed to finalize SHA1 hash");
+                               "Failed to finalize SHA1 hash: %s",
+                               mb_file_error_string(sha1_file));
+        mb_file_free(sha1_file);
         return MB_BI_FATAL;
     }
 
+    mb_file_free(sha1_file);
     return MB_BI_OK;
 }
 
@@ -327,9 +398,26 @@ int mtk_writer_write_data(MbBiWriter *biw, void *userdata,
                           size_t *bytes_written)
 {
     MtkWriterCtx *const ctx = static_cast<MtkWriterCtx *>(userdata);
+    size_t n;
+    int ret;
 
-    return _segment_writer_write_data(&ctx->segctx, biw->file, buf, buf_size,
-                                      bytes_written, biw);
+    ret = _segment_writer_write_data(&ctx->segctx, biw->file, buf, buf_size,
+                                     bytes_written, biw);
+    if (ret != MB_BI_OK) {
+        return ret;
+    }
+
+    ret = mb_file_write_fully(ctx->sha1_file, buf, buf_size, &n);
+    if (ret != MB_FILE_OK) {
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                               "Failed to update SHA1 hash: %s",
+                               mb_file_error_string(ctx->sha1_file));
+        // This must be fatal as the write already happened and cannot be
+        // reattempted
+        return MB_BI_FATAL;
+    }
+
+    return MB_BI_OK;
 }
 
 int mtk_writer_finish_entry(MbBiWriter *biw, void *userdata)
@@ -359,6 +447,29 @@ int mtk_writer_finish_entry(MbBiWriter *biw, void *userdata)
         return MB_BI_FATAL;
     }
 
+    switch (swentry->type) {
+    case MB_BI_ENTRY_MTK_KERNEL_HEADER:
+        ctx->kernel_mtkhdr_size = swentry->size;
+        break;
+    case MB_BI_ENTRY_MTK_RAMDISK_HEADER:
+        ctx->ramdisk_mtkhdr_size = swentry->size;
+        break;
+    default:
+        ret = _mtk_hash_entry_size(biw, ctx->sha1_file, swentry->type,
+                                   swentry->size, ctx->kernel_mtkhdr_size,
+                                   ctx->ramdisk_mtkhdr_size);
+        if (ret != MB_BI_OK) {
+            return ret;
+        }
+        break;
+    }
+
+    // Entries with an explicit size that differs from the amount of data
+    // written are not hashed the same way as when the file is re-read
+    if (ctx->segctx.entry_size == swentry->size) {
+        ++ctx->finished_entries;
+    }
+
     switch (swentry->type) {
     case MB_BI_ENTRY_KERNEL:
         ctx->hdr.kernel_size = swentry->size + sizeof(MtkHeader);
@@ -409,20 +520,27 @@ int mtk_writer_close(MbBiWriter *biw, void *userdata)
             return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
         }
 
+        // The SHA1 computed during write is only valid if every entry went
+        // through the writer
+        bool sha1_valid = ctx->finished_entries
+                == _segment_writer_entries_size(&ctx->segctx);
+
         // Update MTK header sizes
         for (size_t i = 0; i < _segment_writer_entries_size(&ctx->segctx); ++i) {
             SegmentWriterEntry *entry =
                     _segment_writer_entries_get(&ctx->segctx, i);
+            bool changed;
+
             switch (entry->type) {
             case MB_BI_ENTRY_MTK_KERNEL_HEADER:
                 ret = _mtk_header_update_size(biw, biw->file, entry->offset,
                                               ctx->hdr.kernel_size
-                                              - sizeof(MtkHeader));
+                                              - sizeof(MtkHeader), &changed);
                 break;
             case MB_BI_ENTRY_MTK_RAMDISK_HEADER:
                 ret = _mtk_header_update_size(biw, biw->file, entry->offset,
                                               ctx->hdr.ramdisk_size
-                                              - sizeof(MtkHeader));
+                                              - sizeof(MtkHeader), &changed);
                 break;
             default:
                 continue;
@@ -430,17 +548,32 @@ int mtk_writer_close(MbBiWriter *biw, void *userdata)
 
             if (ret != MB_BI_OK) {
                 return ret;
+            } else if (changed) {
+                sha1_valid = false;
             }
         }
 
-        // We need to take the performance hit and compute the SHA1 here.
-        // We can't fill in the sizes in the MTK headers when we're writing
-        // them. Thus, if we calculated the SHA1sum during write, it would be
-        // incorrect.
-        ret = _mtk_compute_sha1(biw, &ctx->segctx, biw->file,
-                                reinterpret_cast<unsigned char *>(ctx->hdr.id));
-        if (ret != MB_BI_OK) {
-            return ret;
+        if (sha1_valid) {
+            ret = mb_file_digest(
+                    ctx->sha1_file, MB_FILE_DIGEST_SHA1,
+                    reinterpret_cast<unsigned char *>(ctx->hdr.id),
+                    MB_FILE_DIGEST_SHA1_SIZE, nullptr);
+            if (ret != MB_FILE_OK) {
+                mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                       "Failed to finalize SHA1 hash: %s",
+                                       mb_file_error_string(ctx->sha1_file));
+                return MB_BI_FATAL;
+            }
+        } else {
+            // We need to take the performance hit and compute the SHA1 here.
+            // The sizes in the MTK headers could not be filled in when they
+            // were written, so the SHA1 computed during write is incorrect.
+            ret = _mtk_compute_sha1(
+                    biw, &ctx->segctx, biw->file,
+                    reinterpret_cast<unsigned char *>(ctx->hdr.id));
+            if (ret != MB_BI_OK) {
+                return ret;
+            }
         }
 
         // Convert fields back to little-endian
@@ -474,6 +607,7 @@ int mtk_writer_free(MbBiWriter *bir, void *userdata)
     (void) bir;
     MtkWriterCtx *const ctx = static_cast<MtkWriterCtx *>(userdata);
     _segment_writer_deinit(&ctx->segctx);
+    mb_file_free(ctx->sha1_file);
     free(ctx);
     return MB_BI_OK;
 }
@@ -490,6 +624,8 @@ int mtk_writer_free(MbBiWriter *bir, void *userdata)
  */
 int mb_bi_writer_set_format_mtk(MbBiWriter *biw)
 {
+    int ret;
+
     MtkWriterCtx *const ctx = static_cast<MtkWriterCtx *>(
             calloc(1, sizeof(MtkWriterCtx)));
     if (!ctx) {
@@ -499,6 +635,12 @@ int mb_bi_writer_set_format_mtk(MbBiWriter *biw)
         return MB_BI_FAILED;
     }
 
+    ret = _android_writer_open_sha1_file(biw, &ctx->sha1_file);
+    if (ret != MB_BI_OK) {
+        free(ctx);
+        return ret;
+    }
+
     _segment_writer_init(&ctx->segctx);
 
     return _mb_bi_writer_register_format(biw,
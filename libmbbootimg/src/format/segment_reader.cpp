@@ -21,11 +21,13 @@
 
 #include <algorithm>
 
+#include <cerrno>
 #include <cinttypes>
 #include <cstdio>
 #include <cstring>
 
 #include "mbcommon/file.h"
+#include "mbcommon/file/window.h"
 #include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
 
@@ -42,7 +44,9 @@ int _segment_reader_init(SegmentReaderCtx *ctx)
 
 int _segment_reader_deinit(SegmentReaderCtx *ctx)
 {
-    (void) ctx;
+    mb_file_free(ctx->entry_file);
+    ctx->entry_file = nullptr;
+
     return MB_BI_OK;
 }
 
@@ -145,28 +149,37 @@ int _segment_reader_move_to_entry(SegmentReaderCtx *ctx, MbFile *file,
         return MB_BI_FAILED;
     }
 
-    uint64_t read_start_offset = srentry->offset;
-    uint64_t read_end_offset = read_start_offset + srentry->size;
-    uint64_t read_cur_offset = read_start_offset;
+    MbFile *entry_file = mb_file_new();
+    if (!entry_file) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_INTERNAL_ERROR,
+                               "%s", strerror(errno));
+        return MB_BI_FAILED;
+    }
 
-    if (ctx->read_cur_offset != srentry->offset) {
-        ret = mb_file_seek(file, read_start_offset, SEEK_SET, nullptr);
-        if (ret < 0) {
-            return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-        }
+    ret = mb_file_open_window(entry_file, file, false, srentry->offset,
+                              srentry->size);
+    if (ret != MB_FILE_OK) {
+        mb_bi_reader_set_error(bir, mb_file_error(entry_file),
+                               "Failed to open entry: %s",
+                               mb_file_error_string(entry_file));
+        mb_file_free(entry_file);
+        return MB_BI_FAILED;
     }
 
     ret = mb_bi_entry_set_type(entry, srentry->type);
-    if (ret != MB_BI_OK) return ret;
+    if (ret == MB_BI_OK) {
+        ret = mb_bi_entry_set_size(entry, srentry->size);
+    }
+    if (ret != MB_BI_OK) {
+        mb_file_free(entry_file);
+        return ret;
+    }
 
-    ret = mb_bi_entry_set_size(entry, srentry->size);
-    if (ret != MB_BI_OK) return ret;
+    mb_file_free(ctx->entry_file);
 
     ctx->state = SegmentReaderState::ENTRIES;
     ctx->entry = srentry;
-    ctx->read_start_offset = read_start_offset;
-    ctx->read_end_offset = read_end_offset;
-    ctx->read_cur_offset = read_cur_offset;
+    ctx->entry_file = entry_file;
 
     return MB_BI_OK;
 }
@@ -206,35 +219,34 @@ int _segment_reader_read_data(SegmentReaderCtx *ctx, MbFile *file,
                               void *buf, size_t buf_size, size_t *bytes_read,
                               MbBiReader *bir)
 {
-    size_t to_copy = std::min<uint64_t>(
-            buf_size, ctx->read_end_offset - ctx->read_cur_offset);
-
-    if (ctx->read_cur_offset > SIZE_MAX - to_copy) {
-        mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
-                               "Current offset %" PRIu64 " with read size %"
-                               MB_PRIzu " would overflow integer",
-                               ctx->read_cur_offset, to_copy);
-        return MB_BI_FAILED;
-    }
+    (void) file;
 
-    int ret = mb_file_read_fully(file, buf, to_copy, bytes_read);
+    // The window ends at the end of the entry
+    int ret = mb_file_read_fully(ctx->entry_file, buf, buf_size, bytes_read);
     if (ret < 0) {
-        mb_bi_reader_set_error(bir, mb_file_error(file),
+        mb_bi_reader_set_error(bir, mb_file_error(ctx->entry_file),
                                "Failed to read data: %s",
-                               mb_file_error_string(file));
+                               mb_file_error_string(ctx->entry_file));
         return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
     }
 
-    ctx->read_cur_offset += *bytes_read;
-
     // Fail if we reach EOF early
-    if (*bytes_read == 0 && ctx->read_cur_offset != ctx->read_end_offset
-            && !ctx->entry->can_truncate) {
-        mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
-                               "Entry is truncated "
-                               "(expected %" PRIu64 " more bytes)",
-                               ctx->read_end_offset - ctx->read_cur_offset);
-        return MB_BI_FATAL;
+    if (*bytes_read == 0 && !ctx->entry->can_truncate) {
+        uint64_t pos;
+
+        ret = mb_file_seek(ctx->entry_file, 0, SEEK_CUR, &pos);
+        if (ret != MB_FILE_OK) {
+            mb_bi_reader_set_error(bir, mb_file_error(ctx->entry_file),
+                                   "Failed to get entry position: %s",
+                                   mb_file_error_string(ctx->entry_file));
+            return MB_BI_FAILED;
+        } else if (pos != ctx->entry->size) {
+            mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
+                                   "Entry is truncated "
+                                   "(expected %" PRIu64 " more bytes)",
+                                   ctx->entry->size - pos);
+            return MB_BI_FATAL;
+        }
     }
 
     return *bytes_read == 0 ? MB_BI_EOF : MB_BI_OK;
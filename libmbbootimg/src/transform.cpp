@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/transform.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/string.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+#define BUF_SIZE                10240
+
+/*!
+ * \file mbbootimg/transform.h
+ * \brief Boot image transform API
+ */
+
+/*!
+ * \typedef MbBiEntryFilterCb
+ *
+ * \brief Entry filter callback
+ *
+ * The callback receives the entire entry data in a buffer allocated with
+ * malloc(). The buffer can be modified in place or replaced with another
+ * malloc()'d buffer (the old buffer must be freed in that case). The buffer
+ * will be freed after the data is written.
+ *
+ * If the input boot image does not contain the entry, \p *data is NULL and
+ * \p *size is 0. The callback can provide new data for the entry.
+ *
+ * \param[in] entry_type Entry type
+ * \param[in,out] data Pointer to entry data buffer
+ * \param[in,out] size Pointer to size of entry data
+ * \param[in] userdata User callback data
+ *
+ * \return
+ *   * Return #MB_BI_OK if successful
+ *   * Return \<= #MB_BI_WARN if an error occurs
+ */
+
+static int copy_reader_error(MbBiReader *bir, MbBiWriter *biw, int ret)
+{
+    mb_bi_writer_set_error(biw, mb_bi_reader_error(bir), "%s",
+                           mb_bi_reader_error_string(bir));
+    return ret;
+}
+
+static int read_entry_data(MbBiReader *bir, MbBiWriter *biw,
+                           MbBiEntry *entry, void **data, size_t *size)
+{
+    size_t capacity = BUF_SIZE;
+    size_t used = 0;
+    size_t n;
+    int ret;
+
+    if (mb_bi_entry_size_is_set(entry)) {
+        capacity = std::max<uint64_t>(capacity, mb_bi_entry_size(entry));
+    }
+
+    unsigned char *buf = static_cast<unsigned char *>(malloc(capacity));
+    if (!buf) {
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                               "Failed to allocate entry buffer: %s",
+                               strerror(errno));
+        return MB_BI_FAILED;
+    }
+
+    while (true) {
+        if (used == capacity) {
+            size_t new_capacity = capacity * 2;
+            auto new_buf = static_cast<unsigned char *>(
+                    realloc(buf, new_capacity));
+            if (!new_buf) {
+                mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                       "Failed to resize entry buffer: %s",
+                                       strerror(errno));
+                free(buf);
+                return MB_BI_FAILED;
+            }
+
+            buf = new_buf;
+            capacity = new_capacity;
+        }
+
+        ret = mb_bi_reader_read_data(bir, buf + used, capacity - used, &n);
+        if (ret == MB_BI_EOF) {
+            break;
+        } else if (ret != MB_BI_OK) {
+            free(buf);
+            return copy_reader_error(bir, biw, ret);
+        }
+
+        used += n;
+    }
+
+    *data = buf;
+    *size = used;
+
+    return MB_BI_OK;
+}
+
+static int copy_entry_data(MbBiReader *bir, MbBiWriter *biw)
+{
+    char buf[BUF_SIZE];
+    size_t n_read;
+    size_t n_written;
+    int ret;
+
+    while ((ret = mb_bi_reader_read_data(bir, buf, sizeof(buf), &n_read))
+            == MB_BI_OK) {
+        ret = mb_bi_writer_write_data(biw, buf, n_read, &n_written);
+        if (ret != MB_BI_OK) {
+            return ret;
+        } else if (n_written != n_read) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                   "Wrote %" MB_PRIzu " of %" MB_PRIzu
+                                   " bytes", n_written, n_read);
+            return MB_BI_FAILED;
+        }
+    }
+
+    if (ret != MB_BI_EOF) {
+        return copy_reader_error(bir, biw, ret);
+    }
+
+    return MB_BI_OK;
+}
+
+static int filter_entry_data(MbBiReader *bir, MbBiWriter *biw,
+                             MbBiEntry *entry, int type,
+                             MbBiEntryFilterCb filter_cb, void *userdata)
+{
+    void *data = nullptr;
+    size_t size = 0;
+    size_t n;
+    int ret;
+
+    if (entry) {
+        ret = read_entry_data(bir, biw, entry, &data, &size);
+        if (ret != MB_BI_OK) {
+            return ret;
+        }
+    }
+
+    ret = filter_cb(type, &data, &size, userdata);
+    if (ret != MB_BI_OK) {
+        free(data);
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                               "Filter failed for entry type %d", type);
+        return ret;
+    }
+
+    if (size > 0) {
+        ret = mb_bi_writer_write_data(biw, data, size, &n);
+        if (ret == MB_BI_OK && n != size) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                   "Wrote %" MB_PRIzu " of %" MB_PRIzu
+                                   " bytes", n, size);
+            ret = MB_BI_FAILED;
+        }
+    }
+
+    free(data);
+    return ret;
+}
+
+/*!
+ * \brief Copy a boot image while transforming its entries
+ *
+ * The header of the input boot image is written to \p biw. Then, for each entry
+ * that \p biw's format supports, the entry data from \p bir is copied to
+ * \p biw. Entries with a type in \p filter_types are read into memory and
+ * passed to \p filter_cb before they are written. All other entries are copied
+ * in a streaming fashion. Entries that do not exist in the input boot image are
+ * left empty, unless they are filtered.
+ *
+ * \p biw is not closed by this function.
+ *
+ * \param bir MbBiReader opened for reading
+ * \param biw MbBiWriter opened for writing
+ * \param filter_types Bitmask of entry types to filter
+ * \param filter_cb Entry filter callback (can be NULL if \p filter_types is 0)
+ * \param userdata User callback data
+ *
+ * \return
+ *   * #MB_BI_OK if the boot image is successfully transformed
+ *   * \<= #MB_BI_WARN if an error occurs. The error is set on \p biw, even if
+ *     the failure was in \p bir.
+ */
+int mb_bi_transform(MbBiReader *bir, MbBiWriter *biw, int filter_types,
+                    MbBiEntryFilterCb filter_cb, void *userdata)
+{
+    MbBiHeader *header;
+    MbBiEntry *in_entry;
+    MbBiEntry *out_entry;
+    int ret;
+
+    ret = mb_bi_reader_read_header(bir, &header);
+    if (ret != MB_BI_OK) {
+        return copy_reader_error(bir, biw, ret);
+    }
+
+    ret = mb_bi_writer_write_header(biw, header);
+    if (ret != MB_BI_OK) {
+        return ret;
+    }
+
+    while ((ret = mb_bi_writer_get_entry(biw, &out_entry)) == MB_BI_OK) {
+        int type = mb_bi_entry_type(out_entry);
+
+        ret = mb_bi_writer_write_entry(biw, out_entry);
+        if (ret != MB_BI_OK) {
+            return ret;
+        }
+
+        ret = mb_bi_reader_go_to_entry(bir, &in_entry, type);
+        if (ret == MB_BI_EOF) {
+            in_entry = nullptr;
+        } else if (ret != MB_BI_OK) {
+            return copy_reader_error(bir, biw, ret);
+        }
+
+        if (filter_types & type) {
+            ret = filter_entry_data(bir, biw, in_entry, type,
+                                    filter_cb, userdata);
+        } else if (in_entry) {
+            ret = copy_entry_data(bir, biw);
+        } else {
+            ret = MB_BI_OK;
+        }
+
+        if (ret != MB_BI_OK) {
+            return ret;
+        }
+    }
+
+    if (ret != MB_BI_EOF) {
+        return ret;
+    }
+
+    return MB_BI_OK;
+}
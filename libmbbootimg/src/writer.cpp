@@ -26,6 +26,8 @@
 
 #include "mbcommon/file.h"
 #include "mbcommon/file/filename.h"
+#include "mbcommon/file/trace.h"
+#include "mbcommon/locale.h"
 #include "mbcommon/string.h"
 
 #include "mbbootimg/entry.h"
@@ -412,6 +414,9 @@ int mb_bi_writer_free(MbBiWriter *biw)
 /*!
  * \brief Open boot image from filename (MBS).
  *
+ * If the #MB_FILE_TRACE_ENV environment variable is set, the I/O performed
+ * on the file is traced. See mb_file_open_trace_from_env() for details.
+ *
  * \param biw MbBiWriter
  * \param filename MBS filename
  *
@@ -443,12 +448,24 @@ int mb_bi_writer_open_filename(MbBiWriter *biw, const char *filename)
         return MB_BI_FAILED;
     }
 
+    // Trace I/O if requested for debugging
+    ret = mb_file_open_trace_from_env(&file, filename);
+    if (ret != MB_FILE_OK) {
+        mb_bi_writer_set_error(biw, mb_file_error(file), "%s",
+                               mb_file_error_string(file));
+        mb_file_free(file);
+        return MB_BI_FAILED;
+    }
+
     return mb_bi_writer_open(biw, file, true);
 }
 
 /*!
  * \brief Open boot image from filename (WCS).
  *
+ * If the #MB_FILE_TRACE_ENV environment variable is set, the I/O performed
+ * on the file is traced. See mb_file_open_trace_from_env() for details.
+ *
  * \param biw MbBiWriter
  * \param filename WCS filename
  *
@@ -481,6 +498,17 @@ int mb_bi_writer_open_filename_w(MbBiWriter *biw, const wchar_t *filename)
         return MB_BI_FAILED;
     }
 
+    // Trace I/O if requested for debugging
+    char *name = mb_wcs_to_mbs(filename);
+    ret = mb_file_open_trace_from_env(&file, name);
+    free(name);
+    if (ret != MB_FILE_OK) {
+        mb_bi_writer_set_error(biw, mb_file_error(file), "%s",
+                               mb_file_error_string(file));
+        mb_file_free(file);
+        return MB_BI_FAILED;
+    }
+
     return mb_bi_writer_open(biw, file, true);
 }
 
@@ -427,3 +427,44 @@ TEST_F(AndroidReaderGoToEntryTest, GoToMissingEntryShouldFail)
     // In EOF state now, so next read should return MB_BI_EOF
     ASSERT_EQ(mb_bi_reader_read_entry(_bir.get(), &entry), MB_BI_EOF);
 }
+
+TEST(AndroidReaderReadDataTest, TruncatedEntryShouldFail)
+{
+    ScopedFile file(mb_file_new(), &mb_file_free);
+    ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
+    std::vector<unsigned char> data;
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    char buf[50];
+    size_t n;
+
+    ASSERT_TRUE(!!file);
+    ASSERT_TRUE(!!bir);
+
+    AndroidHeader ahdr = {};
+    memcpy(ahdr.magic, ANDROID_BOOT_MAGIC, ANDROID_BOOT_MAGIC_SIZE);
+    ahdr.kernel_size = 6;
+    ahdr.page_size = 2048;
+
+    // Only half of the kernel is present
+    data.resize(ahdr.page_size + 3);
+    memcpy(data.data(), &ahdr, sizeof(ahdr));
+    memcpy(data.data() + ahdr.page_size, "ker", 3);
+
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), data.data(), data.size()),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_bi_reader_enable_format_android(bir.get()), MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_open(bir.get(), file.get(), false), MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_read_header(bir.get(), &header), MB_BI_OK);
+
+    ASSERT_EQ(mb_bi_reader_go_to_entry(bir.get(), &entry, MB_BI_ENTRY_KERNEL),
+              MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_read_data(bir.get(), buf, sizeof(buf), &n),
+              MB_BI_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(memcmp(buf, "ker", n), 0);
+    ASSERT_EQ(mb_bi_reader_read_data(bir.get(), buf, sizeof(buf), &n),
+              MB_BI_FATAL);
+    ASSERT_EQ(mb_bi_reader_error(bir.get()), MB_BI_ERROR_FILE_FORMAT);
+}
@@ -18,3 +18,137 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include <cstring>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/mtk_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedFile;
+typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
+
+static const std::string kernel_data = "kernel data";
+static const std::string ramdisk_data = "some ramdisk data";
+
+static std::string mtk_header(uint32_t size)
+{
+    MtkHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MTK_MAGIC, MTK_MAGIC_SIZE);
+    hdr.size = mb_htole32(size);
+    memset(hdr.unused, 0xff, sizeof(hdr.unused));
+
+    return std::string(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+}
+
+struct MtkWriterSHA1Test : public ::testing::Test
+{
+    /*!
+     * \brief Write MTK image with the given MTK header size fields
+     */
+    std::string WriteImage(uint32_t kernel_hdr_size, uint32_t ramdisk_hdr_size)
+    {
+        ScopedFile file(mb_file_new(), mb_file_free);
+        ScopedWriter biw(mb_bi_writer_new(), mb_bi_writer_free);
+        void *buf = nullptr;
+        size_t buf_size = 0;
+        MbBiHeader *header;
+        MbBiEntry *entry;
+        int ret;
+        size_t n;
+
+        EXPECT_EQ(mb_file_open_memory_dynamic(file.get(), &buf, &buf_size),
+                  MB_FILE_OK);
+        EXPECT_EQ(mb_bi_writer_set_format_mtk(biw.get()), MB_BI_OK);
+        EXPECT_EQ(mb_bi_writer_open(biw.get(), file.get(), false), MB_BI_OK);
+
+        EXPECT_EQ(mb_bi_writer_get_header(biw.get(), &header), MB_BI_OK);
+        EXPECT_EQ(mb_bi_header_set_page_size(header, 2048), MB_BI_OK);
+        EXPECT_EQ(mb_bi_writer_write_header(biw.get(), header), MB_BI_OK);
+
+        while ((ret = mb_bi_writer_get_entry(biw.get(), &entry)) == MB_BI_OK) {
+            EXPECT_EQ(mb_bi_writer_write_entry(biw.get(), entry), MB_BI_OK);
+
+            std::string data;
+
+            switch (mb_bi_entry_type(entry)) {
+            case MB_BI_ENTRY_MTK_KERNEL_HEADER:
+                data = mtk_header(kernel_hdr_size);
+                break;
+            case MB_BI_ENTRY_KERNEL:
+                data = kernel_data;
+                break;
+            case MB_BI_ENTRY_MTK_RAMDISK_HEADER:
+                data = mtk_header(ramdisk_hdr_size);
+                break;
+            case MB_BI_ENTRY_RAMDISK:
+                data = ramdisk_data;
+                break;
+            }
+
+            if (!data.empty()) {
+                EXPECT_EQ(mb_bi_writer_write_data(biw.get(), data.data(),
+                                                  data.size(), &n), MB_BI_OK);
+                EXPECT_EQ(n, data.size());
+            }
+        }
+        EXPECT_EQ(ret, MB_BI_EOF);
+
+        EXPECT_EQ(mb_bi_writer_close(biw.get()), MB_BI_OK);
+
+        std::string result(static_cast<char *>(buf), buf_size);
+        free(buf);
+        return result;
+    }
+};
+
+TEST_F(MtkWriterSHA1Test, ChecksumIncludesFinalHeaderSizes)
+{
+    std::string image = WriteImage(kernel_data.size(), ramdisk_data.size());
+
+    // Each MTK header is followed by its image and the combined size
+    std::string hashed;
+    uint32_t le32_size;
+
+    hashed += mtk_header(kernel_data.size());
+    hashed += kernel_data;
+    le32_size = mb_htole32(sizeof(MtkHeader) + kernel_data.size());
+    hashed.append(reinterpret_cast<char *>(&le32_size), sizeof(le32_size));
+    hashed += mtk_header(ramdisk_data.size());
+    hashed += ramdisk_data;
+    le32_size = mb_htole32(sizeof(MtkHeader) + ramdisk_data.size());
+    hashed.append(reinterpret_cast<char *>(&le32_size), sizeof(le32_size));
+    // Second bootloader size (empty device tree size is not included)
+    hashed.append(4, '\0');
+
+    unsigned char expected[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char *>(hashed.data()),
+         hashed.size(), expected);
+
+    ASSERT_GE(image.size(), 576 + sizeof(expected));
+    ASSERT_EQ(memcmp(image.data() + 576, expected, sizeof(expected)), 0);
+}
+
+TEST_F(MtkWriterSHA1Test, IncorrectHeaderSizesAreFixed)
+{
+    // The checksum can be computed while writing only if the MTK header sizes
+    // are already correct. Otherwise, the image is re-read.
+    std::string streamed = WriteImage(kernel_data.size(), ramdisk_data.size());
+    std::string reread = WriteImage(0, 0);
+
+    ASSERT_EQ(streamed, reread);
+
+    std::string partial = WriteImage(kernel_data.size(), 0);
+
+    ASSERT_EQ(streamed, partial);
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/transform.h"
+#include "mbbootimg/writer.h"
+
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedFile;
+typedef std::unique_ptr<MbBiReader, decltype(mb_bi_reader_free) *> ScopedReader;
+typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
+
+struct TransformTest : testing::Test
+{
+    void *_in_buf;
+    size_t _in_size;
+    void *_out_buf;
+    size_t _out_size;
+
+    TransformTest()
+        : _in_buf(nullptr), _in_size(0), _out_buf(nullptr), _out_size(0)
+    {
+    }
+
+    virtual ~TransformTest()
+    {
+        free(_in_buf);
+        free(_out_buf);
+    }
+
+    virtual void SetUp()
+    {
+        ScopedFile file(mb_file_new(), &mb_file_free);
+        ScopedWriter biw(mb_bi_writer_new(), &mb_bi_writer_free);
+        MbBiHeader *header;
+        MbBiEntry *entry;
+        size_t n;
+        int ret;
+
+        ASSERT_TRUE(!!file);
+        ASSERT_TRUE(!!biw);
+
+        ASSERT_EQ(mb_file_open_memory_dynamic(file.get(), &_in_buf, &_in_size),
+                  MB_FILE_OK);
+        ASSERT_EQ(mb_bi_writer_set_format_android(biw.get()), MB_BI_OK);
+        ASSERT_EQ(mb_bi_writer_open(biw.get(), file.get(), false), MB_BI_OK);
+
+        ASSERT_EQ(mb_bi_writer_get_header(biw.get(), &header), MB_BI_OK);
+        ASSERT_EQ(mb_bi_header_set_page_size(header, 2048), MB_BI_OK);
+        ASSERT_EQ(mb_bi_header_set_kernel_cmdline(header, "cmdline"), MB_BI_OK);
+        ASSERT_EQ(mb_bi_writer_write_header(biw.get(), header), MB_BI_OK);
+
+        while ((ret = mb_bi_writer_get_entry(biw.get(), &entry)) == MB_BI_OK) {
+            ASSERT_EQ(mb_bi_writer_write_entry(biw.get(), entry), MB_BI_OK);
+
+            switch (mb_bi_entry_type(entry)) {
+            case MB_BI_ENTRY_KERNEL:
+                ASSERT_EQ(mb_bi_writer_write_data(biw.get(), "kernel", 6, &n),
+                          MB_BI_OK);
+                break;
+            case MB_BI_ENTRY_RAMDISK:
+                ASSERT_EQ(mb_bi_writer_write_data(biw.get(), "ramdisk", 7, &n),
+                          MB_BI_OK);
+                break;
+            }
+        }
+        ASSERT_EQ(ret, MB_BI_EOF);
+
+        ASSERT_EQ(mb_bi_writer_close(biw.get()), MB_BI_OK);
+    }
+
+    int Transform(int filter_types, MbBiEntryFilterCb filter_cb,
+                  void *userdata, std::string *error = nullptr)
+    {
+        ScopedFile fin(mb_file_new(), &mb_file_free);
+        ScopedFile fout(mb_file_new(), &mb_file_free);
+        ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
+        ScopedWriter biw(mb_bi_writer_new(), &mb_bi_writer_free);
+
+        if (!fin || !fout || !bir || !biw
+                || mb_file_open_memory_static(fin.get(), _in_buf, _in_size)
+                        != MB_FILE_OK
+                || mb_file_open_memory_dynamic(fout.get(), &_out_buf,
+                                               &_out_size) != MB_FILE_OK
+                || mb_bi_reader_enable_format_all(bir.get()) != MB_BI_OK
+                || mb_bi_reader_open(bir.get(), fin.get(), false) != MB_BI_OK
+                || mb_bi_writer_set_format_android(biw.get()) != MB_BI_OK
+                || mb_bi_writer_open(biw.get(), fout.get(), false)
+                        != MB_BI_OK) {
+            return MB_BI_FATAL;
+        }
+
+        int ret = mb_bi_transform(bir.get(), biw.get(), filter_types,
+                                  filter_cb, userdata);
+        if (ret != MB_BI_OK) {
+            if (error) {
+                *error = mb_bi_writer_error_string(biw.get());
+            }
+            return ret;
+        }
+
+        return mb_bi_writer_close(biw.get());
+    }
+
+    std::string ReadEntry(int type)
+    {
+        ScopedFile file(mb_file_new(), &mb_file_free);
+        ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
+        MbBiHeader *header;
+        MbBiEntry *entry;
+        std::string data;
+        char buf[4];
+        size_t n;
+        int ret;
+
+        EXPECT_EQ(mb_file_open_memory_static(file.get(), _out_buf, _out_size),
+                  MB_FILE_OK);
+        EXPECT_EQ(mb_bi_reader_enable_format_all(bir.get()), MB_BI_OK);
+        EXPECT_EQ(mb_bi_reader_open(bir.get(), file.get(), false), MB_BI_OK);
+        EXPECT_EQ(mb_bi_reader_read_header(bir.get(), &header), MB_BI_OK);
+
+        ret = mb_bi_reader_go_to_entry(bir.get(), &entry, type);
+        if (ret == MB_BI_EOF) {
+            return data;
+        }
+        EXPECT_EQ(ret, MB_BI_OK);
+
+        while ((ret = mb_bi_reader_read_data(bir.get(), buf, sizeof(buf), &n))
+                == MB_BI_OK) {
+            data.append(buf, n);
+        }
+        EXPECT_EQ(ret, MB_BI_EOF);
+
+        return data;
+    }
+};
+
+static int uppercase_cb(int entry_type, void **data, size_t *size,
+                        void *userdata)
+{
+    (void) entry_type;
+    int *count = static_cast<int *>(userdata);
+    ++*count;
+
+    char *ptr = static_cast<char *>(*data);
+    for (size_t i = 0; i < *size; ++i) {
+        ptr[i] = static_cast<char>(toupper(ptr[i]));
+    }
+
+    return MB_BI_OK;
+}
+
+static int replace_cb(int entry_type, void **data, size_t *size,
+                      void *userdata)
+{
+    (void) entry_type;
+    (void) userdata;
+
+    void *new_data = malloc(6);
+    if (!new_data) {
+        return MB_BI_FAILED;
+    }
+    memcpy(new_data, "second", 6);
+
+    free(*data);
+    *data = new_data;
+    *size = 6;
+
+    return MB_BI_OK;
+}
+
+static int failing_cb(int entry_type, void **data, size_t *size,
+                      void *userdata)
+{
+    (void) entry_type;
+    (void) data;
+    (void) size;
+    (void) userdata;
+
+    return MB_BI_FAILED;
+}
+
+TEST_F(TransformTest, CopyWithoutFilters)
+{
+    ASSERT_EQ(Transform(0, nullptr, nullptr), MB_BI_OK);
+    ASSERT_EQ(_out_size, _in_size);
+    ASSERT_EQ(memcmp(_out_buf, _in_buf, _in_size), 0);
+}
+
+TEST_F(TransformTest, FilterExistingEntry)
+{
+    int count = 0;
+
+    ASSERT_EQ(Transform(MB_BI_ENTRY_RAMDISK, &uppercase_cb, &count), MB_BI_OK);
+    ASSERT_EQ(count, 1);
+    ASSERT_EQ(ReadEntry(MB_BI_ENTRY_KERNEL), "kernel");
+    ASSERT_EQ(ReadEntry(MB_BI_ENTRY_RAMDISK), "RAMDISK");
+}
+
+TEST_F(TransformTest, FilterMissingEntry)
+{
+    ASSERT_EQ(Transform(MB_BI_ENTRY_SECONDBOOT, &replace_cb, nullptr),
+              MB_BI_OK);
+    ASSERT_EQ(ReadEntry(MB_BI_ENTRY_RAMDISK), "ramdisk");
+    ASSERT_EQ(ReadEntry(MB_BI_ENTRY_SECONDBOOT), "second");
+}
+
+TEST_F(TransformTest, FilterFailureShouldFail)
+{
+    std::string error;
+
+    ASSERT_EQ(Transform(MB_BI_ENTRY_KERNEL, &failing_cb, nullptr, &error),
+              MB_BI_FAILED);
+    ASSERT_NE(error.find("Filter failed"), std::string::npos);
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Throughput of the MbFile search and move helpers. Most run against memory
+// files so that the numbers reflect the helpers themselves rather than the
+// page cache or the disk. The fd variant of the move benchmark covers the
+// in-kernel copy path and runs against a temporary file in $TMPDIR (or /tmp).
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <benchmark/benchmark.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+#define HAYSTACK_SIZE   (16 * 1024 * 1024)
+#define MATCH_INTERVAL  (1024 * 1024)
+#define MOVE_SIZE       (8 * 1024 * 1024)
+#define MOVE_DISTANCE   4097
+
+static const char pattern[] = "ANDROID!\x00\x10\x00\x00\x00\x80\x00\x10";
+
+// std::mt19937 is specified exactly by the standard, so the inputs are the
+// same on every platform and across releases
+static std::vector<unsigned char> random_data(size_t size, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    std::vector<unsigned char> data(size);
+    for (auto &b : data) {
+        b = static_cast<unsigned char>(gen());
+    }
+    return data;
+}
+
+static std::vector<unsigned char> search_haystack()
+{
+    auto data = random_data(HAYSTACK_SIZE, 1);
+    for (size_t i = MATCH_INTERVAL / 2; i < data.size(); i += MATCH_INTERVAL) {
+        memcpy(data.data() + i, pattern, sizeof(pattern));
+    }
+    return data;
+}
+
+static int search_result_cb(MbFile *file, void *userdata, uint64_t offset)
+{
+    (void) file;
+    (void) offset;
+    ++*static_cast<size_t *>(userdata);
+    return MB_FILE_OK;
+}
+
+// Arg: buffer size passed to mb_file_search()
+static void BM_FileSearch(benchmark::State &state)
+{
+    static const auto data = search_haystack();
+    size_t bsize = state.range(0);
+    size_t matches = 0;
+
+    MbFile *file = mb_file_new();
+    if (mb_file_open_memory_static(file, data.data(), data.size())
+            != MB_FILE_OK) {
+        state.SkipWithError("Failed to open memory file");
+        mb_file_free(file);
+        return;
+    }
+
+    for (auto _ : state) {
+        matches = 0;
+        if (mb_file_search(file, -1, -1, bsize, pattern, sizeof(pattern), -1,
+                           &search_result_cb, &matches) != MB_FILE_OK) {
+            state.SkipWithError(mb_file_error_string(file));
+            break;
+        }
+    }
+
+    if (matches != HAYSTACK_SIZE / MATCH_INTERVAL) {
+        state.SkipWithError("Unexpected number of matches");
+    }
+
+    state.SetBytesProcessed(state.iterations() * data.size());
+    mb_file_free(file);
+}
+BENCHMARK(BM_FileSearch)
+    ->Arg(4 * 1024)
+    ->Arg(64 * 1024)
+    ->Arg(1024 * 1024)
+    ->Arg(0)
+    ->Unit(benchmark::kMillisecond);
+
+// Arg: 0 to move data towards the end of the file, 1 to move it towards the
+// beginning
+static void BM_FileMove(benchmark::State &state)
+{
+    bool backwards = state.range(0) != 0;
+    uint64_t src = backwards ? MOVE_DISTANCE : 0;
+    uint64_t dest = backwards ? 0 : MOVE_DISTANCE;
+    uint64_t moved;
+
+    auto initial = random_data(MOVE_SIZE + MOVE_DISTANCE, 2);
+    size_t size = initial.size();
+    void *buf = malloc(size);
+    memcpy(buf, initial.data(), size);
+
+    MbFile *file = mb_file_new();
+    if (mb_file_open_memory_dynamic(file, &buf, &size) != MB_FILE_OK) {
+        state.SkipWithError("Failed to open memory file");
+        mb_file_free(file);
+        free(buf);
+        return;
+    }
+
+    for (auto _ : state) {
+        if (mb_file_move(file, src, dest, MOVE_SIZE, &moved) != MB_FILE_OK
+                || moved != MOVE_SIZE) {
+            state.SkipWithError(mb_file_error_string(file));
+            break;
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * MOVE_SIZE);
+    mb_file_free(file);
+    free(buf);
+}
+BENCHMARK(BM_FileMove)
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+#ifndef _WIN32
+// Args: distance between the regions, 0 to move data towards the end of the
+// file or 1 to move it towards the beginning
+static void BM_FileMoveFd(benchmark::State &state)
+{
+    uint64_t distance = state.range(0);
+    bool backwards = state.range(1) != 0;
+    uint64_t src = backwards ? distance : 0;
+    uint64_t dest = backwards ? 0 : distance;
+    uint64_t moved;
+
+    const char *tmpdir = getenv("TMPDIR");
+    std::string path = tmpdir ? tmpdir : "/tmp";
+    path += "/mbcommon_bench.XXXXXX";
+
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        state.SkipWithError("Failed to create temporary file");
+        return;
+    }
+    unlink(path.c_str());
+
+    auto initial = random_data(MOVE_SIZE + distance, 2);
+    if (pwrite(fd, initial.data(), initial.size(), 0)
+            != static_cast<ssize_t>(initial.size())) {
+        state.SkipWithError("Failed to write temporary file");
+        close(fd);
+        return;
+    }
+
+    MbFile *file = mb_file_new();
+    if (mb_file_open_fd(file, fd, true) != MB_FILE_OK) {
+        state.SkipWithError("Failed to open fd file");
+        mb_file_free(file);
+        close(fd);
+        return;
+    }
+
+    for (auto _ : state) {
+        if (mb_file_move(file, src, dest, MOVE_SIZE, &moved) != MB_FILE_OK
+                || moved != MOVE_SIZE) {
+            state.SkipWithError(mb_file_error_string(file));
+            break;
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * MOVE_SIZE);
+    mb_file_free(file);
+}
+BENCHMARK(BM_FileMoveFd)
+    ->Args({ MOVE_DISTANCE, 0 })
+    ->Args({ MOVE_DISTANCE, 1 })
+    ->Args({ 1024 * 1024 + 3, 0 })
+    ->Args({ 1024 * 1024 + 3, 1 })
+    ->Args({ MOVE_SIZE, 0 })
+    ->Unit(benchmark::kMillisecond);
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Throughput of the byte sequence search and replace functions on inputs
+// shaped like the ones the patcher feeds them: large blobs of uncompressible
+// data with sparse matches, and text with frequent matches.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <benchmark/benchmark.h>
+
+#include "mbcommon/libc/string.h"
+#include "mbcommon/string.h"
+
+#define HAYSTACK_SIZE   (16 * 1024 * 1024)
+#define TEXT_SIZE       (4 * 1024 * 1024)
+
+// std::mt19937 is specified exactly by the standard, so the inputs are the
+// same on every platform and across releases
+static std::vector<unsigned char> random_data(size_t size, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    std::vector<unsigned char> data(size);
+    for (auto &b : data) {
+        b = static_cast<unsigned char>(gen());
+    }
+    return data;
+}
+
+// Arg: needle size. The needle only occurs at the end of the haystack, so the
+// whole haystack is scanned.
+static void BM_Memmem(benchmark::State &state)
+{
+    static const auto haystack = random_data(HAYSTACK_SIZE, 3);
+    size_t needle_size = state.range(0);
+    const unsigned char *needle =
+            haystack.data() + haystack.size() - needle_size;
+
+    for (auto _ : state) {
+        void *ptr = mb_memmem(haystack.data(), haystack.size(),
+                              needle, needle_size);
+        benchmark::DoNotOptimize(ptr);
+    }
+
+    state.SetBytesProcessed(state.iterations() * haystack.size());
+}
+BENCHMARK(BM_Memmem)
+    ->Arg(4)
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(512)
+    ->Unit(benchmark::kMillisecond);
+
+// Text consisting of lines of the form "mount("ext4", "EMMC", "/system");"
+// separated by random words
+static std::string mount_text()
+{
+    static const char *words[] = {
+        "ui_print", "package_extract_dir", "set_metadata_recursive",
+        "symlink", "run_program", "unmount", "format", "delete",
+    };
+
+    std::mt19937 gen(4);
+    std::string text;
+
+    while (text.size() < TEXT_SIZE) {
+        if (gen() % 8 == 0) {
+            text += "mount(\"ext4\", \"EMMC\", \"/system\");\n";
+        } else {
+            text += words[gen() % (sizeof(words) / sizeof(words[0]))];
+            text += "(\"/system/bin\");\n";
+        }
+    }
+
+    return text;
+}
+
+// Arg: size of the replacement minus the size of the original sequence
+static void BM_MemReplace(benchmark::State &state)
+{
+    static const auto text = mount_text();
+    static const char from[] = "\"/system\"";
+    std::string to = from;
+    to.insert(1, state.range(0), '_');
+    size_t replaced = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        size_t size = text.size();
+        void *mem = malloc(size);
+        memcpy(mem, text.data(), size);
+        state.ResumeTiming();
+
+        if (mb_mem_replace(&mem, &size, from, sizeof(from) - 1,
+                           to.data(), to.size(), 0, &replaced) < 0) {
+            state.SkipWithError("mb_mem_replace() failed");
+        }
+
+        state.PauseTiming();
+        free(mem);
+        state.ResumeTiming();
+    }
+
+    state.SetBytesProcessed(state.iterations() * text.size());
+    state.counters["replacements"] = replaced;
+}
+BENCHMARK(BM_MemReplace)
+    ->Arg(0)
+    ->Arg(16)
+    ->Unit(benchmark::kMillisecond);
@@ -67,6 +67,15 @@ typedef int (*MbFileSeekCb)(struct MbFile *file, void *userdata,
                             uint64_t *new_offset);
 typedef int (*MbFileTruncateCb)(struct MbFile *file, void *userdata,
                                 uint64_t size);
+typedef int (*MbFilePreadCb)(struct MbFile *file, void *userdata,
+                             void *buf, size_t size, uint64_t offset,
+                             size_t *bytes_read);
+typedef int (*MbFilePwriteCb)(struct MbFile *file, void *userdata,
+                              const void *buf, size_t size, uint64_t offset,
+                              size_t *bytes_written);
+typedef int (*MbFileCopyCb)(struct MbFile *file, void *userdata,
+                            uint64_t src, uint64_t dest, uint64_t size,
+                            uint64_t *bytes_copied);
 
 // Handle creation/destruction
 MB_EXPORT struct MbFile * mb_file_new();
@@ -85,6 +94,12 @@ MB_EXPORT int mb_file_set_seek_callback(struct MbFile *file,
                                         MbFileSeekCb seek_cb);
 MB_EXPORT int mb_file_set_truncate_callback(struct MbFile *file,
                                             MbFileTruncateCb truncate_cb);
+MB_EXPORT int mb_file_set_pread_callback(struct MbFile *file,
+                                         MbFilePreadCb pread_cb);
+MB_EXPORT int mb_file_set_pwrite_callback(struct MbFile *file,
+                                          MbFilePwriteCb pwrite_cb);
+MB_EXPORT int mb_file_set_copy_callback(struct MbFile *file,
+                                        MbFileCopyCb copy_cb);
 MB_EXPORT int mb_file_set_callback_data(struct MbFile *file, void *userdata);
 
 // File open/close
@@ -99,6 +114,12 @@ MB_EXPORT int mb_file_write(struct MbFile *file, const void *buf, size_t size,
 MB_EXPORT int mb_file_seek(struct MbFile *file, int64_t offset, int whence,
                            uint64_t *new_offset);
 MB_EXPORT int mb_file_truncate(struct MbFile *file, uint64_t size);
+MB_EXPORT int mb_file_pread(struct MbFile *file, void *buf, size_t size,
+                            uint64_t offset, size_t *bytes_read);
+MB_EXPORT int mb_file_pwrite(struct MbFile *file, const void *buf, size_t size,
+                             uint64_t offset, size_t *bytes_written);
+MB_EXPORT int mb_file_copy(struct MbFile *file, uint64_t src, uint64_t dest,
+                           uint64_t size, uint64_t *bytes_copied);
 
 // Error handling functions
 MB_EXPORT int mb_file_error(struct MbFile *file);
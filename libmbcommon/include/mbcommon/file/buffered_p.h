@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/guard_p.h"
+
+#include "mbcommon/file/buffered.h"
+
+/*! \cond INTERNAL */
+MB_BEGIN_C_DECLS
+
+struct BufferedFileCtx
+{
+    struct MbFile *inner;
+    bool owned;
+
+    char *buf;
+    size_t buf_size;
+
+    // Read-ahead data is buf[read_pos, read_size). The inner file is positioned
+    // at the end of the read-ahead data.
+    size_t read_pos;
+    size_t read_size;
+    // Pending writes are buf[0, write_size). The inner file is positioned at
+    // the start of the pending data.
+    size_t write_size;
+    // Positional read-ahead data is buf[0, pread_size) and starts at
+    // pread_offset in the inner file. Only one kind of data is in the buffer at
+    // a time.
+    uint64_t pread_offset;
+    size_t pread_size;
+
+    // Logical file position. Only known after the first seek.
+    uint64_t pos;
+    bool pos_valid;
+};
+
+MB_END_C_DECLS
+/*! \endcond */
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#ifdef __cplusplus
+#  include <cstdbool>
+#else
+#  include <stdbool.h>
+#endif
+
+MB_BEGIN_C_DECLS
+
+enum MbFileCompression {
+    // Detect format from the stream header (decompression only)
+    MB_FILE_COMPRESSION_AUTO        = 0,
+    MB_FILE_COMPRESSION_GZIP        = 1,
+    MB_FILE_COMPRESSION_ZLIB        = 2,
+    MB_FILE_COMPRESSION_XZ          = 3,
+    MB_FILE_COMPRESSION_LZ4         = 4,
+    MB_FILE_COMPRESSION_LZ4_LEGACY  = 5,
+};
+
+MB_EXPORT int mb_file_open_decompressor(struct MbFile *file,
+                                        struct MbFile *inner, bool owned,
+                                        int format);
+MB_EXPORT int mb_file_open_compressor(struct MbFile *file,
+                                      struct MbFile *inner, bool owned,
+                                      int format, int level,
+                                      unsigned int threads);
+
+MB_END_C_DECLS
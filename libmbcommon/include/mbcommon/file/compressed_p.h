@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/guard_p.h"
+
+#include "mbcommon/file/compressed.h"
+
+#include <lz4frame.h>
+#include <lzma.h>
+#include <zlib.h>
+
+/*! \cond INTERNAL */
+MB_BEGIN_C_DECLS
+
+struct CompressedFileCtx
+{
+    struct MbFile *inner;
+    bool owned;
+
+    int format;
+    bool compress;
+    int level;
+    unsigned int threads;
+
+    // Staging buffer for data read from or written to the inner file. When
+    // decompressing, unconsumed input is buf[buf_pos, buf_size). When
+    // compressing, pending output is buf[0, buf_size).
+    unsigned char *buf;
+    size_t buf_cap;
+    size_t buf_pos;
+    size_t buf_size;
+    bool in_eof;
+    bool stream_end;
+
+    // Whether the compressed stream should be finished when closing
+    bool finish_on_close;
+
+    // Number of uncompressed bytes read or written
+    uint64_t pos;
+
+    z_stream zstrm;
+    bool zstrm_init;
+    lzma_stream lstrm;
+    bool lstrm_init;
+    LZ4F_compressionContext_t lz4_cctx;
+    LZ4F_decompressionContext_t lz4_dctx;
+
+    // Legacy LZ4 blocks. When compressing, up to lz4_blocks uncompressed
+    // blocks are collected in lz4_in so they can be compressed in parallel.
+    // When decompressing, the current decompressed block is
+    // lz4_out[lz4_out_pos, lz4_out_size).
+    unsigned char *lz4_in;
+    size_t lz4_in_size;
+    unsigned char *lz4_out;
+    size_t lz4_out_pos;
+    size_t lz4_out_size;
+    size_t lz4_blocks;
+};
+
+MB_END_C_DECLS
+/*! \endcond */
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#ifdef __cplusplus
+#  include <cstdbool>
+#else
+#  include <stdbool.h>
+#endif
+
+#define MB_FILE_DIGEST_CRC32_SIZE       4
+#define MB_FILE_DIGEST_SHA1_SIZE        20
+#define MB_FILE_DIGEST_SHA256_SIZE      32
+#define MB_FILE_DIGEST_SHA512_SIZE      64
+#define MB_FILE_DIGEST_MAX_SIZE         MB_FILE_DIGEST_SHA512_SIZE
+
+MB_BEGIN_C_DECLS
+
+enum MbFileDigestType {
+    MB_FILE_DIGEST_CRC32            = 1 << 0,
+    MB_FILE_DIGEST_SHA1             = 1 << 1,
+    MB_FILE_DIGEST_SHA256           = 1 << 2,
+    MB_FILE_DIGEST_SHA512           = 1 << 3,
+};
+
+MB_EXPORT int mb_file_open_digest(struct MbFile *file,
+                                  struct MbFile *inner, bool owned,
+                                  struct MbFile *tee, int types);
+
+MB_EXPORT int mb_file_digest(struct MbFile *file, int type,
+                             unsigned char *digest, size_t size,
+                             size_t *digest_size);
+
+MB_END_C_DECLS
@@ -37,6 +37,12 @@ struct FdFileCtx
     char *filename;
 #endif
     int flags;
+#ifdef __linux__
+    // In-kernel copy support, determined on first use
+    uint64_t block_size;
+    bool clone_unsupported;
+    bool copy_unsupported;
+#endif
 
     SysVtable vtable;
 };
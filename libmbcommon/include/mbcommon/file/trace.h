@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#ifdef __cplusplus
+#  include <cstdbool>
+#  include <cstdint>
+#  include <cstdio>
+#else
+#  include <stdbool.h>
+#  include <stdint.h>
+#  include <stdio.h>
+#endif
+
+// Environment variable for enabling tracing in mb_file_open_trace_from_env()
+#define MB_FILE_TRACE_ENV               "MBP_FILE_TRACE"
+
+// Bucket i of the latency histogram counts operations that took less than
+// 2^i microseconds (and at least 2^(i-1) microseconds). The last bucket counts
+// everything that is slower.
+#define MB_FILE_TRACE_HISTOGRAM_SIZE    24
+
+// Maximum number of operations that are recorded for the Chrome trace
+#define MB_FILE_TRACE_MAX_EVENTS        65536
+
+MB_BEGIN_C_DECLS
+
+enum MbFileTraceOp {
+    MB_FILE_TRACE_OP_READ           = 0,
+    MB_FILE_TRACE_OP_WRITE          = 1,
+    MB_FILE_TRACE_OP_SEEK           = 2,
+    MB_FILE_TRACE_OP_TRUNCATE       = 3,
+    MB_FILE_TRACE_OP_PREAD          = 4,
+    MB_FILE_TRACE_OP_PWRITE         = 5,
+    MB_FILE_TRACE_OP_COUNT,
+};
+
+enum MbFileTraceFormat {
+    // Human-readable summary
+    MB_FILE_TRACE_FORMAT_SUMMARY    = 0,
+    // Chrome trace event JSON (chrome://tracing)
+    MB_FILE_TRACE_FORMAT_CHROME     = 1,
+};
+
+struct MbFileTraceOpStats
+{
+    // Number of operations
+    uint64_t count;
+    // Number of operations that failed
+    uint64_t errors;
+    // Bytes requested and bytes actually transferred
+    uint64_t bytes_requested;
+    uint64_t bytes;
+    // Latency in nanoseconds
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t histogram[MB_FILE_TRACE_HISTOGRAM_SIZE];
+};
+
+struct MbFileTraceAccessStats
+{
+    // Reads and writes that started where the previous one ended
+    uint64_t sequential;
+    // Reads and writes that started anywhere else
+    uint64_t nonsequential;
+    // Seeks that moved the file position forwards, backwards, or not at all
+    uint64_t seeks_forward;
+    uint64_t seeks_backward;
+    uint64_t seeks_unchanged;
+    // Total distance moved by seeks
+    uint64_t seek_distance;
+};
+
+MB_EXPORT int mb_file_open_trace(struct MbFile *file,
+                                 struct MbFile *inner, bool owned,
+                                 const char *name);
+
+MB_EXPORT int mb_file_open_trace_from_env(struct MbFile **file,
+                                          const char *name);
+
+MB_EXPORT int mb_file_trace_set_report(struct MbFile *file,
+                                       const char *path, int format);
+
+MB_EXPORT int mb_file_trace_op_stats(struct MbFile *file, int op,
+                                     struct MbFileTraceOpStats *stats);
+MB_EXPORT int mb_file_trace_access_stats(struct MbFile *file,
+                                         struct MbFileTraceAccessStats *stats);
+
+MB_EXPORT int mb_file_trace_write_report(struct MbFile *file, FILE *fp,
+                                         int format);
+
+MB_END_C_DECLS
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/guard_p.h"
+
+#include "mbcommon/file/trace.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*! \cond INTERNAL */
+MB_BEGIN_C_DECLS
+
+struct TraceEvent
+{
+    int op;
+    int ret;
+    // File offset of the operation (if known)
+    uint64_t offset;
+    bool offset_valid;
+    // Requested size (or size to truncate to) and bytes transferred (or new
+    // file position for seeks)
+    uint64_t size;
+    uint64_t result;
+    // Seek arguments
+    int64_t seek_offset;
+    int whence;
+    // Nanoseconds since the handle was opened
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+
+struct TraceFileCtx
+{
+    struct MbFile *inner;
+    bool owned;
+
+    std::string name;
+    // Unique ID for the Chrome trace
+    unsigned int id;
+
+    // Report to write when the handle is closed
+    FILE *report_fp;
+    int report_format;
+
+    // Start of the trace
+    uint64_t open_steady_ns;
+    uint64_t open_wall_us;
+
+    // Protects everything below, as positional I/O may be done from multiple
+    // threads
+    std::mutex lock;
+
+    MbFileTraceOpStats op_stats[MB_FILE_TRACE_OP_COUNT];
+    MbFileTraceAccessStats access_stats;
+
+    // File position of the inner handle (if known)
+    uint64_t pos;
+    bool pos_valid;
+    // End of the previous read or write (if known)
+    uint64_t last_end;
+    bool last_end_valid;
+
+    std::vector<TraceEvent> events;
+    uint64_t dropped_events;
+};
+
+MB_END_C_DECLS
+/*! \endcond */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#ifdef __cplusplus
+#  include <cstdbool>
+#else
+#  include <stdbool.h>
+#endif
+
+#define MB_FILE_URING_DEFAULT_QUEUE_DEPTH   32
+
+MB_BEGIN_C_DECLS
+
+typedef void (*MbFileAsyncCb)(struct MbFile *file, void *userdata,
+                              int ret, size_t bytes);
+
+MB_EXPORT int mb_file_open_uring(struct MbFile *file, int fd, bool owned,
+                                 unsigned int queue_depth);
+MB_EXPORT int mb_file_open_uring_filename(struct MbFile *file,
+                                          const char *filename, int mode,
+                                          unsigned int queue_depth);
+
+MB_EXPORT bool mb_file_uring_active(struct MbFile *file);
+
+// Asynchronous operations
+MB_EXPORT int mb_file_async_read(struct MbFile *file, void *buf, size_t size,
+                                 uint64_t offset, MbFileAsyncCb cb,
+                                 void *userdata);
+MB_EXPORT int mb_file_async_write(struct MbFile *file, const void *buf,
+                                  size_t size, uint64_t offset,
+                                  MbFileAsyncCb cb, void *userdata);
+MB_EXPORT int mb_file_async_wait(struct MbFile *file, size_t min_completions);
+MB_EXPORT size_t mb_file_async_pending(struct MbFile *file);
+
+MB_END_C_DECLS
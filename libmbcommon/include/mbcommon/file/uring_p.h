@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/guard_p.h"
+
+#include "mbcommon/file/uring.h"
+
+#include <sys/uio.h>
+
+/*! \cond INTERNAL */
+MB_BEGIN_C_DECLS
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+struct UringRequest
+{
+    MbFileAsyncCb cb;
+    void *userdata;
+    bool write;
+    struct iovec iov;
+};
+
+struct UringFileCtx
+{
+    // fd handle used for synchronous operations and as the fallback when
+    // io_uring is not available
+    struct MbFile *inner;
+    int fd;
+
+    // io_uring instance (-1 if not available)
+    int ring_fd;
+    unsigned int queue_depth;
+
+    void *sq_ptr;
+    size_t sq_map_size;
+    void *cq_ptr;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_map_size;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // One request slot per submission queue entry. The slot index is the
+    // user_data of the SQE.
+    struct UringRequest *requests;
+    unsigned int *free_slots;
+    unsigned int free_count;
+
+    // Requests added to the submission queue, but not yet submitted
+    unsigned int unsubmitted;
+    // Requests submitted or queued, but not yet completed
+    size_t pending;
+};
+
+MB_END_C_DECLS
+/*! \endcond */
@@ -22,6 +22,7 @@
 #include "mbcommon/guard_p.h"
 
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 
 #include <sys/stat.h>
@@ -105,11 +106,38 @@ struct SysVtable
                                    size_t count);
     typedef ssize_t (*PosixWriteFn)(void *userdata, int fd, const void *buf,
                                     size_t count);
+#ifndef _WIN32
+    typedef ssize_t (*PosixPread64Fn)(void *userdata, int fd, void *buf,
+                                      size_t count, off64_t offset);
+    typedef ssize_t (*PosixPwrite64Fn)(void *userdata, int fd,
+                                       const void *buf, size_t count,
+                                       off64_t offset);
+#endif
     PosixCloseFn fn_close;
     PosixFtruncate64Fn fn_ftruncate64;
     PosixLseek64Fn fn_lseek64;
     PosixReadFn fn_read;
     PosixWriteFn fn_write;
+#ifndef _WIN32
+    // Optional. Positional I/O is unsupported if these are NULL.
+    PosixPread64Fn fn_pread64;
+    PosixPwrite64Fn fn_pwrite64;
+#endif
+
+#ifdef __linux__
+    // Linux-specific. Optional. In-kernel copies are unsupported if these are
+    // NULL.
+    typedef ssize_t (*LinuxCopyFileRangeFn)(void *userdata, int fd_in,
+                                            off64_t *off_in, int fd_out,
+                                            off64_t *off_out, size_t len,
+                                            unsigned int flags);
+    typedef int (*LinuxFicloneRangeFn)(void *userdata, int dest_fd,
+                                       int src_fd, uint64_t src_offset,
+                                       uint64_t src_length,
+                                       uint64_t dest_offset);
+    LinuxCopyFileRangeFn fn_copy_file_range;
+    LinuxFicloneRangeFn fn_ficlonerange;
+#endif
 
 #ifdef _WIN32
     // windows.h
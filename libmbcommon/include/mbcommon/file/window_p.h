@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/guard_p.h"
+
+#include "mbcommon/file/window.h"
+
+/*! \cond INTERNAL */
+MB_BEGIN_C_DECLS
+
+struct WindowFileCtx
+{
+    struct MbFile *inner;
+    bool owned;
+
+    // Range of the inner file: [offset, offset + size)
+    uint64_t offset;
+    uint64_t size;
+
+    // Position relative to the start of the window
+    uint64_t pos;
+
+    // Whether the inner file supports positional I/O. If not, the inner file
+    // is seeked before a read or write unless it is already at inner_pos.
+    bool use_pread;
+    bool use_pwrite;
+
+    // Where the last read or write left the inner file
+    uint64_t inner_pos;
+    bool inner_pos_valid;
+};
+
+MB_END_C_DECLS
+/*! \endcond */
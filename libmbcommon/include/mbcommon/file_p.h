@@ -46,6 +46,9 @@ struct MbFile
     MbFileWriteCb write_cb;
     MbFileSeekCb seek_cb;
     MbFileTruncateCb truncate_cb;
+    MbFilePreadCb pread_cb;
+    MbFilePwriteCb pwrite_cb;
+    MbFileCopyCb copy_cb;
     void *cb_userdata;
 
     // Error
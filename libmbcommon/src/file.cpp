@@ -261,6 +261,76 @@
  *   * Return \<= #MB_FILE_WARN if an error occurs
  */
 
+/*!
+ * \typedef MbFilePreadCb
+ *
+ * \brief File positional read callback
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ * \param[in] offset File offset to read from
+ * \param[out] bytes_read Output number of bytes that were read. 0 indicates end
+ *                        of file. This parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if some bytes were read or EOF is reached
+ *   * Return #MB_FILE_RETRY if the same operation should be reattempted
+ *   * Return #MB_FILE_UNSUPPORTED if the file does not support positional
+ *     reads (Not registering a pread callback has the same effect.)
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \typedef MbFilePwriteCb
+ *
+ * \brief File positional write callback
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] buf Buffer to write from
+ * \param[in] size Buffer size
+ * \param[in] offset File offset to write to
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if some bytes were written
+ *   * Return #MB_FILE_RETRY if the same operation should be reattempted
+ *   * Return #MB_FILE_UNSUPPORTED if the file does not support positional
+ *     writes (Not registering a pwrite callback has the same effect.)
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \typedef MbFileCopyCb
+ *
+ * \brief File copy callback
+ *
+ * Copies data from one region of the file to another without passing it
+ * through a user space buffer. The regions are guaranteed not to overlap.
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] src Source offset
+ * \param[in] dest Destination offset
+ * \param[in] size Size of data to copy
+ * \param[out] bytes_copied Output number of bytes that were copied. 0
+ *                          indicates that \p src is at or past the end of
+ *                          file. This parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if some bytes were copied or EOF is reached
+ *   * Return #MB_FILE_RETRY if the same operation should be reattempted
+ *   * Return #MB_FILE_UNSUPPORTED if the file does not support copying (Not
+ *     registering a copy callback has the same effect.)
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
 MB_BEGIN_C_DECLS
 
 /*!
@@ -410,6 +480,57 @@ int mb_file_set_truncate_callback(struct MbFile *file,
     return MB_FILE_OK;
 }
 
+/*!
+ * \brief Set the file positional read callback for an MbFile handle.
+ *
+ * \param file MbFile handle
+ * \param pread_cb File positional read callback
+ *
+ * \return
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_pread_callback(struct MbFile *file, MbFilePreadCb pread_cb)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->pread_cb = pread_cb;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Set the file positional write callback for an MbFile handle.
+ *
+ * \param file MbFile handle
+ * \param pwrite_cb File positional write callback
+ *
+ * \return
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_pwrite_callback(struct MbFile *file, MbFilePwriteCb pwrite_cb)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->pwrite_cb = pwrite_cb;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Set the file copy callback for an MbFile handle.
+ *
+ * \param file MbFile handle
+ * \param copy_cb File copy callback
+ *
+ * \return
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_copy_callback(struct MbFile *file, MbFileCopyCb copy_cb)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->copy_cb = copy_cb;
+    return MB_FILE_OK;
+}
+
 /*!
  * \brief Set the data to provide to callbacks for an MbFile handle.
  *
@@ -679,6 +800,158 @@ int mb_file_truncate(struct MbFile *file, uint64_t size)
     return ret;
 }
 
+/*!
+ * \brief Read from an MbFile handle at a specific offset.
+ *
+ * Unlike mb_file_read(), this function does not use or change the file
+ * position. If the handle's backend implements positional reads natively (eg.
+ * the fd and memory backends), the same handle can be read from multiple
+ * threads at once, provided that no other operations are performed on it at
+ * the same time. The error code and string are not synchronized, so they
+ * should only be relied upon if a single thread uses the handle.
+ *
+ * \param[in] file MbFile handle
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ * \param[in] offset File offset to read from
+ * \param[out] bytes_read Output number of bytes that were read. 0 indicates end
+ *                        of file. This parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes were read or EOF is reached
+ *   * #MB_FILE_RETRY if the same operation should be reattempted
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support positional
+ *     reads
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_pread(struct MbFile *file, void *buf, size_t size,
+                  uint64_t offset, size_t *bytes_read)
+{
+    int ret = MB_FILE_UNSUPPORTED;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    if (!bytes_read) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: bytes_read is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (file->pread_cb) {
+        ret = file->pread_cb(file, file->cb_userdata, buf, size, offset,
+                             bytes_read);
+    } else {
+        mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                          "%s: No pread callback registered",
+                          __func__);
+    }
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Write to an MbFile handle at a specific offset.
+ *
+ * Unlike mb_file_write(), this function does not use or change the file
+ * position. See mb_file_pread() for the thread safety guarantees.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] buf Buffer to write from
+ * \param[in] size Buffer size
+ * \param[in] offset File offset to write to
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes were written
+ *   * #MB_FILE_RETRY if the same operation should be reattempted
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support positional
+ *     writes
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_pwrite(struct MbFile *file, const void *buf, size_t size,
+                   uint64_t offset, size_t *bytes_written)
+{
+    int ret = MB_FILE_UNSUPPORTED;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    if (!bytes_written) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: bytes_written is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (file->pwrite_cb) {
+        ret = file->pwrite_cb(file, file->cb_userdata, buf, size, offset,
+                              bytes_written);
+    } else {
+        mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                          "%s: No pwrite callback registered",
+                          __func__);
+    }
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Copy data between two regions of an MbFile handle.
+ *
+ * The data is copied by the handle's backend without passing through a user
+ * space buffer (eg. with `copy_file_range()` or a reflink for the fd backend).
+ * The file position is not used or changed. The source and destination
+ * regions must not overlap.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] src Source offset
+ * \param[in] dest Destination offset
+ * \param[in] size Size of data to copy
+ * \param[out] bytes_copied Output number of bytes that were copied. 0
+ *                          indicates that \p src is at or past the end of
+ *                          file. This parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes were copied or EOF is reached
+ *   * #MB_FILE_RETRY if the same operation should be reattempted
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support copying
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_copy(struct MbFile *file, uint64_t src, uint64_t dest,
+                 uint64_t size, uint64_t *bytes_copied)
+{
+    int ret = MB_FILE_UNSUPPORTED;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    if (!bytes_copied) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: bytes_copied is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (size > (src < dest ? dest - src : src - dest)) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "%s: Source and destination overlap",
+                          __func__);
+        ret = MB_FILE_FAILED;
+    } else if (file->copy_cb) {
+        ret = file->copy_cb(file, file->cb_userdata, src, dest, size,
+                            bytes_copied);
+    } else {
+        mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                          "%s: No copy callback registered",
+                          __func__);
+    }
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
 /*!
  * \brief Get error code for a failed operation.
  *
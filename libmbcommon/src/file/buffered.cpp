@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/buffered.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/buffered_p.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbcommon/file/buffered.h
+ * \brief Open buffered file on top of another MbFile handle
+ */
+
+MB_BEGIN_C_DECLS
+
+static void free_ctx(BufferedFileCtx *ctx)
+{
+    if (ctx->owned) {
+        mb_file_free(ctx->inner);
+    }
+    free(ctx->buf);
+    free(ctx);
+}
+
+static int inner_error(struct MbFile *file, BufferedFileCtx *ctx, int ret)
+{
+    mb_file_set_error(file, mb_file_error(ctx->inner), "%s",
+                      mb_file_error_string(ctx->inner));
+    return ret;
+}
+
+static int flush_writes(struct MbFile *file, BufferedFileCtx *ctx)
+{
+    size_t n;
+    int ret;
+
+    if (ctx->write_size == 0) {
+        return MB_FILE_OK;
+    }
+
+    ret = mb_file_write_fully(ctx->inner, ctx->buf, ctx->write_size, &n);
+
+    // Keep whatever was not written so that the flush can be retried
+    memmove(ctx->buf, ctx->buf + n, ctx->write_size - n);
+    ctx->write_size -= n;
+
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx, ret);
+    } else if (ctx->write_size > 0) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to flush %" MB_PRIzu " buffered bytes",
+                          ctx->write_size);
+        return MB_FILE_FAILED;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int discard_reads(struct MbFile *file, BufferedFileCtx *ctx)
+{
+    // The inner file is ahead of the logical position by the amount of unread
+    // data in the buffer
+    if (ctx->read_pos < ctx->read_size) {
+        int ret = mb_file_seek(ctx->inner, -static_cast<int64_t>(
+                ctx->read_size - ctx->read_pos), SEEK_CUR, nullptr);
+        if (ret != MB_FILE_OK) {
+            return inner_error(file, ctx, ret);
+        }
+    }
+
+    ctx->read_pos = 0;
+    ctx->read_size = 0;
+
+    return MB_FILE_OK;
+}
+
+static int buffered_close_cb(struct MbFile *file, void *userdata)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret = flush_writes(file, ctx);
+
+    if (ctx->owned) {
+        int ret2 = mb_file_close(ctx->inner);
+        if (ret2 != MB_FILE_OK && ret == MB_FILE_OK) {
+            ret = inner_error(file, ctx, ret2);
+        }
+    }
+
+    free_ctx(ctx);
+    return ret;
+}
+
+static int buffered_read_cb(struct MbFile *file, void *userdata,
+                            void *buf, size_t size, size_t *bytes_read)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    ret = flush_writes(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    if (ctx->read_pos == ctx->read_size) {
+        ctx->read_pos = 0;
+        ctx->read_size = 0;
+
+        // Reads that would fill the whole buffer bypass it
+        if (size >= ctx->buf_size) {
+            ret = mb_file_read(ctx->inner, buf, size, bytes_read);
+            if (ret != MB_FILE_OK) {
+                return inner_error(file, ctx, ret);
+            }
+
+            ctx->pos += *bytes_read;
+            return MB_FILE_OK;
+        }
+
+        ctx->pread_size = 0;
+
+        ret = mb_file_read(ctx->inner, ctx->buf, ctx->buf_size,
+                           &ctx->read_size);
+        if (ret != MB_FILE_OK) {
+            ctx->read_size = 0;
+            return inner_error(file, ctx, ret);
+        }
+    }
+
+    size_t n = std::min(size, ctx->read_size - ctx->read_pos);
+    memcpy(buf, ctx->buf + ctx->read_pos, n);
+    ctx->read_pos += n;
+    ctx->pos += n;
+
+    *bytes_read = n;
+    return MB_FILE_OK;
+}
+
+static int buffered_write_cb(struct MbFile *file, void *userdata,
+                             const void *buf, size_t size,
+                             size_t *bytes_written)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    ret = discard_reads(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+    ctx->pread_size = 0;
+
+    if (size > ctx->buf_size - ctx->write_size) {
+        ret = flush_writes(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+    }
+
+    // Writes that would fill the whole buffer bypass it
+    if (size >= ctx->buf_size) {
+        ret = mb_file_write(ctx->inner, buf, size, bytes_written);
+        if (ret != MB_FILE_OK) {
+            return inner_error(file, ctx, ret);
+        }
+
+        ctx->pos += *bytes_written;
+        return MB_FILE_OK;
+    }
+
+    memcpy(ctx->buf + ctx->write_size, buf, size);
+    ctx->write_size += size;
+    ctx->pos += size;
+
+    *bytes_written = size;
+    return MB_FILE_OK;
+}
+
+static int buffered_seek_cb(struct MbFile *file, void *userdata,
+                            int64_t offset, int whence, uint64_t *new_offset)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    if (ctx->pos_valid) {
+        // Querying the position does not need to flush anything
+        if (whence == SEEK_CUR && offset == 0) {
+            *new_offset = ctx->pos;
+            return MB_FILE_OK;
+        }
+
+        // Seeks within the read-ahead data only move the buffer position
+        if (ctx->read_size > 0 && (whence == SEEK_SET || whence == SEEK_CUR)) {
+            uint64_t start = ctx->pos - ctx->read_pos;
+            uint64_t target;
+            bool valid;
+
+            if (whence == SEEK_SET) {
+                valid = offset >= 0;
+                target = static_cast<uint64_t>(offset);
+            } else {
+                valid = offset >= 0
+                        || static_cast<uint64_t>(-offset) <= ctx->pos;
+                target = ctx->pos + offset;
+            }
+
+            if (valid && target >= start && target - start <= ctx->read_size) {
+                ctx->read_pos = target - start;
+                *new_offset = ctx->pos = target;
+                return MB_FILE_OK;
+            }
+        }
+    }
+
+    ret = flush_writes(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    // The inner file is ahead of the logical position when there is unread
+    // data in the buffer
+    if (whence == SEEK_CUR) {
+        offset -= ctx->read_size - ctx->read_pos;
+    }
+
+    ret = mb_file_seek(ctx->inner, offset, whence, new_offset);
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx, ret);
+    }
+
+    ctx->read_pos = 0;
+    ctx->read_size = 0;
+    ctx->pos = *new_offset;
+    ctx->pos_valid = true;
+
+    return MB_FILE_OK;
+}
+
+static int buffered_truncate_cb(struct MbFile *file, void *userdata,
+                                uint64_t size)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    ret = flush_writes(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ret = discard_reads(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ctx->pread_size = 0;
+
+    ret = mb_file_truncate(ctx->inner, size);
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx, ret);
+    }
+
+    return MB_FILE_OK;
+}
+
+static int buffered_pread_cb(struct MbFile *file, void *userdata,
+                             void *buf, size_t size, uint64_t offset,
+                             size_t *bytes_read)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    ret = flush_writes(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    if (ctx->pread_size == 0 || offset < ctx->pread_offset
+            || offset - ctx->pread_offset >= ctx->pread_size) {
+        // Reads that would fill the whole buffer bypass it
+        if (size >= ctx->buf_size) {
+            ret = mb_file_pread(ctx->inner, buf, size, offset, bytes_read);
+            if (ret != MB_FILE_OK) {
+                return inner_error(file, ctx, ret);
+            }
+
+            return MB_FILE_OK;
+        }
+
+        // The sequential read-ahead data is replaced
+        ret = discard_reads(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+        ctx->pread_size = 0;
+
+        ret = mb_file_pread(ctx->inner, ctx->buf, ctx->buf_size, offset,
+                            &ctx->pread_size);
+        if (ret != MB_FILE_OK) {
+            ctx->pread_size = 0;
+            return inner_error(file, ctx, ret);
+        }
+
+        ctx->pread_offset = offset;
+    }
+
+    size_t start = offset - ctx->pread_offset;
+    size_t n = std::min(size, ctx->pread_size - start);
+    memcpy(buf, ctx->buf + start, n);
+
+    *bytes_read = n;
+    return MB_FILE_OK;
+}
+
+static int buffered_pwrite_cb(struct MbFile *file, void *userdata,
+                              const void *buf, size_t size, uint64_t offset,
+                              size_t *bytes_written)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    ret = flush_writes(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    // The write may overlap the read-ahead data
+    ret = discard_reads(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+    ctx->pread_size = 0;
+
+    ret = mb_file_pwrite(ctx->inner, buf, size, offset, bytes_written);
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx, ret);
+    }
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * Open buffered MbFile handle on top of another MbFile handle.
+ *
+ * Small sequential reads are served from a read-ahead buffer that is filled
+ * with one large read from \p inner and small sequential writes are collected
+ * in the same buffer until it is full. Pending writes are flushed before
+ * reading, seeking, truncating, and closing. Reads and writes that are at
+ * least as large as the buffer go directly to \p inner.
+ *
+ * Small positional reads are served from the same buffer, which is refilled
+ * with one large positional read from \p inner when the requested offset is
+ * not in it. This makes positional reads unsafe to perform from multiple
+ * threads at once. Positional writes are passed through to \p inner after
+ * flushing. If \p inner does not support positional I/O, neither does the
+ * buffered handle.
+ *
+ * The position of \p inner is not known until the first seek, so the position
+ * can only be queried (and seeks within the read-ahead data can only be done
+ * without touching \p inner) after the handle has been seeked once.
+ *
+ * \note \p inner must not be used directly while the buffered handle is open.
+ *
+ * \param file MbFile handle
+ * \param inner MbFile handle to read from and write to
+ * \param owned Whether \p inner should be closed and freed when \p file is
+ *              closed
+ * \param buf_size Size of the buffer (#MB_FILE_BUFFERED_DEFAULT_SIZE if 0)
+ *
+ * \return
+ *   * #MB_FILE_OK if the file is successfully opened
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_buffered(struct MbFile *file, struct MbFile *inner,
+                          bool owned, size_t buf_size)
+{
+    BufferedFileCtx *ctx = static_cast<BufferedFileCtx *>(
+            calloc(1, sizeof(BufferedFileCtx)));
+    if (!ctx) {
+        mb_file_set_error(file, -errno,
+                          "Failed to allocate BufferedFileCtx: %s",
+                          strerror(errno));
+        return MB_FILE_FATAL;
+    }
+
+    if (buf_size == 0) {
+        buf_size = MB_FILE_BUFFERED_DEFAULT_SIZE;
+    }
+
+    ctx->buf = static_cast<char *>(malloc(buf_size));
+    if (!ctx->buf) {
+        mb_file_set_error(file, -errno,
+                          "Failed to allocate buffer: %s", strerror(errno));
+        free(ctx);
+        return MB_FILE_FATAL;
+    }
+
+    ctx->inner = inner;
+    ctx->owned = owned;
+    ctx->buf_size = buf_size;
+
+    mb_file_set_pread_callback(file, &buffered_pread_cb);
+    mb_file_set_pwrite_callback(file, &buffered_pwrite_cb);
+
+    return mb_file_open_callbacks(file,
+                                  nullptr,
+                                  &buffered_close_cb,
+                                  &buffered_read_cb,
+                                  &buffered_write_cb,
+                                  &buffered_seek_cb,
+                                  &buffered_truncate_cb,
+                                  ctx);
+}
+
+MB_END_C_DECLS
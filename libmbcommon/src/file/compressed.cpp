@@ -0,0 +1,1096 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compressed.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/compressed_p.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/string.h"
+
+// Size of the staging buffer for reading from or writing to the inner file
+#define STAGING_SIZE                    (64 * 1024)
+// Maximum amount of input passed to LZ4F_compressUpdate() at once
+#define LZ4_FRAME_CHUNK_SIZE            (64 * 1024)
+// Upper bound for LZ4F_compressBegin() output
+#define LZ4_FRAME_HEADER_MAX            32
+
+// Legacy LZ4 format (lz4 -l), as used by the Linux kernel
+#define LZ4_LEGACY_MAGIC                0x184c2102
+#define LZ4_LEGACY_BLOCK_SIZE           (8 * 1024 * 1024)
+#define LZ4_LEGACY_BLOCK_BOUND          LZ4_COMPRESSBOUND(LZ4_LEGACY_BLOCK_SIZE)
+// Levels at and above this use LZ4HC for legacy blocks
+#define LZ4_LEGACY_HC_MIN_LEVEL         3
+
+#define XZ_DEFAULT_PRESET               6
+
+/*!
+ * \file mbcommon/file/compressed.h
+ * \brief Open compressed stream on top of another MbFile handle
+ */
+
+MB_BEGIN_C_DECLS
+
+static void free_ctx(CompressedFileCtx *ctx)
+{
+    if (ctx->zstrm_init) {
+        if (ctx->compress) {
+            deflateEnd(&ctx->zstrm);
+        } else {
+            inflateEnd(&ctx->zstrm);
+        }
+    }
+    if (ctx->lstrm_init) {
+        lzma_end(&ctx->lstrm);
+    }
+    if (ctx->lz4_cctx) {
+        LZ4F_freeCompressionContext(ctx->lz4_cctx);
+    }
+    if (ctx->lz4_dctx) {
+        LZ4F_freeDecompressionContext(ctx->lz4_dctx);
+    }
+    if (ctx->owned) {
+        mb_file_free(ctx->inner);
+    }
+    free(ctx->lz4_in);
+    free(ctx->lz4_out);
+    free(ctx->buf);
+    free(ctx);
+}
+
+static int inner_error(struct MbFile *file, CompressedFileCtx *ctx, int ret)
+{
+    mb_file_set_error(file, mb_file_error(ctx->inner), "%s",
+                      mb_file_error_string(ctx->inner));
+    return ret;
+}
+
+static int alloc_error(struct MbFile *file, const char *what)
+{
+    mb_file_set_error(file, -errno, "Failed to allocate %s: %s",
+                      what, strerror(errno));
+    return MB_FILE_FATAL;
+}
+
+static int truncated_error(struct MbFile *file)
+{
+    mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                      "Unexpected end of compressed stream");
+    return MB_FILE_FAILED;
+}
+
+static const char * format_name(int format)
+{
+    switch (format) {
+    case MB_FILE_COMPRESSION_GZIP:
+        return "gzip";
+    case MB_FILE_COMPRESSION_ZLIB:
+        return "zlib";
+    case MB_FILE_COMPRESSION_XZ:
+        return "xz";
+    case MB_FILE_COMPRESSION_LZ4:
+        return "lz4";
+    case MB_FILE_COMPRESSION_LZ4_LEGACY:
+        return "lz4 (legacy)";
+    default:
+        return "unknown";
+    }
+}
+
+// Decompression
+
+/*!
+ * \brief Refill staging buffer if all of its data has been consumed
+ */
+static int fill_input(struct MbFile *file, CompressedFileCtx *ctx)
+{
+    if (ctx->buf_pos < ctx->buf_size || ctx->in_eof) {
+        return MB_FILE_OK;
+    }
+
+    ctx->buf_pos = 0;
+    ctx->buf_size = 0;
+
+    int ret = mb_file_read(ctx->inner, ctx->buf, ctx->buf_cap,
+                           &ctx->buf_size);
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx, ret);
+    }
+
+    ctx->in_eof = ctx->buf_size == 0;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Read raw input through the staging buffer
+ *
+ * \p bytes_read is less than \p size only if the end of the inner file is
+ * reached.
+ */
+static int read_input(struct MbFile *file, CompressedFileCtx *ctx,
+                      void *buf, size_t size, size_t *bytes_read)
+{
+    auto ptr = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size) {
+        int ret = fill_input(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        } else if (ctx->buf_pos == ctx->buf_size) {
+            break;
+        }
+
+        size_t n = std::min(size - total, ctx->buf_size - ctx->buf_pos);
+        memcpy(ptr + total, ctx->buf + ctx->buf_pos, n);
+        ctx->buf_pos += n;
+        total += n;
+    }
+
+    *bytes_read = total;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Fill staging buffer with enough data to identify the format
+ */
+static int detect_format(struct MbFile *file, CompressedFileCtx *ctx)
+{
+    size_t n;
+    int ret;
+
+    ret = mb_file_read_fully(ctx->inner, ctx->buf, 6, &n);
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx, ret);
+    }
+    ctx->buf_size = n;
+
+    const unsigned char *p = ctx->buf;
+
+    if (n >= 2 && p[0] == 0x1f && p[1] == 0x8b) {
+        ctx->format = MB_FILE_COMPRESSION_GZIP;
+    } else if (n >= 2 && (p[0] & 0x0f) == Z_DEFLATED
+            && ((p[0] << 8) | p[1]) % 31 == 0) {
+        ctx->format = MB_FILE_COMPRESSION_ZLIB;
+    } else if (n >= 6 && memcmp(p, "\xfd" "7zXZ\0", 6) == 0) {
+        ctx->format = MB_FILE_COMPRESSION_XZ;
+    } else if (n >= 4 && memcmp(p, "\x04\x22\x4d\x18", 4) == 0) {
+        ctx->format = MB_FILE_COMPRESSION_LZ4;
+    } else if (n >= 4 && memcmp(p, "\x02\x21\x4c\x18", 4) == 0) {
+        ctx->format = MB_FILE_COMPRESSION_LZ4_LEGACY;
+    } else {
+        mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                          "Unknown compression format");
+        return MB_FILE_FAILED;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int decompressor_open_cb(struct MbFile *file, void *userdata)
+{
+    CompressedFileCtx *const ctx = static_cast<CompressedFileCtx *>(userdata);
+    int ret;
+
+    if (ctx->format == MB_FILE_COMPRESSION_AUTO) {
+        ret = detect_format(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+    }
+
+    switch (ctx->format) {
+    case MB_FILE_COMPRESSION_GZIP:
+    case MB_FILE_COMPRESSION_ZLIB: {
+        // Adding 32 to the window bits accepts both zlib and gzip headers
+        int zret = inflateInit2(&ctx->zstrm, 15 + 32);
+        if (zret != Z_OK) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "zlib: Failed to initialize inflate: %d", zret);
+            return MB_FILE_FAILED;
+        }
+        ctx->zstrm_init = true;
+        break;
+    }
+
+    case MB_FILE_COMPRESSION_XZ: {
+        lzma_ret lret = lzma_stream_decoder(&ctx->lstrm, UINT64_MAX, 0);
+        if (lret != LZMA_OK) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "liblzma: Failed to initialize decoder: %d",
+                              lret);
+            return MB_FILE_FAILED;
+        }
+        ctx->lstrm_init = true;
+        break;
+    }
+
+    case MB_FILE_COMPRESSION_LZ4: {
+        LZ4F_errorCode_t lz4ret = LZ4F_createDecompressionContext(
+                &ctx->lz4_dctx, LZ4F_VERSION);
+        if (LZ4F_isError(lz4ret)) {
+            ctx->lz4_dctx = nullptr;
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "lz4: Failed to create context: %s",
+                              LZ4F_getErrorName(lz4ret));
+            return MB_FILE_FAILED;
+        }
+        break;
+    }
+
+    case MB_FILE_COMPRESSION_LZ4_LEGACY: {
+        ctx->lz4_in = static_cast<unsigned char *>(
+                malloc(LZ4_LEGACY_BLOCK_BOUND));
+        if (!ctx->lz4_in) {
+            return alloc_error(file, "LZ4 block buffer");
+        }
+        ctx->lz4_out = static_cast<unsigned char *>(
+                malloc(LZ4_LEGACY_BLOCK_SIZE));
+        if (!ctx->lz4_out) {
+            return alloc_error(file, "LZ4 block buffer");
+        }
+
+        uint32_t magic;
+        size_t n;
+
+        ret = read_input(file, ctx, &magic, sizeof(magic), &n);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        } else if (n != sizeof(magic)
+                || mb_le32toh(magic) != LZ4_LEGACY_MAGIC) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Invalid legacy LZ4 magic");
+            return MB_FILE_FAILED;
+        }
+        break;
+    }
+
+    default:
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Invalid compression format: %d", ctx->format);
+        return MB_FILE_FAILED;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int inflate_step(struct MbFile *file, CompressedFileCtx *ctx,
+                        void *buf, size_t size, size_t *bytes_read)
+{
+    ctx->zstrm.next_in = ctx->buf + ctx->buf_pos;
+    ctx->zstrm.avail_in = ctx->buf_size - ctx->buf_pos;
+    ctx->zstrm.next_out = static_cast<Bytef *>(buf);
+    ctx->zstrm.avail_out = std::min<size_t>(size, UINT32_MAX);
+
+    int zret = inflate(&ctx->zstrm, Z_NO_FLUSH);
+
+    ctx->buf_pos = ctx->buf_size - ctx->zstrm.avail_in;
+    *bytes_read = static_cast<Bytef *>(ctx->zstrm.next_out)
+            - static_cast<Bytef *>(buf);
+
+    if (zret == Z_STREAM_END) {
+        ctx->stream_end = true;
+    } else if (zret != Z_OK && zret != Z_BUF_ERROR) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "zlib: Failed to inflate: %s",
+                          ctx->zstrm.msg ? ctx->zstrm.msg : "unknown error");
+        return MB_FILE_FAILED;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int lzma_step(struct MbFile *file, CompressedFileCtx *ctx,
+                     void *buf, size_t size, size_t *bytes_read)
+{
+    ctx->lstrm.next_in = ctx->buf + ctx->buf_pos;
+    ctx->lstrm.avail_in = ctx->buf_size - ctx->buf_pos;
+    ctx->lstrm.next_out = static_cast<uint8_t *>(buf);
+    ctx->lstrm.avail_out = size;
+
+    lzma_ret lret = lzma_code(&ctx->lstrm, LZMA_RUN);
+
+    ctx->buf_pos = ctx->buf_size - ctx->lstrm.avail_in;
+    *bytes_read = size - ctx->lstrm.avail_out;
+
+    if (lret == LZMA_STREAM_END) {
+        ctx->stream_end = true;
+    } else if (lret != LZMA_OK && lret != LZMA_BUF_ERROR) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "liblzma: Failed to decode: %d", lret);
+        return MB_FILE_FAILED;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int lz4f_step(struct MbFile *file, CompressedFileCtx *ctx,
+                     void *buf, size_t size, size_t *bytes_read)
+{
+    size_t in_size = ctx->buf_size - ctx->buf_pos;
+    size_t out_size = size;
+
+    size_t lz4ret = LZ4F_decompress(ctx->lz4_dctx, buf, &out_size,
+                                    ctx->buf + ctx->buf_pos, &in_size,
+                                    nullptr);
+    if (LZ4F_isError(lz4ret)) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "lz4: Failed to decompress: %s",
+                          LZ4F_getErrorName(lz4ret));
+        return MB_FILE_FAILED;
+    }
+
+    ctx->buf_pos += in_size;
+    *bytes_read = out_size;
+
+    // A return value of 0 means that the frame is complete
+    if (lz4ret == 0) {
+        ctx->stream_end = true;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int lz4_legacy_step(struct MbFile *file, CompressedFileCtx *ctx,
+                           void *buf, size_t size, size_t *bytes_read)
+{
+    size_t n;
+    int ret;
+
+    while (ctx->lz4_out_pos == ctx->lz4_out_size) {
+        uint32_t block_size;
+
+        ret = read_input(file, ctx, &block_size, sizeof(block_size), &n);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        } else if (n == 0) {
+            // Legacy streams have no end marker
+            ctx->stream_end = true;
+            *bytes_read = 0;
+            return MB_FILE_OK;
+        } else if (n != sizeof(block_size)) {
+            return truncated_error(file);
+        }
+
+        block_size = mb_le32toh(block_size);
+
+        if (block_size == LZ4_LEGACY_MAGIC) {
+            // Concatenated stream
+            continue;
+        } else if (block_size > LZ4_LEGACY_BLOCK_BOUND) {
+            // Anything else is trailing data
+            ctx->stream_end = true;
+            *bytes_read = 0;
+            return MB_FILE_OK;
+        }
+
+        ret = read_input(file, ctx, ctx->lz4_in, block_size, &n);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        } else if (n != block_size) {
+            return truncated_error(file);
+        }
+
+        int out_size = LZ4_decompress_safe(
+                reinterpret_cast<const char *>(ctx->lz4_in),
+                reinterpret_cast<char *>(ctx->lz4_out),
+                static_cast<int>(block_size), LZ4_LEGACY_BLOCK_SIZE);
+        if (out_size < 0) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "lz4: Corrupted legacy block");
+            return MB_FILE_FAILED;
+        }
+
+        ctx->lz4_out_pos = 0;
+        ctx->lz4_out_size = static_cast<size_t>(out_size);
+    }
+
+    n = std::min(size, ctx->lz4_out_size - ctx->lz4_out_pos);
+    memcpy(buf, ctx->lz4_out + ctx->lz4_out_pos, n);
+    ctx->lz4_out_pos += n;
+
+    *bytes_read = n;
+    return MB_FILE_OK;
+}
+
+static int decompressor_read_cb(struct MbFile *file, void *userdata,
+                                void *buf, size_t size, size_t *bytes_read)
+{
+    CompressedFileCtx *const ctx = static_cast<CompressedFileCtx *>(userdata);
+    size_t n = 0;
+    int ret;
+
+    while (n == 0 && size > 0 && !ctx->stream_end) {
+        if (ctx->format == MB_FILE_COMPRESSION_LZ4_LEGACY) {
+            // Reads whole blocks from the staging buffer by itself
+            ret = lz4_legacy_step(file, ctx, buf, size, &n);
+            if (ret != MB_FILE_OK) {
+                return ret;
+            }
+            continue;
+        }
+
+        ret = fill_input(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+
+        bool no_input = ctx->buf_pos == ctx->buf_size;
+
+        switch (ctx->format) {
+        case MB_FILE_COMPRESSION_GZIP:
+        case MB_FILE_COMPRESSION_ZLIB:
+            ret = inflate_step(file, ctx, buf, size, &n);
+            break;
+        case MB_FILE_COMPRESSION_XZ:
+            ret = lzma_step(file, ctx, buf, size, &n);
+            break;
+        case MB_FILE_COMPRESSION_LZ4:
+            ret = lz4f_step(file, ctx, buf, size, &n);
+            break;
+        }
+
+        if (ret != MB_FILE_OK) {
+            return ret;
+        } else if (n == 0 && no_input && !ctx->stream_end) {
+            return truncated_error(file);
+        }
+    }
+
+    ctx->pos += n;
+
+    *bytes_read = n;
+    return MB_FILE_OK;
+}
+
+// Compression
+
+static int flush_output(struct MbFile *file, CompressedFileCtx *ctx)
+{
+    size_t n;
+    int ret;
+
+    if (ctx->buf_size == 0) {
+        return MB_FILE_OK;
+    }
+
+    ret = mb_file_write_fully(ctx->inner, ctx->buf, ctx->buf_size, &n);
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx, ret);
+    } else if (n != ctx->buf_size) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to write %" MB_PRIzu " compressed bytes",
+                          ctx->buf_size);
+        return MB_FILE_FAILED;
+    }
+
+    ctx->buf_size = 0;
+    return MB_FILE_OK;
+}
+
+static int deflate_data(struct MbFile *file, CompressedFileCtx *ctx,
+                        const void *buf, size_t size, bool finish)
+{
+    ctx->zstrm.next_in = static_cast<Bytef *>(const_cast<void *>(buf));
+    ctx->zstrm.avail_in = size;
+
+    while (true) {
+        if (ctx->buf_size == ctx->buf_cap) {
+            int ret = flush_output(file, ctx);
+            if (ret != MB_FILE_OK) {
+                return ret;
+            }
+        }
+
+        ctx->zstrm.next_out = ctx->buf + ctx->buf_size;
+        ctx->zstrm.avail_out = ctx->buf_cap - ctx->buf_size;
+
+        int zret = deflate(&ctx->zstrm, finish ? Z_FINISH : Z_NO_FLUSH);
+
+        ctx->buf_size = ctx->buf_cap - ctx->zstrm.avail_out;
+
+        if (zret == Z_STREAM_END) {
+            break;
+        } else if (zret != Z_OK && zret != Z_BUF_ERROR) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "zlib: Failed to deflate: %d", zret);
+            return MB_FILE_FAILED;
+        } else if (!finish && ctx->zstrm.avail_in == 0
+                && ctx->zstrm.avail_out != 0) {
+            break;
+        }
+    }
+
+    return MB_FILE_OK;
+}
+
+static int lzma_encode_data(struct MbFile *file, CompressedFileCtx *ctx,
+                            const void *buf, size_t size, bool finish)
+{
+    ctx->lstrm.next_in = static_cast<const uint8_t *>(buf);
+    ctx->lstrm.avail_in = size;
+
+    while (true) {
+        if (ctx->buf_size == ctx->buf_cap) {
+            int ret = flush_output(file, ctx);
+            if (ret != MB_FILE_OK) {
+                return ret;
+            }
+        }
+
+        ctx->lstrm.next_out = ctx->buf + ctx->buf_size;
+        ctx->lstrm.avail_out = ctx->buf_cap - ctx->buf_size;
+
+        lzma_ret lret = lzma_code(&ctx->lstrm,
+                                  finish ? LZMA_FINISH : LZMA_RUN);
+
+        ctx->buf_size = ctx->buf_cap - ctx->lstrm.avail_out;
+
+        if (lret == LZMA_STREAM_END) {
+            break;
+        } else if (lret != LZMA_OK) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "liblzma: Failed to encode: %d", lret);
+            return MB_FILE_FAILED;
+        } else if (!finish && ctx->lstrm.avail_in == 0
+                && ctx->lstrm.avail_out != 0) {
+            break;
+        }
+    }
+
+    return MB_FILE_OK;
+}
+
+static int lz4f_encode_data(struct MbFile *file, CompressedFileCtx *ctx,
+                            const void *buf, size_t size, bool finish)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+    int ret;
+
+    // The staging buffer is sized so that it can always hold the output for
+    // one chunk or the end of the frame
+    while (size > 0) {
+        size_t n = std::min<size_t>(size, LZ4_FRAME_CHUNK_SIZE);
+
+        if (LZ4F_compressBound(n, nullptr)
+                > ctx->buf_cap - ctx->buf_size) {
+            ret = flush_output(file, ctx);
+            if (ret != MB_FILE_OK) {
+                return ret;
+            }
+        }
+
+        size_t lz4ret = LZ4F_compressUpdate(
+                ctx->lz4_cctx, ctx->buf + ctx->buf_size,
+                ctx->buf_cap - ctx->buf_size, ptr, n, nullptr);
+        if (LZ4F_isError(lz4ret)) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "lz4: Failed to compress: %s",
+                              LZ4F_getErrorName(lz4ret));
+            return MB_FILE_FAILED;
+        }
+
+        ctx->buf_size += lz4ret;
+        ptr += n;
+        size -= n;
+    }
+
+    if (finish) {
+        if (LZ4F_compressBound(0, nullptr)
+                > ctx->buf_cap - ctx->buf_size) {
+            ret = flush_output(file, ctx);
+            if (ret != MB_FILE_OK) {
+                return ret;
+            }
+        }
+
+        size_t lz4ret = LZ4F_compressEnd(
+                ctx->lz4_cctx, ctx->buf + ctx->buf_size,
+                ctx->buf_cap - ctx->buf_size, nullptr);
+        if (LZ4F_isError(lz4ret)) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "lz4: Failed to finish frame: %s",
+                              LZ4F_getErrorName(lz4ret));
+            return MB_FILE_FAILED;
+        }
+
+        ctx->buf_size += lz4ret;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int lz4_legacy_compress_block(int level, const unsigned char *in,
+                                     size_t in_size, unsigned char *out)
+{
+    auto src = reinterpret_cast<const char *>(in);
+    // Leave room for the block size
+    auto dst = reinterpret_cast<char *>(out + sizeof(uint32_t));
+
+    int n;
+    if (level >= LZ4_LEGACY_HC_MIN_LEVEL) {
+        n = LZ4_compress_HC(src, dst, static_cast<int>(in_size),
+                            LZ4_LEGACY_BLOCK_BOUND, level);
+    } else {
+        n = LZ4_compress_default(src, dst, static_cast<int>(in_size),
+                                 LZ4_LEGACY_BLOCK_BOUND);
+    }
+
+    if (n > 0) {
+        uint32_t block_size = mb_htole32(static_cast<uint32_t>(n));
+        memcpy(out, &block_size, sizeof(block_size));
+    }
+
+    return n;
+}
+
+/*!
+ * \brief Compress and write all collected legacy LZ4 blocks
+ *
+ * Each block is compressed on its own thread.
+ */
+static int lz4_legacy_flush_blocks(struct MbFile *file, CompressedFileCtx *ctx)
+{
+    size_t count = (ctx->lz4_in_size + LZ4_LEGACY_BLOCK_SIZE - 1)
+            / LZ4_LEGACY_BLOCK_SIZE;
+    std::vector<int> sizes(count);
+    std::vector<std::thread> threads;
+    int ret;
+
+    auto compress = [ctx, &sizes](size_t i) {
+        size_t offset = i * LZ4_LEGACY_BLOCK_SIZE;
+        sizes[i] = lz4_legacy_compress_block(
+                ctx->level, ctx->lz4_in + offset,
+                std::min<size_t>(ctx->lz4_in_size - offset,
+                                 LZ4_LEGACY_BLOCK_SIZE),
+                ctx->lz4_out + i * (sizeof(uint32_t) + LZ4_LEGACY_BLOCK_BOUND));
+    };
+
+    for (size_t i = 1; i < count; ++i) {
+        threads.emplace_back(compress, i);
+    }
+    if (count > 0) {
+        compress(0);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    ctx->lz4_in_size = 0;
+
+    ret = flush_output(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (sizes[i] <= 0) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "lz4: Failed to compress legacy block");
+            return MB_FILE_FAILED;
+        }
+
+        size_t n;
+        size_t block_size = sizeof(uint32_t) + static_cast<size_t>(sizes[i]);
+
+        ret = mb_file_write_fully(
+                ctx->inner,
+                ctx->lz4_out + i * (sizeof(uint32_t) + LZ4_LEGACY_BLOCK_BOUND),
+                block_size, &n);
+        if (ret != MB_FILE_OK) {
+            return inner_error(file, ctx, ret);
+        } else if (n != block_size) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "Failed to write %" MB_PRIzu " compressed bytes",
+                              block_size);
+            return MB_FILE_FAILED;
+        }
+    }
+
+    return MB_FILE_OK;
+}
+
+static int lz4_legacy_encode_data(struct MbFile *file, CompressedFileCtx *ctx,
+                                  const void *buf, size_t size, bool finish)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+    size_t batch_size = ctx->lz4_blocks * LZ4_LEGACY_BLOCK_SIZE;
+    int ret;
+
+    while (size > 0) {
+        size_t n = std::min(size, batch_size - ctx->lz4_in_size);
+        memcpy(ctx->lz4_in + ctx->lz4_in_size, ptr, n);
+        ctx->lz4_in_size += n;
+        ptr += n;
+        size -= n;
+
+        if (ctx->lz4_in_size == batch_size) {
+            ret = lz4_legacy_flush_blocks(file, ctx);
+            if (ret != MB_FILE_OK) {
+                return ret;
+            }
+        }
+    }
+
+    if (finish) {
+        ret = lz4_legacy_flush_blocks(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+    }
+
+    return MB_FILE_OK;
+}
+
+static int encode_data(struct MbFile *file, CompressedFileCtx *ctx,
+                       const void *buf, size_t size, bool finish)
+{
+    switch (ctx->format) {
+    case MB_FILE_COMPRESSION_GZIP:
+    case MB_FILE_COMPRESSION_ZLIB:
+        return deflate_data(file, ctx, buf, size, finish);
+    case MB_FILE_COMPRESSION_XZ:
+        return lzma_encode_data(file, ctx, buf, size, finish);
+    case MB_FILE_COMPRESSION_LZ4:
+        return lz4f_encode_data(file, ctx, buf, size, finish);
+    case MB_FILE_COMPRESSION_LZ4_LEGACY:
+        return lz4_legacy_encode_data(file, ctx, buf, size, finish);
+    default:
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "Invalid compression format: %d", ctx->format);
+        return MB_FILE_FATAL;
+    }
+}
+
+static int init_xz_encoder(struct MbFile *file, CompressedFileCtx *ctx)
+{
+    uint32_t preset = ctx->level < 0
+            ? XZ_DEFAULT_PRESET : static_cast<uint32_t>(ctx->level);
+    lzma_ret lret;
+
+    // The Linux kernel's xz decoder only supports CRC32 checks
+    if (ctx->threads > 1) {
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.threads = ctx->threads;
+        mt.preset = preset;
+        mt.check = LZMA_CHECK_CRC32;
+
+        lret = lzma_stream_encoder_mt(&ctx->lstrm, &mt);
+        if (lret == LZMA_OK) {
+            ctx->lstrm_init = true;
+            return MB_FILE_OK;
+        }
+
+        // liblzma may have been built without threading support
+    }
+
+    lret = lzma_easy_encoder(&ctx->lstrm, preset, LZMA_CHECK_CRC32);
+    if (lret != LZMA_OK) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "liblzma: Failed to initialize encoder: %d", lret);
+        return MB_FILE_FAILED;
+    }
+    ctx->lstrm_init = true;
+
+    return MB_FILE_OK;
+}
+
+static int compressor_open_cb(struct MbFile *file, void *userdata)
+{
+    CompressedFileCtx *const ctx = static_cast<CompressedFileCtx *>(userdata);
+
+    switch (ctx->format) {
+    case MB_FILE_COMPRESSION_GZIP:
+    case MB_FILE_COMPRESSION_ZLIB: {
+        int level = ctx->level < 0 ? Z_DEFAULT_COMPRESSION : ctx->level;
+        // Adding 16 to the window bits writes a gzip header
+        int window_bits = ctx->format == MB_FILE_COMPRESSION_GZIP
+                ? 15 + 16 : 15;
+
+        int zret = deflateInit2(&ctx->zstrm, level, Z_DEFLATED, window_bits,
+                                8, Z_DEFAULT_STRATEGY);
+        if (zret != Z_OK) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "zlib: Failed to initialize deflate: %d", zret);
+            return MB_FILE_FAILED;
+        }
+        ctx->zstrm_init = true;
+        break;
+    }
+
+    case MB_FILE_COMPRESSION_XZ: {
+        int ret = init_xz_encoder(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+        break;
+    }
+
+    case MB_FILE_COMPRESSION_LZ4: {
+        LZ4F_errorCode_t lz4ret = LZ4F_createCompressionContext(
+                &ctx->lz4_cctx, LZ4F_VERSION);
+        if (LZ4F_isError(lz4ret)) {
+            ctx->lz4_cctx = nullptr;
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "lz4: Failed to create context: %s",
+                              LZ4F_getErrorName(lz4ret));
+            return MB_FILE_FAILED;
+        }
+
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = std::max(ctx->level, 0);
+
+        lz4ret = LZ4F_compressBegin(ctx->lz4_cctx, ctx->buf, ctx->buf_cap,
+                                    &prefs);
+        if (LZ4F_isError(lz4ret)) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "lz4: Failed to begin frame: %s",
+                              LZ4F_getErrorName(lz4ret));
+            return MB_FILE_FAILED;
+        }
+        ctx->buf_size = lz4ret;
+        break;
+    }
+
+    case MB_FILE_COMPRESSION_LZ4_LEGACY: {
+        // One block per thread is compressed at a time
+        ctx->lz4_blocks = std::max(ctx->threads, 1u);
+
+        ctx->lz4_in = static_cast<unsigned char *>(
+                malloc(ctx->lz4_blocks * LZ4_LEGACY_BLOCK_SIZE));
+        if (!ctx->lz4_in) {
+            return alloc_error(file, "LZ4 block buffer");
+        }
+        ctx->lz4_out = static_cast<unsigned char *>(
+                malloc(ctx->lz4_blocks
+                        * (sizeof(uint32_t) + LZ4_LEGACY_BLOCK_BOUND)));
+        if (!ctx->lz4_out) {
+            return alloc_error(file, "LZ4 block buffer");
+        }
+
+        uint32_t magic = mb_htole32(LZ4_LEGACY_MAGIC);
+        memcpy(ctx->buf, &magic, sizeof(magic));
+        ctx->buf_size = sizeof(magic);
+        break;
+    }
+
+    default:
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Invalid compression format: %d", ctx->format);
+        return MB_FILE_FAILED;
+    }
+
+    ctx->finish_on_close = true;
+
+    return MB_FILE_OK;
+}
+
+static int compressor_write_cb(struct MbFile *file, void *userdata,
+                               const void *buf, size_t size,
+                               size_t *bytes_written)
+{
+    CompressedFileCtx *const ctx = static_cast<CompressedFileCtx *>(userdata);
+
+    int ret = encode_data(file, ctx, buf, size, false);
+    if (ret != MB_FILE_OK) {
+        // The encoder state is unknown after a partial write
+        ctx->finish_on_close = false;
+        return MB_FILE_FATAL;
+    }
+
+    ctx->pos += size;
+
+    *bytes_written = size;
+    return MB_FILE_OK;
+}
+
+// Common
+
+static int compressed_close_cb(struct MbFile *file, void *userdata)
+{
+    CompressedFileCtx *const ctx = static_cast<CompressedFileCtx *>(userdata);
+    int ret = MB_FILE_OK;
+
+    if (ctx->finish_on_close) {
+        ret = encode_data(file, ctx, nullptr, 0, true);
+        if (ret == MB_FILE_OK) {
+            ret = flush_output(file, ctx);
+        }
+    }
+
+    if (ctx->owned) {
+        int ret2 = mb_file_close(ctx->inner);
+        if (ret2 != MB_FILE_OK && ret == MB_FILE_OK) {
+            ret = inner_error(file, ctx, ret2);
+        }
+    }
+
+    free_ctx(ctx);
+    return ret;
+}
+
+static int compressed_seek_cb(struct MbFile *file, void *userdata,
+                              int64_t offset, int whence, uint64_t *new_offset)
+{
+    CompressedFileCtx *const ctx = static_cast<CompressedFileCtx *>(userdata);
+
+    // Only querying the position is supported
+    if (whence == SEEK_CUR && offset == 0) {
+        *new_offset = ctx->pos;
+        return MB_FILE_OK;
+    }
+
+    mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                      "Cannot seek in %s stream", format_name(ctx->format));
+    return MB_FILE_UNSUPPORTED;
+}
+
+static int open_compressed(struct MbFile *file, struct MbFile *inner,
+                           bool owned, int format, bool compress, int level,
+                           unsigned int threads)
+{
+    CompressedFileCtx *ctx = static_cast<CompressedFileCtx *>(
+            calloc(1, sizeof(CompressedFileCtx)));
+    if (!ctx) {
+        return alloc_error(file, "CompressedFileCtx");
+    }
+
+    // Large enough for the LZ4 frame header or the output for one chunk
+    size_t buf_cap = STAGING_SIZE;
+    if (compress && format == MB_FILE_COMPRESSION_LZ4) {
+        buf_cap = std::max<size_t>(
+                buf_cap, LZ4F_compressBound(LZ4_FRAME_CHUNK_SIZE, nullptr)
+                        + LZ4_FRAME_HEADER_MAX);
+    }
+
+    ctx->buf = static_cast<unsigned char *>(malloc(buf_cap));
+    if (!ctx->buf) {
+        free(ctx);
+        return alloc_error(file, "buffer");
+    }
+
+    ctx->inner = inner;
+    ctx->owned = owned;
+    ctx->format = format;
+    ctx->compress = compress;
+    ctx->level = level;
+    ctx->threads = threads;
+    ctx->buf_cap = buf_cap;
+
+    return mb_file_open_callbacks(file,
+                                  compress
+                                          ? &compressor_open_cb
+                                          : &decompressor_open_cb,
+                                  &compressed_close_cb,
+                                  compress ? nullptr : &decompressor_read_cb,
+                                  compress ? &compressor_write_cb : nullptr,
+                                  &compressed_seek_cb,
+                                  nullptr,
+                                  ctx);
+}
+
+/*!
+ * Open MbFile handle that decompresses data read from another MbFile handle.
+ *
+ * The handle is read-only and sequential. Seeking is only supported for
+ * querying the current (uncompressed) position. Reading stops at the end of
+ * the first compressed stream and any trailing data in \p inner is ignored.
+ * Legacy LZ4 streams have no end marker, so they end at the end of \p inner
+ * or at the first block size that is not valid.
+ *
+ * If \p format is #MB_FILE_COMPRESSION_AUTO, the format is detected from the
+ * stream header. #MB_FILE_COMPRESSION_GZIP and #MB_FILE_COMPRESSION_ZLIB both
+ * accept gzip and zlib streams.
+ *
+ * \note \p inner must not be used directly while the decompressor is open.
+ *
+ * \param file MbFile handle
+ * \param inner MbFile handle to read compressed data from
+ * \param owned Whether \p inner should be closed and freed when \p file is
+ *              closed
+ * \param format Compression format (#MbFileCompression)
+ *
+ * \return
+ *   * #MB_FILE_OK if the file is successfully opened
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_decompressor(struct MbFile *file, struct MbFile *inner,
+                              bool owned, int format)
+{
+    return open_compressed(file, inner, owned, format, false, -1, 0);
+}
+
+/*!
+ * Open MbFile handle that compresses data written to it into another MbFile
+ * handle.
+ *
+ * The handle is write-only and sequential. Seeking is only supported for
+ * querying the current (uncompressed) position. The compressed stream is
+ * finished and flushed to \p inner when the handle is closed. If an error
+ * occurs while compressing, the handle is put in the fatal state because the
+ * output is no longer valid.
+ *
+ * xz streams use CRC32 checks so that they can be read by the Linux kernel.
+ *
+ * \p threads is used for xz, where liblzma's multithreaded encoder splits the
+ * stream into independently compressed blocks (falling back to the
+ * single-threaded encoder if it is not available), and for legacy LZ4, where
+ * up to \p threads 8 MiB blocks are compressed in parallel. It is ignored for
+ * other formats.
+ *
+ * \note \p inner must not be used directly while the compressor is open.
+ *
+ * \param file MbFile handle
+ * \param inner MbFile handle to write compressed data to
+ * \param owned Whether \p inner should be closed and freed when \p file is
+ *              closed
+ * \param format Compression format (#MbFileCompression, except
+ *               #MB_FILE_COMPRESSION_AUTO)
+ * \param level Compression level or -1 for the format's default. Legacy LZ4
+ *              uses LZ4HC for levels 3 and above.
+ * \param threads Number of threads to compress with (0 or 1 for the calling
+ *                thread only)
+ *
+ * \return
+ *   * #MB_FILE_OK if the file is successfully opened
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_compressor(struct MbFile *file, struct MbFile *inner,
+                            bool owned, int format, int level,
+                            unsigned int threads)
+{
+    return open_compressed(file, inner, owned, format, true, level, threads);
+}
+
+MB_END_C_DECLS
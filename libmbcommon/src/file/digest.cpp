@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/digest.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/digest_p.h"
+#include "mbcommon/file_p.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbcommon/file/digest.h
+ * \brief Open digest-computing file on top of another MbFile handle
+ */
+
+MB_BEGIN_C_DECLS
+
+// CRC32 with the same polynomial as zlib's crc32(). This is implemented here
+// so that libmbcommon does not depend on zlib for every build target.
+static const uint32_t * crc32_table()
+{
+    struct Table
+    {
+        uint32_t entries[256];
+
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                }
+                entries[i] = c;
+            }
+        }
+    };
+
+    static const Table table;
+    return table.entries;
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *buf, size_t size)
+{
+    const uint32_t *table = crc32_table();
+    auto ptr = static_cast<const unsigned char *>(buf);
+
+    crc = ~crc;
+    while (size-- > 0) {
+        crc = table[(crc ^ *ptr++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void update_digests(DigestFileCtx *ctx, const void *buf, size_t size)
+{
+    if (ctx->types & MB_FILE_DIGEST_CRC32) {
+        ctx->crc32 = crc32_update(ctx->crc32, buf, size);
+    }
+    if (ctx->types & MB_FILE_DIGEST_SHA1) {
+        SHA1_Update(&ctx->sha1, buf, size);
+    }
+    if (ctx->types & MB_FILE_DIGEST_SHA256) {
+        SHA256_Update(&ctx->sha256, buf, size);
+    }
+    if (ctx->types & MB_FILE_DIGEST_SHA512) {
+        SHA512_Update(&ctx->sha512, buf, size);
+    }
+
+    ctx->count += size;
+}
+
+static void free_ctx(DigestFileCtx *ctx)
+{
+    if (ctx->owned && ctx->inner) {
+        mb_file_free(ctx->inner);
+    }
+    free(ctx);
+}
+
+static int inner_error(struct MbFile *file, struct MbFile *inner, int ret)
+{
+    mb_file_set_error(file, mb_file_error(inner), "%s",
+                      mb_file_error_string(inner));
+    return ret;
+}
+
+/*!
+ * \brief Digest and tee data that has already gone through the inner file
+ */
+static int process_data(struct MbFile *file, DigestFileCtx *ctx,
+                        const void *buf, size_t size)
+{
+    update_digests(ctx, buf, size);
+
+    if (ctx->tee && size > 0) {
+        size_t n;
+
+        int ret = mb_file_write_fully(ctx->tee, buf, size, &n);
+        if (ret != MB_FILE_OK) {
+            inner_error(file, ctx->tee, ret);
+            // The data cannot be read or written again
+            return MB_FILE_FATAL;
+        } else if (n != size) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "Unexpected EOF when writing to tee file");
+            return MB_FILE_FATAL;
+        }
+    }
+
+    return MB_FILE_OK;
+}
+
+static int digest_close_cb(struct MbFile *file, void *userdata)
+{
+    DigestFileCtx *const ctx = static_cast<DigestFileCtx *>(userdata);
+    int ret = MB_FILE_OK;
+
+    if (ctx->owned && ctx->inner) {
+        ret = mb_file_close(ctx->inner);
+        if (ret != MB_FILE_OK) {
+            inner_error(file, ctx->inner, ret);
+        }
+    }
+
+    free_ctx(ctx);
+    return ret;
+}
+
+static int digest_read_cb(struct MbFile *file, void *userdata,
+                          void *buf, size_t size, size_t *bytes_read)
+{
+    DigestFileCtx *const ctx = static_cast<DigestFileCtx *>(userdata);
+
+    int ret = mb_file_read(ctx->inner, buf, size, bytes_read);
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx->inner, ret);
+    }
+
+    return process_data(file, ctx, buf, *bytes_read);
+}
+
+static int digest_write_cb(struct MbFile *file, void *userdata,
+                           const void *buf, size_t size,
+                           size_t *bytes_written)
+{
+    DigestFileCtx *const ctx = static_cast<DigestFileCtx *>(userdata);
+
+    if (ctx->inner) {
+        int ret = mb_file_write(ctx->inner, buf, size, bytes_written);
+        if (ret != MB_FILE_OK) {
+            return inner_error(file, ctx->inner, ret);
+        }
+    } else {
+        *bytes_written = size;
+    }
+
+    return process_data(file, ctx, buf, *bytes_written);
+}
+
+static int digest_seek_cb(struct MbFile *file, void *userdata,
+                          int64_t offset, int whence, uint64_t *new_offset)
+{
+    DigestFileCtx *const ctx = static_cast<DigestFileCtx *>(userdata);
+
+    if (ctx->inner) {
+        int ret = mb_file_seek(ctx->inner, offset, whence, new_offset);
+        if (ret != MB_FILE_OK) {
+            return inner_error(file, ctx->inner, ret);
+        }
+        return MB_FILE_OK;
+    } else if (whence == SEEK_CUR && offset == 0) {
+        *new_offset = ctx->count;
+        return MB_FILE_OK;
+    }
+
+    mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                      "Cannot seek without an inner file");
+    return MB_FILE_UNSUPPORTED;
+}
+
+static int digest_truncate_cb(struct MbFile *file, void *userdata,
+                              uint64_t size)
+{
+    DigestFileCtx *const ctx = static_cast<DigestFileCtx *>(userdata);
+
+    int ret = mb_file_truncate(ctx->inner, size);
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx->inner, ret);
+    }
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * Open MbFile handle that computes digests over the data passing through it.
+ *
+ * Every byte that is read from or written to \p file is passed to the digest
+ * algorithms in \p types in the order that the reads and writes happen. If
+ * \p tee is not NULL, the same bytes are also written to \p tee, which allows
+ * a stream to be copied and checksummed in a single pass.
+ *
+ * If \p inner is NULL, the handle is a write-only sink: writes always succeed
+ * and only update the digests (and \p tee). Otherwise, reads and writes go to
+ * \p inner and only the bytes that were actually transferred are digested.
+ * Seeking and truncation are passed through to \p inner, but do not affect
+ * the digests, so they only make sense when all data goes through the handle
+ * in order. Positional reads and writes are not supported.
+ *
+ * If writing to \p tee fails, the handle is put in the fatal state because the
+ * data cannot be passed through again.
+ *
+ * \note \p inner must not be used directly while the digest handle is open.
+ *       \p tee is never closed by the digest handle.
+ *
+ * \param file MbFile handle
+ * \param inner MbFile handle to read from and write to (or NULL)
+ * \param owned Whether \p inner should be closed and freed when \p file is
+ *              closed
+ * \param tee MbFile handle to copy all data to (or NULL)
+ * \param types Bitmask of #MbFileDigestType values
+ *
+ * \return
+ *   * #MB_FILE_OK if the file is successfully opened
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_digest(struct MbFile *file, struct MbFile *inner,
+                        bool owned, struct MbFile *tee, int types)
+{
+    DigestFileCtx *ctx = static_cast<DigestFileCtx *>(
+            calloc(1, sizeof(DigestFileCtx)));
+    if (!ctx) {
+        mb_file_set_error(file, -errno,
+                          "Failed to allocate DigestFileCtx: %s",
+                          strerror(errno));
+        return MB_FILE_FATAL;
+    }
+
+    ctx->inner = inner;
+    ctx->owned = owned;
+    ctx->tee = tee;
+    ctx->types = types;
+
+    SHA1_Init(&ctx->sha1);
+    SHA256_Init(&ctx->sha256);
+    SHA512_Init(&ctx->sha512);
+
+    return mb_file_open_callbacks(file,
+                                  nullptr,
+                                  &digest_close_cb,
+                                  inner ? &digest_read_cb : nullptr,
+                                  &digest_write_cb,
+                                  &digest_seek_cb,
+                                  inner ? &digest_truncate_cb : nullptr,
+                                  ctx);
+}
+
+/*!
+ * Get the digest of the data that has passed through a digest handle so far.
+ *
+ * This does not reset the digest. More data can be read or written afterwards
+ * and the digest will include everything since the handle was opened. CRC32
+ * digests are returned as a big-endian 32-bit integer.
+ *
+ * \param[in] file MbFile handle opened with mb_file_open_digest()
+ * \param[in] type Digest type (one of the types the handle was opened with)
+ * \param[out] digest Output buffer for the digest
+ * \param[in] size Size of \p digest (at most #MB_FILE_DIGEST_MAX_SIZE bytes
+ *                 are needed)
+ * \param[out] digest_size Size of the digest (can be NULL)
+ *
+ * \return
+ *   * #MB_FILE_OK if the digest was returned
+ *   * #MB_FILE_FAILED if \p file is not an open digest handle, \p type was
+ *     not enabled, or \p digest is too small
+ */
+int mb_file_digest(struct MbFile *file, int type, unsigned char *digest,
+                   size_t size, size_t *digest_size)
+{
+    if (file->state != MbFileState::OPENED
+            || file->close_cb != &digest_close_cb) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Not an open digest file");
+        return MB_FILE_FAILED;
+    }
+
+    DigestFileCtx *const ctx = static_cast<DigestFileCtx *>(file->cb_userdata);
+    size_t n;
+
+    switch (type) {
+    case MB_FILE_DIGEST_CRC32:
+        n = MB_FILE_DIGEST_CRC32_SIZE;
+        break;
+    case MB_FILE_DIGEST_SHA1:
+        n = MB_FILE_DIGEST_SHA1_SIZE;
+        break;
+    case MB_FILE_DIGEST_SHA256:
+        n = MB_FILE_DIGEST_SHA256_SIZE;
+        break;
+    case MB_FILE_DIGEST_SHA512:
+        n = MB_FILE_DIGEST_SHA512_SIZE;
+        break;
+    default:
+        n = 0;
+        break;
+    }
+
+    if (n == 0 || !(ctx->types & type)) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Digest type not enabled: %d", type);
+        return MB_FILE_FAILED;
+    } else if (size < n) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Digest buffer too small: %" MB_PRIzu " < %"
+                          MB_PRIzu, size, n);
+        return MB_FILE_FAILED;
+    }
+
+    // Finalize copies of the contexts so that digesting can continue
+    switch (type) {
+    case MB_FILE_DIGEST_CRC32:
+        digest[0] = (ctx->crc32 >> 24) & 0xff;
+        digest[1] = (ctx->crc32 >> 16) & 0xff;
+        digest[2] = (ctx->crc32 >> 8) & 0xff;
+        digest[3] = ctx->crc32 & 0xff;
+        break;
+    case MB_FILE_DIGEST_SHA1: {
+        SHA_CTX sha1 = ctx->sha1;
+        SHA1_Final(digest, &sha1);
+        break;
+    }
+    case MB_FILE_DIGEST_SHA256: {
+        SHA256_CTX sha256 = ctx->sha256;
+        SHA256_Final(digest, &sha256);
+        break;
+    }
+    case MB_FILE_DIGEST_SHA512: {
+        SHA512_CTX sha512 = ctx->sha512;
+        SHA512_Final(digest, &sha512);
+        break;
+    }
+    }
+
+    if (digest_size) {
+        *digest_size = n;
+    }
+
+    return MB_FILE_OK;
+}
+
+MB_END_C_DECLS
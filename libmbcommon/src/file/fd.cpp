@@ -173,6 +173,130 @@ static int fd_truncate_cb(struct MbFile *file, void *userdata,
     return MB_FILE_OK;
 }
 
+#ifndef _WIN32
+static int fd_pread_cb(struct MbFile *file, void *userdata,
+                       void *buf, size_t size, uint64_t offset,
+                       size_t *bytes_read)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = ctx->vtable.fn_pread64(ctx->vtable.userdata, ctx->fd, buf,
+                                       size, offset);
+    if (n < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to read file: %s", strerror(errno));
+        return errno == EINTR ? MB_FILE_RETRY : MB_FILE_FAILED;
+    }
+
+    *bytes_read = n;
+    return MB_FILE_OK;
+}
+
+static int fd_pwrite_cb(struct MbFile *file, void *userdata,
+                        const void *buf, size_t size, uint64_t offset,
+                        size_t *bytes_written)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = ctx->vtable.fn_pwrite64(ctx->vtable.userdata, ctx->fd, buf,
+                                        size, offset);
+    if (n < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to write file: %s", strerror(errno));
+        return errno == EINTR ? MB_FILE_RETRY : MB_FILE_FAILED;
+    }
+
+    *bytes_written = n;
+    return MB_FILE_OK;
+}
+#endif
+
+#ifdef __linux__
+static int fd_copy_cb(struct MbFile *file, void *userdata,
+                      uint64_t src, uint64_t dest, uint64_t size,
+                      uint64_t *bytes_copied)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+
+    // Try sharing the extents first. This only works on filesystems that
+    // support reflinks (eg. btrfs and xfs) and only for whole blocks.
+    if (!ctx->clone_unsupported && ctx->vtable.fn_ficlonerange
+            && ctx->block_size == 0) {
+        struct stat sb;
+
+        if (ctx->vtable.fn_fstat(ctx->vtable.userdata, ctx->fd, &sb) == 0
+                && S_ISREG(sb.st_mode) && sb.st_blksize > 0) {
+            ctx->block_size = sb.st_blksize;
+        } else {
+            ctx->clone_unsupported = true;
+        }
+    }
+
+    if (!ctx->clone_unsupported && ctx->vtable.fn_ficlonerange
+            && src % ctx->block_size == 0 && dest % ctx->block_size == 0
+            && size >= ctx->block_size) {
+        uint64_t length = size - size % ctx->block_size;
+
+        if (ctx->vtable.fn_ficlonerange(ctx->vtable.userdata, ctx->fd,
+                                        ctx->fd, src, length, dest) == 0) {
+            *bytes_copied = length;
+            return MB_FILE_OK;
+        }
+
+        // Fall back to copying for the lifetime of the handle. This also
+        // catches ranges that end past EOF, which the kernel refuses to clone.
+        ctx->clone_unsupported = true;
+    }
+
+    if (ctx->copy_unsupported || !ctx->vtable.fn_copy_file_range) {
+        mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                          "In-kernel copy is not supported");
+        return MB_FILE_UNSUPPORTED;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    off64_t off_in = src;
+    off64_t off_out = dest;
+
+    ssize_t n = ctx->vtable.fn_copy_file_range(ctx->vtable.userdata,
+                                               ctx->fd, &off_in,
+                                               ctx->fd, &off_out, size, 0);
+    if (n < 0) {
+        switch (errno) {
+        case ENOSYS:
+        case EXDEV:
+        case EINVAL:
+        case EOPNOTSUPP:
+        case EBADF:
+            // Old kernel, unsupported file type, or O_APPEND
+            ctx->copy_unsupported = true;
+            mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                              "In-kernel copy is not supported: %s",
+                              strerror(errno));
+            return MB_FILE_UNSUPPORTED;
+        }
+
+        mb_file_set_error(file, -errno,
+                          "Failed to copy file data: %s", strerror(errno));
+        return errno == EINTR ? MB_FILE_RETRY : MB_FILE_FAILED;
+    }
+
+    *bytes_copied = n;
+    return MB_FILE_OK;
+}
+#endif
+
 static bool check_vtable(SysVtable *vtable, bool needs_open)
 {
     return vtable
@@ -213,6 +337,22 @@ static FdFileCtx * create_ctx(struct MbFile *file, SysVtable *vtable,
 
 static int open_ctx(struct MbFile *file, FdFileCtx *ctx)
 {
+#ifndef _WIN32
+    // Positional I/O is optional
+    if (ctx->vtable.fn_pread64) {
+        mb_file_set_pread_callback(file, &fd_pread_cb);
+    }
+    if (ctx->vtable.fn_pwrite64) {
+        mb_file_set_pwrite_callback(file, &fd_pwrite_cb);
+    }
+#endif
+#ifdef __linux__
+    // In-kernel copies are optional
+    if (ctx->vtable.fn_copy_file_range || ctx->vtable.fn_ficlonerange) {
+        mb_file_set_copy_callback(file, &fd_copy_cb);
+    }
+#endif
+
     return mb_file_open_callbacks(file,
                                   &fd_open_cb,
                                   &fd_close_cb,
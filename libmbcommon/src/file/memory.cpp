@@ -52,41 +52,34 @@ static int memory_close_cb(struct MbFile *file, void *userdata)
     return MB_FILE_OK;
 }
 
-static int memory_read_cb(struct MbFile *file, void *userdata,
-                          void *buf, size_t size, size_t *bytes_read)
+static size_t read_at(MemoryFileCtx *ctx, void *buf, size_t size, size_t pos)
 {
-    (void) file;
-    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
-
     size_t to_read = 0;
-    if (ctx->pos < ctx->size) {
-        to_read = std::min(ctx->size - ctx->pos, size);
+    if (pos < ctx->size) {
+        to_read = std::min(ctx->size - pos, size);
     }
 
-    memcpy(buf, static_cast<char *>(ctx->data) + ctx->pos, to_read);
-    ctx->pos += to_read;
+    memcpy(buf, static_cast<char *>(ctx->data) + pos, to_read);
 
-    *bytes_read = to_read;
-    return MB_FILE_OK;
+    return to_read;
 }
 
-static int memory_write_cb(struct MbFile *file, void *userdata,
-                           const void *buf, size_t size, size_t *bytes_written)
+static int write_at(struct MbFile *file, MemoryFileCtx *ctx,
+                    const void *buf, size_t size, size_t pos,
+                    size_t *bytes_written)
 {
-    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
-
-    if (ctx->pos > SIZE_MAX - size) {
+    if (pos > SIZE_MAX - size) {
         mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
                           "Write would overflow size_t");
         return MB_FILE_FAILED;
     }
 
-    size_t desired_size = ctx->pos + size;
+    size_t desired_size = pos + size;
     size_t to_write = size;
 
     if (desired_size > ctx->size) {
         if (ctx->fixed_size) {
-            to_write = ctx->pos <= ctx->size ? ctx->size - ctx->pos : 0;
+            to_write = pos <= ctx->size ? ctx->size - pos : 0;
         } else {
             // Enlarge buffer
             void *new_data = realloc(ctx->data, desired_size);
@@ -112,13 +105,37 @@ static int memory_write_cb(struct MbFile *file, void *userdata,
         }
     }
 
-    memcpy(static_cast<char *>(ctx->data) + ctx->pos, buf, to_write);
-    ctx->pos += to_write;
+    memcpy(static_cast<char *>(ctx->data) + pos, buf, to_write);
 
     *bytes_written = to_write;
     return MB_FILE_OK;
 }
 
+static int memory_read_cb(struct MbFile *file, void *userdata,
+                          void *buf, size_t size, size_t *bytes_read)
+{
+    (void) file;
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    *bytes_read = read_at(ctx, buf, size, ctx->pos);
+    ctx->pos += *bytes_read;
+
+    return MB_FILE_OK;
+}
+
+static int memory_write_cb(struct MbFile *file, void *userdata,
+                           const void *buf, size_t size, size_t *bytes_written)
+{
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    int ret = write_at(file, ctx, buf, size, ctx->pos, bytes_written);
+    if (ret == MB_FILE_OK) {
+        ctx->pos += *bytes_written;
+    }
+
+    return ret;
+}
+
 static int memory_seek_cb(struct MbFile *file, void *userdata,
                           int64_t offset, int whence, uint64_t *new_offset)
 {
@@ -204,6 +221,36 @@ static int memory_truncate_cb(struct MbFile *file, void *userdata,
     return MB_FILE_OK;
 }
 
+static int memory_pread_cb(struct MbFile *file, void *userdata,
+                           void *buf, size_t size, uint64_t offset,
+                           size_t *bytes_read)
+{
+    (void) file;
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    // Offsets that don't fit in size_t are past the end of the buffer anyway
+    *bytes_read = offset < ctx->size
+            ? read_at(ctx, buf, size, static_cast<size_t>(offset)) : 0;
+
+    return MB_FILE_OK;
+}
+
+static int memory_pwrite_cb(struct MbFile *file, void *userdata,
+                            const void *buf, size_t size, uint64_t offset,
+                            size_t *bytes_written)
+{
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    if (offset > SIZE_MAX) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Write would overflow size_t");
+        return MB_FILE_FAILED;
+    }
+
+    return write_at(file, ctx, buf, size, static_cast<size_t>(offset),
+                    bytes_written);
+}
+
 static MemoryFileCtx * create_ctx(struct MbFile *file)
 {
     MemoryFileCtx *ctx = static_cast<MemoryFileCtx *>(
@@ -220,6 +267,9 @@ static MemoryFileCtx * create_ctx(struct MbFile *file)
 
 static int open_ctx(struct MbFile *file, MemoryFileCtx *ctx)
 {
+    mb_file_set_pread_callback(file, &memory_pread_cb);
+    mb_file_set_pwrite_callback(file, &memory_pwrite_cb);
+
     return mb_file_open_callbacks(file,
                                   nullptr,
                                   &memory_close_cb,
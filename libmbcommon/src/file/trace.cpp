@@ -0,0 +1,764 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#  include <process.h>
+#else
+#  include <unistd.h>
+#endif
+
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/trace_p.h"
+#include "mbcommon/file_p.h"
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbcommon/file/trace.h
+ * \brief Open I/O tracing file on top of another MbFile handle
+ */
+
+MB_BEGIN_C_DECLS
+
+static const char *op_names[MB_FILE_TRACE_OP_COUNT] = {
+    "read",
+    "write",
+    "seek",
+    "truncate",
+    "pread",
+    "pwrite",
+};
+
+static uint64_t steady_time_ns()
+{
+    using namespace std::chrono;
+
+    return duration_cast<nanoseconds>(
+            steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t wall_time_us()
+{
+    using namespace std::chrono;
+
+    return duration_cast<microseconds>(
+            system_clock::now().time_since_epoch()).count();
+}
+
+static int current_pid()
+{
+#ifdef _WIN32
+    return _getpid();
+#else
+    return getpid();
+#endif
+}
+
+static size_t histogram_bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    size_t bucket = 0;
+
+    while (us > 0 && bucket < MB_FILE_TRACE_HISTOGRAM_SIZE - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+static void free_ctx(TraceFileCtx *ctx)
+{
+    if (ctx->owned) {
+        mb_file_free(ctx->inner);
+    }
+    if (ctx->report_fp && ctx->report_fp != stderr) {
+        fclose(ctx->report_fp);
+    }
+    delete ctx;
+}
+
+static int inner_error(struct MbFile *file, TraceFileCtx *ctx, int ret)
+{
+    mb_file_set_error(file, mb_file_error(ctx->inner), "%s",
+                      mb_file_error_string(ctx->inner));
+    return ret;
+}
+
+/*!
+ * \brief Record a completed operation
+ *
+ * \pre ctx->lock is held
+ */
+static void record_op(TraceFileCtx *ctx, const TraceEvent &event)
+{
+    MbFileTraceOpStats &stats = ctx->op_stats[event.op];
+
+    if (stats.count == 0 || event.duration_ns < stats.min_ns) {
+        stats.min_ns = event.duration_ns;
+    }
+    if (event.duration_ns > stats.max_ns) {
+        stats.max_ns = event.duration_ns;
+    }
+    ++stats.count;
+    stats.total_ns += event.duration_ns;
+    ++stats.histogram[histogram_bucket(event.duration_ns)];
+
+    if (event.ret != MB_FILE_OK) {
+        ++stats.errors;
+    }
+
+    switch (event.op) {
+    case MB_FILE_TRACE_OP_READ:
+    case MB_FILE_TRACE_OP_WRITE:
+    case MB_FILE_TRACE_OP_PREAD:
+    case MB_FILE_TRACE_OP_PWRITE:
+        stats.bytes_requested += event.size;
+
+        if (event.ret == MB_FILE_OK) {
+            stats.bytes += event.result;
+
+            if (event.offset_valid) {
+                if (ctx->last_end_valid && event.offset == ctx->last_end) {
+                    ++ctx->access_stats.sequential;
+                } else {
+                    ++ctx->access_stats.nonsequential;
+                }
+
+                ctx->last_end = event.offset + event.result;
+                ctx->last_end_valid = true;
+            } else {
+                ctx->last_end_valid = false;
+            }
+        }
+        break;
+
+    case MB_FILE_TRACE_OP_SEEK:
+        if (event.ret == MB_FILE_OK && event.offset_valid) {
+            if (event.result > event.offset) {
+                ++ctx->access_stats.seeks_forward;
+                ctx->access_stats.seek_distance += event.result - event.offset;
+            } else if (event.result < event.offset) {
+                ++ctx->access_stats.seeks_backward;
+                ctx->access_stats.seek_distance += event.offset - event.result;
+            } else {
+                ++ctx->access_stats.seeks_unchanged;
+            }
+        }
+        break;
+    }
+
+    if (ctx->events.size() < MB_FILE_TRACE_MAX_EVENTS) {
+        ctx->events.push_back(event);
+    } else {
+        ++ctx->dropped_events;
+    }
+}
+
+static TraceEvent begin_op(TraceFileCtx *ctx, int op)
+{
+    TraceEvent event = {};
+    event.op = op;
+    event.start_ns = steady_time_ns() - ctx->open_steady_ns;
+    return event;
+}
+
+static void end_op(TraceFileCtx *ctx, TraceEvent &event, int ret)
+{
+    event.duration_ns = steady_time_ns() - ctx->open_steady_ns
+            - event.start_ns;
+    event.ret = ret;
+
+    std::lock_guard<std::mutex> guard(ctx->lock);
+    record_op(ctx, event);
+}
+
+static void write_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; *str; ++str) {
+        unsigned char c = static_cast<unsigned char>(*str);
+
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(c, fp);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void write_chrome_report(TraceFileCtx *ctx, FILE *fp)
+{
+    int pid = current_pid();
+
+    // Reports for multiple files can be appended to the same output. The
+    // closing bracket of the JSON array is optional in the Chrome trace event
+    // format.
+    if (fseek(fp, 0, SEEK_END) != 0 || ftell(fp) <= 0) {
+        fputs("[\n", fp);
+    }
+
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%u,\"args\":{\"name\":", pid, ctx->id);
+    write_json_string(fp, ctx->name.c_str());
+    fputs("}},\n", fp);
+
+    if (ctx->dropped_events > 0) {
+        fprintf(fp, "{\"name\":\"dropped_events\",\"ph\":\"i\",\"s\":\"t\","
+                "\"pid\":%d,\"tid\":%u,\"ts\":%" PRIu64 ","
+                "\"args\":{\"count\":%" PRIu64 "}},\n",
+                pid, ctx->id, ctx->open_wall_us, ctx->dropped_events);
+    }
+
+    for (const TraceEvent &event : ctx->events) {
+        uint64_t ts_ns = ctx->open_wall_us * 1000 + event.start_ns;
+
+        fprintf(fp, "{\"name\":\"%s\",\"cat\":\"mbfile\",\"ph\":\"X\","
+                "\"pid\":%d,\"tid\":%u,"
+                "\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u,"
+                "\"args\":{",
+                op_names[event.op], pid, ctx->id,
+                ts_ns / 1000, static_cast<unsigned int>(ts_ns % 1000),
+                event.duration_ns / 1000,
+                static_cast<unsigned int>(event.duration_ns % 1000));
+
+        if (event.op == MB_FILE_TRACE_OP_SEEK) {
+            fprintf(fp, "\"offset\":%" PRId64 ",\"whence\":%d",
+                    event.seek_offset, event.whence);
+            if (event.ret == MB_FILE_OK) {
+                fprintf(fp, ",\"position\":%" PRIu64, event.result);
+            }
+        } else {
+            if (event.offset_valid) {
+                fprintf(fp, "\"offset\":%" PRIu64 ",", event.offset);
+            }
+            fprintf(fp, "\"size\":%" PRIu64, event.size);
+            if (event.op != MB_FILE_TRACE_OP_TRUNCATE) {
+                fprintf(fp, ",\"result\":%" PRIu64, event.result);
+            }
+        }
+
+        fprintf(fp, ",\"ret\":%d}},\n", event.ret);
+    }
+}
+
+static void write_summary_report(TraceFileCtx *ctx, FILE *fp)
+{
+    const MbFileTraceAccessStats &access = ctx->access_stats;
+
+    fprintf(fp, "I/O trace for %s\n", ctx->name.c_str());
+    fprintf(fp, "  Duration: %.3f ms\n",
+            (steady_time_ns() - ctx->open_steady_ns) / 1e6);
+    fprintf(fp, "  %-9s %10s %7s %14s %12s %10s %10s %10s\n",
+            "Operation", "Count", "Errors", "Bytes", "Total (ms)",
+            "Avg (us)", "Min (us)", "Max (us)");
+
+    for (int op = 0; op < MB_FILE_TRACE_OP_COUNT; ++op) {
+        const MbFileTraceOpStats &stats = ctx->op_stats[op];
+        if (stats.count == 0) {
+            continue;
+        }
+
+        fprintf(fp, "  %-9s %10" PRIu64 " %7" PRIu64 " %14" PRIu64
+                " %12.3f %10.2f %10.2f %10.2f\n",
+                op_names[op], stats.count, stats.errors, stats.bytes,
+                stats.total_ns / 1e6,
+                static_cast<double>(stats.total_ns) / stats.count / 1e3,
+                stats.min_ns / 1e3, stats.max_ns / 1e3);
+    }
+
+    fprintf(fp, "  Access pattern: %" PRIu64 " sequential, %" PRIu64
+            " non-sequential\n", access.sequential, access.nonsequential);
+    fprintf(fp, "  Seeks: %" PRIu64 " forward, %" PRIu64 " backward, %"
+            PRIu64 " unchanged (%" PRIu64 " bytes total distance)\n",
+            access.seeks_forward, access.seeks_backward,
+            access.seeks_unchanged, access.seek_distance);
+
+    for (int op = 0; op < MB_FILE_TRACE_OP_COUNT; ++op) {
+        const MbFileTraceOpStats &stats = ctx->op_stats[op];
+        if (stats.count == 0) {
+            continue;
+        }
+
+        fprintf(fp, "  Latency histogram (%s):\n", op_names[op]);
+
+        for (size_t i = 0; i < MB_FILE_TRACE_HISTOGRAM_SIZE; ++i) {
+            if (stats.histogram[i] == 0) {
+                continue;
+            }
+
+            if (i == MB_FILE_TRACE_HISTOGRAM_SIZE - 1) {
+                fprintf(fp, "    >= %8" PRIu64 " us: %" PRIu64 "\n",
+                        UINT64_C(1) << (i - 1), stats.histogram[i]);
+            } else {
+                fprintf(fp, "    <  %8" PRIu64 " us: %" PRIu64 "\n",
+                        UINT64_C(1) << i, stats.histogram[i]);
+            }
+        }
+    }
+}
+
+static void write_report(TraceFileCtx *ctx, FILE *fp, int format)
+{
+    std::lock_guard<std::mutex> guard(ctx->lock);
+
+    if (format == MB_FILE_TRACE_FORMAT_CHROME) {
+        write_chrome_report(ctx, fp);
+    } else {
+        write_summary_report(ctx, fp);
+    }
+
+    fflush(fp);
+}
+
+static int trace_open_cb(struct MbFile *file, void *userdata)
+{
+    (void) file;
+
+    TraceFileCtx *const ctx = static_cast<TraceFileCtx *>(userdata);
+
+    // The starting position is needed for the access pattern statistics, but
+    // not every handle can report it
+    ctx->pos_valid = mb_file_seek(ctx->inner, 0, SEEK_CUR, &ctx->pos)
+            == MB_FILE_OK;
+
+    return MB_FILE_OK;
+}
+
+static int trace_close_cb(struct MbFile *file, void *userdata)
+{
+    TraceFileCtx *const ctx = static_cast<TraceFileCtx *>(userdata);
+    int ret = MB_FILE_OK;
+
+    // Failing to write the report must not affect the file operations, so
+    // errors are ignored
+    if (ctx->report_fp) {
+        write_report(ctx, ctx->report_fp, ctx->report_format);
+    }
+
+    if (ctx->owned) {
+        ret = mb_file_close(ctx->inner);
+        if (ret != MB_FILE_OK) {
+            inner_error(file, ctx, ret);
+        }
+    }
+
+    free_ctx(ctx);
+    return ret;
+}
+
+static int trace_read_cb(struct MbFile *file, void *userdata,
+                         void *buf, size_t size, size_t *bytes_read)
+{
+    TraceFileCtx *const ctx = static_cast<TraceFileCtx *>(userdata);
+    TraceEvent event = begin_op(ctx, MB_FILE_TRACE_OP_READ);
+    event.offset = ctx->pos;
+    event.offset_valid = ctx->pos_valid;
+    event.size = size;
+
+    int ret = mb_file_read(ctx->inner, buf, size, bytes_read);
+    if (ret == MB_FILE_OK) {
+        event.result = *bytes_read;
+        ctx->pos += *bytes_read;
+    } else {
+        ctx->pos_valid = false;
+    }
+
+    end_op(ctx, event, ret);
+
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int trace_write_cb(struct MbFile *file, void *userdata,
+                          const void *buf, size_t size,
+                          size_t *bytes_written)
+{
+    TraceFileCtx *const ctx = static_cast<TraceFileCtx *>(userdata);
+    TraceEvent event = begin_op(ctx, MB_FILE_TRACE_OP_WRITE);
+    event.offset = ctx->pos;
+    event.offset_valid = ctx->pos_valid;
+    event.size = size;
+
+    int ret = mb_file_write(ctx->inner, buf, size, bytes_written);
+    if (ret == MB_FILE_OK) {
+        event.result = *bytes_written;
+        ctx->pos += *bytes_written;
+    } else {
+        ctx->pos_valid = false;
+    }
+
+    end_op(ctx, event, ret);
+
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int trace_seek_cb(struct MbFile *file, void *userdata,
+                         int64_t offset, int whence, uint64_t *new_offset)
+{
+    TraceFileCtx *const ctx = static_cast<TraceFileCtx *>(userdata);
+    TraceEvent event = begin_op(ctx, MB_FILE_TRACE_OP_SEEK);
+    event.offset = ctx->pos;
+    event.offset_valid = ctx->pos_valid;
+    event.seek_offset = offset;
+    event.whence = whence;
+
+    int ret = mb_file_seek(ctx->inner, offset, whence, new_offset);
+    if (ret == MB_FILE_OK) {
+        event.result = *new_offset;
+        ctx->pos = *new_offset;
+        ctx->pos_valid = true;
+    }
+
+    end_op(ctx, event, ret);
+
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int trace_truncate_cb(struct MbFile *file, void *userdata,
+                             uint64_t size)
+{
+    TraceFileCtx *const ctx = static_cast<TraceFileCtx *>(userdata);
+    TraceEvent event = begin_op(ctx, MB_FILE_TRACE_OP_TRUNCATE);
+    event.size = size;
+
+    int ret = mb_file_truncate(ctx->inner, size);
+
+    end_op(ctx, event, ret);
+
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int trace_pread_cb(struct MbFile *file, void *userdata,
+                          void *buf, size_t size, uint64_t offset,
+                          size_t *bytes_read)
+{
+    TraceFileCtx *const ctx = static_cast<TraceFileCtx *>(userdata);
+    TraceEvent event = begin_op(ctx, MB_FILE_TRACE_OP_PREAD);
+    event.offset = offset;
+    event.offset_valid = true;
+    event.size = size;
+
+    int ret = mb_file_pread(ctx->inner, buf, size, offset, bytes_read);
+    if (ret == MB_FILE_OK) {
+        event.result = *bytes_read;
+    }
+
+    end_op(ctx, event, ret);
+
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int trace_pwrite_cb(struct MbFile *file, void *userdata,
+                           const void *buf, size_t size, uint64_t offset,
+                           size_t *bytes_written)
+{
+    TraceFileCtx *const ctx = static_cast<TraceFileCtx *>(userdata);
+    TraceEvent event = begin_op(ctx, MB_FILE_TRACE_OP_PWRITE);
+    event.offset = offset;
+    event.offset_valid = true;
+    event.size = size;
+
+    int ret = mb_file_pwrite(ctx->inner, buf, size, offset, bytes_written);
+    if (ret == MB_FILE_OK) {
+        event.result = *bytes_written;
+    }
+
+    end_op(ctx, event, ret);
+
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static TraceFileCtx * get_ctx(struct MbFile *file)
+{
+    if (file->state != MbFileState::OPENED
+            || file->close_cb != &trace_close_cb) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Not an open trace file");
+        return nullptr;
+    }
+
+    return static_cast<TraceFileCtx *>(file->cb_userdata);
+}
+
+/*!
+ * Open MbFile handle that traces the operations performed on another handle.
+ *
+ * All operations are passed through to \p inner unchanged. For each type of
+ * operation, the number of calls, failures, bytes requested and transferred,
+ * and a latency histogram are recorded. The file position is tracked to
+ * determine how many reads and writes are sequential and how far the seeks
+ * move. The first #MB_FILE_TRACE_MAX_EVENTS operations are also recorded
+ * individually for the Chrome trace output.
+ *
+ * The statistics can be queried with mb_file_trace_op_stats() and
+ * mb_file_trace_access_stats() and a report can be written with
+ * mb_file_trace_write_report() or automatically when the handle is closed
+ * with mb_file_trace_set_report().
+ *
+ * \note \p inner must not be used directly while the trace handle is open.
+ *
+ * \param file MbFile handle
+ * \param inner MbFile handle to trace
+ * \param owned Whether \p inner should be closed and freed when \p file is
+ *              closed
+ * \param name Name of the file in reports (can be NULL)
+ *
+ * \return
+ *   * #MB_FILE_OK if the file is successfully opened
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_trace(struct MbFile *file, struct MbFile *inner,
+                       bool owned, const char *name)
+{
+    static std::atomic<unsigned int> next_id(1);
+
+    TraceFileCtx *ctx = new(std::nothrow) TraceFileCtx();
+    if (!ctx) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to allocate TraceFileCtx");
+        return MB_FILE_FATAL;
+    }
+
+    ctx->inner = inner;
+    ctx->owned = owned;
+    ctx->name = name ? name : "<unnamed>";
+    ctx->id = next_id++;
+    ctx->open_steady_ns = steady_time_ns();
+    ctx->open_wall_us = wall_time_us();
+
+    mb_file_set_pread_callback(file, &trace_pread_cb);
+    mb_file_set_pwrite_callback(file, &trace_pwrite_cb);
+
+    return mb_file_open_callbacks(file,
+                                  &trace_open_cb,
+                                  &trace_close_cb,
+                                  &trace_read_cb,
+                                  &trace_write_cb,
+                                  &trace_seek_cb,
+                                  &trace_truncate_cb,
+                                  ctx);
+}
+
+/*!
+ * Wrap an MbFile handle in a trace handle if #MB_FILE_TRACE_ENV is set.
+ *
+ * If the environment variable is set to a path, \p *file is replaced by a
+ * trace handle that owns the original handle and appends a report to the path
+ * when it is closed. If the path ends in `.json`, the report is in the Chrome
+ * trace format. Otherwise, it is a human-readable summary. If the path is
+ * `-`, the summary is written to stderr. If the environment variable is not
+ * set, \p *file is left unchanged.
+ *
+ * \param[in,out] file Pointer to opened MbFile handle
+ * \param[in] name Name of the file in reports (can be NULL)
+ *
+ * \return
+ *   * #MB_FILE_OK if tracing is disabled or \p *file was successfully wrapped
+ *   * \<= #MB_FILE_WARN if an error occurs. The error is set on \p *file,
+ *     which is left unchanged.
+ */
+int mb_file_open_trace_from_env(struct MbFile **file, const char *name)
+{
+    const char *path = getenv(MB_FILE_TRACE_ENV);
+    if (!path || !*path) {
+        return MB_FILE_OK;
+    }
+
+    int format = mb_ends_with_icase(path, ".json")
+            ? MB_FILE_TRACE_FORMAT_CHROME : MB_FILE_TRACE_FORMAT_SUMMARY;
+    int ret;
+
+    MbFile *trace = mb_file_new();
+    if (!trace) {
+        mb_file_set_error(*file, -errno, "Failed to allocate MbFile: %s",
+                          strerror(errno));
+        return MB_FILE_FAILED;
+    }
+
+    // Ownership is only transferred once everything succeeds so that the
+    // original handle is untouched on failure
+    ret = mb_file_open_trace(trace, *file, false, name);
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_trace_set_report(trace, path, format);
+    }
+    if (ret != MB_FILE_OK) {
+        mb_file_set_error(*file, mb_file_error(trace),
+                          "Failed to enable I/O tracing: %s",
+                          mb_file_error_string(trace));
+        mb_file_free(trace);
+        return MB_FILE_FAILED;
+    }
+
+    static_cast<TraceFileCtx *>(trace->cb_userdata)->owned = true;
+    *file = trace;
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * Write a report to a file when a trace handle is closed.
+ *
+ * The report is appended to \p path. If \p path is `-`, the report is written
+ * to stderr. Errors that occur while writing the report are ignored so that
+ * tracing never causes mb_file_close() to fail.
+ *
+ * \param file MbFile handle opened with mb_file_open_trace()
+ * \param path Output path
+ * \param format Report format (#MbFileTraceFormat)
+ *
+ * \return
+ *   * #MB_FILE_OK if the report output was successfully opened
+ *   * #MB_FILE_FAILED if \p file is not an open trace handle or \p path cannot
+ *     be opened
+ */
+int mb_file_trace_set_report(struct MbFile *file, const char *path,
+                             int format)
+{
+    TraceFileCtx *ctx = get_ctx(file);
+    if (!ctx) {
+        return MB_FILE_FAILED;
+    }
+
+    FILE *fp;
+
+    if (strcmp(path, "-") == 0) {
+        fp = stderr;
+    } else {
+        fp = fopen(path, "a");
+        if (!fp) {
+            mb_file_set_error(file, -errno, "%s: Failed to open: %s",
+                              path, strerror(errno));
+            return MB_FILE_FAILED;
+        }
+    }
+
+    if (ctx->report_fp && ctx->report_fp != stderr) {
+        fclose(ctx->report_fp);
+    }
+    ctx->report_fp = fp;
+    ctx->report_format = format;
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * Get statistics for one type of operation performed on a trace handle.
+ *
+ * \param[in] file MbFile handle opened with mb_file_open_trace()
+ * \param[in] op Operation (#MbFileTraceOp)
+ * \param[out] stats Output statistics
+ *
+ * \return
+ *   * #MB_FILE_OK if the statistics were returned
+ *   * #MB_FILE_FAILED if \p file is not an open trace handle or \p op is
+ *     invalid
+ */
+int mb_file_trace_op_stats(struct MbFile *file, int op,
+                           struct MbFileTraceOpStats *stats)
+{
+    TraceFileCtx *ctx = get_ctx(file);
+    if (!ctx) {
+        return MB_FILE_FAILED;
+    } else if (op < 0 || op >= MB_FILE_TRACE_OP_COUNT) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Invalid operation: %d", op);
+        return MB_FILE_FAILED;
+    }
+
+    std::lock_guard<std::mutex> guard(ctx->lock);
+    *stats = ctx->op_stats[op];
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * Get the access pattern statistics of a trace handle.
+ *
+ * \param[in] file MbFile handle opened with mb_file_open_trace()
+ * \param[out] stats Output statistics
+ *
+ * \return
+ *   * #MB_FILE_OK if the statistics were returned
+ *   * #MB_FILE_FAILED if \p file is not an open trace handle
+ */
+int mb_file_trace_access_stats(struct MbFile *file,
+                               struct MbFileTraceAccessStats *stats)
+{
+    TraceFileCtx *ctx = get_ctx(file);
+    if (!ctx) {
+        return MB_FILE_FAILED;
+    }
+
+    std::lock_guard<std::mutex> guard(ctx->lock);
+    *stats = ctx->access_stats;
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * Write a report of the operations performed on a trace handle so far.
+ *
+ * The Chrome trace format report is a JSON array of trace events with one
+ * complete event per operation. A `[` is written first if \p fp is empty.
+ * Reports for multiple files can be appended to the same output because the
+ * closing `]` is optional in the trace event format.
+ *
+ * \param file MbFile handle opened with mb_file_open_trace()
+ * \param fp Output file
+ * \param format Report format (#MbFileTraceFormat)
+ *
+ * \return
+ *   * #MB_FILE_OK if the report was written
+ *   * #MB_FILE_FAILED if \p file is not an open trace handle or an error
+ *     occurs while writing the report
+ */
+int mb_file_trace_write_report(struct MbFile *file, FILE *fp, int format)
+{
+    TraceFileCtx *ctx = get_ctx(file);
+    if (!ctx) {
+        return MB_FILE_FAILED;
+    }
+
+    write_report(ctx, fp, format);
+
+    if (ferror(fp)) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to write report");
+        return MB_FILE_FAILED;
+    }
+
+    return MB_FILE_OK;
+}
+
+MB_END_C_DECLS
@@ -0,0 +1,793 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/uring.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#      define HAVE_IO_URING 1
+#    endif
+#  endif
+#endif
+
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/fd_p.h"
+#include "mbcommon/file/uring_p.h"
+#include "mbcommon/file_p.h"
+
+/*!
+ * \file mbcommon/file/uring.h
+ * \brief Open file with Linux io_uring API for asynchronous I/O
+ */
+
+MB_BEGIN_C_DECLS
+
+static int uring_close_cb(struct MbFile *file, void *userdata);
+
+static void teardown_ring(UringFileCtx *ctx)
+{
+#ifdef HAVE_IO_URING
+    if (ctx->sqes) {
+        munmap(ctx->sqes, ctx->sqes_map_size);
+    }
+    if (ctx->cq_ptr && ctx->cq_ptr != ctx->sq_ptr) {
+        munmap(ctx->cq_ptr, ctx->cq_map_size);
+    }
+    if (ctx->sq_ptr) {
+        munmap(ctx->sq_ptr, ctx->sq_map_size);
+    }
+#endif
+    if (ctx->ring_fd >= 0) {
+        close(ctx->ring_fd);
+    }
+    free(ctx->requests);
+    free(ctx->free_slots);
+
+    ctx->ring_fd = -1;
+    ctx->sq_ptr = nullptr;
+    ctx->cq_ptr = nullptr;
+    ctx->sqes = nullptr;
+    ctx->requests = nullptr;
+    ctx->free_slots = nullptr;
+}
+
+static void free_ctx(UringFileCtx *ctx)
+{
+    teardown_ring(ctx);
+    mb_file_free(ctx->inner);
+    free(ctx);
+}
+
+static int inner_error(struct MbFile *file, UringFileCtx *ctx, int ret)
+{
+    mb_file_set_error(file, mb_file_error(ctx->inner), "%s",
+                      mb_file_error_string(ctx->inner));
+    return ret;
+}
+
+static UringFileCtx * get_active_ctx(struct MbFile *file)
+{
+    if (file->state != MbFileState::OPENED
+            || file->close_cb != &uring_close_cb) {
+        return nullptr;
+    }
+
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(file->cb_userdata);
+    return ctx->ring_fd >= 0 ? ctx : nullptr;
+}
+
+#ifdef HAVE_IO_URING
+
+static int sys_io_uring_setup(unsigned int entries, io_uring_params *p)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+}
+
+/*!
+ * \brief Set up io_uring instance
+ *
+ * \return Whether io_uring is available. On failure, the ring is left
+ *         partially set up and must be cleaned up with teardown_ring().
+ */
+static bool setup_ring(UringFileCtx *ctx)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ctx->ring_fd = sys_io_uring_setup(ctx->queue_depth, &params);
+    if (ctx->ring_fd < 0) {
+        return false;
+    }
+
+    ctx->sq_map_size = params.sq_off.array
+            + params.sq_entries * sizeof(unsigned int);
+    ctx->cq_map_size = params.cq_off.cqes
+            + params.cq_entries * sizeof(io_uring_cqe);
+
+    // Both rings can be mapped at once on newer kernels
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ctx->sq_map_size = ctx->cq_map_size =
+                std::max(ctx->sq_map_size, ctx->cq_map_size);
+    }
+
+    void *ptr = mmap(nullptr, ctx->sq_map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+                     IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    ctx->sq_ptr = ptr;
+
+    if (single_mmap) {
+        ctx->cq_ptr = ctx->sq_ptr;
+    } else {
+        ptr = mmap(nullptr, ctx->cq_map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+                   IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        ctx->cq_ptr = ptr;
+    }
+
+    ctx->sqes_map_size = params.sq_entries * sizeof(io_uring_sqe);
+    ptr = mmap(nullptr, ctx->sqes_map_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    ctx->sqes = static_cast<io_uring_sqe *>(ptr);
+
+    char *sq = static_cast<char *>(ctx->sq_ptr);
+    char *cq = static_cast<char *>(ctx->cq_ptr);
+
+    ctx->sq_head = reinterpret_cast<unsigned int *>(sq + params.sq_off.head);
+    ctx->sq_tail = reinterpret_cast<unsigned int *>(sq + params.sq_off.tail);
+    ctx->sq_mask = reinterpret_cast<unsigned int *>(
+            sq + params.sq_off.ring_mask);
+    ctx->sq_array = reinterpret_cast<unsigned int *>(sq + params.sq_off.array);
+    ctx->cq_head = reinterpret_cast<unsigned int *>(cq + params.cq_off.head);
+    ctx->cq_tail = reinterpret_cast<unsigned int *>(cq + params.cq_off.tail);
+    ctx->cq_mask = reinterpret_cast<unsigned int *>(
+            cq + params.cq_off.ring_mask);
+    ctx->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // The kernel may round up the number of entries. Limiting the number of
+    // in-flight requests to the submission queue size guarantees that the
+    // completion queue (which is at least as large) never overflows.
+    ctx->queue_depth = params.sq_entries;
+
+    ctx->requests = static_cast<UringRequest *>(
+            calloc(ctx->queue_depth, sizeof(UringRequest)));
+    ctx->free_slots = static_cast<unsigned int *>(
+            calloc(ctx->queue_depth, sizeof(unsigned int)));
+    if (!ctx->requests || !ctx->free_slots) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < ctx->queue_depth; ++i) {
+        ctx->free_slots[i] = ctx->queue_depth - i - 1;
+    }
+    ctx->free_count = ctx->queue_depth;
+
+    return true;
+}
+
+/*!
+ * \brief Submit queued requests and wait for completions
+ */
+static int enter_ring(struct MbFile *file, UringFileCtx *ctx,
+                      unsigned int min_complete)
+{
+    while (true) {
+        unsigned int flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+        int n = sys_io_uring_enter(ctx->ring_fd, ctx->unsubmitted,
+                                   min_complete, flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            mb_file_set_error(file, -errno,
+                              "Failed to submit I/O requests: %s",
+                              strerror(errno));
+            return MB_FILE_FATAL;
+        }
+
+        ctx->unsubmitted -= std::min<unsigned int>(n, ctx->unsubmitted);
+        return MB_FILE_OK;
+    }
+}
+
+/*!
+ * \brief Run the callbacks of all completed requests
+ *
+ * \return Number of completed requests
+ */
+static size_t reap_completions(struct MbFile *file, UringFileCtx *ctx)
+{
+    size_t count = 0;
+
+    while (true) {
+        unsigned int head = *ctx->cq_head;
+        unsigned int tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+
+        io_uring_cqe cqe = ctx->cqes[head & *ctx->cq_mask];
+        __atomic_store_n(ctx->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        // Free the slot before calling the callback so that it can submit
+        // another request
+        unsigned int slot = static_cast<unsigned int>(cqe.user_data);
+        UringRequest req = ctx->requests[slot];
+        ctx->free_slots[ctx->free_count++] = slot;
+        --ctx->pending;
+        ++count;
+
+        int ret = MB_FILE_OK;
+        size_t bytes = 0;
+
+        if (cqe.res < 0) {
+            mb_file_set_error(file, cqe.res, "Failed to %s file: %s",
+                              req.write ? "write" : "read",
+                              strerror(-cqe.res));
+            ret = cqe.res == -EINTR || cqe.res == -EAGAIN
+                    ? MB_FILE_RETRY : MB_FILE_FAILED;
+        } else {
+            bytes = static_cast<size_t>(cqe.res);
+        }
+
+        req.cb(file, req.userdata, ret, bytes);
+    }
+
+    return count;
+}
+
+static int wait_completions(struct MbFile *file, UringFileCtx *ctx,
+                            size_t min_completions)
+{
+    min_completions = std::min(min_completions, ctx->pending);
+
+    while (true) {
+        size_t n = reap_completions(file, ctx);
+        min_completions -= std::min(n, min_completions);
+
+        if (min_completions == 0 && ctx->unsubmitted == 0) {
+            return MB_FILE_OK;
+        }
+
+        int ret = enter_ring(file, ctx, static_cast<unsigned int>(
+                std::min<size_t>(min_completions, UINT_MAX)));
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+    }
+}
+
+static int queue_request(struct MbFile *file, UringFileCtx *ctx, bool write,
+                         void *buf, size_t size, uint64_t offset,
+                         MbFileAsyncCb cb, void *userdata)
+{
+    // Wait for a slot to become available
+    if (ctx->free_count == 0) {
+        int ret = wait_completions(file, ctx, 1);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+    }
+
+    unsigned int slot = ctx->free_slots[--ctx->free_count];
+    UringRequest *req = &ctx->requests[slot];
+    req->cb = cb;
+    req->userdata = userdata;
+    req->write = write;
+    req->iov.iov_base = buf;
+    // Short reads and writes are reported to the callback
+    req->iov.iov_len = std::min<size_t>(size, SSIZE_MAX);
+
+    // Only this thread writes to the tail
+    unsigned int tail = *ctx->sq_tail;
+    unsigned int index = tail & *ctx->sq_mask;
+
+    io_uring_sqe *sqe = &ctx->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = ctx->fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uintptr_t>(&req->iov);
+    sqe->len = 1;
+    sqe->user_data = slot;
+
+    ctx->sq_array[index] = index;
+    __atomic_store_n(ctx->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ++ctx->unsubmitted;
+    ++ctx->pending;
+
+    return MB_FILE_OK;
+}
+
+#else
+
+static bool setup_ring(UringFileCtx *ctx)
+{
+    (void) ctx;
+    return false;
+}
+
+static int wait_completions(struct MbFile *file, UringFileCtx *ctx,
+                            size_t min_completions)
+{
+    (void) file;
+    (void) ctx;
+    (void) min_completions;
+    return MB_FILE_OK;
+}
+
+static int queue_request(struct MbFile *file, UringFileCtx *ctx, bool write,
+                         void *buf, size_t size, uint64_t offset,
+                         MbFileAsyncCb cb, void *userdata)
+{
+    (void) ctx;
+    (void) write;
+    (void) buf;
+    (void) size;
+    (void) offset;
+    (void) cb;
+    (void) userdata;
+
+    mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                      "io_uring is not supported");
+    return MB_FILE_UNSUPPORTED;
+}
+
+#endif
+
+/*!
+ * \brief Wait for all asynchronous operations before a synchronous operation
+ */
+static int drain(struct MbFile *file, UringFileCtx *ctx)
+{
+    if (ctx->ring_fd < 0) {
+        return MB_FILE_OK;
+    }
+
+    return wait_completions(file, ctx, ctx->pending);
+}
+
+static int uring_open_cb(struct MbFile *file, void *userdata)
+{
+    (void) file;
+
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(userdata);
+
+    // The fd belongs to the inner handle
+    ctx->fd = static_cast<FdFileCtx *>(ctx->inner->cb_userdata)->fd;
+
+    // Fall back to the fd backend if io_uring is unavailable (eg. old kernels
+    // or blocked by seccomp)
+    if (!setup_ring(ctx)) {
+        teardown_ring(ctx);
+    }
+
+    return MB_FILE_OK;
+}
+
+static int uring_close_cb(struct MbFile *file, void *userdata)
+{
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(userdata);
+    int ret;
+
+    ret = drain(file, ctx);
+
+    int ret2 = mb_file_close(ctx->inner);
+    if (ret2 != MB_FILE_OK && ret == MB_FILE_OK) {
+        ret = inner_error(file, ctx, ret2);
+    }
+
+    free_ctx(ctx);
+    return ret;
+}
+
+static int uring_read_cb(struct MbFile *file, void *userdata,
+                         void *buf, size_t size, size_t *bytes_read)
+{
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(userdata);
+
+    int ret = drain(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ret = mb_file_read(ctx->inner, buf, size, bytes_read);
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int uring_write_cb(struct MbFile *file, void *userdata,
+                          const void *buf, size_t size,
+                          size_t *bytes_written)
+{
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(userdata);
+
+    int ret = drain(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ret = mb_file_write(ctx->inner, buf, size, bytes_written);
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int uring_seek_cb(struct MbFile *file, void *userdata,
+                         int64_t offset, int whence, uint64_t *new_offset)
+{
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(userdata);
+
+    int ret = mb_file_seek(ctx->inner, offset, whence, new_offset);
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int uring_truncate_cb(struct MbFile *file, void *userdata,
+                             uint64_t size)
+{
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(userdata);
+
+    int ret = drain(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ret = mb_file_truncate(ctx->inner, size);
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int uring_pread_cb(struct MbFile *file, void *userdata,
+                          void *buf, size_t size, uint64_t offset,
+                          size_t *bytes_read)
+{
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(userdata);
+
+    int ret = drain(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ret = mb_file_pread(ctx->inner, buf, size, offset, bytes_read);
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+static int uring_pwrite_cb(struct MbFile *file, void *userdata,
+                           const void *buf, size_t size, uint64_t offset,
+                           size_t *bytes_written)
+{
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(userdata);
+
+    int ret = drain(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ret = mb_file_pwrite(ctx->inner, buf, size, offset, bytes_written);
+    return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+}
+
+/*!
+ * \brief Open io_uring handle on top of an opened fd handle
+ *
+ * \p inner is always freed if this function fails.
+ */
+static int open_uring(struct MbFile *file, struct MbFile *inner,
+                      unsigned int queue_depth)
+{
+    UringFileCtx *ctx = static_cast<UringFileCtx *>(
+            calloc(1, sizeof(UringFileCtx)));
+    if (!ctx) {
+        mb_file_set_error(file, -errno,
+                          "Failed to allocate UringFileCtx: %s",
+                          strerror(errno));
+        mb_file_free(inner);
+        return MB_FILE_FATAL;
+    }
+
+    ctx->inner = inner;
+    ctx->ring_fd = -1;
+    ctx->queue_depth = queue_depth == 0
+            ? MB_FILE_URING_DEFAULT_QUEUE_DEPTH : queue_depth;
+
+    mb_file_set_pread_callback(file, &uring_pread_cb);
+    mb_file_set_pwrite_callback(file, &uring_pwrite_cb);
+
+    return mb_file_open_callbacks(file,
+                                  &uring_open_cb,
+                                  &uring_close_cb,
+                                  &uring_read_cb,
+                                  &uring_write_cb,
+                                  &uring_seek_cb,
+                                  &uring_truncate_cb,
+                                  ctx);
+}
+
+/*!
+ * Open MbFile handle from file descriptor with support for asynchronous I/O.
+ *
+ * Asynchronous reads and writes submitted with mb_file_async_read() and
+ * mb_file_async_write() are queued in a Linux io_uring instance, which allows
+ * up to \p queue_depth requests to be in flight at once. All synchronous
+ * operations are performed with the fd backend (mb_file_open_fd()) after
+ * waiting for the outstanding asynchronous operations to complete.
+ *
+ * If io_uring is not available (eg. on non-Linux systems, on kernels older
+ * than 5.1, or if it is blocked by seccomp), the handle is still opened and
+ * behaves exactly like an fd handle. The asynchronous operations then complete
+ * synchronously. mb_file_uring_active() reports whether io_uring is used.
+ *
+ * \param file MbFile handle
+ * \param fd File descriptor
+ * \param owned Whether the file descriptor should be owned by the MbFile
+ *              handle
+ * \param queue_depth Maximum number of requests in flight
+ *                    (#MB_FILE_URING_DEFAULT_QUEUE_DEPTH if 0)
+ *
+ * \return
+ *   * #MB_FILE_OK if the file was successfully opened
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_uring(struct MbFile *file, int fd, bool owned,
+                       unsigned int queue_depth)
+{
+    MbFile *inner = mb_file_new();
+    if (!inner) {
+        mb_file_set_error(file, -errno, "Failed to allocate MbFile: %s",
+                          strerror(errno));
+        return MB_FILE_FATAL;
+    }
+
+    int ret = mb_file_open_fd(inner, fd, owned);
+    if (ret != MB_FILE_OK) {
+        mb_file_set_error(file, mb_file_error(inner), "%s",
+                          mb_file_error_string(inner));
+        mb_file_free(inner);
+        return ret;
+    }
+
+    return open_uring(file, inner, queue_depth);
+}
+
+/*!
+ * Open MbFile handle from a multi-byte filename with support for asynchronous
+ * I/O.
+ *
+ * See mb_file_open_uring() and mb_file_open_fd_filename() for details.
+ *
+ * \param file MbFile handle
+ * \param filename MBS filename
+ * \param mode Open mode (\ref MbFileOpenMode)
+ * \param queue_depth Maximum number of requests in flight
+ *                    (#MB_FILE_URING_DEFAULT_QUEUE_DEPTH if 0)
+ *
+ * \return
+ *   * #MB_FILE_OK if the file was successfully opened
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_uring_filename(struct MbFile *file, const char *filename,
+                                int mode, unsigned int queue_depth)
+{
+    MbFile *inner = mb_file_new();
+    if (!inner) {
+        mb_file_set_error(file, -errno, "Failed to allocate MbFile: %s",
+                          strerror(errno));
+        return MB_FILE_FATAL;
+    }
+
+    int ret = mb_file_open_fd_filename(inner, filename, mode);
+    if (ret != MB_FILE_OK) {
+        mb_file_set_error(file, mb_file_error(inner), "%s",
+                          mb_file_error_string(inner));
+        mb_file_free(inner);
+        return ret;
+    }
+
+    return open_uring(file, inner, queue_depth);
+}
+
+/*!
+ * Check whether an MbFile handle uses io_uring for asynchronous operations.
+ *
+ * \param file MbFile handle
+ *
+ * \return Whether \p file was opened with mb_file_open_uring() or
+ *         mb_file_open_uring_filename() and io_uring is available
+ */
+bool mb_file_uring_active(struct MbFile *file)
+{
+    return get_active_ctx(file) != nullptr;
+}
+
+/*!
+ * \brief Perform asynchronous operation synchronously
+ */
+static int async_fallback(struct MbFile *file, bool write, void *buf,
+                          size_t size, uint64_t offset, MbFileAsyncCb cb,
+                          void *userdata)
+{
+    size_t n = 0;
+    int ret;
+
+    if (write) {
+        ret = mb_file_pwrite(file, buf, size, offset, &n);
+    } else {
+        ret = mb_file_pread(file, buf, size, offset, &n);
+    }
+
+    cb(file, userdata, ret, ret == MB_FILE_OK ? n : 0);
+
+    // The result is reported to the callback
+    return ret == MB_FILE_UNSUPPORTED || ret <= MB_FILE_FATAL
+            ? ret : MB_FILE_OK;
+}
+
+/*!
+ * Queue an asynchronous read.
+ *
+ * The read is submitted to the kernel when the submission queue is full or
+ * when mb_file_async_wait() is called. When it completes, \p cb is called
+ * from mb_file_async_wait() (or from another asynchronous call that had to
+ * wait for a free slot) with the result and the number of bytes read. Like
+ * mb_file_pread(), the read may be short and 0 bytes indicates EOF. \p buf
+ * must remain valid until the callback is called.
+ *
+ * If \p file does not use io_uring, the read is performed synchronously with
+ * mb_file_pread() and \p cb is called before this function returns. This
+ * works for any handle that supports positional reads.
+ *
+ * \param file MbFile handle
+ * \param buf Buffer to read into
+ * \param size Buffer size
+ * \param offset File offset to read from
+ * \param cb Completion callback
+ * \param userdata Data pointer to pass to \p cb
+ *
+ * \return
+ *   * #MB_FILE_OK if the read was queued (or performed synchronously, in
+ *     which case the result is passed to \p cb)
+ *   * #MB_FILE_UNSUPPORTED if \p file does not support positional reads
+ *   * \<= #MB_FILE_FATAL if the request could not be submitted
+ */
+int mb_file_async_read(struct MbFile *file, void *buf, size_t size,
+                       uint64_t offset, MbFileAsyncCb cb, void *userdata)
+{
+    UringFileCtx *ctx = get_active_ctx(file);
+    if (!ctx) {
+        return async_fallback(file, false, buf, size, offset, cb, userdata);
+    }
+
+    int ret = queue_request(file, ctx, false, buf, size, offset, cb,
+                            userdata);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+    return ret;
+}
+
+/*!
+ * Queue an asynchronous write.
+ *
+ * See mb_file_async_read() for details. \p buf must remain valid and
+ * unmodified until the callback is called. The order in which overlapping
+ * asynchronous writes are performed is unspecified.
+ *
+ * \param file MbFile handle
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ * \param offset File offset to write to
+ * \param cb Completion callback
+ * \param userdata Data pointer to pass to \p cb
+ *
+ * \return
+ *   * #MB_FILE_OK if the write was queued (or performed synchronously, in
+ *     which case the result is passed to \p cb)
+ *   * #MB_FILE_UNSUPPORTED if \p file does not support positional writes
+ *   * \<= #MB_FILE_FATAL if the request could not be submitted
+ */
+int mb_file_async_write(struct MbFile *file, const void *buf, size_t size,
+                        uint64_t offset, MbFileAsyncCb cb, void *userdata)
+{
+    UringFileCtx *ctx = get_active_ctx(file);
+    if (!ctx) {
+        return async_fallback(file, true, const_cast<void *>(buf), size,
+                              offset, cb, userdata);
+    }
+
+    int ret = queue_request(file, ctx, true, const_cast<void *>(buf), size,
+                            offset, cb, userdata);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+    return ret;
+}
+
+/*!
+ * Submit queued asynchronous operations and wait for them to complete.
+ *
+ * The callbacks of all operations that have completed are called, including
+ * ones beyond \p min_completions. Callbacks may queue new operations.
+ *
+ * \param file MbFile handle
+ * \param min_completions Minimum number of operations to wait for. This is
+ *                        limited to the number of pending operations, so
+ *                        `SIZE_MAX` waits for all of them. If 0, queued
+ *                        operations are submitted without blocking.
+ *
+ * \return
+ *   * #MB_FILE_OK if the operations were submitted and the requested number
+ *     of them completed
+ *   * \<= #MB_FILE_FATAL if an error occurs
+ */
+int mb_file_async_wait(struct MbFile *file, size_t min_completions)
+{
+    UringFileCtx *ctx = get_active_ctx(file);
+    if (!ctx) {
+        return MB_FILE_OK;
+    }
+
+    int ret = wait_completions(file, ctx, min_completions);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+    return ret;
+}
+
+/*!
+ * Get the number of asynchronous operations that have not completed.
+ *
+ * \param file MbFile handle
+ *
+ * \return Number of operations whose callbacks have not been called
+ */
+size_t mb_file_async_pending(struct MbFile *file)
+{
+    UringFileCtx *ctx = get_active_ctx(file);
+    return ctx ? ctx->pending : 0;
+}
+
+MB_END_C_DECLS
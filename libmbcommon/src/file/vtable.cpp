@@ -19,9 +19,17 @@
 
 #include "mbcommon/file/vtable_p.h"
 
+#include <cerrno>
+
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#  include <linux/fs.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
+
 MB_BEGIN_C_DECLS
 
 // fcntl.h
@@ -148,6 +156,69 @@ static ssize_t _default_write(void *userdata, int fd, const void *buf,
     return write(fd, buf, count);
 }
 
+#ifndef _WIN32
+static ssize_t _default_pread64(void *userdata, int fd, void *buf,
+                                size_t count, off64_t offset)
+{
+    (void) userdata;
+    return pread64(fd, buf, count, offset);
+}
+
+static ssize_t _default_pwrite64(void *userdata, int fd, const void *buf,
+                                 size_t count, off64_t offset)
+{
+    (void) userdata;
+    return pwrite64(fd, buf, count, offset);
+}
+#endif
+
+#ifdef __linux__
+// Neither glibc before 2.27 nor bionic have a copy_file_range() wrapper
+static ssize_t _default_copy_file_range(void *userdata, int fd_in,
+                                        off64_t *off_in, int fd_out,
+                                        off64_t *off_out, size_t len,
+                                        unsigned int flags)
+{
+    (void) userdata;
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len,
+                   flags);
+#else
+    (void) fd_in;
+    (void) off_in;
+    (void) fd_out;
+    (void) off_out;
+    (void) len;
+    (void) flags;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int _default_ficlonerange(void *userdata, int dest_fd, int src_fd,
+                                 uint64_t src_offset, uint64_t src_length,
+                                 uint64_t dest_offset)
+{
+    (void) userdata;
+#ifdef FICLONERANGE
+    struct file_clone_range range;
+    range.src_fd = src_fd;
+    range.src_offset = src_offset;
+    range.src_length = src_length;
+    range.dest_offset = dest_offset;
+    return ioctl(dest_fd, FICLONERANGE, &range);
+#else
+    (void) dest_fd;
+    (void) src_fd;
+    (void) src_offset;
+    (void) src_length;
+    (void) dest_offset;
+    errno = ENOTTY;
+    return -1;
+#endif
+}
+#endif
+
 #ifdef _WIN32
 static BOOL _default_CloseHandle(void *userdata, HANDLE hObject)
 {
@@ -236,6 +307,14 @@ void _vtable_fill_system_funcs(SysVtable *vtable)
     vtable->fn_lseek64 = _default_lseek64;
     vtable->fn_read = _default_read;
     vtable->fn_write = _default_write;
+#ifndef _WIN32
+    vtable->fn_pread64 = _default_pread64;
+    vtable->fn_pwrite64 = _default_pwrite64;
+#endif
+#ifdef __linux__
+    vtable->fn_copy_file_range = _default_copy_file_range;
+    vtable->fn_ficlonerange = _default_ficlonerange;
+#endif
 #ifdef _WIN32
     // windows.h
     vtable->fn_CloseHandle = _default_CloseHandle;
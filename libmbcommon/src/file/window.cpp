@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/window.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/window_p.h"
+
+/*!
+ * \file mbcommon/file/window.h
+ * \brief Open byte range of another MbFile handle as a file
+ */
+
+MB_BEGIN_C_DECLS
+
+static void free_ctx(WindowFileCtx *ctx)
+{
+    if (ctx->owned) {
+        mb_file_free(ctx->inner);
+    }
+    free(ctx);
+}
+
+static int inner_error(struct MbFile *file, WindowFileCtx *ctx, int ret)
+{
+    mb_file_set_error(file, mb_file_error(ctx->inner), "%s",
+                      mb_file_error_string(ctx->inner));
+    return ret;
+}
+
+/*!
+ * \brief Get number of bytes that can be transferred at a window position
+ */
+static size_t clamp_size(WindowFileCtx *ctx, uint64_t pos, size_t size)
+{
+    if (pos >= ctx->size) {
+        return 0;
+    }
+    return static_cast<size_t>(std::min<uint64_t>(size, ctx->size - pos));
+}
+
+/*!
+ * \brief Seek inner file unless the last read or write left it at \p offset
+ */
+static int seek_inner(struct MbFile *file, WindowFileCtx *ctx, uint64_t offset)
+{
+    if (ctx->inner_pos_valid && ctx->inner_pos == offset) {
+        return MB_FILE_OK;
+    }
+
+    ctx->inner_pos_valid = false;
+
+    int ret = mb_file_seek(ctx->inner, offset, SEEK_SET, nullptr);
+    if (ret != MB_FILE_OK) {
+        return inner_error(file, ctx, ret);
+    }
+
+    ctx->inner_pos = offset;
+    ctx->inner_pos_valid = true;
+    return MB_FILE_OK;
+}
+
+static int window_pread_cb(struct MbFile *file, void *userdata,
+                           void *buf, size_t size, uint64_t offset,
+                           size_t *bytes_read)
+{
+    WindowFileCtx *const ctx = static_cast<WindowFileCtx *>(userdata);
+    int ret;
+
+    size = clamp_size(ctx, offset, size);
+    if (size == 0) {
+        *bytes_read = 0;
+        return MB_FILE_OK;
+    }
+
+    if (ctx->use_pread) {
+        ret = mb_file_pread(ctx->inner, buf, size, ctx->offset + offset,
+                            bytes_read);
+        if (ret != MB_FILE_UNSUPPORTED) {
+            return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+        }
+        ctx->use_pread = false;
+    }
+
+    ret = seek_inner(file, ctx, ctx->offset + offset);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ret = mb_file_read(ctx->inner, buf, size, bytes_read);
+    if (ret != MB_FILE_OK) {
+        ctx->inner_pos_valid = false;
+        return inner_error(file, ctx, ret);
+    }
+
+    ctx->inner_pos += *bytes_read;
+    return MB_FILE_OK;
+}
+
+static int window_pwrite_cb(struct MbFile *file, void *userdata,
+                            const void *buf, size_t size, uint64_t offset,
+                            size_t *bytes_written)
+{
+    WindowFileCtx *const ctx = static_cast<WindowFileCtx *>(userdata);
+    int ret;
+
+    size = clamp_size(ctx, offset, size);
+    if (size == 0) {
+        *bytes_written = 0;
+        return MB_FILE_OK;
+    }
+
+    if (ctx->use_pwrite) {
+        ret = mb_file_pwrite(ctx->inner, buf, size, ctx->offset + offset,
+                             bytes_written);
+        if (ret != MB_FILE_UNSUPPORTED) {
+            return ret == MB_FILE_OK ? ret : inner_error(file, ctx, ret);
+        }
+        ctx->use_pwrite = false;
+    }
+
+    ret = seek_inner(file, ctx, ctx->offset + offset);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ret = mb_file_write(ctx->inner, buf, size, bytes_written);
+    if (ret != MB_FILE_OK) {
+        ctx->inner_pos_valid = false;
+        return inner_error(file, ctx, ret);
+    }
+
+    ctx->inner_pos += *bytes_written;
+    return MB_FILE_OK;
+}
+
+static int window_close_cb(struct MbFile *file, void *userdata)
+{
+    WindowFileCtx *const ctx = static_cast<WindowFileCtx *>(userdata);
+    int ret = MB_FILE_OK;
+
+    if (ctx->owned) {
+        ret = mb_file_close(ctx->inner);
+        if (ret != MB_FILE_OK) {
+            inner_error(file, ctx, ret);
+        }
+    }
+
+    free_ctx(ctx);
+    return ret;
+}
+
+static int window_read_cb(struct MbFile *file, void *userdata,
+                          void *buf, size_t size, size_t *bytes_read)
+{
+    WindowFileCtx *const ctx = static_cast<WindowFileCtx *>(userdata);
+
+    int ret = window_pread_cb(file, userdata, buf, size, ctx->pos,
+                              bytes_read);
+    if (ret == MB_FILE_OK) {
+        ctx->pos += *bytes_read;
+    }
+    return ret;
+}
+
+static int window_write_cb(struct MbFile *file, void *userdata,
+                           const void *buf, size_t size,
+                           size_t *bytes_written)
+{
+    WindowFileCtx *const ctx = static_cast<WindowFileCtx *>(userdata);
+
+    int ret = window_pwrite_cb(file, userdata, buf, size, ctx->pos,
+                               bytes_written);
+    if (ret == MB_FILE_OK) {
+        ctx->pos += *bytes_written;
+    }
+    return ret;
+}
+
+static int window_seek_cb(struct MbFile *file, void *userdata,
+                          int64_t offset, int whence, uint64_t *new_offset)
+{
+    WindowFileCtx *const ctx = static_cast<WindowFileCtx *>(userdata);
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = ctx->pos;
+        break;
+    case SEEK_END:
+        base = ctx->size;
+        break;
+    default:
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Invalid whence argument: %d", whence);
+        return MB_FILE_FAILED;
+    }
+
+    if ((offset < 0 && static_cast<uint64_t>(-(offset + 1)) >= base)
+            || (offset > 0 && static_cast<uint64_t>(offset)
+                    > UINT64_MAX - ctx->offset - base)) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Offset out of range: %" PRId64, offset);
+        return MB_FILE_FAILED;
+    }
+
+    // Like regular files, seeking past the end is allowed, but nothing can be
+    // read or written there
+    ctx->pos = base + offset;
+    *new_offset = ctx->pos;
+    return MB_FILE_OK;
+}
+
+/*!
+ * Open MbFile handle for a byte range of another MbFile handle.
+ *
+ * The range [\p offset, \p offset + \p size) of \p inner is presented as an
+ * independent, seekable file of \p size bytes. Reads and writes are clamped to
+ * the end of the range, so data outside of the range is never accessed and the
+ * window cannot be resized. Seeking past the end is allowed, but reads there
+ * return EOF. If \p inner is shorter than the range, reads return EOF at the
+ * end of \p inner.
+ *
+ * If \p inner supports positional I/O (mb_file_pread() and mb_file_pwrite()),
+ * it is used and the position of \p inner is never changed. In that case,
+ * \p inner may be used directly and multiple windows can be opened on the same
+ * handle at the same time. If \p inner is a buffered handle, positional reads
+ * are served from its buffer.
+ *
+ * Otherwise, \p inner is read from and written to at its current position. It
+ * is only seeked when it is not where the window's previous read or write left
+ * it, so sequential access does not seek at all. Because of this, \p inner
+ * must not be seeked, read from, or written to by anything else (including
+ * other windows) while the window is being used.
+ *
+ * \param file MbFile handle
+ * \param inner MbFile handle to read from and write to
+ * \param owned Whether \p inner should be closed and freed when \p file is
+ *              closed
+ * \param offset Start of the range in \p inner
+ * \param size Size of the range
+ *
+ * \return
+ *   * #MB_FILE_OK if the file is successfully opened
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_window(struct MbFile *file, struct MbFile *inner,
+                        bool owned, uint64_t offset, uint64_t size)
+{
+    if (offset > UINT64_MAX - size) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Window would overflow offset: %" PRIu64
+                          " + %" PRIu64, offset, size);
+        return MB_FILE_FAILED;
+    }
+
+    WindowFileCtx *ctx = static_cast<WindowFileCtx *>(
+            calloc(1, sizeof(WindowFileCtx)));
+    if (!ctx) {
+        mb_file_set_error(file, -errno,
+                          "Failed to allocate WindowFileCtx: %s",
+                          strerror(errno));
+        return MB_FILE_FATAL;
+    }
+
+    ctx->inner = inner;
+    ctx->owned = owned;
+    ctx->offset = offset;
+    ctx->size = size;
+    ctx->use_pread = true;
+    ctx->use_pwrite = true;
+
+    mb_file_set_pread_callback(file, &window_pread_cb);
+    mb_file_set_pwrite_callback(file, &window_pwrite_cb);
+
+    return mb_file_open_callbacks(file,
+                                  nullptr,
+                                  &window_close_cb,
+                                  &window_read_cb,
+                                  &window_write_cb,
+                                  &window_seek_cb,
+                                  nullptr,
+                                  ctx);
+}
+
+MB_END_C_DECLS
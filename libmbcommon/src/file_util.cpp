@@ -23,11 +23,13 @@
 
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
 #include "mbcommon/libc/string.h"
 
 #define DEFAULT_BUFFER_SIZE             (8 * 1024 * 1024)
+#define MOVE_BUFFER_SIZE                (1024 * 1024)
 
 /*!
  * \file mbcommon/file_util.h
@@ -402,6 +404,131 @@ done:
     return ret;
 }
 
+/*!
+ * \brief Read from an offset for mb_file_move()
+ *
+ * mb_file_pread() is used if the handle supports it. Otherwise, \p *positional
+ * is set to false and the file is seeked before reading.
+ */
+static int read_fully_at(struct MbFile *file, void *buf, size_t size,
+                         uint64_t offset, bool *positional, size_t *bytes_read)
+{
+    size_t n;
+    int ret;
+
+    *bytes_read = 0;
+
+    while (*positional && *bytes_read < size) {
+        ret = mb_file_pread(file, static_cast<char *>(buf) + *bytes_read,
+                            size - *bytes_read, offset + *bytes_read, &n);
+        if (ret == MB_FILE_RETRY) {
+            continue;
+        } else if (ret == MB_FILE_UNSUPPORTED && *bytes_read == 0) {
+            *positional = false;
+            break;
+        } else if (ret < 0) {
+            return ret;
+        } else if (n == 0) {
+            break;
+        }
+
+        *bytes_read += n;
+    }
+
+    if (*positional) {
+        return MB_FILE_OK;
+    }
+
+    ret = mb_file_seek(file, offset, SEEK_SET, nullptr);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    return mb_file_read_fully(file, buf, size, bytes_read);
+}
+
+/*!
+ * \brief Write to an offset for mb_file_move()
+ *
+ * mb_file_pwrite() is used if the handle supports it. Otherwise, \p *positional
+ * is set to false and the file is seeked before writing.
+ */
+static int write_fully_at(struct MbFile *file, const void *buf, size_t size,
+                          uint64_t offset, bool *positional,
+                          size_t *bytes_written)
+{
+    size_t n;
+    int ret;
+
+    *bytes_written = 0;
+
+    while (*positional && *bytes_written < size) {
+        ret = mb_file_pwrite(file,
+                             static_cast<const char *>(buf) + *bytes_written,
+                             size - *bytes_written, offset + *bytes_written,
+                             &n);
+        if (ret == MB_FILE_RETRY) {
+            continue;
+        } else if (ret == MB_FILE_UNSUPPORTED && *bytes_written == 0) {
+            *positional = false;
+            break;
+        } else if (ret < 0) {
+            return ret;
+        } else if (n == 0) {
+            break;
+        }
+
+        *bytes_written += n;
+    }
+
+    if (*positional) {
+        return MB_FILE_OK;
+    }
+
+    ret = mb_file_seek(file, offset, SEEK_SET, nullptr);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    return mb_file_write_fully(file, buf, size, bytes_written);
+}
+
+/*!
+ * \brief Copy a block with mb_file_copy() for mb_file_move()
+ *
+ * If the handle does not support in-kernel copies, \p *in_kernel is set to
+ * false. \p *bytes_copied is less than \p size if that happens or if the end
+ * of file is reached.
+ */
+static int copy_fully_at(struct MbFile *file, uint64_t src, uint64_t dest,
+                         uint64_t size, bool *in_kernel,
+                         uint64_t *bytes_copied)
+{
+    uint64_t n;
+    int ret;
+
+    *bytes_copied = 0;
+
+    while (*bytes_copied < size) {
+        ret = mb_file_copy(file, src + *bytes_copied, dest + *bytes_copied,
+                           size - *bytes_copied, &n);
+        if (ret == MB_FILE_RETRY) {
+            continue;
+        } else if (ret == MB_FILE_UNSUPPORTED) {
+            *in_kernel = false;
+            break;
+        } else if (ret < 0) {
+            return ret;
+        } else if (n == 0) {
+            break;
+        }
+
+        *bytes_copied += n;
+    }
+
+    return MB_FILE_OK;
+}
+
 /*!
  * \brief Move data in file
  *
@@ -410,9 +537,18 @@ done:
  * case where \p src == \p dest or \p size == 0, no operation will be performed,
  * but the function will return #MB_BI_OK and set \p size_moved accordingly.
  *
- * \note This function is very seek-heavy and may be slow if the handle cannot
- *       seek efficiently. It will perform two seeks per loop interation. Each
- *       iteration moves up to 10240 bytes.
+ * If the handle supports mb_file_copy() (eg. the fd backend on Linux), the data
+ * is copied by the kernel in blocks no larger than the distance between
+ * \p src and \p dest, so that no block overlaps its own source or any data
+ * that has not been moved yet. This is only done if the blocks are at least as
+ * large as the buffer used otherwise. If a block cannot be copied in its
+ * entirety, the in-kernel copy is abandoned and that block and the remaining
+ * data are moved through a buffer.
+ *
+ * \note If the handle supports mb_file_pread() and mb_file_pwrite(), those are
+ *       used and the file position is not changed. Otherwise, this function
+ *       performs two seeks per loop interation and the file position is left
+ *       unspecified. Each iteration moves up to 1 MiB.
  *
  * \note If \p *size_moved is less than \p size, then the *first* \p *size_moved
  *       bytes have been copied from offset \p src to offset \p dest. This is
@@ -431,10 +567,15 @@ done:
 int mb_file_move(struct MbFile *file, uint64_t src, uint64_t dest,
                  uint64_t size, uint64_t *size_moved)
 {
-    char buf[10240];
+    char *buf = nullptr;
+    size_t buf_size;
+    uint64_t distance;
+    uint64_t n_copied;
     size_t n_read;
     size_t n_written;
-    int ret;
+    bool in_kernel;
+    bool positional = true;
+    int ret = MB_FILE_OK;
 
     // Check if we need to do anything
     if (src == dest || size == 0) {
@@ -450,36 +591,63 @@ int mb_file_move(struct MbFile *file, uint64_t src, uint64_t dest,
 
     *size_moved = 0;
 
+    // Blocks are processed in the same order as the buffered copy below, so
+    // the buffered copy can take over at any block boundary
+    distance = src < dest ? dest - src : src - dest;
+    in_kernel = distance >= std::min<uint64_t>(size, MOVE_BUFFER_SIZE);
+
+    while (in_kernel && *size_moved < size) {
+        uint64_t block = std::min(distance, size - *size_moved);
+        uint64_t offset = dest < src
+                ? *size_moved
+                : size - *size_moved - block;
+
+        ret = copy_fully_at(file, src + offset, dest + offset, block,
+                            &in_kernel, &n_copied);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        } else if (n_copied < block) {
+            // Hit EOF or the handle can't copy. The block will be redone with
+            // the buffer, which handles EOF the same way as before.
+            in_kernel = false;
+            break;
+        }
+
+        *size_moved += n_copied;
+    }
+
+    if (*size_moved == size) {
+        return MB_FILE_OK;
+    }
+
+    buf_size = std::min<uint64_t>(MOVE_BUFFER_SIZE, size - *size_moved);
+    buf = static_cast<char *>(malloc(buf_size));
+    if (!buf) {
+        mb_file_set_error(file, -errno, "Failed to allocate buffer: %s",
+                          strerror(errno));
+        return MB_FILE_FAILED;
+    }
+
     if (dest < src) {
         // Copy forwards
         while (*size_moved < size) {
             size_t to_read = std::min<uint64_t>(
-                    sizeof(buf), size - *size_moved);
-
-            // Seek to source offset
-            ret = mb_file_seek(file, src + *size_moved, SEEK_SET, nullptr);
-            if (ret != MB_FILE_OK) {
-                return ret;
-            }
+                    buf_size, size - *size_moved);
 
             // Read data from source
-            ret = mb_file_read_fully(file, buf, to_read, &n_read);
+            ret = read_fully_at(file, buf, to_read, src + *size_moved,
+                                &positional, &n_read);
             if (ret != MB_FILE_OK) {
-                return ret;
+                goto done;
             } else if (n_read == 0) {
                 break;
             }
 
-            // Seek to destination offset
-            ret = mb_file_seek(file, dest + *size_moved, SEEK_SET, nullptr);
-            if (ret != MB_FILE_OK) {
-                return ret;
-            }
-
             // Write data to destination
-            ret = mb_file_write_fully(file, buf, n_read, &n_written);
+            ret = write_fully_at(file, buf, n_read, dest + *size_moved,
+                                 &positional, &n_written);
             if (ret != MB_FILE_OK) {
-                return ret;
+                goto done;
             }
 
             *size_moved += n_written;
@@ -492,34 +660,24 @@ int mb_file_move(struct MbFile *file, uint64_t src, uint64_t dest,
         // Copy backwards
         while (*size_moved < size) {
             size_t to_read = std::min<uint64_t>(
-                    sizeof(buf), size - *size_moved);
-
-            // Seek to source offset
-            ret = mb_file_seek(file, src + size - *size_moved - to_read,
-                               SEEK_SET, nullptr);
-            if (ret != MB_FILE_OK) {
-                return ret;
-            }
+                    buf_size, size - *size_moved);
 
             // Read data form source
-            ret = mb_file_read_fully(file, buf, to_read, &n_read);
+            ret = read_fully_at(file, buf, to_read,
+                                src + size - *size_moved - to_read,
+                                &positional, &n_read);
             if (ret != MB_FILE_OK) {
-                return ret;
+                goto done;
             } else if (n_read == 0) {
                 break;
             }
 
-            // Seek to destination offset
-            ret = mb_file_seek(file, dest + size - *size_moved - n_read,
-                               SEEK_SET, nullptr);
-            if (ret != MB_FILE_OK) {
-                return ret;
-            }
-
             // Write data to destination
-            ret = mb_file_write_fully(file, buf, n_read, &n_written);
+            ret = write_fully_at(file, buf, n_read,
+                                 dest + size - *size_moved - n_read,
+                                 &positional, &n_written);
             if (ret != MB_FILE_OK) {
-                return ret;
+                goto done;
             }
 
             *size_moved += n_written;
@@ -531,7 +689,9 @@ int mb_file_move(struct MbFile *file, uint64_t src, uint64_t dest,
         }
     }
 
-    return MB_FILE_OK;
+done:
+    free(buf);
+    return ret;
 }
 
 MB_END_C_DECLS
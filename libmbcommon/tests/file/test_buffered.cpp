@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+struct FileBufferedTest : testing::Test
+{
+    MbFile *_file;
+    MbFile *_inner;
+
+    std::string _data;
+    size_t _pos = 0;
+
+    unsigned int _n_read = 0;
+    unsigned int _n_write = 0;
+    unsigned int _n_seek = 0;
+    unsigned int _n_truncate = 0;
+    unsigned int _n_pread = 0;
+    bool _closed = false;
+
+    FileBufferedTest() : _file(mb_file_new()), _inner(mb_file_new())
+    {
+    }
+
+    virtual ~FileBufferedTest()
+    {
+        mb_file_free(_file);
+        mb_file_free(_inner);
+    }
+
+    virtual void SetUp()
+    {
+        ASSERT_EQ(mb_file_set_pread_callback(_inner, &_pread_cb), MB_FILE_OK);
+        ASSERT_EQ(mb_file_open_callbacks(_inner, nullptr, &_close_cb,
+                                         &_read_cb, &_write_cb, &_seek_cb,
+                                         &_truncate_cb, this), MB_FILE_OK);
+    }
+
+    static int _close_cb(MbFile *file, void *userdata)
+    {
+        (void) file;
+        static_cast<FileBufferedTest *>(userdata)->_closed = true;
+        return MB_FILE_OK;
+    }
+
+    static int _read_cb(MbFile *file, void *userdata,
+                        void *buf, size_t size,
+                        size_t *bytes_read)
+    {
+        (void) file;
+        FileBufferedTest *test = static_cast<FileBufferedTest *>(userdata);
+        ++test->_n_read;
+
+        size_t n = 0;
+        if (test->_pos < test->_data.size()) {
+            n = std::min(size, test->_data.size() - test->_pos);
+        }
+        memcpy(buf, test->_data.data() + test->_pos, n);
+        test->_pos += n;
+
+        *bytes_read = n;
+        return MB_FILE_OK;
+    }
+
+    static int _write_cb(MbFile *file, void *userdata,
+                         const void *buf, size_t size,
+                         size_t *bytes_written)
+    {
+        (void) file;
+        FileBufferedTest *test = static_cast<FileBufferedTest *>(userdata);
+        ++test->_n_write;
+
+        if (test->_pos + size > test->_data.size()) {
+            test->_data.resize(test->_pos + size);
+        }
+        test->_data.replace(test->_pos, size,
+                            static_cast<const char *>(buf), size);
+        test->_pos += size;
+
+        *bytes_written = size;
+        return MB_FILE_OK;
+    }
+
+    static int _seek_cb(MbFile *file, void *userdata,
+                        int64_t offset, int whence,
+                        uint64_t *new_offset)
+    {
+        FileBufferedTest *test = static_cast<FileBufferedTest *>(userdata);
+        ++test->_n_seek;
+
+        int64_t base;
+        switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = test->_pos;
+            break;
+        case SEEK_END:
+            base = test->_data.size();
+            break;
+        default:
+            base = -1;
+            break;
+        }
+
+        if (base < 0 || base + offset < 0) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Invalid seek");
+            return MB_FILE_FAILED;
+        }
+
+        *new_offset = test->_pos = base + offset;
+        return MB_FILE_OK;
+    }
+
+    static int _truncate_cb(MbFile *file, void *userdata,
+                            uint64_t size)
+    {
+        (void) file;
+        FileBufferedTest *test = static_cast<FileBufferedTest *>(userdata);
+        ++test->_n_truncate;
+
+        test->_data.resize(size);
+        return MB_FILE_OK;
+    }
+
+    static int _pread_cb(MbFile *file, void *userdata,
+                         void *buf, size_t size, uint64_t offset,
+                         size_t *bytes_read)
+    {
+        (void) file;
+        FileBufferedTest *test = static_cast<FileBufferedTest *>(userdata);
+        ++test->_n_pread;
+
+        size_t n = 0;
+        if (offset < test->_data.size()) {
+            n = std::min<uint64_t>(size, test->_data.size() - offset);
+        }
+        memcpy(buf, test->_data.data() + offset, n);
+
+        *bytes_read = n;
+        return MB_FILE_OK;
+    }
+};
+
+TEST_F(FileBufferedTest, SmallReadsAreCoalesced)
+{
+    _data = "abcdefghijklmnopqrstuvwxyz";
+
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 8), MB_FILE_OK);
+
+    std::string out;
+    char c;
+    size_t n;
+
+    while (mb_file_read(_file, &c, 1, &n) == MB_FILE_OK && n > 0) {
+        out += c;
+    }
+
+    ASSERT_EQ(out, _data);
+    // 4 reads to fill the buffer and 1 read to reach EOF
+    ASSERT_EQ(_n_read, 5u);
+}
+
+TEST_F(FileBufferedTest, LargeReadBypassesBuffer)
+{
+    _data = "abcdefghijklmnopqrstuvwxyz";
+
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 8), MB_FILE_OK);
+
+    char buf[26];
+    size_t n;
+
+    ASSERT_EQ(mb_file_read(_file, buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(n, 26u);
+    ASSERT_EQ(std::string(buf, n), _data);
+    ASSERT_EQ(_n_read, 1u);
+}
+
+TEST_F(FileBufferedTest, SmallWritesAreCoalesced)
+{
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 8), MB_FILE_OK);
+
+    size_t n;
+
+    for (char c = 'a'; c <= 'z'; ++c) {
+        ASSERT_EQ(mb_file_write(_file, &c, 1, &n), MB_FILE_OK);
+        ASSERT_EQ(n, 1u);
+    }
+    ASSERT_EQ(_n_write, 3u);
+    ASSERT_EQ(_data, "abcdefghijklmnopqrstuvwx");
+
+    ASSERT_EQ(mb_file_close(_file), MB_FILE_OK);
+    ASSERT_EQ(_n_write, 4u);
+    ASSERT_EQ(_data, "abcdefghijklmnopqrstuvwxyz");
+    ASSERT_FALSE(_closed);
+}
+
+TEST_F(FileBufferedTest, SeekFlushesWrites)
+{
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 8), MB_FILE_OK);
+
+    size_t n;
+    uint64_t offset;
+
+    ASSERT_EQ(mb_file_write(_file, "abc", 3, &n), MB_FILE_OK);
+    ASSERT_EQ(_n_write, 0u);
+
+    ASSERT_EQ(mb_file_seek(_file, 1, SEEK_SET, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 1u);
+    ASSERT_EQ(_data, "abc");
+
+    // Querying the position does not touch the inner file
+    ASSERT_EQ(mb_file_write(_file, "X", 1, &n), MB_FILE_OK);
+    unsigned int n_seek = _n_seek;
+    ASSERT_EQ(mb_file_seek(_file, 0, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 2u);
+    ASSERT_EQ(_n_seek, n_seek);
+    ASSERT_EQ(_data, "abc");
+
+    ASSERT_EQ(mb_file_close(_file), MB_FILE_OK);
+    ASSERT_EQ(_data, "aXc");
+}
+
+TEST_F(FileBufferedTest, SeekWithinReadBuffer)
+{
+    _data = "abcdefghijklmnopqrstuvwxyz";
+
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 16), MB_FILE_OK);
+
+    char buf[4];
+    size_t n;
+    uint64_t offset;
+
+    ASSERT_EQ(mb_file_seek(_file, 4, SEEK_SET, &offset), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "ef");
+    ASSERT_EQ(_n_read, 1u);
+    ASSERT_EQ(_n_seek, 1u);
+
+    ASSERT_EQ(mb_file_seek(_file, 10, SEEK_SET, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 10u);
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "kl");
+
+    ASSERT_EQ(mb_file_seek(_file, -8, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 4u);
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "ef");
+
+    ASSERT_EQ(_n_read, 1u);
+    ASSERT_EQ(_n_seek, 1u);
+
+    // Outside of the buffer
+    ASSERT_EQ(mb_file_seek(_file, 2, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 8u);
+    ASSERT_EQ(mb_file_seek(_file, -2, SEEK_END, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 24u);
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "yz");
+    ASSERT_EQ(_n_seek, 2u);
+}
+
+TEST_F(FileBufferedTest, SeekCurOutsideReadBuffer)
+{
+    _data = "abcdefghijklmnopqrstuvwxyz";
+
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 8), MB_FILE_OK);
+
+    char buf[2];
+    size_t n;
+    uint64_t offset;
+
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "ab");
+
+    // Position is not yet known, so the inner file has to be seeked
+    ASSERT_EQ(mb_file_seek(_file, 10, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 12u);
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "mn");
+}
+
+TEST_F(FileBufferedTest, WriteAfterRead)
+{
+    _data = "abcdefghijklmnopqrstuvwxyz";
+
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 8), MB_FILE_OK);
+
+    char buf[2];
+    size_t n;
+
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write(_file, "XY", 2, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "ef");
+
+    ASSERT_EQ(mb_file_close(_file), MB_FILE_OK);
+    ASSERT_EQ(_data, "abXYefghijklmnopqrstuvwxyz");
+}
+
+TEST_F(FileBufferedTest, TruncateFlushesWrites)
+{
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 8), MB_FILE_OK);
+
+    size_t n;
+
+    ASSERT_EQ(mb_file_write(_file, "abcdef", 6, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_truncate(_file, 3), MB_FILE_OK);
+    ASSERT_EQ(_data, "abc");
+    ASSERT_EQ(_n_truncate, 1u);
+}
+
+TEST_F(FileBufferedTest, OwnedInnerFileIsClosed)
+{
+    MbFile *inner = _inner;
+    _inner = nullptr;
+
+    ASSERT_EQ(mb_file_open_buffered(_file, inner, true, 0), MB_FILE_OK);
+    ASSERT_EQ(mb_file_close(_file), MB_FILE_OK);
+    ASSERT_TRUE(_closed);
+}
+
+TEST_F(FileBufferedTest, PositionalIoFlushesWrites)
+{
+    MbFile *inner = mb_file_new();
+    ASSERT_TRUE(!!inner);
+    void *data = nullptr;
+    size_t size = 0;
+    ASSERT_EQ(mb_file_open_memory_dynamic(inner, &data, &size), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_open_buffered(_file, inner, true, 8), MB_FILE_OK);
+
+    char buf[4];
+    size_t n;
+    uint64_t offset;
+
+    ASSERT_EQ(mb_file_write(_file, "abcdef", 6, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_pread(_file, buf, sizeof(buf), 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "cdef");
+
+    ASSERT_EQ(mb_file_seek(_file, 0, SEEK_SET, &offset), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "ab");
+
+    // Read-ahead data must not be stale after a positional write
+    ASSERT_EQ(mb_file_pwrite(_file, "XY", 2, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "XY");
+
+    ASSERT_EQ(mb_file_close(_file), MB_FILE_OK);
+    free(data);
+}
+
+TEST_F(FileBufferedTest, SmallPositionalReadsAreCoalesced)
+{
+    _data = "abcdefghijklmnopqrstuvwxyz";
+
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 8), MB_FILE_OK);
+
+    char buf[8];
+    size_t n;
+
+    // Buffer is filled with [2, 10)
+    ASSERT_EQ(mb_file_pread(_file, buf, 2, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "cd");
+    ASSERT_EQ(mb_file_pread(_file, buf, 4, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "efgh");
+    ASSERT_EQ(mb_file_pread(_file, buf, 4, 8, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "ij");
+    ASSERT_EQ(_n_pread, 1u);
+
+    // Offsets outside of the buffer refill it
+    ASSERT_EQ(mb_file_pread(_file, buf, 2, 0, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "ab");
+    ASSERT_EQ(_n_pread, 2u);
+
+    // Reads that would fill the whole buffer bypass it
+    ASSERT_EQ(mb_file_pread(_file, buf, 8, 10, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "klmnopqr");
+    ASSERT_EQ(_n_pread, 3u);
+
+    ASSERT_EQ(mb_file_pread(_file, buf, 1, 26, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0u);
+
+    // The file position is not used
+    ASSERT_EQ(_n_read, 0u);
+    ASSERT_EQ(_n_seek, 0u);
+}
+
+TEST_F(FileBufferedTest, PositionalReadAfterWrite)
+{
+    _data = "abcdefghijklmnopqrstuvwxyz";
+
+    ASSERT_EQ(mb_file_open_buffered(_file, _inner, false, 8), MB_FILE_OK);
+
+    char buf[4];
+    size_t n;
+    uint64_t offset;
+
+    ASSERT_EQ(mb_file_pread(_file, buf, sizeof(buf), 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "cdef");
+
+    // The write replaces the buffered data, which must not be reused
+    ASSERT_EQ(mb_file_seek(_file, 3, SEEK_SET, &offset), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write(_file, "XY", 2, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_pread(_file, buf, sizeof(buf), 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "cXYf");
+    ASSERT_EQ(_n_pread, 2u);
+}
@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/compressed.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+static const int all_formats[] = {
+    MB_FILE_COMPRESSION_GZIP,
+    MB_FILE_COMPRESSION_ZLIB,
+    MB_FILE_COMPRESSION_XZ,
+    MB_FILE_COMPRESSION_LZ4,
+    MB_FILE_COMPRESSION_LZ4_LEGACY,
+};
+
+struct FileCompressedTest : testing::Test
+{
+    MbFile *_file;
+    MbFile *_inner;
+
+    FileCompressedTest() : _file(mb_file_new()), _inner(mb_file_new())
+    {
+    }
+
+    virtual ~FileCompressedTest()
+    {
+        mb_file_free(_file);
+        mb_file_free(_inner);
+    }
+
+    void reset()
+    {
+        mb_file_free(_file);
+        mb_file_free(_inner);
+        _file = mb_file_new();
+        _inner = mb_file_new();
+    }
+
+    static std::string make_data(size_t size)
+    {
+        std::string data;
+        data.reserve(size);
+
+        // Compressible, but not trivially so
+        unsigned int state = 1;
+        while (data.size() < size) {
+            state = state * 1103515245 + 12345;
+            data += "line ";
+            data += std::to_string((state >> 16) % 1000);
+            data += '\n';
+        }
+        data.resize(size);
+
+        return data;
+    }
+
+    std::string compress(int format, int level, unsigned int threads,
+                         const std::string &data)
+    {
+        MbFile *file = mb_file_new();
+        MbFile *inner = mb_file_new();
+        void *buf = nullptr;
+        size_t size = 0;
+        size_t n;
+
+        EXPECT_EQ(mb_file_open_memory_dynamic(inner, &buf, &size),
+                  MB_FILE_OK);
+        EXPECT_EQ(mb_file_open_compressor(file, inner, true, format, level,
+                                          threads), MB_FILE_OK)
+                << mb_file_error_string(file);
+
+        // Write in odd-sized pieces
+        for (size_t pos = 0; pos < data.size(); pos += n) {
+            EXPECT_EQ(mb_file_write(file, data.data() + pos,
+                                    std::min<size_t>(data.size() - pos, 7777),
+                                    &n), MB_FILE_OK)
+                    << mb_file_error_string(file);
+            if (n == 0) {
+                break;
+            }
+        }
+
+        EXPECT_EQ(mb_file_close(file), MB_FILE_OK)
+                << mb_file_error_string(file);
+        mb_file_free(file);
+
+        std::string result(static_cast<char *>(buf), size);
+        free(buf);
+        return result;
+    }
+
+    int decompress(int format, const std::string &data, std::string *out)
+    {
+        int ret;
+        size_t n;
+        char buf[10000];
+
+        out->clear();
+
+        ret = mb_file_open_memory_static(_inner, data.data(), data.size());
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+
+        ret = mb_file_open_decompressor(_file, _inner, false, format);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+
+        while ((ret = mb_file_read(_file, buf, sizeof(buf), &n)) == MB_FILE_OK
+                && n > 0) {
+            out->append(buf, n);
+        }
+
+        return ret;
+    }
+};
+
+TEST_F(FileCompressedTest, RoundTripAllFormats)
+{
+    std::string data = make_data(300000);
+
+    for (int format : all_formats) {
+        SCOPED_TRACE(format);
+
+        std::string compressed = compress(format, -1, 0, data);
+        ASSERT_FALSE(compressed.empty());
+        ASSERT_LT(compressed.size(), data.size());
+
+        std::string result;
+        ASSERT_EQ(decompress(format, compressed, &result), MB_FILE_OK)
+                << mb_file_error_string(_file);
+        ASSERT_EQ(result, data);
+
+        reset();
+    }
+}
+
+TEST_F(FileCompressedTest, RoundTripEmpty)
+{
+    for (int format : all_formats) {
+        SCOPED_TRACE(format);
+
+        std::string compressed = compress(format, -1, 0, std::string());
+        ASSERT_FALSE(compressed.empty());
+
+        std::string result("x");
+        ASSERT_EQ(decompress(format, compressed, &result), MB_FILE_OK)
+                << mb_file_error_string(_file);
+        ASSERT_TRUE(result.empty());
+
+        reset();
+    }
+}
+
+TEST_F(FileCompressedTest, AutoDetectFormat)
+{
+    std::string data = make_data(50000);
+
+    for (int format : all_formats) {
+        SCOPED_TRACE(format);
+
+        std::string compressed = compress(format, -1, 0, data);
+
+        std::string result;
+        ASSERT_EQ(decompress(MB_FILE_COMPRESSION_AUTO, compressed, &result),
+                  MB_FILE_OK) << mb_file_error_string(_file);
+        ASSERT_EQ(result, data);
+
+        reset();
+    }
+}
+
+TEST_F(FileCompressedTest, AutoDetectUnknownFormat)
+{
+    std::string result;
+    ASSERT_EQ(decompress(MB_FILE_COMPRESSION_AUTO, "not compressed", &result),
+              MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), MB_FILE_ERROR_UNSUPPORTED);
+}
+
+TEST_F(FileCompressedTest, MultithreadedXz)
+{
+    std::string data = make_data(3 * 1024 * 1024);
+
+    std::string compressed = compress(MB_FILE_COMPRESSION_XZ, 0, 4, data);
+
+    std::string result;
+    ASSERT_EQ(decompress(MB_FILE_COMPRESSION_XZ, compressed, &result),
+              MB_FILE_OK) << mb_file_error_string(_file);
+    ASSERT_EQ(result, data);
+}
+
+TEST_F(FileCompressedTest, MultithreadedLz4Legacy)
+{
+    // Spans several 8 MiB blocks and more than one batch of blocks
+    std::string data = make_data(20 * 1024 * 1024 + 123);
+
+    std::string single = compress(MB_FILE_COMPRESSION_LZ4_LEGACY, -1, 1, data);
+    std::string multi = compress(MB_FILE_COMPRESSION_LZ4_LEGACY, -1, 2, data);
+
+    // Blocks are compressed independently, so the output is identical
+    ASSERT_EQ(single, multi);
+
+    std::string result;
+    ASSERT_EQ(decompress(MB_FILE_COMPRESSION_LZ4_LEGACY, multi, &result),
+              MB_FILE_OK) << mb_file_error_string(_file);
+    ASSERT_EQ(result, data);
+}
+
+TEST_F(FileCompressedTest, ReadZlibCompatibleGzip)
+{
+    std::string data = make_data(100000);
+
+    // Compress with zlib directly
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    ASSERT_EQ(deflateInit2(&strm, 9, Z_DEFLATED, 15 + 16, 8,
+                           Z_DEFAULT_STRATEGY), Z_OK);
+
+    std::string compressed(deflateBound(&strm, data.size()), '\0');
+    strm.next_in = reinterpret_cast<Bytef *>(&data[0]);
+    strm.avail_in = data.size();
+    strm.next_out = reinterpret_cast<Bytef *>(&compressed[0]);
+    strm.avail_out = compressed.size();
+    ASSERT_EQ(deflate(&strm, Z_FINISH), Z_STREAM_END);
+    compressed.resize(strm.total_out);
+    deflateEnd(&strm);
+
+    std::string result;
+    ASSERT_EQ(decompress(MB_FILE_COMPRESSION_GZIP, compressed, &result),
+              MB_FILE_OK) << mb_file_error_string(_file);
+    ASSERT_EQ(result, data);
+}
+
+TEST_F(FileCompressedTest, TrailingDataIsIgnored)
+{
+    std::string data = make_data(10000);
+
+    for (int format : all_formats) {
+        SCOPED_TRACE(format);
+
+        std::string compressed = compress(format, -1, 0, data);
+        // Like the padding after a ramdisk in a boot image
+        compressed.append(4096, '\xff');
+
+        std::string result;
+        ASSERT_EQ(decompress(format, compressed, &result), MB_FILE_OK)
+                << mb_file_error_string(_file);
+        ASSERT_EQ(result, data);
+
+        reset();
+    }
+}
+
+TEST_F(FileCompressedTest, TruncatedStreamFails)
+{
+    std::string data = make_data(100000);
+
+    for (int format : all_formats) {
+        SCOPED_TRACE(format);
+
+        std::string compressed = compress(format, -1, 0, data);
+        compressed.resize(compressed.size() / 2);
+
+        std::string result;
+        ASSERT_EQ(decompress(format, compressed, &result), MB_FILE_FAILED);
+
+        reset();
+    }
+}
+
+TEST_F(FileCompressedTest, SeekOnlyReportsPosition)
+{
+    std::string data = make_data(10000);
+    std::string compressed = compress(MB_FILE_COMPRESSION_GZIP, -1, 0, data);
+    char buf[100];
+    size_t n;
+    uint64_t pos;
+
+    ASSERT_EQ(mb_file_open_memory_static(_inner, compressed.data(),
+                                         compressed.size()), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_decompressor(_file, _inner, false,
+                                        MB_FILE_COMPRESSION_GZIP), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_read_fully(_file, buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(n, sizeof(buf));
+
+    ASSERT_EQ(mb_file_seek(_file, 0, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, sizeof(buf));
+
+    ASSERT_EQ(mb_file_seek(_file, 0, SEEK_SET, &pos), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(mb_file_error(_file), MB_FILE_ERROR_UNSUPPORTED);
+
+    // Writing is not supported
+    ASSERT_EQ(mb_file_write(_file, buf, sizeof(buf), &n), MB_FILE_UNSUPPORTED);
+}
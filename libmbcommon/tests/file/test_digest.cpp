@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdlib>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/digest.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+static std::string hex(const unsigned char *data, size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+
+    for (size_t i = 0; i < size; ++i) {
+        result += digits[data[i] >> 4];
+        result += digits[data[i] & 0xf];
+    }
+
+    return result;
+}
+
+struct FileDigestTest : testing::Test
+{
+    MbFile *_file;
+
+    FileDigestTest() : _file(mb_file_new())
+    {
+    }
+
+    virtual ~FileDigestTest()
+    {
+        mb_file_free(_file);
+    }
+
+    std::string digest(int type)
+    {
+        unsigned char buf[MB_FILE_DIGEST_MAX_SIZE];
+        size_t n;
+
+        EXPECT_EQ(mb_file_digest(_file, type, buf, sizeof(buf), &n),
+                  MB_FILE_OK) << mb_file_error_string(_file);
+        return hex(buf, n);
+    }
+};
+
+TEST_F(FileDigestTest, SinkComputesKnownDigests)
+{
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_digest(_file, nullptr, false, nullptr,
+                                  MB_FILE_DIGEST_SHA1 | MB_FILE_DIGEST_SHA256
+                                  | MB_FILE_DIGEST_SHA512), MB_FILE_OK);
+
+    // Split across writes
+    ASSERT_EQ(mb_file_write(_file, "a", 1, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1u);
+    ASSERT_EQ(mb_file_write(_file, "bc", 2, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 2u);
+
+    ASSERT_EQ(digest(MB_FILE_DIGEST_SHA1),
+              "a9993e364706816aba3e25717850c26c9cd0d89d");
+    ASSERT_EQ(digest(MB_FILE_DIGEST_SHA256),
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    ASSERT_EQ(digest(MB_FILE_DIGEST_SHA512),
+              "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+              "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f");
+}
+
+TEST_F(FileDigestTest, SinkComputesCrc32)
+{
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_digest(_file, nullptr, false, nullptr,
+                                  MB_FILE_DIGEST_CRC32), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write_fully(_file, "123456789", 9, &n), MB_FILE_OK);
+
+    ASSERT_EQ(digest(MB_FILE_DIGEST_CRC32), "cbf43926");
+}
+
+TEST_F(FileDigestTest, DigestCanBeQueriedMidStream)
+{
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_digest(_file, nullptr, false, nullptr,
+                                  MB_FILE_DIGEST_SHA1), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_write_fully(_file, "ab", 2, &n), MB_FILE_OK);
+    ASSERT_EQ(digest(MB_FILE_DIGEST_SHA1),
+              "da23614e02469a0d7c7bd1bdab5c9c474b1904dc");
+
+    ASSERT_EQ(mb_file_write_fully(_file, "c", 1, &n), MB_FILE_OK);
+    ASSERT_EQ(digest(MB_FILE_DIGEST_SHA1),
+              "a9993e364706816aba3e25717850c26c9cd0d89d");
+}
+
+TEST_F(FileDigestTest, ReadThroughInnerWithTee)
+{
+    std::string data(100000, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 7);
+    }
+
+    MbFile *inner = mb_file_new();
+    MbFile *tee = mb_file_new();
+    void *tee_buf = nullptr;
+    size_t tee_size = 0;
+    char buf[4096];
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_memory_static(inner, data.data(), data.size()),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_memory_dynamic(tee, &tee_buf, &tee_size),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_digest(_file, inner, true, tee,
+                                  MB_FILE_DIGEST_CRC32 | MB_FILE_DIGEST_SHA1),
+              MB_FILE_OK);
+
+    while (mb_file_read(_file, buf, sizeof(buf), &n) == MB_FILE_OK && n > 0);
+
+    // Same data written to a sink gives the same digests
+    MbFile *sink = mb_file_new();
+    ASSERT_EQ(mb_file_open_digest(sink, nullptr, false, nullptr,
+                                  MB_FILE_DIGEST_CRC32 | MB_FILE_DIGEST_SHA1),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_write_fully(sink, data.data(), data.size(), &n),
+              MB_FILE_OK);
+
+    for (int type : { MB_FILE_DIGEST_CRC32, MB_FILE_DIGEST_SHA1 }) {
+        unsigned char expected[MB_FILE_DIGEST_MAX_SIZE];
+        size_t expected_size;
+        ASSERT_EQ(mb_file_digest(sink, type, expected, sizeof(expected),
+                                 &expected_size), MB_FILE_OK);
+        ASSERT_EQ(digest(type), hex(expected, expected_size));
+    }
+
+    mb_file_free(sink);
+
+    ASSERT_EQ(mb_file_close(_file), MB_FILE_OK);
+    ASSERT_EQ(mb_file_close(tee), MB_FILE_OK);
+    mb_file_free(tee);
+
+    ASSERT_EQ(std::string(static_cast<char *>(tee_buf), tee_size), data);
+    free(tee_buf);
+}
+
+TEST_F(FileDigestTest, WriteThroughInner)
+{
+    MbFile *inner = mb_file_new();
+    void *buf = nullptr;
+    size_t size = 0;
+    size_t n;
+    uint64_t pos;
+
+    ASSERT_EQ(mb_file_open_memory_dynamic(inner, &buf, &size), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_digest(_file, inner, true, nullptr,
+                                  MB_FILE_DIGEST_SHA256), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_write_fully(_file, "abc", 3, &n), MB_FILE_OK);
+
+    // Seeks go to the inner file
+    ASSERT_EQ(mb_file_seek(_file, 0, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 3u);
+
+    ASSERT_EQ(digest(MB_FILE_DIGEST_SHA256),
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    ASSERT_EQ(mb_file_close(_file), MB_FILE_OK);
+
+    ASSERT_EQ(std::string(static_cast<char *>(buf), size), "abc");
+    free(buf);
+}
+
+TEST_F(FileDigestTest, SinkOnlySupportsWritingAndTell)
+{
+    char buf[10];
+    size_t n;
+    uint64_t pos;
+
+    ASSERT_EQ(mb_file_open_digest(_file, nullptr, false, nullptr,
+                                  MB_FILE_DIGEST_SHA1), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write_fully(_file, "abcde", 5, &n), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_seek(_file, 0, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 5u);
+
+    ASSERT_EQ(mb_file_seek(_file, 0, SEEK_SET, &pos), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(mb_file_read(_file, buf, sizeof(buf), &n), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(mb_file_truncate(_file, 0), MB_FILE_UNSUPPORTED);
+}
+
+TEST_F(FileDigestTest, InvalidDigestRequests)
+{
+    unsigned char buf[MB_FILE_DIGEST_MAX_SIZE];
+
+    // Not a digest file
+    MbFile *other = mb_file_new();
+    ASSERT_EQ(mb_file_open_memory_static(other, "", 0), MB_FILE_OK);
+    ASSERT_EQ(mb_file_digest(other, MB_FILE_DIGEST_SHA1, buf, sizeof(buf),
+                             nullptr), MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(other), MB_FILE_ERROR_INVALID_ARGUMENT);
+    mb_file_free(other);
+
+    ASSERT_EQ(mb_file_open_digest(_file, nullptr, false, nullptr,
+                                  MB_FILE_DIGEST_SHA1), MB_FILE_OK);
+
+    // Type not enabled
+    ASSERT_EQ(mb_file_digest(_file, MB_FILE_DIGEST_SHA256, buf, sizeof(buf),
+                             nullptr), MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), MB_FILE_ERROR_INVALID_ARGUMENT);
+
+    // Buffer too small
+    ASSERT_EQ(mb_file_digest(_file, MB_FILE_DIGEST_SHA1, buf,
+                             MB_FILE_DIGEST_SHA1_SIZE - 1, nullptr),
+              MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), MB_FILE_ERROR_INVALID_ARGUMENT);
+}
@@ -44,6 +44,14 @@ struct FileFdTest : testing::Test
     int _n_lseek64 = 0;
     int _n_read = 0;
     int _n_write = 0;
+#ifndef _WIN32
+    int _n_pread64 = 0;
+    int _n_pwrite64 = 0;
+#endif
+#ifdef __linux__
+    int _n_copy_file_range = 0;
+    int _n_ficlonerange = 0;
+#endif
 
     FileFdTest() : _file(mb_file_new())
     {
@@ -59,6 +67,14 @@ struct FileFdTest : testing::Test
         _vtable.fn_lseek64 = _lseek64;
         _vtable.fn_read = _read;
         _vtable.fn_write = _write;
+#ifndef _WIN32
+        _vtable.fn_pread64 = _pread64;
+        _vtable.fn_pwrite64 = _pwrite64;
+#endif
+#ifdef __linux__
+        _vtable.fn_copy_file_range = _copy_file_range;
+        _vtable.fn_ficlonerange = _ficlonerange;
+#endif
 
         _vtable.userdata = this;
     }
@@ -182,6 +198,89 @@ struct FileFdTest : testing::Test
         errno = EIO;
         return -1;
     }
+
+#ifndef _WIN32
+    static ssize_t _pread64(void *userdata, int fd, void *buf, size_t count,
+                            off64_t offset)
+    {
+        (void) fd;
+        (void) buf;
+        (void) count;
+        (void) offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pread64;
+
+        errno = EIO;
+        return -1;
+    }
+
+    static ssize_t _pwrite64(void *userdata, int fd, const void *buf,
+                             size_t count, off64_t offset)
+    {
+        (void) fd;
+        (void) buf;
+        (void) count;
+        (void) offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pwrite64;
+
+        errno = EIO;
+        return -1;
+    }
+#endif
+
+#ifdef __linux__
+    static ssize_t _copy_file_range(void *userdata, int fd_in,
+                                    off64_t *off_in, int fd_out,
+                                    off64_t *off_out, size_t len,
+                                    unsigned int flags)
+    {
+        (void) fd_in;
+        (void) off_in;
+        (void) fd_out;
+        (void) off_out;
+        (void) len;
+        (void) flags;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_copy_file_range;
+
+        errno = EIO;
+        return -1;
+    }
+
+    static int _ficlonerange(void *userdata, int dest_fd, int src_fd,
+                             uint64_t src_offset, uint64_t src_length,
+                             uint64_t dest_offset)
+    {
+        (void) dest_fd;
+        (void) src_fd;
+        (void) src_offset;
+        (void) src_length;
+        (void) dest_offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_ficlonerange;
+
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    static int _fstat_file_4k(void *userdata, int fildes, struct stat *buf)
+    {
+        (void) fildes;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_fstat;
+
+        memset(buf, 0, sizeof(*buf));
+        buf->st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+        buf->st_blksize = 4096;
+        return 0;
+    }
+#endif
 };
 
 TEST_F(FileFdTest, OpenNoVtable)
@@ -736,3 +835,246 @@ TEST_F(FileFdTest, TruncateFailed)
     ASSERT_EQ(mb_file_error(_file), -EIO);
     ASSERT_EQ(_n_ftruncate64, 1);
 }
+
+#ifndef _WIN32
+#define LFS_SIZE (10ULL * 1024 * 1024 * 1024)
+TEST_F(FileFdTest, PreadSuccess)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_pread64 = [](void *userdata, int fd, void *buf, size_t count,
+                            off64_t offset) -> ssize_t {
+        (void) fd;
+        (void) buf;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pread64;
+
+        EXPECT_EQ(offset, static_cast<off64_t>(LFS_SIZE));
+
+        return count;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    char c;
+    size_t n;
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, LFS_SIZE, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(_n_pread64, 1);
+    ASSERT_EQ(_n_read, 0);
+    ASSERT_EQ(_n_lseek64, 0);
+}
+#undef LFS_SIZE
+
+TEST_F(FileFdTest, PreadFailureEINTR)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_pread64 = [](void *userdata, int fd, void *buf, size_t count,
+                            off64_t offset) -> ssize_t {
+        (void) fd;
+        (void) buf;
+        (void) count;
+        (void) offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pread64;
+
+        errno = EINTR;
+        return -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    char c;
+    size_t n;
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 0, &n), MB_FILE_RETRY);
+    ASSERT_EQ(mb_file_error(_file), -EINTR);
+    ASSERT_EQ(_n_pread64, 1);
+}
+
+TEST_F(FileFdTest, PwriteSuccess)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_pwrite64 = [](void *userdata, int fd, const void *buf,
+                             size_t count, off64_t offset) -> ssize_t {
+        (void) fd;
+        (void) buf;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pwrite64;
+
+        EXPECT_EQ(offset, 10);
+
+        return count;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    size_t n;
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 10, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(_n_pwrite64, 1);
+    ASSERT_EQ(_n_write, 0);
+    ASSERT_EQ(_n_lseek64, 0);
+}
+
+TEST_F(FileFdTest, PwriteFailure)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    size_t n;
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 0, &n), MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), -EIO);
+    ASSERT_EQ(_n_pwrite64, 1);
+}
+
+TEST_F(FileFdTest, PositionalIoUnsupportedWithoutVtableFunctions)
+{
+    _vtable.fn_fstat = _fstat_file;
+    _vtable.fn_pread64 = nullptr;
+    _vtable.fn_pwrite64 = nullptr;
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    char c;
+    size_t n;
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 0, &n), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 0, &n), MB_FILE_UNSUPPORTED);
+}
+#endif
+
+#ifdef __linux__
+TEST_F(FileFdTest, CopyShouldCloneAlignedBlocks)
+{
+    _vtable.fn_fstat = _fstat_file_4k;
+
+    _vtable.fn_ficlonerange = [](void *userdata, int dest_fd, int src_fd,
+                                 uint64_t src_offset, uint64_t src_length,
+                                 uint64_t dest_offset) -> int {
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_ficlonerange;
+
+        EXPECT_EQ(dest_fd, src_fd);
+        EXPECT_EQ(src_offset, 16384u);
+        EXPECT_EQ(src_length, 8192u);
+        EXPECT_EQ(dest_offset, 0u);
+
+        return 0;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_copy(_file, 16384, 0, 8192 + 100, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 8192u);
+    ASSERT_EQ(_n_ficlonerange, 1);
+    ASSERT_EQ(_n_copy_file_range, 0);
+}
+
+TEST_F(FileFdTest, CopyShouldFallBackToCopyFileRange)
+{
+    _vtable.fn_fstat = _fstat_file_4k;
+
+    _vtable.fn_copy_file_range = [](void *userdata, int fd_in,
+                                    off64_t *off_in, int fd_out,
+                                    off64_t *off_out, size_t len,
+                                    unsigned int flags) -> ssize_t {
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_copy_file_range;
+
+        EXPECT_EQ(fd_in, fd_out);
+        EXPECT_EQ(*off_in, 4096);
+        EXPECT_EQ(*off_out, 0);
+        EXPECT_EQ(flags, 0u);
+
+        return len;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_copy(_file, 4096, 0, 4096, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 4096u);
+    ASSERT_EQ(_n_ficlonerange, 1);
+    ASSERT_EQ(_n_copy_file_range, 1);
+
+    // Cloning is not reattempted
+    ASSERT_EQ(mb_file_copy(_file, 4096, 0, 4096, &n), MB_FILE_OK);
+    ASSERT_EQ(_n_ficlonerange, 1);
+    ASSERT_EQ(_n_copy_file_range, 2);
+}
+
+TEST_F(FileFdTest, CopyShouldBeUnsupportedIfKernelLacksSupport)
+{
+    _vtable.fn_fstat = _fstat_file_4k;
+
+    _vtable.fn_copy_file_range = [](void *userdata, int fd_in,
+                                    off64_t *off_in, int fd_out,
+                                    off64_t *off_out, size_t len,
+                                    unsigned int flags) -> ssize_t {
+        (void) fd_in;
+        (void) off_in;
+        (void) fd_out;
+        (void) off_out;
+        (void) len;
+        (void) flags;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_copy_file_range;
+
+        errno = ENOSYS;
+        return -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_copy(_file, 10, 0, 10, &n), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(mb_file_error(_file), MB_FILE_ERROR_UNSUPPORTED);
+    ASSERT_EQ(mb_file_copy(_file, 10, 0, 10, &n), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(_n_ficlonerange, 0);
+    ASSERT_EQ(_n_copy_file_range, 1);
+}
+
+TEST_F(FileFdTest, CopyFailure)
+{
+    _vtable.fn_fstat = _fstat_file_4k;
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_copy(_file, 10, 0, 10, &n), MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), -EIO);
+    ASSERT_EQ(_n_copy_file_range, 1);
+}
+
+TEST_F(FileFdTest, CopyOverlappingRegionsShouldFail)
+{
+    _vtable.fn_fstat = _fstat_file_4k;
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_copy(_file, 10, 0, 11, &n), MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), MB_FILE_ERROR_INVALID_ARGUMENT);
+    ASSERT_EQ(_n_copy_file_range, 0);
+    ASSERT_EQ(_n_ficlonerange, 0);
+}
+
+TEST_F(FileFdTest, CopyUnsupportedWithoutVtableFunctions)
+{
+    _vtable.fn_fstat = _fstat_file;
+    _vtable.fn_copy_file_range = nullptr;
+    _vtable.fn_ficlonerange = nullptr;
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_copy(_file, 10, 0, 10, &n), MB_FILE_UNSUPPORTED);
+}
+#endif
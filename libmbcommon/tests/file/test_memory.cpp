@@ -258,6 +258,49 @@ TEST(FileStaticMemoryTest, CheckTruncateUnsupported)
     ASSERT_TRUE(strstr(mb_file_error_string(file.get()), "truncate"));
 }
 
+TEST(FileStaticMemoryTest, PreadDoesNotMovePosition)
+{
+    char in[] = "abcdef";
+    size_t in_size = 6;
+    char out[4];
+    size_t out_size;
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), in, in_size), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_pread(file.get(), out, sizeof(out), 4, &out_size),
+              MB_FILE_OK);
+    ASSERT_EQ(out_size, 2);
+    ASSERT_EQ(memcmp(out, "ef", 2), 0);
+
+    ASSERT_EQ(mb_file_pread(file.get(), out, sizeof(out), 10, &out_size),
+              MB_FILE_OK);
+    ASSERT_EQ(out_size, 0);
+
+    ASSERT_EQ(mb_file_read(file.get(), out, 1, &out_size), MB_FILE_OK);
+    ASSERT_EQ(out_size, 1);
+    ASSERT_EQ(out[0], 'a');
+}
+
+TEST(FileStaticMemoryTest, PwriteOutOfBounds)
+{
+    char in[] = "abc";
+    size_t in_size = 3;
+    size_t n;
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), in, in_size), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_pwrite(file.get(), "xyz", 3, 1, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 2);
+    ASSERT_STREQ(in, "axy");
+
+    ASSERT_EQ(mb_file_pwrite(file.get(), "xyz", 3, 10, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0);
+}
+
 TEST(FileDynamicMemoryTest, OpenFile)
 {
     void *in = nullptr;
@@ -571,3 +614,26 @@ TEST(FileDynamicMemoryTest, TruncateFile)
 
     free(in);
 }
+
+TEST(FileDynamicMemoryTest, PwriteEnlargesBuffer)
+{
+    void *in = strdup("x");
+    size_t in_size = 1;
+    size_t n;
+    uint64_t pos;
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ASSERT_EQ(mb_file_open_memory_dynamic(file.get(), &in, &in_size),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_pwrite(file.get(), "yz", 2, 3, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 2);
+    ASSERT_EQ(in_size, 5);
+    ASSERT_EQ(memcmp(in, "x\0\0yz", 5), 0);
+
+    ASSERT_EQ(mb_file_seek(file.get(), 0, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 0);
+
+    free(in);
+}
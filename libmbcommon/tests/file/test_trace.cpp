@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/trace.h"
+#include "mbcommon/file_util.h"
+
+static std::string read_stream(FILE *fp)
+{
+    std::string result;
+    char buf[1024];
+    size_t n;
+
+    rewind(fp);
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        result.append(buf, n);
+    }
+
+    return result;
+}
+
+struct FileTraceTest : testing::Test
+{
+    MbFile *_file;
+    MbFile *_inner;
+    std::string _data;
+
+    FileTraceTest()
+        : _file(mb_file_new()), _inner(mb_file_new()), _data("0123456789")
+    {
+    }
+
+    virtual ~FileTraceTest()
+    {
+        mb_file_free(_file);
+        mb_file_free(_inner);
+    }
+
+    virtual void SetUp()
+    {
+        ASSERT_EQ(mb_file_open_memory_static(_inner, &_data[0], _data.size()),
+                  MB_FILE_OK);
+    }
+
+    MbFileTraceOpStats op_stats(int op)
+    {
+        MbFileTraceOpStats stats;
+        EXPECT_EQ(mb_file_trace_op_stats(_file, op, &stats), MB_FILE_OK)
+                << mb_file_error_string(_file);
+        return stats;
+    }
+
+    MbFileTraceAccessStats access_stats()
+    {
+        MbFileTraceAccessStats stats;
+        EXPECT_EQ(mb_file_trace_access_stats(_file, &stats), MB_FILE_OK)
+                << mb_file_error_string(_file);
+        return stats;
+    }
+};
+
+TEST_F(FileTraceTest, ReadsAndSeeksArePassedThroughAndCounted)
+{
+    char buf[4];
+    size_t n;
+    uint64_t pos;
+
+    ASSERT_EQ(mb_file_open_trace(_file, _inner, false, "test"), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_read(_file, buf, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "0123");
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "45");
+
+    ASSERT_EQ(mb_file_seek(_file, 1, SEEK_SET, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 1u);
+    ASSERT_EQ(mb_file_read(_file, buf, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "12");
+
+    ASSERT_EQ(mb_file_seek(_file, 5, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 8u);
+    ASSERT_EQ(mb_file_seek(_file, 0, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 8u);
+    ASSERT_EQ(mb_file_read(_file, buf, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "89");
+
+    MbFileTraceOpStats read_stats = op_stats(MB_FILE_TRACE_OP_READ);
+    ASSERT_EQ(read_stats.count, 4u);
+    ASSERT_EQ(read_stats.errors, 0u);
+    ASSERT_EQ(read_stats.bytes_requested, 12u);
+    ASSERT_EQ(read_stats.bytes, 10u);
+    ASSERT_LE(read_stats.min_ns, read_stats.max_ns);
+
+    uint64_t histogram_total = 0;
+    for (size_t i = 0; i < MB_FILE_TRACE_HISTOGRAM_SIZE; ++i) {
+        histogram_total += read_stats.histogram[i];
+    }
+    ASSERT_EQ(histogram_total, 4u);
+
+    ASSERT_EQ(op_stats(MB_FILE_TRACE_OP_SEEK).count, 3u);
+    ASSERT_EQ(op_stats(MB_FILE_TRACE_OP_WRITE).count, 0u);
+
+    // The first read starts at the initial position and is not preceded by
+    // another read
+    MbFileTraceAccessStats access = access_stats();
+    ASSERT_EQ(access.sequential, 1u);
+    ASSERT_EQ(access.nonsequential, 3u);
+    ASSERT_EQ(access.seeks_forward, 1u);
+    ASSERT_EQ(access.seeks_backward, 1u);
+    ASSERT_EQ(access.seeks_unchanged, 1u);
+    ASSERT_EQ(access.seek_distance, 10u);
+}
+
+TEST_F(FileTraceTest, PositionalAndWriteOperationsAreCounted)
+{
+    char buf[4];
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_trace(_file, _inner, false, "test"), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_write(_file, "ab", 2, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 2u);
+    ASSERT_EQ(mb_file_pread(_file, buf, 3, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "234");
+    ASSERT_EQ(mb_file_pwrite(_file, "cd", 2, 8, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 2u);
+    ASSERT_EQ(_data, "ab234567cd");
+
+    ASSERT_EQ(op_stats(MB_FILE_TRACE_OP_WRITE).bytes, 2u);
+    ASSERT_EQ(op_stats(MB_FILE_TRACE_OP_PREAD).bytes, 3u);
+    ASSERT_EQ(op_stats(MB_FILE_TRACE_OP_PWRITE).bytes, 2u);
+
+    MbFileTraceAccessStats access = access_stats();
+    ASSERT_EQ(access.sequential, 1u);
+    ASSERT_EQ(access.nonsequential, 2u);
+}
+
+TEST_F(FileTraceTest, ErrorsAreCountedAndPropagated)
+{
+    ASSERT_EQ(mb_file_open_trace(_file, _inner, false, "test"), MB_FILE_OK);
+
+    // Static memory files cannot be resized
+    ASSERT_LT(mb_file_truncate(_file, 100), 0);
+    ASSERT_FALSE(std::string(mb_file_error_string(_file)).empty());
+
+    MbFileTraceOpStats stats = op_stats(MB_FILE_TRACE_OP_TRUNCATE);
+    ASSERT_EQ(stats.count, 1u);
+    ASSERT_EQ(stats.errors, 1u);
+}
+
+TEST_F(FileTraceTest, SummaryReport)
+{
+    char buf[4];
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_trace(_file, _inner, false, "boot.img"),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_read(_file, buf, sizeof(buf), &n), MB_FILE_OK);
+
+    FILE *fp = tmpfile();
+    ASSERT_TRUE(fp);
+    ASSERT_EQ(mb_file_trace_write_report(_file, fp,
+                                         MB_FILE_TRACE_FORMAT_SUMMARY),
+              MB_FILE_OK);
+    std::string report = read_stream(fp);
+    fclose(fp);
+
+    ASSERT_NE(report.find("I/O trace for boot.img"), std::string::npos);
+    ASSERT_NE(report.find("read"), std::string::npos);
+    ASSERT_NE(report.find("Latency histogram (read)"), std::string::npos);
+    ASSERT_EQ(report.find("pwrite"), std::string::npos);
+}
+
+TEST_F(FileTraceTest, ChromeReportsCanBeAppended)
+{
+    char buf[4];
+    size_t n;
+    uint64_t pos;
+
+    ASSERT_EQ(mb_file_open_trace(_file, _inner, false, "a \"quoted\" name"),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_read(_file, buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_seek(_file, 0, SEEK_SET, &pos), MB_FILE_OK);
+
+    FILE *fp = tmpfile();
+    ASSERT_TRUE(fp);
+    ASSERT_EQ(mb_file_trace_write_report(_file, fp,
+                                         MB_FILE_TRACE_FORMAT_CHROME),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_trace_write_report(_file, fp,
+                                         MB_FILE_TRACE_FORMAT_CHROME),
+              MB_FILE_OK);
+    std::string report = read_stream(fp);
+    fclose(fp);
+
+    // Only one array opening bracket
+    ASSERT_EQ(report.compare(0, 2, "[\n"), 0);
+    ASSERT_EQ(report.find('[', 1), std::string::npos);
+
+    ASSERT_NE(report.find("\"name\":\"a \\\"quoted\\\" name\""),
+              std::string::npos);
+    ASSERT_NE(report.find("\"name\":\"read\",\"cat\":\"mbfile\",\"ph\":\"X\""),
+              std::string::npos);
+    ASSERT_NE(report.find("\"offset\":0,\"size\":4,\"result\":4,\"ret\":0"),
+              std::string::npos);
+    ASSERT_NE(report.find("\"offset\":0,\"whence\":0,\"position\":0"),
+              std::string::npos);
+}
+
+TEST_F(FileTraceTest, InvalidHandle)
+{
+    MbFileTraceOpStats stats;
+
+    ASSERT_EQ(mb_file_trace_op_stats(_inner, MB_FILE_TRACE_OP_READ, &stats),
+              MB_FILE_FAILED);
+
+    ASSERT_EQ(mb_file_open_trace(_file, _inner, false, "test"), MB_FILE_OK);
+    ASSERT_EQ(mb_file_trace_op_stats(_file, MB_FILE_TRACE_OP_COUNT, &stats),
+              MB_FILE_FAILED);
+}
+
+#ifndef _WIN32
+TEST_F(FileTraceTest, EnvironmentVariableEnablesReportOnClose)
+{
+    char path[] = "/tmp/mbcommon_trace_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    MbFile *file = _inner;
+    char buf[4];
+    size_t n;
+
+    // Disabled
+    ASSERT_EQ(unsetenv(MB_FILE_TRACE_ENV), 0);
+    ASSERT_EQ(mb_file_open_trace_from_env(&file, "test"), MB_FILE_OK);
+    ASSERT_EQ(file, _inner);
+
+    // Enabled
+    ASSERT_EQ(setenv(MB_FILE_TRACE_ENV, path, 1), 0);
+    ASSERT_EQ(mb_file_open_trace_from_env(&file, "env.img"), MB_FILE_OK);
+    ASSERT_EQ(unsetenv(MB_FILE_TRACE_ENV), 0);
+    ASSERT_NE(file, _inner);
+
+    // The trace handle now owns the original handle
+    _inner = nullptr;
+
+    ASSERT_EQ(mb_file_read(file, buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_free(file), MB_FILE_OK);
+
+    FILE *fp = fopen(path, "r");
+    ASSERT_TRUE(fp);
+    std::string report = read_stream(fp);
+    fclose(fp);
+    unlink(path);
+
+    ASSERT_NE(report.find("I/O trace for env.img"), std::string::npos);
+}
+#endif
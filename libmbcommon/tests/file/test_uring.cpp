@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/uring.h"
+#include "mbcommon/file_util.h"
+
+struct Completion
+{
+    int ret;
+    size_t bytes;
+};
+
+static void record_completion(MbFile *file, void *userdata,
+                              int ret, size_t bytes)
+{
+    (void) file;
+
+    auto completions = static_cast<std::vector<Completion> *>(userdata);
+    completions->push_back({ ret, bytes });
+}
+
+struct FileUringTest : testing::Test
+{
+    MbFile *_file;
+    FILE *_fp;
+
+    FileUringTest() : _file(mb_file_new()), _fp(tmpfile())
+    {
+    }
+
+    virtual ~FileUringTest()
+    {
+        mb_file_free(_file);
+        if (_fp) {
+            fclose(_fp);
+        }
+    }
+
+    virtual void SetUp()
+    {
+        ASSERT_TRUE(_fp);
+    }
+
+    void open(unsigned int queue_depth)
+    {
+        int fd = dup(fileno(_fp));
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(mb_file_open_uring(_file, fd, true, queue_depth),
+                  MB_FILE_OK) << mb_file_error_string(_file);
+    }
+};
+
+TEST_F(FileUringTest, SynchronousOperationsUseFdBackend)
+{
+    size_t n;
+    uint64_t pos;
+    char buf[5];
+
+    open(0);
+
+    ASSERT_EQ(mb_file_write_fully(_file, "hello", 5, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 5u);
+    ASSERT_EQ(mb_file_seek(_file, 1, SEEK_SET, &pos), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read_fully(_file, buf, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "ello");
+    ASSERT_EQ(mb_file_truncate(_file, 2), MB_FILE_OK);
+    ASSERT_EQ(mb_file_pread(_file, buf, sizeof(buf), 0, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "he");
+}
+
+TEST_F(FileUringTest, AsyncWritesAndReadsMoreThanQueueDepth)
+{
+    // Exceed the queue depth so that submissions have to wait for free slots
+    static const size_t chunk_size = 4096;
+    static const size_t chunks = 16;
+    std::vector<std::string> data;
+    std::vector<Completion> completions;
+
+    open(2);
+
+    for (size_t i = 0; i < chunks; ++i) {
+        data.push_back(std::string(chunk_size, static_cast<char>('a' + i)));
+    }
+
+    for (size_t i = 0; i < chunks; ++i) {
+        ASSERT_EQ(mb_file_async_write(_file, data[i].data(), chunk_size,
+                                      i * chunk_size, &record_completion,
+                                      &completions), MB_FILE_OK);
+    }
+    ASSERT_EQ(mb_file_async_wait(_file, SIZE_MAX), MB_FILE_OK);
+    ASSERT_EQ(mb_file_async_pending(_file), 0u);
+
+    ASSERT_EQ(completions.size(), chunks);
+    for (auto const &c : completions) {
+        ASSERT_EQ(c.ret, MB_FILE_OK);
+        ASSERT_EQ(c.bytes, chunk_size);
+    }
+
+    completions.clear();
+
+    std::vector<std::string> result(chunks, std::string(chunk_size, '\0'));
+
+    // Read back in reverse order
+    for (size_t i = chunks; i-- > 0;) {
+        ASSERT_EQ(mb_file_async_read(_file, &result[i][0], chunk_size,
+                                     i * chunk_size, &record_completion,
+                                     &completions), MB_FILE_OK);
+    }
+    ASSERT_EQ(mb_file_async_wait(_file, SIZE_MAX), MB_FILE_OK);
+
+    ASSERT_EQ(completions.size(), chunks);
+    ASSERT_EQ(result, data);
+}
+
+TEST_F(FileUringTest, ReadPastEndCompletesWithZeroBytes)
+{
+    std::vector<Completion> completions;
+    char buf[16];
+    size_t n;
+
+    open(4);
+
+    ASSERT_EQ(mb_file_write_fully(_file, "abc", 3, &n), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_async_read(_file, buf, sizeof(buf), 1,
+                                 &record_completion, &completions),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_async_read(_file, buf + 8, 8, 100,
+                                 &record_completion, &completions),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_async_wait(_file, SIZE_MAX), MB_FILE_OK);
+
+    ASSERT_EQ(completions.size(), 2u);
+    ASSERT_EQ(completions[0].bytes + completions[1].bytes, 2u);
+    ASSERT_EQ(std::string(buf, 2), "bc");
+}
+
+TEST_F(FileUringTest, SynchronousOperationsWaitForAsyncWrites)
+{
+    std::vector<Completion> completions;
+    char buf[3];
+    size_t n;
+
+    open(4);
+
+    ASSERT_EQ(mb_file_async_write(_file, "xyz", 3, 0, &record_completion,
+                                  &completions), MB_FILE_OK);
+    ASSERT_EQ(mb_file_pread(_file, buf, sizeof(buf), 0, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "xyz");
+    ASSERT_EQ(completions.size(), 1u);
+}
+
+struct ChainedReadState
+{
+    std::string data;
+    size_t offset;
+    size_t calls;
+};
+
+static void chained_read_cb(MbFile *file, void *userdata, int ret,
+                            size_t bytes)
+{
+    auto state = static_cast<ChainedReadState *>(userdata);
+    ++state->calls;
+
+    if (ret != MB_FILE_OK) {
+        return;
+    }
+
+    state->offset += bytes;
+    if (bytes > 0 && state->offset < state->data.size()) {
+        mb_file_async_read(file, &state->data[state->offset],
+                           std::min<size_t>(3, state->data.size()
+                                            - state->offset),
+                           state->offset, &chained_read_cb, state);
+    }
+}
+
+TEST_F(FileUringTest, CallbackCanQueueMoreRequests)
+{
+    ChainedReadState state{std::string(10, '\0'), 0, 0};
+    size_t n;
+
+    open(1);
+
+    ASSERT_EQ(mb_file_write_fully(_file, "0123456789", 10, &n), MB_FILE_OK);
+
+    // Read the file 3 bytes at a time by queueing the next read from the
+    // completion callback
+    ASSERT_EQ(mb_file_async_read(_file, &state.data[0], 3, 0,
+                                 &chained_read_cb, &state), MB_FILE_OK);
+    ASSERT_EQ(mb_file_async_wait(_file, SIZE_MAX), MB_FILE_OK);
+    while (mb_file_async_pending(_file) > 0) {
+        ASSERT_EQ(mb_file_async_wait(_file, SIZE_MAX), MB_FILE_OK);
+    }
+
+    ASSERT_EQ(state.data, "0123456789");
+    ASSERT_EQ(state.calls, 4u);
+}
+
+TEST_F(FileUringTest, AsyncOperationsOnOtherHandlesAreSynchronous)
+{
+    MbFile *file = mb_file_new();
+    ASSERT_TRUE(file);
+
+    std::string data("abcdef");
+    std::vector<Completion> completions;
+    char buf[3];
+
+    ASSERT_EQ(mb_file_open_memory_static(file, &data[0], data.size()),
+              MB_FILE_OK);
+    ASSERT_FALSE(mb_file_uring_active(file));
+
+    ASSERT_EQ(mb_file_async_read(file, buf, sizeof(buf), 2,
+                                 &record_completion, &completions),
+              MB_FILE_OK);
+    // Callback is called immediately
+    ASSERT_EQ(completions.size(), 1u);
+    ASSERT_EQ(completions[0].ret, MB_FILE_OK);
+    ASSERT_EQ(completions[0].bytes, 3u);
+    ASSERT_EQ(std::string(buf, 3), "cde");
+
+    ASSERT_EQ(mb_file_async_write(file, "XY", 2, 0, &record_completion,
+                                  &completions), MB_FILE_OK);
+    ASSERT_EQ(completions.size(), 2u);
+    ASSERT_EQ(data, "XYcdef");
+
+    ASSERT_EQ(mb_file_async_wait(file, SIZE_MAX), MB_FILE_OK);
+    ASSERT_EQ(mb_file_async_pending(file), 0u);
+
+    mb_file_free(file);
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdio>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/digest.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/window.h"
+#include "mbcommon/file_util.h"
+
+struct SeekCounter
+{
+    MbFile *inner;
+    unsigned int n_seek;
+};
+
+static int counter_read_cb(MbFile *file, void *userdata,
+                           void *buf, size_t size, size_t *bytes_read)
+{
+    (void) file;
+    SeekCounter *counter = static_cast<SeekCounter *>(userdata);
+    return mb_file_read(counter->inner, buf, size, bytes_read);
+}
+
+static int counter_seek_cb(MbFile *file, void *userdata,
+                           int64_t offset, int whence, uint64_t *new_offset)
+{
+    (void) file;
+    SeekCounter *counter = static_cast<SeekCounter *>(userdata);
+    ++counter->n_seek;
+    return mb_file_seek(counter->inner, offset, whence, new_offset);
+}
+
+struct FileWindowTest : testing::Test
+{
+    MbFile *_file;
+    MbFile *_inner;
+    std::string _data;
+
+    FileWindowTest()
+        : _file(mb_file_new()), _inner(mb_file_new()), _data("0123456789")
+    {
+    }
+
+    virtual ~FileWindowTest()
+    {
+        mb_file_free(_file);
+        mb_file_free(_inner);
+    }
+
+    virtual void SetUp()
+    {
+        ASSERT_EQ(mb_file_open_memory_static(_inner, &_data[0], _data.size()),
+                  MB_FILE_OK);
+    }
+
+    std::string read_all(MbFile *file)
+    {
+        std::string result;
+        char buf[3];
+        size_t n;
+
+        while (true) {
+            EXPECT_EQ(mb_file_read(file, buf, sizeof(buf), &n), MB_FILE_OK)
+                    << mb_file_error_string(file);
+            if (n == 0) {
+                break;
+            }
+            result.append(buf, n);
+        }
+
+        return result;
+    }
+};
+
+TEST_F(FileWindowTest, ReadsAreLimitedToRange)
+{
+    uint64_t pos;
+
+    ASSERT_EQ(mb_file_open_window(_file, _inner, false, 2, 5), MB_FILE_OK);
+    ASSERT_EQ(read_all(_file), "23456");
+
+    ASSERT_EQ(mb_file_seek(_file, -2, SEEK_END, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 3u);
+    ASSERT_EQ(read_all(_file), "56");
+
+    ASSERT_EQ(mb_file_seek(_file, 1, SEEK_SET, &pos), MB_FILE_OK);
+    ASSERT_EQ(mb_file_seek(_file, 1, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 2u);
+    ASSERT_EQ(read_all(_file), "456");
+
+    // Seeking past the end is allowed, but there is nothing to read
+    ASSERT_EQ(mb_file_seek(_file, 10, SEEK_SET, &pos), MB_FILE_OK);
+    ASSERT_EQ(read_all(_file), "");
+
+    // Seeking before the start is not
+    ASSERT_EQ(mb_file_seek(_file, -1, SEEK_SET, &pos), MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), MB_FILE_ERROR_INVALID_ARGUMENT);
+}
+
+TEST_F(FileWindowTest, InnerPositionIsUnchanged)
+{
+    char buf[2];
+    size_t n;
+    uint64_t pos;
+
+    ASSERT_EQ(mb_file_seek(_inner, 8, SEEK_SET, &pos), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_window(_file, _inner, false, 0, 4), MB_FILE_OK);
+    ASSERT_EQ(read_all(_file), "0123");
+
+    ASSERT_EQ(mb_file_read(_inner, buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "89");
+}
+
+TEST_F(FileWindowTest, WritesAreLimitedToRange)
+{
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_window(_file, _inner, false, 7, 2), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write(_file, "abc", 3, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 2u);
+    ASSERT_EQ(mb_file_write(_file, "c", 1, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0u);
+    ASSERT_EQ(_data, "0123456ab9");
+
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 1, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1u);
+    ASSERT_EQ(_data, "0123456ax9");
+
+    ASSERT_LT(mb_file_truncate(_file, 1), 0);
+}
+
+TEST_F(FileWindowTest, RangePastEndOfInner)
+{
+    char buf[10];
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_window(_file, _inner, false, 8, 100), MB_FILE_OK);
+    ASSERT_EQ(read_all(_file), "89");
+    ASSERT_EQ(mb_file_pread(_file, buf, sizeof(buf), 50, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0u);
+}
+
+TEST_F(FileWindowTest, InnerWithoutPositionalIo)
+{
+    // Digest handles do not support pread(), so the window has to seek
+    MbFile *digest = mb_file_new();
+    ASSERT_TRUE(digest);
+    ASSERT_EQ(mb_file_open_digest(digest, _inner, false, nullptr,
+                                  MB_FILE_DIGEST_CRC32), MB_FILE_OK);
+
+    char buf[3];
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_window(_file, digest, true, 3, 4), MB_FILE_OK);
+    ASSERT_EQ(read_all(_file), "3456");
+    ASSERT_EQ(mb_file_pread(_file, buf, sizeof(buf), 1, &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "456");
+}
+
+TEST_F(FileWindowTest, SequentialReadsWithoutPositionalIoDoNotSeek)
+{
+    SeekCounter counter{_inner, 0};
+    MbFile *inner = mb_file_new();
+    ASSERT_TRUE(inner);
+    ASSERT_EQ(mb_file_open_callbacks(inner, nullptr, nullptr,
+                                     &counter_read_cb, nullptr,
+                                     &counter_seek_cb, nullptr, &counter),
+              MB_FILE_OK);
+
+    uint64_t pos;
+
+    ASSERT_EQ(mb_file_open_window(_file, inner, true, 1, 8), MB_FILE_OK);
+    ASSERT_EQ(read_all(_file), "12345678");
+    ASSERT_EQ(counter.n_seek, 1u);
+
+    // Seeking the window moves the inner file on the next read
+    ASSERT_EQ(mb_file_seek(_file, 5, SEEK_SET, &pos), MB_FILE_OK);
+    ASSERT_EQ(read_all(_file), "678");
+    ASSERT_EQ(counter.n_seek, 2u);
+}
+
+TEST_F(FileWindowTest, BufferedFdInner)
+{
+    FILE *fp = tmpfile();
+    ASSERT_TRUE(fp);
+    ASSERT_EQ(fwrite("0123456789abcdef", 1, 16, fp), 16u);
+    ASSERT_EQ(fflush(fp), 0);
+
+    MbFile *fd_file = mb_file_new();
+    MbFile *buffered = mb_file_new();
+    ASSERT_TRUE(fd_file);
+    ASSERT_TRUE(buffered);
+    ASSERT_EQ(mb_file_open_fd(fd_file, fileno(fp), false), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_buffered(buffered, fd_file, true, 8), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_window(_file, buffered, true, 2, 12), MB_FILE_OK);
+
+    char buf[3];
+    size_t n;
+
+    // The first read fills the buffer with [2, 10) of the file
+    ASSERT_EQ(mb_file_read(_file, buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(std::string(buf, n), "234");
+
+    // Data that is already buffered is not read from the file again, so this
+    // change is only visible past the end of the buffer
+    ASSERT_EQ(fseek(fp, 0, SEEK_SET), 0);
+    ASSERT_EQ(fwrite("XXXXXXXXXXXXXXXX", 1, 16, fp), 16u);
+    ASSERT_EQ(fflush(fp), 0);
+
+    ASSERT_EQ(read_all(_file), "56789XXXX");
+
+    ASSERT_EQ(mb_file_close(_file), MB_FILE_OK);
+    fclose(fp);
+}
+
+TEST_F(FileWindowTest, NestedWindows)
+{
+    MbFile *outer = mb_file_new();
+    ASSERT_TRUE(outer);
+    ASSERT_EQ(mb_file_open_window(outer, _inner, false, 2, 6), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_open_window(_file, outer, true, 1, 3), MB_FILE_OK);
+    ASSERT_EQ(read_all(_file), "345");
+}
+
+TEST_F(FileWindowTest, OverflowingRangeFails)
+{
+    ASSERT_EQ(mb_file_open_window(_file, _inner, false, UINT64_MAX, 2),
+              MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), MB_FILE_ERROR_INVALID_ARGUMENT);
+}
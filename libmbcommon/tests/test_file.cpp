@@ -42,6 +42,8 @@ struct FileTest : testing::Test
     int _n_write = 0;
     int _n_seek = 0;
     int _n_truncate = 0;
+    int _n_pread = 0;
+    int _n_pwrite = 0;
 
     FileTest() : _file(mb_file_new())
     {
@@ -66,6 +68,10 @@ struct FileTest : testing::Test
         ASSERT_EQ(_file->seek_cb, &_seek_cb);
         ASSERT_EQ(mb_file_set_truncate_callback(_file, &_truncate_cb), MB_FILE_OK);
         ASSERT_EQ(_file->truncate_cb, &_truncate_cb);
+        ASSERT_EQ(mb_file_set_pread_callback(_file, &_pread_cb), MB_FILE_OK);
+        ASSERT_EQ(_file->pread_cb, &_pread_cb);
+        ASSERT_EQ(mb_file_set_pwrite_callback(_file, &_pwrite_cb), MB_FILE_OK);
+        ASSERT_EQ(_file->pwrite_cb, &_pwrite_cb);
         ASSERT_EQ(mb_file_set_callback_data(_file, this), MB_FILE_OK);
         ASSERT_EQ(_file->cb_userdata, this);
     }
@@ -191,6 +197,45 @@ struct FileTest : testing::Test
         test->_buf.resize(size);
         return MB_FILE_OK;
     }
+
+    static int _pread_cb(MbFile *file, void *userdata,
+                         void *buf, size_t size, uint64_t offset,
+                         size_t *bytes_read)
+    {
+        (void) file;
+
+        FileTest *test = static_cast<FileTest *>(userdata);
+        ++test->_n_pread;
+
+        uint64_t n = 0;
+        if (offset < test->_buf.size()) {
+            n = std::min<uint64_t>(test->_buf.size() - offset, size);
+        }
+        memcpy(buf, test->_buf.data() + offset, n);
+        *bytes_read = n;
+
+        return MB_FILE_OK;
+    }
+
+    static int _pwrite_cb(MbFile *file, void *userdata,
+                          const void *buf, size_t size, uint64_t offset,
+                          size_t *bytes_written)
+    {
+        (void) file;
+
+        FileTest *test = static_cast<FileTest *>(userdata);
+        ++test->_n_pwrite;
+
+        size_t required = offset + size;
+        if (required > test->_buf.size()) {
+            test->_buf.resize(required);
+        }
+
+        memcpy(test->_buf.data() + offset, buf, size);
+        *bytes_written = size;
+
+        return MB_FILE_OK;
+    }
 };
 
 TEST_F(FileTest, CheckInitialValues)
@@ -202,6 +247,8 @@ TEST_F(FileTest, CheckInitialValues)
     ASSERT_EQ(_file->write_cb, nullptr);
     ASSERT_EQ(_file->seek_cb, nullptr);
     ASSERT_EQ(_file->truncate_cb, nullptr);
+    ASSERT_EQ(_file->pread_cb, nullptr);
+    ASSERT_EQ(_file->pwrite_cb, nullptr);
     ASSERT_EQ(_file->cb_userdata, nullptr);
     ASSERT_EQ(_file->error_code, MB_FILE_ERROR_NONE);
     ASSERT_EQ(_file->error_string, nullptr);
@@ -396,6 +443,22 @@ TEST_F(FileTest, SetCallbacksInNonNewState)
     ASSERT_TRUE(strstr(_file->error_string, "mb_file_set_truncate_callback"));
     ASSERT_TRUE(strstr(_file->error_string, "Invalid state"));
 
+    ASSERT_EQ(mb_file_set_pread_callback(_file, nullptr), MB_FILE_FATAL);
+    ASSERT_NE(_file->pread_cb, nullptr);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_set_pread_callback"));
+    ASSERT_TRUE(strstr(_file->error_string, "Invalid state"));
+
+    ASSERT_EQ(mb_file_set_pwrite_callback(_file, nullptr), MB_FILE_FATAL);
+    ASSERT_NE(_file->pwrite_cb, nullptr);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_set_pwrite_callback"));
+    ASSERT_TRUE(strstr(_file->error_string, "Invalid state"));
+
     ASSERT_EQ(mb_file_set_callback_data(_file, nullptr), MB_FILE_FATAL);
     ASSERT_NE(_file->cb_userdata, nullptr);
     ASSERT_EQ(_file->state, MbFileState::FATAL);
@@ -1159,6 +1222,166 @@ TEST_F(FileTest, TruncateReturnFatalFailure)
     ASSERT_EQ(_n_truncate, 1);
 }
 
+TEST_F(FileTest, PreadCallbackCalled)
+{
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_n_open, 1);
+
+    // Read from file
+    char buf[10];
+    size_t n;
+    ASSERT_EQ(mb_file_pread(_file, buf, sizeof(buf), 26, &n), MB_FILE_OK);
+    ASSERT_EQ(n, sizeof(buf));
+    ASSERT_EQ(memcmp(buf, _buf.data(), sizeof(buf)), 0);
+    ASSERT_EQ(_n_pread, 1);
+    ASSERT_EQ(_n_read, 0);
+    ASSERT_EQ(_n_seek, 0);
+    ASSERT_EQ(_position, 0);
+}
+
+TEST_F(FileTest, PreadWithNullBytesReadParam)
+{
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_n_open, 1);
+
+    // Read from file
+    char c;
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 0, nullptr), MB_FILE_FATAL);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_pread"));
+    ASSERT_TRUE(strstr(_file->error_string, "is NULL"));
+    ASSERT_EQ(_n_pread, 0);
+}
+
+TEST_F(FileTest, PreadNoCallback)
+{
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Clear pread callback
+    mb_file_set_pread_callback(_file, nullptr);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_n_open, 1);
+
+    // Read from file
+    char c;
+    size_t n;
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 0, &n), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_UNSUPPORTED);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_pread"));
+    ASSERT_TRUE(strstr(_file->error_string, "pread callback"));
+    ASSERT_EQ(_n_pread, 0);
+}
+
+TEST_F(FileTest, PreadReturnFatalFailure)
+{
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Set pread callback
+    auto pread_cb = [](MbFile *file, void *userdata,
+                       void *buf, size_t size, uint64_t offset,
+                       size_t *bytes_read) -> int {
+        (void) file;
+        (void) buf;
+        (void) size;
+        (void) offset;
+        (void) bytes_read;
+        FileTest *test = static_cast<FileTest *>(userdata);
+        ++test->_n_pread;
+        return MB_FILE_FATAL;
+    };
+    ASSERT_EQ(mb_file_set_pread_callback(_file, pread_cb), MB_FILE_OK);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_n_open, 1);
+
+    // Read from file
+    char c;
+    size_t n;
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 0, &n), MB_FILE_FATAL);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_n_pread, 1);
+}
+
+TEST_F(FileTest, PwriteCallbackCalled)
+{
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_n_open, 1);
+
+    // Write to file
+    size_t n;
+    ASSERT_EQ(mb_file_pwrite(_file, "xyz", 3, INITIAL_BUF_SIZE, &n),
+              MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(_buf.size(), INITIAL_BUF_SIZE + 3);
+    ASSERT_EQ(memcmp(_buf.data() + INITIAL_BUF_SIZE, "xyz", 3), 0);
+    ASSERT_EQ(_n_pwrite, 1);
+    ASSERT_EQ(_n_write, 0);
+    ASSERT_EQ(_n_seek, 0);
+    ASSERT_EQ(_position, 0);
+}
+
+TEST_F(FileTest, PwriteNoCallback)
+{
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Clear pwrite callback
+    mb_file_set_pwrite_callback(_file, nullptr);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_n_open, 1);
+
+    // Write to file
+    size_t n;
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 0, &n), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_UNSUPPORTED);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_pwrite"));
+    ASSERT_TRUE(strstr(_file->error_string, "pwrite callback"));
+    ASSERT_EQ(_n_pwrite, 0);
+}
+
 TEST_F(FileTest, SetError)
 {
     ASSERT_EQ(_file->error_code, MB_FILE_ERROR_NONE);
@@ -48,6 +48,10 @@ struct FileUtilTest : testing::Test
     int _n_write = 0;
     int _n_seek = 0;
     int _n_truncate = 0;
+    int _n_copy = 0;
+
+    // Result of copy callback
+    int _copy_ret = MB_FILE_OK;
 
     FileUtilTest() : _file(mb_file_new())
     {
@@ -197,6 +201,31 @@ struct FileUtilTest : testing::Test
         test->_buf.resize(size);
         return MB_FILE_OK;
     }
+
+    static int _copy_cb(MbFile *file, void *userdata,
+                        uint64_t src, uint64_t dest, uint64_t size,
+                        uint64_t *bytes_copied)
+    {
+        FileUtilTest *test = static_cast<FileUtilTest *>(userdata);
+        ++test->_n_copy;
+
+        if (test->_copy_ret != MB_FILE_OK) {
+            mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                              "Copy not supported");
+            return test->_copy_ret;
+        }
+
+        uint64_t n = src < test->_buf.size()
+                ? std::min<uint64_t>(size, test->_buf.size() - src) : 0;
+        if (dest + n > test->_buf.size()) {
+            test->_buf.resize(dest + n);
+        }
+
+        memcpy(test->_buf.data() + dest, test->_buf.data() + src, n);
+        *bytes_copied = n;
+
+        return MB_FILE_OK;
+    }
 };
 
 TEST_F(FileUtilTest, ReadFullyNormal)
@@ -716,4 +745,123 @@ TEST(FileMoveTest, LargeBackwardsCopyShouldSucceed)
     free(buf);
 }
 
+TEST(FileMoveTest, PositionalCopyShouldNotChangePosition)
+{
+    char buf[] = "abcdef";
+    uint64_t n;
+    uint64_t pos;
+
+    ScopedFile file(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!file);
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), buf, sizeof(buf) - 1),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_seek(file.get(), 1, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_move(file.get(), 2, 0, 3, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_STREQ(buf, "cdedef");
+    ASSERT_EQ(mb_file_seek(file.get(), 0, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 1);
+}
+
+TEST_F(FileUtilTest, MoveWithoutPositionalIoShouldSeek)
+{
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_n_open, 1);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_move(_file, 2, 0, 3, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(memcmp(_buf.data(), "cdedef", 6), 0);
+    ASSERT_EQ(_n_seek, 2);
+    ASSERT_EQ(_n_read, 1);
+    ASSERT_EQ(_n_write, 1);
+}
+
+TEST_F(FileUtilTest, MoveWithCopyShouldUseNonOverlappingBlocks)
+{
+    set_all_callbacks();
+    ASSERT_EQ(mb_file_set_copy_callback(_file, &_copy_cb), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+
+    _buf.resize(4 * 1024 * 1024);
+    for (size_t i = 0; i < _buf.size(); ++i) {
+        _buf[i] = static_cast<unsigned char>(i * 7 + i / 251);
+    }
+
+    const uint64_t src = 0;
+    const uint64_t dest = 1024 * 1024 + 7;
+    const uint64_t size = 3 * 1024 * 1024 - 7;
+
+    std::vector<unsigned char> expected(_buf);
+    memmove(expected.data() + dest, expected.data() + src, size);
+
+    // mb_file_copy() rejects overlapping regions, so this only succeeds if
+    // the blocks are planned correctly
+    uint64_t n;
+    ASSERT_EQ(mb_file_move(_file, src, dest, size, &n), MB_FILE_OK);
+    ASSERT_EQ(n, size);
+    ASSERT_EQ(_buf, expected);
+    ASSERT_EQ(_n_copy, 3);
+    ASSERT_EQ(_n_read, 0);
+    ASSERT_EQ(_n_write, 0);
+}
+
+TEST_F(FileUtilTest, MoveWithSmallDistanceShouldNotCopy)
+{
+    set_all_callbacks();
+    ASSERT_EQ(mb_file_set_copy_callback(_file, &_copy_cb), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_move(_file, 2, 0, 3, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(memcmp(_buf.data(), "cdedef", 6), 0);
+    ASSERT_EQ(_n_copy, 0);
+}
+
+TEST_F(FileUtilTest, MoveWithUnsupportedCopyShouldFallBack)
+{
+    set_all_callbacks();
+    ASSERT_EQ(mb_file_set_copy_callback(_file, &_copy_cb), MB_FILE_OK);
+    _copy_ret = MB_FILE_UNSUPPORTED;
+
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+
+    std::vector<unsigned char> expected(_buf);
+    memmove(expected.data() + 512, expected.data(), 512);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_move(_file, 0, 512, 512, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 512);
+    ASSERT_EQ(_buf, expected);
+    ASSERT_EQ(_n_copy, 1);
+    ASSERT_EQ(_n_read, 1);
+    ASSERT_EQ(_n_write, 1);
+}
+
+TEST_F(FileUtilTest, MoveWithCopyPastEofShouldCopyPartially)
+{
+    set_all_callbacks();
+    ASSERT_EQ(mb_file_set_copy_callback(_file, &_copy_cb), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+
+    std::vector<unsigned char> expected(_buf);
+    memmove(expected.data(), expected.data() + 600, INITIAL_BUF_SIZE - 600);
+
+    // The in-kernel copy stops at EOF and the buffered copy takes over
+    uint64_t n;
+    ASSERT_EQ(mb_file_move(_file, 600, 0, 600, &n), MB_FILE_OK);
+    ASSERT_EQ(n, INITIAL_BUF_SIZE - 600);
+    ASSERT_EQ(_buf, expected);
+    ASSERT_EQ(_n_copy, 2);
+}
+
 // TODO: Add more tests after integrating gmock
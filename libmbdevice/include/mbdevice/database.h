@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "mbdevice/device.h"
+
+/*
+ * Compiled device database
+ *
+ * The database is generated from the device definitions at build time (see
+ * devicesgen) so that looking up a single device does not require parsing
+ * and validating every device. It contains each device serialized as compact
+ * JSON along with an index of all codenames, sorted by strcmp() order. Only
+ * the device that is requested is parsed.
+ *
+ * All integers are little-endian 32-bit values and all offsets are relative
+ * to the beginning of the file.
+ *
+ *   header:
+ *     char     magic[8]           "MBDEVDB\0"
+ *     uint32_t version            MB_DEVICE_DATABASE_VERSION
+ *     uint32_t device_count
+ *     uint32_t codename_count
+ *     uint32_t reserved           0
+ *   devices[device_count]:
+ *     uint32_t json_offset        NULL-terminated JSON object
+ *     uint32_t json_size          Size excluding the NULL terminator
+ *   codenames[codename_count]:
+ *     uint32_t name_offset        NULL-terminated codename
+ *     uint32_t device_index
+ *   string data
+ *
+ * Functions that fail return NULL and set errno. EINVAL means that the data is
+ * not a valid database and ENOENT means that no device matched.
+ *
+ * mb_device_database_find_valid() takes a NULL-terminated list of codenames
+ * and returns the first device, in database order, that has any of them and
+ * passes mb_device_validate(). Invalid devices are skipped.
+ *
+ * mb_device_database_open() maps the file into memory. The buffer passed to
+ * mb_device_database_open_buffer() is not copied and must remain valid until
+ * the database is closed.
+ */
+
+#define MB_DEVICE_DATABASE_VERSION      1
+
+struct MbDeviceDatabase;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+MB_EXPORT struct MbDeviceDatabase * mb_device_database_open(const char *path);
+
+MB_EXPORT struct MbDeviceDatabase * mb_device_database_open_buffer(const void *data,
+                                                                   size_t size);
+
+MB_EXPORT void mb_device_database_close(struct MbDeviceDatabase *db);
+
+MB_EXPORT size_t mb_device_database_count(const struct MbDeviceDatabase *db);
+
+MB_EXPORT struct Device * mb_device_database_get(const struct MbDeviceDatabase *db,
+                                                 size_t index);
+
+MB_EXPORT struct Device * mb_device_database_find(const struct MbDeviceDatabase *db,
+                                                  const char *codename);
+
+MB_EXPORT struct Device * mb_device_database_find_valid(const struct MbDeviceDatabase *db,
+                                                        const char * const *codenames);
+
+MB_EXPORT void * mb_device_database_build(struct Device * const *devices,
+                                          size_t *size_out);
+
+#ifdef __cplusplus
+}
+#endif
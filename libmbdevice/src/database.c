@@ -0,0 +1,551 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/database.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include "mbdevice/json.h"
+#include "mbdevice/validate.h"
+
+#define DB_MAGIC                "MBDEVDB"
+#define DB_MAGIC_SIZE           8
+#define DB_HEADER_SIZE          (DB_MAGIC_SIZE + 4 * 4)
+#define DB_ENTRY_SIZE           (2 * 4)
+
+enum DatabaseStorage
+{
+    // Buffer belongs to the caller
+    DB_STORAGE_BORROWED,
+    // Buffer is mmap'd
+    DB_STORAGE_MAPPED,
+    // Buffer is malloc'd
+    DB_STORAGE_ALLOCATED,
+};
+
+struct MbDeviceDatabase
+{
+    const unsigned char *data;
+    size_t size;
+    enum DatabaseStorage storage;
+
+    uint32_t device_count;
+    uint32_t codename_count;
+    // Offsets of the tables and of the first byte after them
+    size_t devices_offset;
+    size_t codenames_offset;
+    size_t strings_offset;
+};
+
+struct BuildCodename
+{
+    const char *name;
+    uint32_t device_index;
+};
+
+static inline uint32_t read_le32(const unsigned char *p)
+{
+    return (uint32_t) p[0]
+            | ((uint32_t) p[1] << 8)
+            | ((uint32_t) p[2] << 16)
+            | ((uint32_t) p[3] << 24);
+}
+
+static inline void write_le32(unsigned char *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static struct MbDeviceDatabase * database_new(const unsigned char *data,
+                                              size_t size,
+                                              enum DatabaseStorage storage)
+{
+    struct MbDeviceDatabase *db;
+    uint64_t tables_size;
+
+    if (size < DB_HEADER_SIZE
+            || memcmp(data, DB_MAGIC, DB_MAGIC_SIZE) != 0
+            || read_le32(data + 8) != MB_DEVICE_DATABASE_VERSION) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    db = (struct MbDeviceDatabase *) malloc(sizeof(struct MbDeviceDatabase));
+    if (!db) {
+        return NULL;
+    }
+
+    db->data = data;
+    db->size = size;
+    db->storage = storage;
+    db->device_count = read_le32(data + 12);
+    db->codename_count = read_le32(data + 16);
+    db->devices_offset = DB_HEADER_SIZE;
+
+    tables_size = ((uint64_t) db->device_count + db->codename_count)
+            * DB_ENTRY_SIZE;
+
+    // Every string is NULL-terminated, so as long as the last byte is a NULL
+    // byte, any offset inside the string data refers to a valid string
+    if (tables_size > size - DB_HEADER_SIZE
+            || (size > DB_HEADER_SIZE + tables_size && data[size - 1] != '\0')) {
+        free(db);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    db->codenames_offset = db->devices_offset
+            + (size_t) db->device_count * DB_ENTRY_SIZE;
+    db->strings_offset = DB_HEADER_SIZE + (size_t) tables_size;
+
+    return db;
+}
+
+struct MbDeviceDatabase * mb_device_database_open_buffer(const void *data,
+                                                         size_t size)
+{
+    return database_new((const unsigned char *) data, size,
+                        DB_STORAGE_BORROWED);
+}
+
+#ifdef _WIN32
+
+struct MbDeviceDatabase * mb_device_database_open(const char *path)
+{
+    struct MbDeviceDatabase *db = NULL;
+    unsigned char *buf = NULL;
+    long size;
+    FILE *fp;
+    int saved_errno;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        return NULL;
+    }
+
+    if (fseek(fp, 0, SEEK_END) < 0
+            || (size = ftell(fp)) < 0
+            || fseek(fp, 0, SEEK_SET) < 0) {
+        goto done;
+    }
+
+    buf = (unsigned char *) malloc(size > 0 ? size : 1);
+    if (!buf) {
+        goto done;
+    }
+
+    if (fread(buf, 1, size, fp) != (size_t) size) {
+        errno = EIO;
+        goto done;
+    }
+
+    db = database_new(buf, size, DB_STORAGE_ALLOCATED);
+
+done:
+    saved_errno = errno;
+    if (!db) {
+        free(buf);
+    }
+    fclose(fp);
+    errno = saved_errno;
+    return db;
+}
+
+#else
+
+struct MbDeviceDatabase * mb_device_database_open(const char *path)
+{
+    struct MbDeviceDatabase *db = NULL;
+    struct stat sb;
+    void *map = MAP_FAILED;
+    int fd;
+    int saved_errno;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &sb) < 0) {
+        goto done;
+    }
+
+    if (sb.st_size < DB_HEADER_SIZE) {
+        errno = EINVAL;
+        goto done;
+    }
+
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        goto done;
+    }
+
+    db = database_new((const unsigned char *) map, sb.st_size,
+                      DB_STORAGE_MAPPED);
+
+done:
+    saved_errno = errno;
+    if (!db && map != MAP_FAILED) {
+        munmap(map, sb.st_size);
+    }
+    close(fd);
+    errno = saved_errno;
+    return db;
+}
+
+#endif
+
+void mb_device_database_close(struct MbDeviceDatabase *db)
+{
+    if (!db) {
+        return;
+    }
+
+    switch (db->storage) {
+    case DB_STORAGE_MAPPED:
+#ifndef _WIN32
+        munmap((void *) db->data, db->size);
+#endif
+        break;
+    case DB_STORAGE_ALLOCATED:
+        free((void *) db->data);
+        break;
+    case DB_STORAGE_BORROWED:
+        break;
+    }
+
+    free(db);
+}
+
+size_t mb_device_database_count(const struct MbDeviceDatabase *db)
+{
+    return db->device_count;
+}
+
+struct Device * mb_device_database_get(const struct MbDeviceDatabase *db,
+                                       size_t index)
+{
+    const unsigned char *entry;
+    uint32_t offset;
+    uint32_t size;
+    struct Device *device;
+    struct MbDeviceJsonError error;
+
+    if (index >= db->device_count) {
+        errno = ERANGE;
+        return NULL;
+    }
+
+    entry = db->data + db->devices_offset + index * DB_ENTRY_SIZE;
+    offset = read_le32(entry);
+    size = read_le32(entry + 4);
+
+    if (offset < db->strings_offset || offset >= db->size
+            || size >= db->size - offset
+            || db->data[offset + size] != '\0') {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    device = mb_device_new_from_json((const char *) db->data + offset, &error);
+    if (!device && error.type != MB_DEVICE_JSON_STANDARD_ERROR) {
+        errno = EINVAL;
+    }
+
+    return device;
+}
+
+// Returns NULL if the offset does not point into the string data
+static const char * database_string(const struct MbDeviceDatabase *db,
+                                    uint32_t offset)
+{
+    if (offset < db->strings_offset || offset >= db->size) {
+        return NULL;
+    }
+    return (const char *) db->data + offset;
+}
+
+// Find the first index entry that is not less than the codename. Returns
+// false and sets errno to EINVAL if the index refers to an invalid string.
+static bool database_lower_bound(const struct MbDeviceDatabase *db,
+                                 const char *codename, size_t *index_out)
+{
+    const unsigned char *entry;
+    const char *name;
+    size_t low = 0;
+    size_t high = db->codename_count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        entry = db->data + db->codenames_offset + mid * DB_ENTRY_SIZE;
+        name = database_string(db, read_le32(entry));
+        if (!name) {
+            errno = EINVAL;
+            return false;
+        }
+
+        if (strcmp(name, codename) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    *index_out = low;
+    return true;
+}
+
+struct Device * mb_device_database_find(const struct MbDeviceDatabase *db,
+                                        const char *codename)
+{
+    const unsigned char *entry;
+    const char *name;
+    size_t index;
+
+    // If a codename is shared by several devices, the first device in the
+    // database wins
+    if (!database_lower_bound(db, codename, &index)) {
+        return NULL;
+    }
+
+    if (index == db->codename_count) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    entry = db->data + db->codenames_offset + index * DB_ENTRY_SIZE;
+    name = database_string(db, read_le32(entry));
+    if (!name || strcmp(name, codename) != 0) {
+        errno = name ? ENOENT : EINVAL;
+        return NULL;
+    }
+
+    return mb_device_database_get(db, read_le32(entry + 4));
+}
+
+struct Device * mb_device_database_find_valid(const struct MbDeviceDatabase *db,
+                                              const char * const *codenames)
+{
+    const unsigned char *entry;
+    const char *name;
+    size_t index;
+    uint32_t device_index;
+    uint32_t best = UINT32_MAX;
+    struct Device *device;
+
+    // Devices are checked in database order, so the first valid device that
+    // has any of the codenames wins, regardless of which codename matched.
+    // Every pass finds the lowest device index after the previous candidate.
+    for (;;) {
+        uint32_t prev = best;
+        best = UINT32_MAX;
+
+        for (const char * const *it = codenames; *it; ++it) {
+            if (!database_lower_bound(db, *it, &index)) {
+                return NULL;
+            }
+
+            // Entries for the same codename are sorted by device index
+            for (; index < db->codename_count; ++index) {
+                entry = db->data + db->codenames_offset + index * DB_ENTRY_SIZE;
+                name = database_string(db, read_le32(entry));
+                if (!name) {
+                    errno = EINVAL;
+                    return NULL;
+                } else if (strcmp(name, *it) != 0) {
+                    break;
+                }
+
+                device_index = read_le32(entry + 4);
+                if (prev == UINT32_MAX || device_index > prev) {
+                    if (device_index < best) {
+                        best = device_index;
+                    }
+                    break;
+                }
+            }
+        }
+
+        if (best == UINT32_MAX) {
+            errno = ENOENT;
+            return NULL;
+        }
+
+        device = mb_device_database_get(db, best);
+        if (!device) {
+            return NULL;
+        } else if (mb_device_validate(device) == 0) {
+            return device;
+        }
+
+        mb_device_free(device);
+    }
+}
+
+static int compare_codenames(const void *a, const void *b)
+{
+    const struct BuildCodename *lhs = (const struct BuildCodename *) a;
+    const struct BuildCodename *rhs = (const struct BuildCodename *) b;
+    int ret;
+
+    ret = strcmp(lhs->name, rhs->name);
+    if (ret != 0) {
+        return ret;
+    } else if (lhs->device_index != rhs->device_index) {
+        return lhs->device_index < rhs->device_index ? -1 : 1;
+    } else {
+        return 0;
+    }
+}
+
+void * mb_device_database_build(struct Device * const *devices,
+                                size_t *size_out)
+{
+    size_t device_count = 0;
+    size_t codename_count = 0;
+    char **json = NULL;
+    size_t *json_sizes = NULL;
+    struct BuildCodename *codenames = NULL;
+    unsigned char *buf = NULL;
+    unsigned char *ptr;
+    uint64_t size;
+    size_t n;
+    bool ok = false;
+    int saved_errno;
+
+    for (struct Device * const *it = devices; *it; ++it) {
+        char const * const *device_codenames = mb_device_codenames(*it);
+        if (device_codenames) {
+            for (; *device_codenames; ++device_codenames) {
+                ++codename_count;
+            }
+        }
+        ++device_count;
+    }
+
+    json = (char **) calloc(device_count + 1, sizeof(char *));
+    json_sizes = (size_t *) calloc(device_count + 1, sizeof(size_t));
+    codenames = (struct BuildCodename *) calloc(
+            codename_count + 1, sizeof(struct BuildCodename));
+    if (!json || !json_sizes || !codenames) {
+        goto done;
+    }
+
+    size = DB_HEADER_SIZE
+            + ((uint64_t) device_count + codename_count) * DB_ENTRY_SIZE;
+
+    n = 0;
+    for (size_t i = 0; i < device_count; ++i) {
+        char const * const *device_codenames = mb_device_codenames(devices[i]);
+
+        json[i] = mb_device_to_json(devices[i]);
+        if (!json[i]) {
+            errno = ENOMEM;
+            goto done;
+        }
+        json_sizes[i] = strlen(json[i]);
+        size += json_sizes[i] + 1;
+
+        if (device_codenames) {
+            for (; *device_codenames; ++device_codenames) {
+                codenames[n].name = *device_codenames;
+                codenames[n].device_index = (uint32_t) i;
+                size += strlen(*device_codenames) + 1;
+                ++n;
+            }
+        }
+    }
+
+    if (size > UINT32_MAX) {
+        errno = EOVERFLOW;
+        goto done;
+    }
+
+    qsort(codenames, codename_count, sizeof(struct BuildCodename),
+          &compare_codenames);
+
+    buf = (unsigned char *) malloc((size_t) size);
+    if (!buf) {
+        goto done;
+    }
+
+    memset(buf, 0, DB_HEADER_SIZE);
+    memcpy(buf, DB_MAGIC, sizeof(DB_MAGIC));
+    write_le32(buf + 8, MB_DEVICE_DATABASE_VERSION);
+    write_le32(buf + 12, (uint32_t) device_count);
+    write_le32(buf + 16, (uint32_t) codename_count);
+
+    ptr = buf + DB_HEADER_SIZE
+            + (device_count + codename_count) * DB_ENTRY_SIZE;
+
+    for (size_t i = 0; i < device_count; ++i) {
+        unsigned char *entry = buf + DB_HEADER_SIZE + i * DB_ENTRY_SIZE;
+
+        write_le32(entry, (uint32_t) (ptr - buf));
+        write_le32(entry + 4, (uint32_t) json_sizes[i]);
+        memcpy(ptr, json[i], json_sizes[i] + 1);
+        ptr += json_sizes[i] + 1;
+    }
+
+    for (size_t i = 0; i < codename_count; ++i) {
+        unsigned char *entry = buf + DB_HEADER_SIZE
+                + (device_count + i) * DB_ENTRY_SIZE;
+        size_t name_size = strlen(codenames[i].name) + 1;
+
+        write_le32(entry, (uint32_t) (ptr - buf));
+        write_le32(entry + 4, codenames[i].device_index);
+        memcpy(ptr, codenames[i].name, name_size);
+        ptr += name_size;
+    }
+
+    *size_out = (size_t) size;
+    ok = true;
+
+done:
+    saved_errno = errno;
+    if (json) {
+        for (size_t i = 0; i < device_count; ++i) {
+            free(json[i]);
+        }
+    }
+    free(json);
+    free(json_sizes);
+    free(codenames);
+    if (!ok) {
+        free(buf);
+    }
+    errno = saved_errno;
+    return ok ? buf : NULL;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbdevice/database.h"
+#include "mbdevice/device.h"
+
+struct DatabaseTest : testing::Test
+{
+    Device *_devices[4];
+    void *_data;
+    size_t _size;
+
+    DatabaseTest() : _devices(), _data(nullptr), _size(0)
+    {
+    }
+
+    virtual ~DatabaseTest()
+    {
+        for (Device *device : _devices) {
+            mb_device_free(device);
+        }
+        free(_data);
+    }
+
+    virtual void SetUp()
+    {
+        const char *codenames_a[] = { "zeta", "alpha", nullptr };
+        const char *codenames_b[] = { "beta", "shared", nullptr };
+        const char *codenames_c[] = { "shared", "gamma", nullptr };
+
+        _devices[0] = new_device("a", "Device A", codenames_a);
+        _devices[1] = new_device("b", "Device B", codenames_b);
+        _devices[2] = new_device("c", "Device C", codenames_c);
+        _devices[3] = nullptr;
+
+        _data = mb_device_database_build(_devices, &_size);
+        ASSERT_NE(_data, nullptr);
+    }
+
+    static Device * new_device(const char *id, const char *name,
+                               const char * const *codenames)
+    {
+        Device *device = mb_device_new();
+        mb_device_set_id(device, id);
+        mb_device_set_name(device, name);
+        mb_device_set_codenames(device, codenames);
+        mb_device_set_architecture(device, "arm64-v8a");
+        return device;
+    }
+};
+
+TEST_F(DatabaseTest, GetDevices)
+{
+    MbDeviceDatabase *db = mb_device_database_open_buffer(_data, _size);
+    ASSERT_NE(db, nullptr);
+    ASSERT_EQ(mb_device_database_count(db), 3u);
+
+    for (size_t i = 0; i < 3; ++i) {
+        Device *device = mb_device_database_get(db, i);
+        ASSERT_NE(device, nullptr);
+        ASSERT_TRUE(mb_device_equals(device, _devices[i]));
+        mb_device_free(device);
+    }
+
+    ASSERT_EQ(mb_device_database_get(db, 3), nullptr);
+    ASSERT_EQ(errno, ERANGE);
+
+    mb_device_database_close(db);
+}
+
+TEST_F(DatabaseTest, FindByCodename)
+{
+    MbDeviceDatabase *db = mb_device_database_open_buffer(_data, _size);
+    ASSERT_NE(db, nullptr);
+
+    struct {
+        const char *codename;
+        const char *id;
+    } cases[] = {
+        { "alpha", "a" },
+        { "zeta", "a" },
+        { "beta", "b" },
+        { "gamma", "c" },
+        // The first device in the database wins
+        { "shared", "b" },
+    };
+
+    for (auto const &c : cases) {
+        Device *device = mb_device_database_find(db, c.codename);
+        ASSERT_NE(device, nullptr) << c.codename;
+        ASSERT_STREQ(mb_device_id(device), c.id);
+        mb_device_free(device);
+    }
+
+    for (const char *codename : { "", "a", "delta", "zzz" }) {
+        ASSERT_EQ(mb_device_database_find(db, codename), nullptr) << codename;
+        ASSERT_EQ(errno, ENOENT);
+    }
+
+    mb_device_database_close(db);
+}
+
+TEST_F(DatabaseTest, FindValidDeviceInDatabaseOrder)
+{
+    const char *codenames_a[] = { "first", "only_a", nullptr };
+    const char *codenames_b[] = { "second", "shared", nullptr };
+    const char *codenames_c[] = { "first", "shared", nullptr };
+    const char *codenames_d[] = { "second", nullptr };
+    const char *block_devs[] = { "/dev/block/test", nullptr };
+
+    Device *devices[5];
+    devices[0] = new_device("a", "Device A", codenames_a);
+    devices[1] = new_device("b", "Device B", codenames_b);
+    devices[2] = new_device("c", "Device C", codenames_c);
+    devices[3] = new_device("d", "Device D", codenames_d);
+    devices[4] = nullptr;
+
+    // Device A is invalid
+    for (size_t i = 1; i < 4; ++i) {
+        mb_device_set_system_block_devs(devices[i], block_devs);
+        mb_device_set_cache_block_devs(devices[i], block_devs);
+        mb_device_set_data_block_devs(devices[i], block_devs);
+        mb_device_set_boot_block_devs(devices[i], block_devs);
+    }
+
+    size_t size;
+    void *data = mb_device_database_build(devices, &size);
+    ASSERT_NE(data, nullptr);
+
+    MbDeviceDatabase *db = mb_device_database_open_buffer(data, size);
+    ASSERT_NE(db, nullptr);
+
+    struct {
+        const char *codenames[3];
+        const char *id;
+    } cases[] = {
+        // Invalid match is skipped in favor of the next device with the same
+        // codename
+        { { "first", nullptr }, "c" },
+        // Second codename is tried when the first only matches an invalid
+        // device
+        { { "first", "second", nullptr }, "b" },
+        // Earliest device wins regardless of the order of the codenames
+        { { "shared", "first", nullptr }, "b" },
+        { { "unknown", "second", nullptr }, "b" },
+    };
+
+    for (auto const &c : cases) {
+        Device *device = mb_device_database_find_valid(db, c.codenames);
+        ASSERT_NE(device, nullptr) << c.codenames[0];
+        ASSERT_STREQ(mb_device_id(device), c.id) << c.codenames[0];
+        mb_device_free(device);
+    }
+
+    const char *unknown[] = { "unknown", "", nullptr };
+    ASSERT_EQ(mb_device_database_find_valid(db, unknown), nullptr);
+    ASSERT_EQ(errno, ENOENT);
+
+    // Only matches the invalid device
+    const char *invalid[] = { "only_a", nullptr };
+    ASSERT_EQ(mb_device_database_find_valid(db, invalid), nullptr);
+    ASSERT_EQ(errno, ENOENT);
+
+    mb_device_database_close(db);
+    free(data);
+
+    for (Device *device : devices) {
+        mb_device_free(device);
+    }
+}
+
+TEST_F(DatabaseTest, EmptyDatabase)
+{
+    Device *devices[] = { nullptr };
+    size_t size;
+    void *data = mb_device_database_build(devices, &size);
+    ASSERT_NE(data, nullptr);
+
+    MbDeviceDatabase *db = mb_device_database_open_buffer(data, size);
+    ASSERT_NE(db, nullptr);
+    ASSERT_EQ(mb_device_database_count(db), 0u);
+    ASSERT_EQ(mb_device_database_find(db, "alpha"), nullptr);
+    ASSERT_EQ(errno, ENOENT);
+
+    mb_device_database_close(db);
+    free(data);
+}
+
+TEST_F(DatabaseTest, RejectInvalidData)
+{
+    const char json[] = "[{\"id\":\"a\"}]";
+    ASSERT_EQ(mb_device_database_open_buffer(json, sizeof(json)), nullptr);
+    ASSERT_EQ(errno, EINVAL);
+
+    // Truncated tables
+    ASSERT_EQ(mb_device_database_open_buffer(_data, 30), nullptr);
+    ASSERT_EQ(errno, EINVAL);
+
+    // Truncated strings
+    ASSERT_EQ(mb_device_database_open_buffer(_data, _size - 1), nullptr);
+    ASSERT_EQ(errno, EINVAL);
+
+    // Unsupported version
+    static_cast<unsigned char *>(_data)[8] = 0xff;
+    ASSERT_EQ(mb_device_database_open_buffer(_data, _size), nullptr);
+    ASSERT_EQ(errno, EINVAL);
+}
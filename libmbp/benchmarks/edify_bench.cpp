@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Throughput of the edify tokenizer on a synthetic updater-script. The script
+// is built from the constructs found in real ROM installers: comments, quoted
+// strings with escapes, nested function calls, conditionals, and
+// concatenation.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "mbp/edify/tokenizer.h"
+
+#define SCRIPT_SIZE     (1024 * 1024)
+
+// std::mt19937 is specified exactly by the standard, so the input is the same
+// on every platform and across releases
+static const std::string & updater_script()
+{
+    static std::string script;
+
+    if (!script.empty()) {
+        return script;
+    }
+
+    static const char *statements[] = {
+        "# Install system files\n",
+        "ui_print(\"Installing \\\"ROM\\\" \\x41\\n\");\n",
+        "mount(\"ext4\", \"EMMC\", "
+            "\"/dev/block/platform/msm_sdcc.1/by-name/system\", "
+            "\"/system\");\n",
+        "package_extract_dir(\"system\", \"/system\");\n",
+        "symlink(\"toolbox\", \"/system/bin/cat\", \"/system/bin/ls\", "
+            "\"/system/bin/ps\");\n",
+        "set_metadata_recursive(\"/system\", \"uid\", 0, \"gid\", 0, "
+            "\"dmode\", 0755, \"fmode\", 0644, \"capabilities\", 0x0, "
+            "\"selabel\", \"u:object_r:system_file:s0\");\n",
+        "if is_mounted(\"/data\") == \"\" && "
+            "!less_than_int(getprop(\"ro.build.date.utc\"), 1400000000) then\n",
+        "    run_program(\"/sbin/busybox\", \"mount\", \"/data\") || "
+            "abort(\"Failed to \" + \"mount /data\");\n",
+        "else\n",
+        "    ui_print(concat(\"Skipping \", \"data\"));\n",
+        "endif;\n",
+        "assert(getprop(\"ro.product.device\") == \"hammerhead\" || "
+            "getprop(\"ro.build.product\") != \"hammerhead\");\n",
+        "unmount(\"/system\");\n",
+    };
+
+    const size_t n_statements = sizeof(statements) / sizeof(statements[0]);
+    std::mt19937 gen(8);
+
+    while (script.size() < SCRIPT_SIZE) {
+        script += statements[gen() % n_statements];
+    }
+
+    return script;
+}
+
+static void BM_EdifyTokenizeRefs(benchmark::State &state)
+{
+    const std::string &script = updater_script();
+    std::vector<mbp::EdifyTokenRef> tokens;
+
+    for (auto _ : state) {
+        if (!mbp::EdifyTokenizer::tokenize(script.data(), script.size(),
+                                           &tokens)) {
+            state.SkipWithError("Failed to tokenize script");
+            break;
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * script.size());
+    state.counters["tokens"] = tokens.size();
+}
+BENCHMARK(BM_EdifyTokenizeRefs)->Unit(benchmark::kMillisecond);
+
+static void BM_EdifyTokenizeObjects(benchmark::State &state)
+{
+    const std::string &script = updater_script();
+    std::vector<mbp::EdifyToken *> tokens;
+    size_t count = 0;
+
+    for (auto _ : state) {
+        if (!mbp::EdifyTokenizer::tokenize(script.data(), script.size(),
+                                           &tokens)) {
+            state.SkipWithError("Failed to tokenize script");
+            break;
+        }
+
+        count = tokens.size();
+        for (mbp::EdifyToken *t : tokens) {
+            delete t;
+        }
+        tokens.clear();
+    }
+
+    state.SetBytesProcessed(state.iterations() * script.size());
+    state.counters["tokens"] = count;
+}
+BENCHMARK(BM_EdifyTokenizeObjects)->Unit(benchmark::kMillisecond);
+
+// Tokenizes the script and indexes its function calls, as the standard
+// autopatcher does
+static void BM_EdifyScriptLoad(benchmark::State &state)
+{
+    const std::string &script = updater_script();
+    size_t calls = 0;
+
+    for (auto _ : state) {
+        mbp::EdifyScript edify;
+        if (!edify.load(script.data(), script.size())) {
+            state.SkipWithError("Failed to load script");
+            break;
+        }
+        calls = edify.calls().size();
+    }
+
+    state.SetBytesProcessed(state.iterations() * script.size());
+    state.counters["calls"] = calls;
+}
+BENCHMARK(BM_EdifyScriptLoad)->Unit(benchmark::kMillisecond);
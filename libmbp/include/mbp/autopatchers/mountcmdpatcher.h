@@ -45,6 +45,9 @@ public:
     virtual std::vector<std::string> existingFiles() const override;
 
     virtual bool patchFiles(const std::string &directory) override;
+    virtual bool patchContents(const std::string &name,
+                               std::string *contents) override;
+    virtual LineFilterCallback lineFilter(const std::string &name) const override;
 
 private:
     class Impl;
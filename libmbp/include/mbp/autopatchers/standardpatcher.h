@@ -49,9 +49,12 @@ public:
     virtual std::vector<std::string> existingFiles() const override;
 
     virtual bool patchFiles(const std::string &directory) override;
+    virtual bool patchContents(const std::string &name,
+                               std::string *contents) override;
+    virtual LineFilterCallback lineFilter(const std::string &name) const override;
 
-    bool patchUpdater(const std::string &directory);
-    bool patchTransferList(const std::string &directory);
+    bool patchUpdater(std::string *contents);
+    bool patchTransferList(std::string *contents);
 
 private:
     class Impl;
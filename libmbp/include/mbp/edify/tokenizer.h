@@ -265,11 +265,32 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Token that refers to its text in the tokenized buffer instead of owning a
+// copy of it
+struct EdifyTokenRef
+{
+    EdifyTokenType type;
+    std::size_t offset;
+    std::size_t size;
+};
+
+// Function call site. The members are indexes into the list of tokens.
+struct EdifyCall
+{
+    std::size_t name;
+    std::size_t leftParen;
+    std::size_t rightParen;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 class EdifyTokenizer
 {
 public:
     static bool tokenize(const char *data, std::size_t size,
                          std::vector<EdifyToken *> *tokens);
+    static bool tokenize(const char *data, std::size_t size,
+                         std::vector<EdifyTokenRef> *tokens);
     static std::string untokenize(const std::vector<EdifyToken *> &tokens);
     static std::string untokenize(const std::vector<EdifyToken *>::iterator &begin,
                                   const std::vector<EdifyToken *>::iterator &end);
@@ -279,6 +300,8 @@ public:
 private:
     static bool isValidUnquoted(char c);
 
+    static bool scanToken(const char *data, std::size_t size, std::size_t pos,
+                          EdifyTokenType *type, std::size_t *length);
     static bool nextToken(const char *data, std::size_t size, std::size_t *pos,
                           EdifyToken **token);
 
@@ -287,4 +310,54 @@ private:
     EdifyTokenizer(EdifyTokenizer &&) = delete;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Editable edify script
+ *
+ * The tokens are stored in a single array and only reference the source
+ * buffer, which must outlive this object. Function calls are indexed once
+ * when the script is loaded. Replacing a call does not modify the tokens, but
+ * records a piece of replacement text that is spliced in by generate(), so
+ * any number of replacements can be made in linear time.
+ *
+ * Replacements must be made in the order of the call sites and cannot
+ * overlap.
+ */
+class EdifyScript
+{
+public:
+    EdifyScript();
+
+    bool load(const char *data, std::size_t size);
+
+    const std::vector<EdifyTokenRef> & tokens() const;
+    const std::vector<EdifyCall> & calls() const;
+
+    std::string text(const EdifyTokenRef &token) const;
+    bool textEquals(const EdifyTokenRef &token, const char *str) const;
+    bool unescapedString(const EdifyTokenRef &token, std::string *out) const;
+
+    bool replace(const EdifyCall &call, std::string replacement);
+
+    std::string generate() const;
+
+    void dump() const;
+
+private:
+    struct Piece
+    {
+        // Range of replaced tokens
+        std::size_t begin;
+        std::size_t end;
+        std::string text;
+    };
+
+    const char *m_data;
+    std::size_t m_size;
+    std::vector<EdifyTokenRef> m_tokens;
+    std::vector<EdifyCall> m_calls;
+    std::vector<Piece> m_pieces;
+};
+
 }
@@ -19,6 +19,9 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include "mbcommon/common.h"
 
 #include "errors.h"
@@ -28,6 +31,8 @@
 namespace mbp
 {
 
+class PatcherConfig;
+
 /*!
  * \class Patcher
  * \brief Handles the patching of zip files and boot images
@@ -100,9 +105,21 @@ public:
  *
  * \sa Patcher
  */
-class AutoPatcher
+class MB_EXPORT AutoPatcher
 {
 public:
+    enum class LineAction
+    {
+        // Keep the line, including any changes made by the filter
+        Keep,
+        // Remove the line
+        Drop,
+        // More of the line is needed to decide
+        NeedMore
+    };
+
+    typedef LineAction (*LineFilterCallback) (std::string *line, bool complete);
+
     virtual ~AutoPatcher() {}
 
     /*!
@@ -138,6 +155,57 @@ public:
      * \param directory Directory containing the files to be patched
      */
     virtual bool patchFiles(const std::string &directory) = 0;
+
+    /*!
+     * \brief Patch the contents of a file in memory
+     *
+     * Files that the autopatcher does not handle are left unmodified.
+     *
+     * The default implementation writes the file to a temporary directory
+     * under PatcherConfig::tempDirectory() and patches it with patchFiles(),
+     * so autopatchers that only implement patchFiles() keep working.
+     *
+     * \param name Path of the file in the zip file (from existingFiles())
+     * \param contents Contents of the file. This will be replaced by the
+     *                 patched contents.
+     */
+    virtual bool patchContents(const std::string &name,
+                               std::string *contents);
+
+    /*!
+     * \brief Line filter for a file that is patched one line at a time
+     *
+     * An autopatcher that only needs to look at the beginning of each line of
+     * a file can return a filter for it. The file is then patched while it is
+     * streamed from the input zip to the output zip instead of being loaded
+     * into memory and passed to patchContents().
+     *
+     * The filter receives the beginning of a line (without the newline) and
+     * whether the entire line is available. The line may be modified if it is
+     * kept.
+     *
+     * The default implementation returns nullptr for all files.
+     *
+     * \param name Path of the file in the zip file (from existingFiles())
+     *
+     * \return Filter or nullptr if the file should be passed to
+     *         patchContents()
+     */
+    virtual LineFilterCallback lineFilter(const std::string &name) const
+    {
+        (void) name;
+        return nullptr;
+    }
+
+protected:
+    /*!
+     * \param pc PatcherConfig providing the temporary directory used by the
+     *           default patchContents()
+     */
+    explicit AutoPatcher(const PatcherConfig * const pc);
+
+private:
+    const PatcherConfig *m_pc;
 };
 
 }
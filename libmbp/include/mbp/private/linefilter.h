@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "mbp/patcherinterface.h"
+
+
+namespace mbp
+{
+
+/*
+ * Streaming line filter
+ *
+ * Data is passed to write() in chunks of any size. Only the beginning of each
+ * line is buffered until the filter callback decides what to do with the line.
+ * The rest of the line is then passed through or discarded directly, so memory
+ * usage does not depend on the size of the input.
+ *
+ * The output is the same as splitting the input at '\n', filtering the lines,
+ * and joining them with '\n'.
+ */
+class LineFilter
+{
+public:
+    typedef bool (*WriteCallback) (const char *data, std::size_t size,
+                                   void *userData);
+
+    LineFilter(AutoPatcher::LineFilterCallback filterCb,
+               WriteCallback writeCb, void *userData);
+
+    bool write(const char *data, std::size_t size);
+    bool finish();
+
+    static bool filter(AutoPatcher::LineFilterCallback filterCb,
+                       std::string *contents);
+
+private:
+    enum class State
+    {
+        Buffering,
+        Passing,
+        Dropping
+    };
+
+    bool processLine(bool complete);
+
+    AutoPatcher::LineFilterCallback m_filterCb;
+    WriteCallback m_writeCb;
+    void *m_userData;
+
+    State m_state;
+    std::string m_line;
+    bool m_first;
+};
+
+}
@@ -26,6 +26,7 @@
 #include "minizip/zip.h"
 
 #include "mbp/errors.h"
+#include "mbp/patcherinterface.h"
 
 
 namespace mbp
@@ -52,7 +53,7 @@ public:
 
     static UnzCtx * openInputFile(std::string path);
 
-    static ZipCtx * openOutputFile(std::string path);
+    static ZipCtx * openOutputFile(std::string path, bool append = false);
 
     static int closeInputFile(UnzCtx *ctx);
 
@@ -85,6 +86,11 @@ public:
     static ErrorCode addFile(zipFile zf,
                              const std::string &name,
                              const std::string &path);
+
+    static ErrorCode filterFile(unzFile uf,
+                                zipFile zf,
+                                const std::string &name,
+                                AutoPatcher::LineFilterCallback filter);
 };
 
 }
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace mbp
+{
+
+/*
+ * Parallel raw deflate compressor
+ *
+ * The input is split into fixed-size blocks that are compressed on a pool of
+ * worker threads. Like pigz, each block is primed with the last 32 KiB of the
+ * previous block as the dictionary and ends with a sync flush, so the
+ * concatenated output is a single valid deflate stream that compresses almost
+ * as well as a serial one.
+ *
+ * Compressed data is passed to the write callback in order, on the thread
+ * calling write() or finish(). The result is suitable for writing to a zip
+ * entry opened in raw mode.
+ */
+class ParallelDeflate
+{
+public:
+    typedef bool (*WriteCallback) (const void *data, std::size_t size,
+                                   void *userData);
+
+    ParallelDeflate(int level, unsigned int threads,
+                    WriteCallback cb, void *userData);
+    ~ParallelDeflate();
+
+    bool write(const void *data, std::size_t size);
+    bool finish();
+
+    // CRC32 and size of the uncompressed data written so far
+    uint32_t crc32() const;
+    uint64_t size() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+
+    ParallelDeflate(const ParallelDeflate &) = delete;
+    ParallelDeflate & operator=(const ParallelDeflate &) = delete;
+};
+
+}
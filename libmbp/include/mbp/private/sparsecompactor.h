@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include <cstddef>
+
+
+namespace mbp
+{
+
+/*
+ * Streaming sparse image re-encoder
+ *
+ * The chunk list of an Android sparse image is parsed as the image is written
+ * and an equivalent, more compact sparse image is passed to the write
+ * callback:
+ *
+ * - Adjacent DONT_CARE chunks are merged
+ * - Raw chunks that consist of a single repeated 32-bit value become fill
+ *   chunks and adjacent fill chunks with the same value are merged
+ * - CRC32 chunks are dropped
+ * - Extra bytes in the file and chunk headers are dropped
+ *
+ * The sparse header is written before the chunk count is known, so the number
+ * of chunks in the output is kept the same as in the input by terminating the
+ * image with empty DONT_CARE chunks in place of the ones that were removed.
+ *
+ * write() and finish() fail if the input is not a valid sparse image.
+ */
+class SparseCompactor
+{
+public:
+    typedef bool (*WriteCallback) (const void *data, std::size_t size,
+                                   void *userData);
+
+    SparseCompactor(WriteCallback cb, void *userData);
+    ~SparseCompactor();
+
+    bool write(const void *data, std::size_t size);
+    bool finish();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+
+    SparseCompactor(const SparseCompactor &) = delete;
+    SparseCompactor & operator=(const SparseCompactor &) = delete;
+};
+
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbp/errors.h"
+
+
+namespace mbp
+{
+
+/*!
+ * \brief Copies zip entries without recompressing them
+ *
+ * The input zip's central directory tells us the compressed size of every
+ * entry, so the position of every entry in the output zip can be computed
+ * before any data is copied. This lets several entries be copied in parallel
+ * using large positional reads and writes instead of pushing every entry
+ * through minizip's stream interface.
+ *
+ * The output contains only the copied entries and a new central directory.
+ * More entries can be added afterwards by opening it with minizip in
+ * APPEND_STATUS_ADDINZIP mode.
+ */
+class ZipRewriter
+{
+public:
+    struct Entry {
+        // Name in the input zip
+        std::string name;
+        // Name in the output zip
+        std::string outputName;
+
+        uint16_t versionMadeBy;
+        uint16_t versionNeeded;
+        uint16_t flags;
+        uint16_t method;
+        uint16_t dosTime;
+        uint16_t dosDate;
+        uint32_t crc32;
+        uint64_t compressedSize;
+        uint64_t uncompressedSize;
+        uint16_t internalAttrs;
+        uint32_t externalAttrs;
+
+        // Offsets of the local file header
+        uint64_t inputOffset;
+        uint64_t outputOffset;
+    };
+
+    typedef void (*ProgressCb)(uint64_t bytes, void *userData);
+
+    static ErrorCode readCentralDirectory(const std::string &path,
+                                          std::vector<Entry> *entries);
+
+    static ErrorCode copyEntries(const std::string &inputPath,
+                                 const std::string &outputPath,
+                                 std::vector<Entry> *entries,
+                                 ProgressCb cb, void *userData,
+                                 volatile bool *cancelled);
+};
+
+}
@@ -22,7 +22,7 @@
 #include <cstring>
 
 #include "mbp/private/fileutils.h"
-#include "mbp/private/stringutils.h"
+#include "mbp/private/linefilter.h"
 
 
 namespace mbp
@@ -50,7 +50,7 @@ static const std::string InstallerScript =
 
 MountCmdPatcher::MountCmdPatcher(const PatcherConfig * const pc,
                                  const FileInfo * const info) :
-    m_impl(new Impl())
+    AutoPatcher(pc), m_impl(new Impl())
 {
     m_impl->pc = pc;
     m_impl->info = info;
@@ -85,42 +85,61 @@ static bool spaceOrEnd(const char *ptr)
     return !*ptr || isspace(*ptr);
 }
 
-static bool patchFile(const std::string &path)
+static AutoPatcher::LineAction filterScriptLine(std::string *line,
+                                               bool complete)
 {
-    std::string contents;
+    const char *ptr = line->c_str();
 
-    ErrorCode ret = FileUtils::readToString(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
+    // Skip whitespace
+    for (; *ptr && isspace(*ptr); ++ptr);
+
+    // Need "umount" and the character after it
+    if (!complete && std::strlen(ptr) < 7) {
+        return AutoPatcher::LineAction::NeedMore;
     }
 
-    std::vector<std::string> lines = StringUtils::split(contents, '\n');
+    if ((strncmp(ptr, "mount", 5) == 0 && spaceOrEnd(ptr + 5))
+            || (strncmp(ptr, "umount", 6) == 0 && spaceOrEnd(ptr + 6))) {
+        line->insert(ptr - line->c_str(), "/sbin/");
+    }
 
-    for (std::string &line : lines) {
-        const char *ptr = line.data();
+    return AutoPatcher::LineAction::Keep;
+}
 
-        // Skip whitespace
-        for (; *ptr && isspace(*ptr); ++ptr);
+bool MountCmdPatcher::patchFiles(const std::string &directory)
+{
+    for (auto const &file : existingFiles()) {
+        std::string path = directory + "/" + file;
+        std::string contents;
 
-        if ((strncmp(ptr, "mount", 5) == 0 && spaceOrEnd(ptr + 5))
-                || (strncmp(ptr, "umount", 6) == 0 && spaceOrEnd(ptr + 6))) {
-            line.insert(ptr - line.data(), "/sbin/");
+        if (FileUtils::readToString(path, &contents) == ErrorCode::NoError) {
+            patchContents(file, &contents);
+            FileUtils::writeFromString(path, contents);
         }
     }
 
-    contents = StringUtils::join(lines, "\n");
-    FileUtils::writeFromString(path, contents);
-
+    // Don't fail if an error occurs
     return true;
 }
 
-bool MountCmdPatcher::patchFiles(const std::string &directory)
+bool MountCmdPatcher::patchContents(const std::string &name,
+                                    std::string *contents)
 {
-    patchFile(directory + "/" + FlashScript);
-    patchFile(directory + "/" + InstallerScript);
+    if (name == FlashScript || name == InstallerScript) {
+        return LineFilter::filter(&filterScriptLine, contents);
+    }
 
-    // Don't fail if an error occurs
     return true;
 }
 
+AutoPatcher::LineFilterCallback
+MountCmdPatcher::lineFilter(const std::string &name) const
+{
+    if (name == FlashScript || name == InstallerScript) {
+        return &filterScriptLine;
+    }
+
+    return nullptr;
+}
+
 }
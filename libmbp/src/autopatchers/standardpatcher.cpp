@@ -19,6 +19,8 @@
 
 #include "mbp/autopatchers/standardpatcher.h"
 
+#include <algorithm>
+
 #include <cstring>
 
 #include "mbcommon/string.h"
@@ -26,6 +28,7 @@
 
 #include "mbp/edify/tokenizer.h"
 #include "mbp/private/fileutils.h"
+#include "mbp/private/linefilter.h"
 #include "mbp/private/stringutils.h"
 
 #define DUMP_DEBUG 0
@@ -63,7 +66,7 @@ const std::string StandardPatcher::SystemTransferList
 
 StandardPatcher::StandardPatcher(const PatcherConfig * const pc,
                                  const FileInfo * const info) :
-    m_impl(new Impl())
+    AutoPatcher(pc), m_impl(new Impl())
 {
     m_impl->pc = pc;
     m_impl->info = info;
@@ -105,162 +108,33 @@ static bool findItemsInString(const char *haystack,
     return false;
 }
 
-static bool findFunction(const std::vector<EdifyToken *>::iterator begin,
-                         const std::vector<EdifyToken *>::iterator end,
-                         std::vector<EdifyToken *>::iterator *outFuncName,
-                         std::vector<EdifyToken *>::iterator *outLeftParen,
-                         std::vector<EdifyToken *>::iterator *outRightParen)
-{
-    std::vector<EdifyToken *>::iterator funcName;
-    std::vector<EdifyToken *>::iterator leftParen;
-    std::vector<EdifyToken *>::iterator rightParen;
-
-    for (auto it = begin; it != end; ++it) {
-        // Find string representing the function name
-        if ((*it)->type() != EdifyTokenType::String) {
-            continue;
-        }
-
-        funcName = it;
-
-        bool foundLeftParen = false;
-        bool foundRightParen = false;
-
-        // Barring any whitespace, newlines, or comments, the function name
-        // should be followed by a left parenthesis
-        for (auto it2 = it + 1; it2 != end; ++it2) {
-            if ((*it2)->type() == EdifyTokenType::Whitespace
-                    || (*it2)->type() == EdifyTokenType::Newline
-                    || (*it2)->type() == EdifyTokenType::Comment) {
-                continue;
-            } else if ((*it2)->type() == EdifyTokenType::LeftParen) {
-                foundLeftParen = true;
-                leftParen = it2;
-            }
-            break;
-        }
-
-        // If a left parenthesis was not found, then the string token was not
-        // a function name
-        if (!foundLeftParen) {
-            continue;
-        }
-
-        // Left for matching right parenthesis
-        std::size_t depth = 0;
-
-        for (auto it2 = leftParen; it2 != end; ++it2) {
-            if ((*it2)->type() == EdifyTokenType::LeftParen) {
-                ++depth;
-            } else if ((*it2)->type() == EdifyTokenType::RightParen) {
-                --depth;
-            }
-            if (depth == 0) {
-                foundRightParen = true;
-                rightParen = it2;
-                break;
-            }
-        }
-
-        // If a right parenthesis was not found, but the function name and left
-        // parenthesis were found, then assume there's a syntax error and bail
-        // out
-        if (!foundRightParen) {
-            return false;
-        }
-
-        *outFuncName = funcName;
-        *outLeftParen = leftParen;
-        *outRightParen = rightParen;
-
-        return true;
-    }
-
-    return false;
-}
-
-/*!
- * \brief Replace edify function
- *
- * \param tokens List of edify tokens
- * \param funcName Function name token of the replaced function
- * \param leftParen Left parenthesis token of the replaced function
- * \param rightParen Right parenthesis token of the replaced function
- * \param replacement Replacement edify function (in string form)
- *
- * \return New iterator pointing to position *after* the right parenthesis of
- *         the replaced function. Returns tokens->end() if the replacement
- *         string could not be tokenized.
- */
-static std::vector<EdifyToken *>::iterator
-replaceFunction(std::vector<EdifyToken *> *tokens,
-                std::vector<EdifyToken *>::iterator funcName,
-                std::vector<EdifyToken *>::iterator leftParen,
-                std::vector<EdifyToken *>::iterator rightParen,
-                const std::string &replacement)
-{
-    // Included for completeness' sake
-    (void) leftParen;
-
-    std::vector<EdifyToken *> replacementTokens;
-    bool result = EdifyTokenizer::tokenize(
-            replacement.data(), replacement.size(), &replacementTokens);
-    if (!result) {
-        LOGE("Failed to tokenize replacement function string: %s",
-             replacement.c_str());
-        return tokens->end();
-    }
-
-    // Deallocate replaced tokens
-    for (auto it = funcName; it != rightParen; ++it) {
-        delete *it;
-    }
-    delete *rightParen;
-
-    // Remove replaced tokens
-    auto it = tokens->erase(funcName, rightParen);
-    it = tokens->erase(it);
-
-    // Add replacement tokens
-    it = tokens->insert(it, replacementTokens.begin(), replacementTokens.end());
-
-    // Move iterator to the end of the replaced tokens
-    it += replacementTokens.size();
-
-    return it;
-}
-
 /*!
  * \brief Replace edify mount() command
  *
- * \param tokens List of edify tokens
- * \param funcName Function name token
- * \param leftParen Left parenthesis token
- * \param rightParen Right parenthesis token
+ * \param script Edify script
+ * \param call Function call site
  * \param systemDevs List of system partition block devices
  * \param cacheDevs List of cache partition block devices
  * \param dataDevs List of data partition block devices
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function was successfully replaced or left untouched
  */
-static std::vector<EdifyToken *>::iterator
-replaceEdifyMount(std::vector<EdifyToken *> *tokens,
-                  const std::vector<EdifyToken *>::iterator funcName,
-                  const std::vector<EdifyToken *>::iterator leftParen,
-                  const std::vector<EdifyToken *>::iterator rightParen,
-                  const char * const *systemDevs,
-                  const char * const *cacheDevs,
-                  const char * const *dataDevs)
+static bool replaceEdifyMount(EdifyScript *script,
+                              const EdifyCall &call,
+                              const char * const *systemDevs,
+                              const char * const *cacheDevs,
+                              const char * const *dataDevs)
 {
+    auto const &tokens = script->tokens();
+
     // For the mount() edify function, replace with the corresponding
     // update-binary-tool command
-    for (auto it = leftParen + 1; it != rightParen; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    for (auto i = call.leftParen + 1; i != call.rightParen; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string str = token->string();
+        const std::string str = script->text(tokens[i]);
 
         bool isSystem = str.find("/system") != std::string::npos
                 || findItemsInString(str.c_str(), systemDevs);
@@ -271,50 +145,43 @@ replaceEdifyMount(std::vector<EdifyToken *> *tokens,
                 || findItemsInString(str.c_str(), dataDevs);
 
         if (isSystem) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(MOUNT_FMT, "/system"));
+            return script->replace(call, StringUtils::format(MOUNT_FMT, "/system"));
         } else if (isCache) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(MOUNT_FMT, "/cache"));
+            return script->replace(call, StringUtils::format(MOUNT_FMT, "/cache"));
         } else if (isData) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(MOUNT_FMT, "/data"));
+            return script->replace(call, StringUtils::format(MOUNT_FMT, "/data"));
         }
     }
-    return rightParen + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify unmount() command
  *
- * \param tokens List of edify tokens
- * \param funcName Function name token
- * \param leftParen Left parenthesis token
- * \param rightParen Right parenthesis token
+ * \param script Edify script
+ * \param call Function call site
  * \param systemDevs List of system partition block devices
  * \param cacheDevs List of cache partition block devices
  * \param dataDevs List of data partition block devices
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function was successfully replaced or left untouched
  */
-static std::vector<EdifyToken *>::iterator
-replaceEdifyUnmount(std::vector<EdifyToken *> *tokens,
-                    const std::vector<EdifyToken *>::iterator funcName,
-                    const std::vector<EdifyToken *>::iterator leftParen,
-                    const std::vector<EdifyToken *>::iterator rightParen,
-                    const char * const *systemDevs,
-                    const char * const *cacheDevs,
-                    const char * const *dataDevs)
+static bool replaceEdifyUnmount(EdifyScript *script,
+                                const EdifyCall &call,
+                                const char * const *systemDevs,
+                                const char * const *cacheDevs,
+                                const char * const *dataDevs)
 {
+    auto const &tokens = script->tokens();
+
     // For the unmount() edify function, replace with the corresponding
     // update-binary-tool command
-    for (auto it = leftParen + 1; it != rightParen; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    for (auto i = call.leftParen + 1; i != call.rightParen; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string str = token->string();
+        const std::string str = script->text(tokens[i]);
 
         bool isSystem = str.find("/system") != std::string::npos
                 || findItemsInString(str.c_str(), systemDevs);
@@ -325,41 +192,34 @@ replaceEdifyUnmount(std::vector<EdifyToken *> *tokens,
                 || findItemsInString(str.c_str(), dataDevs);
 
         if (isSystem) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(UNMOUNT_FMT, "/system"));
+            return script->replace(call, StringUtils::format(UNMOUNT_FMT, "/system"));
         } else if (isCache) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(UNMOUNT_FMT, "/cache"));
+            return script->replace(call, StringUtils::format(UNMOUNT_FMT, "/cache"));
         } else if (isData) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(UNMOUNT_FMT, "/data"));
+            return script->replace(call, StringUtils::format(UNMOUNT_FMT, "/data"));
         }
     }
-    return rightParen + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify run_program() command
  *
- * \param tokens List of edify tokens
- * \param funcName Function name token
- * \param leftParen Left parenthesis token
- * \param rightParen Right parenthesis token
+ * \param script Edify script
+ * \param call Function call site
  * \param systemDevs List of system partition block devices
  * \param cacheDevs List of cache partition block devices
  * \param dataDevs List of data partition block devices
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function was successfully replaced or left untouched
  */
-static std::vector<EdifyToken *>::iterator
-replaceEdifyRunProgram(std::vector<EdifyToken *> *tokens,
-                       const std::vector<EdifyToken *>::iterator funcName,
-                       const std::vector<EdifyToken *>::iterator leftParen,
-                       const std::vector<EdifyToken *>::iterator rightParen,
-                       const char * const *systemDevs,
-                       const char * const *cacheDevs,
-                       const char * const *dataDevs)
+static bool replaceEdifyRunProgram(EdifyScript *script,
+                                   const EdifyCall &call,
+                                   const char * const *systemDevs,
+                                   const char * const *cacheDevs,
+                                   const char * const *dataDevs)
 {
+    auto const &tokens = script->tokens();
     bool foundReboot = false;
     bool foundMount = false;
     bool foundUmount = false;
@@ -369,13 +229,15 @@ replaceEdifyRunProgram(std::vector<EdifyToken *> *tokens,
     bool isCache = false;
     bool isData = false;
 
-    for (auto it = leftParen + 1; it != rightParen; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    for (auto i = call.leftParen + 1; i != call.rightParen; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string unescaped = token->unescapedString();
+        std::string unescaped;
+        if (!script->unescapedString(tokens[i], &unescaped)) {
+            return false;
+        }
 
         if (mb_ends_with(unescaped.c_str(), "reboot")) {
             foundReboot = true;
@@ -409,115 +271,97 @@ replaceEdifyRunProgram(std::vector<EdifyToken *> *tokens,
     }
 
     if (foundReboot) {
-        return replaceFunction(tokens, funcName, leftParen, rightParen,
-                               "(ui_print(\"Removed reboot command\") == 0)");
+        return script->replace(call, "(ui_print(\"Removed reboot command\") == 0)");
     } else if (foundUmount) {
         if (isSystem) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(UNMOUNT_FMT, "/system"));
+            return script->replace(call, StringUtils::format(UNMOUNT_FMT, "/system"));
         } else if (isCache) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(UNMOUNT_FMT, "/cache"));
+            return script->replace(call, StringUtils::format(UNMOUNT_FMT, "/cache"));
         } else if (isData) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(UNMOUNT_FMT, "/data"));
+            return script->replace(call, StringUtils::format(UNMOUNT_FMT, "/data"));
         }
     } else if (foundMount) {
         if (isSystem) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(MOUNT_FMT, "/system"));
+            return script->replace(call, StringUtils::format(MOUNT_FMT, "/system"));
         } else if (isCache) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(MOUNT_FMT, "/cache"));
+            return script->replace(call, StringUtils::format(MOUNT_FMT, "/cache"));
         } else if (isData) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(MOUNT_FMT, "/data"));
+            return script->replace(call, StringUtils::format(MOUNT_FMT, "/data"));
         }
     } else if (foundFormatSh) {
-        return replaceFunction(tokens, funcName, leftParen, rightParen,
-                               StringUtils::format(FORMAT_FMT, "/system"));
+        return script->replace(call, StringUtils::format(FORMAT_FMT, "/system"));
     } else if (foundMke2fs) {
         if (isSystem) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(FORMAT_FMT, "/system"));
+            return script->replace(call, StringUtils::format(FORMAT_FMT, "/system"));
         } else if (isCache) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(FORMAT_FMT, "/cache"));
+            return script->replace(call, StringUtils::format(FORMAT_FMT, "/cache"));
         } else if (isData) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(FORMAT_FMT, "/data"));
+            return script->replace(call, StringUtils::format(FORMAT_FMT, "/data"));
         }
     }
 
-    return rightParen + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify delete_recursive() command
  *
- * \param tokens List of edify tokens
- * \param funcName Function name token
- * \param leftParen Left parenthesis token
- * \param rightParen Right parenthesis token
+ * \param script Edify script
+ * \param call Function call site
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function was successfully replaced or left untouched
  */
-static std::vector<EdifyToken *>::iterator
-replaceEdifyDeleteRecursive(std::vector<EdifyToken *> *tokens,
-                            const std::vector<EdifyToken *>::iterator funcName,
-                            const std::vector<EdifyToken *>::iterator leftParen,
-                            const std::vector<EdifyToken *>::iterator rightParen)
+static bool replaceEdifyDeleteRecursive(EdifyScript *script,
+                                        const EdifyCall &call)
 {
-    for (auto it = leftParen + 1; it != rightParen; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    auto const &tokens = script->tokens();
+
+    for (auto i = call.leftParen + 1; i != call.rightParen; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string unescaped = token->unescapedString();
+        std::string unescaped;
+        if (!script->unescapedString(tokens[i], &unescaped)) {
+            return false;
+        }
 
         if (unescaped == "/system" || unescaped == "/system/") {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(FORMAT_FMT, "/system"));
+            return script->replace(call, StringUtils::format(FORMAT_FMT, "/system"));
         } else if (unescaped == "/cache" || unescaped == "/cache/") {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(FORMAT_FMT, "/cache"));
+            return script->replace(call, StringUtils::format(FORMAT_FMT, "/cache"));
         }
     }
-    return rightParen + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify format() command
  *
- * \param tokens List of edify tokens
- * \param funcName Function name token
- * \param leftParen Left parenthesis token
- * \param rightParen Right parenthesis token
+ * \param script Edify script
+ * \param call Function call site
  * \param systemDevs List of system partition block devices
  * \param cacheDevs List of cache partition block devices
  * \param dataDevs List of data partition block devices
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function was successfully replaced or left untouched
  */
-static std::vector<EdifyToken *>::iterator
-replaceEdifyFormat(std::vector<EdifyToken *> *tokens,
-                   const std::vector<EdifyToken *>::iterator funcName,
-                   const std::vector<EdifyToken *>::iterator leftParen,
-                   const std::vector<EdifyToken *>::iterator rightParen,
-                   const char * const *systemDevs,
-                   const char * const *cacheDevs,
-                   const char * const *dataDevs)
+static bool replaceEdifyFormat(EdifyScript *script,
+                               const EdifyCall &call,
+                               const char * const *systemDevs,
+                               const char * const *cacheDevs,
+                               const char * const *dataDevs)
 {
+    auto const &tokens = script->tokens();
+
     // For the format() edify function, replace with the corresponding
     // update-binary-tool command
-    for (auto it = leftParen + 1; it != rightParen; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    for (auto i = call.leftParen + 1; i != call.rightParen; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        EdifyTokenString *token = (EdifyTokenString *)(*it);
-        const std::string str = token->string();
+        const std::string str = script->text(tokens[i]);
 
         bool isSystem = str.find("/system") != std::string::npos
                 || findItemsInString(str.c_str(), systemDevs);
@@ -528,58 +372,71 @@ replaceEdifyFormat(std::vector<EdifyToken *> *tokens,
                 || findItemsInString(str.c_str(), dataDevs);
 
         if (isSystem) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(FORMAT_FMT, "/system"));
+            return script->replace(call, StringUtils::format(FORMAT_FMT, "/system"));
         } else if (isCache) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(FORMAT_FMT, "/cache"));
+            return script->replace(call, StringUtils::format(FORMAT_FMT, "/cache"));
         } else if (isData) {
-            return replaceFunction(tokens, funcName, leftParen, rightParen,
-                                   StringUtils::format(FORMAT_FMT, "/data"));
+            return script->replace(call, StringUtils::format(FORMAT_FMT, "/data"));
         }
     }
-    return rightParen + 1;
+    return true;
 }
 
 bool StandardPatcher::patchFiles(const std::string &directory)
 {
-    if (!patchUpdater(directory)) {
-        return false;
-    }
+    for (auto const &file : existingFiles()) {
+        std::string path(directory);
+        path += "/";
+        path += file;
+
+        std::string contents;
+        auto ret = FileUtils::readToString(path, &contents);
+        if (ret == ErrorCode::FileOpenError) {
+            // Not all zips contain every file
+            continue;
+        } else if (ret != ErrorCode::NoError) {
+            return false;
+        }
 
-    if (!patchTransferList(directory)) {
-        return false;
+        if (!patchContents(file, &contents)) {
+            return false;
+        }
+
+        if (FileUtils::writeFromString(path, contents) != ErrorCode::NoError) {
+            return false;
+        }
     }
 
     return true;
 }
 
-bool StandardPatcher::patchUpdater(const std::string &directory)
+bool StandardPatcher::patchContents(const std::string &name,
+                                    std::string *contents)
 {
-    std::string contents;
-    std::string path;
-
-    path += directory;
-    path += "/";
-    path += UpdaterScript;
+    if (name == UpdaterScript) {
+        return patchUpdater(contents);
+    } else if (name == SystemTransferList) {
+        return patchTransferList(contents);
+    }
 
-    FileUtils::readToString(path, &contents);
+    return true;
+}
 
-    if (contents.size() >= 2 && std::memcmp(contents.data(), "#!", 2) == 0) {
+bool StandardPatcher::patchUpdater(std::string *contents)
+{
+    if (contents->size() >= 2 && std::memcmp(contents->data(), "#!", 2) == 0) {
         // Ignore any script with a shebang line
         return true;
     }
 
-    std::vector<EdifyToken *> tokens;
-    bool result = EdifyTokenizer::tokenize(
-            contents.data(), contents.size(), &tokens);
-    if (!result) {
+    EdifyScript script;
+    if (!script.load(contents->data(), contents->size())) {
         LOGE("Failed to tokenize updater-script");
         return false;
     }
 
 #if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
+    script.dump();
 #endif
 
     Device *device = m_impl->info->device();
@@ -587,89 +444,83 @@ bool StandardPatcher::patchUpdater(const std::string &directory)
     auto cacheDevs = mb_device_cache_block_devs(device);
     auto dataDevs = mb_device_data_block_devs(device);
 
-    std::vector<EdifyToken *>::iterator begin = tokens.begin();
-    std::vector<EdifyToken *>::iterator end;
+    // Calls within a handled function call are not patched separately
+    std::size_t next = 0;
 
-    // TODO: Catch errors
-    while (true) {
-        end = tokens.end();
-
-        // Need to find:
-        // 1. String containing function name
-        // 2. Left parenthesis for the function
-        // 3. Right parenthesis for the function
-        std::vector<EdifyToken *>::iterator funcName;
-        std::vector<EdifyToken *>::iterator leftParen;
-        std::vector<EdifyToken *>::iterator rightParen;
+    for (auto const &call : script.calls()) {
+        if (call.name < next) {
+            continue;
+        }
 
-        if (!findFunction(begin, end, &funcName, &leftParen, &rightParen)) {
-            break;
+        std::string funcName;
+        if (!script.unescapedString(script.tokens()[call.name], &funcName)) {
+            return false;
         }
 
-        // Tokens (types are checked by findFunction())
-        EdifyTokenString *tFuncName = (EdifyTokenString *)(*funcName);
+        bool ret;
 
-        if (tFuncName->unescapedString() == "mount") {
-            begin = replaceEdifyMount(&tokens, funcName, leftParen, rightParen,
+        if (funcName == "mount") {
+            ret = replaceEdifyMount(&script, call,
+                                    systemDevs, cacheDevs, dataDevs);
+        } else if (funcName == "unmount") {
+            ret = replaceEdifyUnmount(&script, call,
                                       systemDevs, cacheDevs, dataDevs);
-        } else if (tFuncName->unescapedString() == "unmount") {
-            begin = replaceEdifyUnmount(&tokens, funcName, leftParen, rightParen,
-                                        systemDevs, cacheDevs, dataDevs);
-        } else if (tFuncName->unescapedString() == "run_program") {
-            begin = replaceEdifyRunProgram(&tokens, funcName, leftParen, rightParen,
-                                           systemDevs, cacheDevs, dataDevs);
-        } else if (tFuncName->unescapedString() == "delete_recursive") {
-            begin = replaceEdifyDeleteRecursive(&tokens, funcName, leftParen, rightParen);
-        } else if (tFuncName->unescapedString() == "format") {
-            begin = replaceEdifyFormat(&tokens, funcName, leftParen, rightParen,
-                                       systemDevs, cacheDevs, dataDevs);
+        } else if (funcName == "run_program") {
+            ret = replaceEdifyRunProgram(&script, call,
+                                         systemDevs, cacheDevs, dataDevs);
+        } else if (funcName == "delete_recursive") {
+            ret = replaceEdifyDeleteRecursive(&script, call);
+        } else if (funcName == "format") {
+            ret = replaceEdifyFormat(&script, call,
+                                     systemDevs, cacheDevs, dataDevs);
         } else {
-            begin = funcName + 1;
+            continue;
         }
-    }
 
-#if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
-#endif
-
-    FileUtils::writeFromString(path, EdifyTokenizer::untokenize(tokens));
+        if (!ret) {
+            return false;
+        }
 
-    for (EdifyToken *t : tokens) {
-        delete t;
+        next = call.rightParen + 1;
     }
 
+    *contents = script.generate();
+
     return true;
 }
 
-bool StandardPatcher::patchTransferList(const std::string &directory)
+static AutoPatcher::LineAction filterTransferListLine(std::string *line,
+                                                     bool complete)
 {
-    std::string contents;
-    std::string path;
-    std::vector<std::string> lines;
-
-    path += directory;
-    path += "/";
-    path += SystemTransferList;
-
-    auto ret = FileUtils::readToString(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return ret == ErrorCode::FileOpenError;
+    static const char prefix[] = "erase ";
+    static const std::size_t prefixLen = sizeof(prefix) - 1;
+
+    if (std::memcmp(line->data(), prefix,
+                    std::min(line->size(), prefixLen)) != 0) {
+        return AutoPatcher::LineAction::Keep;
+    } else if (line->size() < prefixLen) {
+        return complete
+                ? AutoPatcher::LineAction::Keep
+                : AutoPatcher::LineAction::NeedMore;
     }
 
-    lines = StringUtils::split(contents, '\n');
+    // Remove erase commands
+    return AutoPatcher::LineAction::Drop;
+}
 
-    for (auto it = lines.begin(); it != lines.end();) {
-        if (mb_starts_with(it->c_str(), "erase ")) {
-            it = lines.erase(it);
-        } else {
-            ++it;
-        }
+AutoPatcher::LineFilterCallback
+StandardPatcher::lineFilter(const std::string &name) const
+{
+    if (name == SystemTransferList) {
+        return &filterTransferListLine;
     }
 
-    contents = StringUtils::join(lines, "\n");
-    FileUtils::writeFromString(path, contents);
+    return nullptr;
+}
 
-    return true;
+bool StandardPatcher::patchTransferList(std::string *contents)
+{
+    return LineFilter::filter(&filterTransferListLine, contents);
 }
 
 }
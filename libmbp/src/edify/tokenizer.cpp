@@ -281,23 +281,29 @@ static int hexCharToInt(char c)
     if (c >= '0' && c <= '9') {
         return c - '0';
     } else if (c >= 'a' && c <= 'f') {
-        return c - 'a';
+        return c - 'a' + 10;
     } else if (c >= 'A' && c <= 'F') {
-        return c - 'A';
+        return c - 'A' + 10;
     } else {
         return -1;
     }
 }
 
-bool EdifyTokenString::unescape(const std::string &str, std::string *out)
+/*
+ * Unknown escape sequences, including "\x" without two hex digits, are kept
+ * as a literal backslash and character, like the recovery's edify lexer does.
+ * Fails only if the string ends with a lone backslash, which the tokenizer
+ * never produces.
+ */
+static bool unescapeChars(const char *str, std::size_t size, std::string *out)
 {
     std::string output;
 
-    for (std::size_t i = 0; i < str.size();) {
+    for (std::size_t i = 0; i < size;) {
         char c = str[i];
 
         if (c == '\\') {
-            if (i == str.size() - 1) {
+            if (i == size - 1) {
                 // Escape character is last character
                 return false;
             }
@@ -320,25 +326,20 @@ bool EdifyTokenString::unescape(const std::string &str, std::string *out)
                 output += '\v';
             } else if (str[i + 1] == '\\') {
                 output += '\\';
-            } else if (str[i + 1] == 'x') {
-                if (str.size() - i < 4) {
-                    // Need 4 chars: \xYY
-                    return false;
-                }
-                int digit1 = hexCharToInt(str[i + 2]);
-                int digit2 = hexCharToInt(str[i + 3]);
-                if (digit1 < 0 || digit2 < 0) {
-                    // One of the chars is not a valid hex character
-                    return false;
-                }
-
-                char val = (digit1 << 4) & digit2;
+            } else if (str[i + 1] == '"') {
+                output += '"';
+            } else if (str[i + 1] == 'x' && size - i >= 4
+                    && hexCharToInt(str[i + 2]) >= 0
+                    && hexCharToInt(str[i + 3]) >= 0) {
+                char val = (hexCharToInt(str[i + 2]) << 4)
+                        | hexCharToInt(str[i + 3]);
                 output += val;
 
                 new_i += 2;
             } else {
-                // Invalid escape char
-                return false;
+                // Unknown escape sequence
+                output += c;
+                output += str[i + 1];
             }
 
             i = new_i;
@@ -353,6 +354,11 @@ bool EdifyTokenString::unescape(const std::string &str, std::string *out)
     return true;
 }
 
+bool EdifyTokenString::unescape(const std::string &str, std::string *out)
+{
+    return unescapeChars(str.data(), str.size(), out);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 EdifyTokenUnknown::EdifyTokenUnknown(char c) : EdifyToken(EdifyTokenType::Unknown), m_char(c)
@@ -375,88 +381,78 @@ bool EdifyTokenizer::isValidUnquoted(char c)
             || c == '.';
 }
 
-bool EdifyTokenizer::nextToken(const char *data, std::size_t size,
-                               std::size_t *pos, EdifyToken **token)
+bool EdifyTokenizer::scanToken(const char *data, std::size_t size,
+                               std::size_t pos, EdifyTokenType *type,
+                               std::size_t *length)
 {
-    std::size_t p = *pos;
+    std::size_t p = pos;
     assert(p < size);
 
     if (size - p >= 2 && std::memcmp(data + p, "if", 2) == 0) {
-        *token = new EdifyTokenIf();
+        *type = EdifyTokenType::If;
         p += 2;
     } else if (size - p >= 4 && std::memcmp(data + p, "then", 4) == 0) {
-        *token = new EdifyTokenThen();
+        *type = EdifyTokenType::Then;
         p += 4;
     } else if (size - p >= 4 && std::memcmp(data + p, "else", 4) == 0) {
-        *token = new EdifyTokenElse();
+        *type = EdifyTokenType::Else;
         p += 4;
     } else if (size - p >= 5 && std::memcmp(data + p, "endif", 5) == 0) {
-        *token = new EdifyTokenEndif();
+        *type = EdifyTokenType::Endif;
         p += 5;
     } else if (size - p >= 2 && std::memcmp(data + p, "&&", 2) == 0) {
-        *token = new EdifyTokenAnd();
+        *type = EdifyTokenType::And;
         p += 2;
     } else if (size - p >= 2 && std::memcmp(data + p, "||", 2) == 0) {
-        *token = new EdifyTokenOr();
+        *type = EdifyTokenType::Or;
         p += 2;
     } else if (size - p >= 2 && std::memcmp(data + p, "==", 2) == 0) {
-        *token = new EdifyTokenEquals();
+        *type = EdifyTokenType::Equals;
         p += 2;
     } else if (size - p >= 2 && std::memcmp(data + p, "!=", 2) == 0) {
-        *token = new EdifyTokenNotEquals();
+        *type = EdifyTokenType::NotEquals;
         p += 2;
     } else if (data[p] == '!') {
-        *token = new EdifyTokenNot();
+        *type = EdifyTokenType::Not;
         p += 1;
     } else if (data[p] == '(') {
-        *token = new EdifyTokenLeftParen();
+        *type = EdifyTokenType::LeftParen;
         p += 1;
     } else if (data[p] == ')') {
-        *token = new EdifyTokenRightParen();
+        *type = EdifyTokenType::RightParen;
         p += 1;
     } else if (data[p] == ';') {
-        *token = new EdifyTokenSemicolon();
+        *type = EdifyTokenType::Semicolon;
         p += 1;
     } else if (data[p] == ',') {
-        *token = new EdifyTokenComma();
+        *type = EdifyTokenType::Comma;
         p += 1;
     } else if (data[p] == '+') {
-        *token = new EdifyTokenConcat();
+        *type = EdifyTokenType::Concat;
         p += 1;
     } else if (data[p] == '\n') {
-        *token = new EdifyTokenNewline();
+        *type = EdifyTokenType::Newline;
         p += 1;
     } else if (data[p] != '\n' && std::isspace(data[p])) {
-        std::string buf;
-        buf += data[p];
+        *type = EdifyTokenType::Whitespace;
         p += 1;
         while (size - p >= 1 && data[p] != '\n' && std::isspace(data[p])) {
-            buf += data[p];
             p += 1;
         }
-        *token = new EdifyTokenWhitespace(std::move(buf));
     } else if (data[p] == '#') {
-        std::string buf;
-        // Omit '#' character
+        // Includes '#' character
+        *type = EdifyTokenType::Comment;
         p += 1;
         while (size - p >= 1 && data[p] != '\n') {
-            buf += data[p];
             p += 1;
         }
-        *token = new EdifyTokenComment(std::move(buf));
     } else if (isValidUnquoted(data[p])) {
-        std::string buf;
-        buf += data[p];
+        *type = EdifyTokenType::String;
         p += 1;
         while (size - p >= 1 && isValidUnquoted(data[p])) {
-            buf += data[p];
             p += 1;
         }
-        *token = new EdifyTokenString(std::move(buf), EdifyTokenString::NotQuoted);
     } else if (data[p] == '"') {
-        std::size_t curPos = p;
-        std::string buf;
-        buf += data[p];
         p += 1;
         bool escaped = false;
         bool terminated = false;
@@ -464,25 +460,104 @@ bool EdifyTokenizer::nextToken(const char *data, std::size_t size,
             if (data[p] == '\\' || escaped) {
                 escaped = !escaped;
             } else if (!escaped && data[p] == '"') {
-                buf += data[p];
                 p += 1;
                 terminated = true;
                 break;
             }
-            buf += data[p];
             p += 1;
         }
         if (!terminated) {
-            LOGE("Unterminated quote at position %" MB_PRIzu, curPos);
+            LOGE("Unterminated quote at position %" MB_PRIzu, pos);
             return false;
         }
-        *token = new EdifyTokenString(std::move(buf), EdifyTokenString::AlreadyQuoted);
+        *type = EdifyTokenType::String;
     } else {
-        *token = new EdifyTokenUnknown(data[p]);
+        *type = EdifyTokenType::Unknown;
         p += 1;
     }
 
-    *pos = p;
+    *length = p - pos;
+
+    return true;
+}
+
+bool EdifyTokenizer::nextToken(const char *data, std::size_t size,
+                               std::size_t *pos, EdifyToken **token)
+{
+    EdifyTokenType type;
+    std::size_t length;
+
+    if (!scanToken(data, size, *pos, &type, &length)) {
+        return false;
+    }
+
+    const char *str = data + *pos;
+
+    switch (type) {
+    case EdifyTokenType::If:
+        *token = new EdifyTokenIf();
+        break;
+    case EdifyTokenType::Then:
+        *token = new EdifyTokenThen();
+        break;
+    case EdifyTokenType::Else:
+        *token = new EdifyTokenElse();
+        break;
+    case EdifyTokenType::Endif:
+        *token = new EdifyTokenEndif();
+        break;
+    case EdifyTokenType::And:
+        *token = new EdifyTokenAnd();
+        break;
+    case EdifyTokenType::Or:
+        *token = new EdifyTokenOr();
+        break;
+    case EdifyTokenType::Equals:
+        *token = new EdifyTokenEquals();
+        break;
+    case EdifyTokenType::NotEquals:
+        *token = new EdifyTokenNotEquals();
+        break;
+    case EdifyTokenType::Not:
+        *token = new EdifyTokenNot();
+        break;
+    case EdifyTokenType::LeftParen:
+        *token = new EdifyTokenLeftParen();
+        break;
+    case EdifyTokenType::RightParen:
+        *token = new EdifyTokenRightParen();
+        break;
+    case EdifyTokenType::Semicolon:
+        *token = new EdifyTokenSemicolon();
+        break;
+    case EdifyTokenType::Comma:
+        *token = new EdifyTokenComma();
+        break;
+    case EdifyTokenType::Concat:
+        *token = new EdifyTokenConcat();
+        break;
+    case EdifyTokenType::Newline:
+        *token = new EdifyTokenNewline();
+        break;
+    case EdifyTokenType::Whitespace:
+        *token = new EdifyTokenWhitespace(std::string(str, length));
+        break;
+    case EdifyTokenType::Comment:
+        // Omit '#' character
+        *token = new EdifyTokenComment(std::string(str + 1, length - 1));
+        break;
+    case EdifyTokenType::String:
+        *token = new EdifyTokenString(std::string(str, length),
+                                      *str == '"'
+                                      ? EdifyTokenString::AlreadyQuoted
+                                      : EdifyTokenString::NotQuoted);
+        break;
+    case EdifyTokenType::Unknown:
+        *token = new EdifyTokenUnknown(*str);
+        break;
+    }
+
+    *pos += length;
 
     return true;
 }
@@ -521,6 +596,24 @@ bool EdifyTokenizer::tokenize(const char *data, std::size_t size,
     return true;
 }
 
+bool EdifyTokenizer::tokenize(const char *data, std::size_t size,
+                              std::vector<EdifyTokenRef> *tokens)
+{
+    std::vector<EdifyTokenRef> temp;
+    EdifyTokenType type;
+    std::size_t length;
+
+    for (std::size_t pos = 0; pos < size; pos += length) {
+        if (!scanToken(data, size, pos, &type, &length)) {
+            return false;
+        }
+        temp.push_back({ type, pos, length });
+    }
+
+    tokens->swap(temp);
+    return true;
+}
+
 std::string EdifyTokenizer::untokenize(const std::vector<EdifyToken *> &tokens)
 {
     std::string output;
@@ -540,36 +633,201 @@ std::string EdifyTokenizer::untokenize(const std::vector<EdifyToken *>::iterator
     return output;
 }
 
-void EdifyTokenizer::dump(const std::vector<EdifyToken *> &tokens)
+static const char * tokenTypeName(EdifyTokenType type)
 {
     const char *tokenName = nullptr;
 
+    switch (type) {
+    case EdifyTokenType::If:         tokenName = "If";         break;
+    case EdifyTokenType::Then:       tokenName = "Then";       break;
+    case EdifyTokenType::Else:       tokenName = "Else";       break;
+    case EdifyTokenType::Endif:      tokenName = "Endif";      break;
+    case EdifyTokenType::And:        tokenName = "And";        break;
+    case EdifyTokenType::Or:         tokenName = "Or";         break;
+    case EdifyTokenType::Equals:     tokenName = "Equals";     break;
+    case EdifyTokenType::NotEquals:  tokenName = "NotEquals";  break;
+    case EdifyTokenType::Not:        tokenName = "Not";        break;
+    case EdifyTokenType::LeftParen:  tokenName = "LeftParen";  break;
+    case EdifyTokenType::RightParen: tokenName = "RightParen"; break;
+    case EdifyTokenType::Semicolon:  tokenName = "Semicolon";  break;
+    case EdifyTokenType::Comma:      tokenName = "Comma";      break;
+    case EdifyTokenType::Concat:     tokenName = "Concat";     break;
+    case EdifyTokenType::Newline:    tokenName = "Newline";    break;
+    case EdifyTokenType::Whitespace: tokenName = "Whitespace"; break;
+    case EdifyTokenType::Comment:    tokenName = "Comment";    break;
+    case EdifyTokenType::String:     tokenName = "String";     break;
+    case EdifyTokenType::Unknown:    tokenName = "Unknown";    break;
+    }
+
+    return tokenName;
+}
+
+void EdifyTokenizer::dump(const std::vector<EdifyToken *> &tokens)
+{
     for (std::size_t i = 0; i < tokens.size(); ++i) {
         EdifyToken *t = tokens[i];
+        const char *tokenName = tokenTypeName(t->type());
 
-        switch (t->type()) {
-        case EdifyTokenType::If:         tokenName = "If";         break;
-        case EdifyTokenType::Then:       tokenName = "Then";       break;
-        case EdifyTokenType::Else:       tokenName = "Else";       break;
-        case EdifyTokenType::Endif:      tokenName = "Endif";      break;
-        case EdifyTokenType::And:        tokenName = "And";        break;
-        case EdifyTokenType::Or:         tokenName = "Or";         break;
-        case EdifyTokenType::Equals:     tokenName = "Equals";     break;
-        case EdifyTokenType::NotEquals:  tokenName = "NotEquals";  break;
-        case EdifyTokenType::Not:        tokenName = "Not";        break;
-        case EdifyTokenType::LeftParen:  tokenName = "LeftParen";  break;
-        case EdifyTokenType::RightParen: tokenName = "RightParen"; break;
-        case EdifyTokenType::Semicolon:  tokenName = "Semicolon";  break;
-        case EdifyTokenType::Comma:      tokenName = "Comma";      break;
-        case EdifyTokenType::Concat:     tokenName = "Concat";     break;
-        case EdifyTokenType::Newline:    tokenName = "Newline";    break;
-        case EdifyTokenType::Whitespace: tokenName = "Whitespace"; break;
-        case EdifyTokenType::Comment:    tokenName = "Comment";    break;
-        case EdifyTokenType::String:     tokenName = "String";     break;
-        case EdifyTokenType::Unknown:    tokenName = "Unknown";    break;
+        LOGD("%" MB_PRIzu ": %-20s: %s", i, tokenName, t->generate().c_str());
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const std::size_t NoIndex = static_cast<std::size_t>(-1);
+
+EdifyScript::EdifyScript() : m_data(nullptr), m_size(0)
+{
+}
+
+bool EdifyScript::load(const char *data, std::size_t size)
+{
+    std::vector<EdifyTokenRef> tokens;
+    if (!EdifyTokenizer::tokenize(data, size, &tokens)) {
+        return false;
+    }
+
+    std::vector<EdifyCall> calls;
+    // Index of the call for each unclosed left parenthesis (or NoIndex if the
+    // parenthesis does not belong to a function call)
+    std::vector<std::size_t> parens;
+    std::size_t lastString = NoIndex;
+
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        switch (tokens[i].type) {
+        case EdifyTokenType::String:
+            lastString = i;
+            break;
+        // Function names may be followed by these before the left parenthesis
+        case EdifyTokenType::Whitespace:
+        case EdifyTokenType::Newline:
+        case EdifyTokenType::Comment:
+            break;
+        case EdifyTokenType::LeftParen:
+            if (lastString != NoIndex) {
+                calls.push_back({ lastString, i, NoIndex });
+                parens.push_back(calls.size() - 1);
+            } else {
+                parens.push_back(NoIndex);
+            }
+            lastString = NoIndex;
+            break;
+        case EdifyTokenType::RightParen:
+            if (!parens.empty()) {
+                if (parens.back() != NoIndex) {
+                    calls[parens.back()].rightParen = i;
+                }
+                parens.pop_back();
+            }
+            lastString = NoIndex;
+            break;
+        default:
+            lastString = NoIndex;
+            break;
         }
+    }
 
-        LOGD("%" MB_PRIzu ": %-20s: %s", i, tokenName, t->generate().c_str());
+    // A function call without a matching right parenthesis is a syntax error.
+    // Ignore it and everything after it.
+    for (auto it = calls.begin(); it != calls.end(); ++it) {
+        if (it->rightParen == NoIndex) {
+            calls.erase(it, calls.end());
+            break;
+        }
+    }
+
+    m_data = data;
+    m_size = size;
+    m_tokens.swap(tokens);
+    m_calls.swap(calls);
+    m_pieces.clear();
+
+    return true;
+}
+
+const std::vector<EdifyTokenRef> & EdifyScript::tokens() const
+{
+    return m_tokens;
+}
+
+const std::vector<EdifyCall> & EdifyScript::calls() const
+{
+    return m_calls;
+}
+
+std::string EdifyScript::text(const EdifyTokenRef &token) const
+{
+    return std::string(m_data + token.offset, token.size);
+}
+
+bool EdifyScript::textEquals(const EdifyTokenRef &token, const char *str) const
+{
+    return std::strlen(str) == token.size
+            && std::memcmp(m_data + token.offset, str, token.size) == 0;
+}
+
+bool EdifyScript::unescapedString(const EdifyTokenRef &token,
+                                  std::string *out) const
+{
+    out->clear();
+    if (!unescapeChars(m_data + token.offset, token.size, out)) {
+        LOGE("Invalid escape sequence in string: %s", text(token).c_str());
+        return false;
+    }
+    if (token.size > 0 && m_data[token.offset] == '"' && out->size() >= 2) {
+        out->pop_back();
+        out->erase(out->begin());
+    }
+    return true;
+}
+
+bool EdifyScript::replace(const EdifyCall &call, std::string replacement)
+{
+    if (!m_pieces.empty() && call.name < m_pieces.back().end) {
+        LOGE("Replaced function calls overlap or are out of order");
+        return false;
+    }
+
+    m_pieces.push_back({ call.name, call.rightParen + 1,
+                         std::move(replacement) });
+    return true;
+}
+
+std::string EdifyScript::generate() const
+{
+    std::string output;
+    output.reserve(m_size);
+
+    // Tokens are contiguous, so a range of tokens is a range of the source
+    auto appendTokens = [&](std::size_t begin, std::size_t end) {
+        if (begin < end) {
+            std::size_t offset = m_tokens[begin].offset;
+            std::size_t endOffset = m_tokens[end - 1].offset
+                    + m_tokens[end - 1].size;
+            output.append(m_data + offset, endOffset - offset);
+        }
+    };
+
+    std::size_t pos = 0;
+
+    for (auto const &piece : m_pieces) {
+        appendTokens(pos, piece.begin);
+        output += piece.text;
+        pos = piece.end;
+    }
+
+    appendTokens(pos, m_tokens.size());
+
+    return output;
+}
+
+void EdifyScript::dump() const
+{
+    for (std::size_t i = 0; i < m_tokens.size(); ++i) {
+        const char *tokenName = tokenTypeName(m_tokens[i].type);
+
+        LOGD("%" MB_PRIzu ": %-20s: %s", i, tokenName,
+             text(m_tokens[i]).c_str());
     }
 }
 
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbp/patcherinterface.h"
+
+#include <algorithm>
+
+#include "mbpio/delete.h"
+#include "mbpio/directory.h"
+#include "mbpio/path.h"
+
+#include "mbp/patcherconfig.h"
+#include "mbp/private/fileutils.h"
+
+
+namespace mbp
+{
+
+AutoPatcher::AutoPatcher(const PatcherConfig * const pc) : m_pc(pc)
+{
+}
+
+/*!
+ * \brief Default implementation of patchContents()
+ *
+ * For autopatchers that only implement patchFiles(), the contents are written
+ * to a temporary directory under PatcherConfig::tempDirectory(), patched there
+ * with patchFiles() and read back.
+ * Files that are not in existingFiles() are left unmodified.
+ */
+bool AutoPatcher::patchContents(const std::string &name,
+                                std::string *contents)
+{
+    auto files = existingFiles();
+    if (std::find(files.begin(), files.end(), name) == files.end()) {
+        return true;
+    }
+
+    std::string tempDir = FileUtils::createTemporaryDir(m_pc->tempDirectory());
+    if (tempDir.empty()) {
+        return false;
+    }
+
+    std::string path(tempDir);
+    path += "/";
+    path += name;
+
+    bool ret = io::createDirectories(io::dirName(path))
+            && FileUtils::writeFromString(path, *contents) == ErrorCode::NoError
+            && patchFiles(tempDir)
+            && FileUtils::readToString(path, contents) == ErrorCode::NoError;
+
+    io::deleteRecursively(tempDir);
+
+    return ret;
+}
+
+}
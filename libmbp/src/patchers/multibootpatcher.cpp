@@ -20,6 +20,7 @@
 #include "mbp/patchers/multibootpatcher.h"
 
 #include <algorithm>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <cassert>
@@ -29,12 +30,11 @@
 #include "mbcommon/version.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
-#include "mbpio/delete.h"
 
 #include "mbp/patcherconfig.h"
-#include "mbp/private/fileutils.h"
 #include "mbp/private/miniziputils.h"
 #include "mbp/private/stringutils.h"
+#include "mbp/private/ziprewriter.h"
 
 // minizip
 #include "minizip/unzip.h"
@@ -70,13 +70,20 @@ public:
     MinizipUtils::UnzCtx *zInput = nullptr;
     MinizipUtils::ZipCtx *zOutput = nullptr;
     std::vector<AutoPatcher *> autoPatchers;
+    // Autopatcher files that are streamed through a line filter
+    std::unordered_map<std::string, AutoPatcher::LineFilterCallback> lineFilters;
 
     bool patchZip();
 
-    bool pass1(const std::string &temporaryDir,
-               const std::unordered_set<std::string> &exclude);
-    bool pass2(const std::string &temporaryDir,
-               const std::unordered_set<std::string> &files);
+    // Files that are patched by the autopatchers (name -> contents)
+    typedef std::vector<std::pair<std::string, std::string>> FileContents;
+
+    bool pass1(const std::unordered_set<std::string> &exclude,
+               std::vector<ZipRewriter::Entry> *entries,
+               FileContents *extracted,
+               std::vector<std::string> *streamed);
+    bool pass2(FileContents *extracted,
+               const std::vector<std::string> &streamed);
     bool openInputArchive();
     void closeInputArchive();
     bool openOutputArchive();
@@ -198,27 +205,28 @@ bool MultiBootPatcher::Impl::patchZip()
         // AutoPatcher files should be excluded from the first pass
         for (auto const &file : ap->existingFiles()) {
             excludeFromPass1.insert(file);
-        }
-    }
 
-    // Unlike the old patcher, we'll write directly to the new file
-    if (!openOutputArchive()) {
-        return false;
+            // Files can only be streamed if a single autopatcher handles them
+            auto filter = ap->lineFilter(file);
+            if (!lineFilters.emplace(file, filter).second) {
+                lineFilters[file] = nullptr;
+            }
+        }
     }
 
-    zipFile zf = MinizipUtils::ctxGetZipFile(zOutput);
-
     if (cancelled) return false;
 
-    MinizipUtils::ArchiveStats stats;
-    auto result = MinizipUtils::archiveStats(info->inputPath(), &stats,
-                                             std::vector<std::string>());
+    std::vector<ZipRewriter::Entry> entries;
+    auto result = ZipRewriter::readCentralDirectory(info->inputPath(),
+                                                    &entries);
     if (result != ErrorCode::NoError) {
         error = result;
         return false;
     }
 
-    maxBytes = stats.totalSize;
+    for (auto const &entry : entries) {
+        maxBytes += entry.uncompressedSize;
+    }
 
     if (cancelled) return false;
 
@@ -260,32 +268,39 @@ bool MultiBootPatcher::Impl::patchZip()
 
     // +1 for info.prop
     // +1 for device.json
-    maxFiles = stats.files + toCopy.size() + 2;
+    maxFiles = entries.size() + toCopy.size() + 2;
     updateFiles(files, maxFiles);
 
     if (!openInputArchive()) {
         return false;
     }
 
-    // Create temporary dir for extracted files for autopatchers
-    std::string tempDir = FileUtils::createTemporaryDir(pc->tempDirectory());
+    // Files for the autopatchers are either kept in memory or streamed from
+    // the input zip during the second pass
+    FileContents extracted;
+    std::vector<std::string> streamed;
 
-    if (!pass1(tempDir, excludeFromPass1)) {
-        io::deleteRecursively(tempDir);
+    // Unlike the old patcher, we'll write directly to the new file
+    if (!pass1(excludeFromPass1, &entries, &extracted, &streamed)) {
         return false;
     }
 
     if (cancelled) return false;
 
+    // The first pass produced a complete zip. Everything else is appended to
+    // it.
+    if (!openOutputArchive()) {
+        return false;
+    }
+
+    zipFile zf = MinizipUtils::ctxGetZipFile(zOutput);
+
     // On the second pass, run the autopatchers on the rest of the files
 
-    if (!pass2(tempDir, excludeFromPass1)) {
-        io::deleteRecursively(tempDir);
+    if (!pass2(&extracted, streamed)) {
         return false;
     }
 
-    io::deleteRecursively(tempDir);
-
     for (const CopySpec &spec : toCopy) {
         if (cancelled) return false;
 
@@ -344,63 +359,73 @@ bool MultiBootPatcher::Impl::patchZip()
  *
  * This performs the following operations:
  *
- * - Files needed by an AutoPatcher are extracted to the temporary directory.
- * - Otherwise, the file is copied directly to the output zip.
+ * - Files needed by an AutoPatcher are read into memory, unless they can be
+ *   streamed through a line filter in the second pass.
+ * - Otherwise, the file is copied directly to the output zip. The copying is
+ *   done in parallel without recompressing and creates the output zip.
  */
-bool MultiBootPatcher::Impl::pass1(const std::string &temporaryDir,
-                                   const std::unordered_set<std::string> &exclude)
+bool MultiBootPatcher::Impl::pass1(const std::unordered_set<std::string> &exclude,
+                                   std::vector<ZipRewriter::Entry> *entries,
+                                   FileContents *extracted,
+                                   std::vector<std::string> *streamed)
 {
     unzFile uf = MinizipUtils::ctxGetUnzFile(zInput);
-    zipFile zf = MinizipUtils::ctxGetZipFile(zOutput);
+    std::vector<ZipRewriter::Entry> toCopy;
+    uint64_t toCopyBytes = 0;
 
-    int ret = unzGoToFirstFile(uf);
-    if (ret != UNZ_OK) {
-        error = ErrorCode::ArchiveReadHeaderError;
-        return false;
-    }
-
-    do {
+    for (auto &entry : *entries) {
         if (cancelled) return false;
 
-        unz_file_info64 fi;
-        std::string curFile;
-
-        if (!MinizipUtils::getInfo(uf, &fi, &curFile)) {
-            error = ErrorCode::ArchiveReadHeaderError;
-            return false;
-        }
+        // Skip files that should be patched and added in pass 2
+        if (exclude.find(entry.name) != exclude.end()) {
+            updateFiles(++files, maxFiles);
+            updateDetails(entry.name);
 
-        updateFiles(++files, maxFiles);
-        updateDetails(curFile);
+            if (lineFilters[entry.name]) {
+                streamed->push_back(entry.name);
+                continue;
+            }
 
-        // Skip files that should be patched and added in pass 2
-        if (exclude.find(curFile) != exclude.end()) {
-            if (!MinizipUtils::extractFile(uf, temporaryDir)) {
+            if (unzLocateFile(uf, entry.name.c_str(), nullptr) != UNZ_OK) {
+                error = ErrorCode::ArchiveReadHeaderError;
+                return false;
+            }
+            std::vector<unsigned char> data;
+            if (!MinizipUtils::readToMemory(uf, &data, nullptr, nullptr)) {
                 error = ErrorCode::ArchiveReadDataError;
                 return false;
             }
+
+            extracted->emplace_back(entry.name,
+                                    std::string(data.begin(), data.end()));
             continue;
         }
 
         // Rename the installer for mbtool
-        if (curFile == "META-INF/com/google/android/update-binary") {
-            curFile = "META-INF/com/google/android/update-binary.orig";
+        if (entry.name == "META-INF/com/google/android/update-binary") {
+            entry.outputName = "META-INF/com/google/android/update-binary.orig";
         }
 
-        if (!MinizipUtils::copyFileRaw(uf, zf, curFile, &laProgressCb, this)) {
-            LOGW("minizip: Failed to copy raw data: %s", curFile.c_str());
-            error = ErrorCode::ArchiveWriteDataError;
-            return false;
-        }
+        toCopy.push_back(entry);
+        toCopyBytes += entry.uncompressedSize;
+    }
 
-        bytes += fi.uncompressed_size;
-    } while ((ret = unzGoToNextFile(uf)) == UNZ_OK);
+    updateDetails(info->inputPath());
 
-    if (ret != UNZ_END_OF_LIST_OF_FILE) {
-        error = ErrorCode::ArchiveReadHeaderError;
+    auto ret = ZipRewriter::copyEntries(info->inputPath(), info->outputPath(),
+                                        &toCopy, &laProgressCb, this,
+                                        &cancelled);
+    if (ret != ErrorCode::NoError) {
+        LOGW("Failed to copy raw data from %s", info->inputPath().c_str());
+        error = ret;
         return false;
     }
 
+    bytes += toCopyBytes;
+    files += toCopy.size();
+    updateProgress(bytes, maxBytes);
+    updateFiles(files, maxFiles);
+
     if (cancelled) return false;
 
     return true;
@@ -411,44 +436,55 @@ bool MultiBootPatcher::Impl::pass1(const std::string &temporaryDir,
  *
  * This performs the following operations:
  *
- * - Patch files in the temporary directory using the AutoPatchers and add the
- *   resulting files to the output zip
+ * - Stream files with a line filter from the input zip to the output zip
+ * - Patch the files read during the first pass using the AutoPatchers and add
+ *   the resulting files to the output zip
  */
-bool MultiBootPatcher::Impl::pass2(const std::string &temporaryDir,
-                                   const std::unordered_set<std::string> &files)
+bool MultiBootPatcher::Impl::pass2(FileContents *extracted,
+                                   const std::vector<std::string> &streamed)
 {
+    unzFile uf = MinizipUtils::ctxGetUnzFile(zInput);
     zipFile zf = MinizipUtils::ctxGetZipFile(zOutput);
 
-    for (auto *ap : autoPatchers) {
+    for (auto const &file : streamed) {
         if (cancelled) return false;
-        if (!ap->patchFiles(temporaryDir)) {
-            error = ap->error();
+
+        if (unzLocateFile(uf, file.c_str(), nullptr) != UNZ_OK) {
+            error = ErrorCode::ArchiveReadHeaderError;
             return false;
         }
+
+        auto ret = MinizipUtils::filterFile(uf, zf, file, lineFilters[file]);
+        if (ret != ErrorCode::NoError) {
+            error = ret;
+            return false;
+        }
+    }
+
+    for (auto &file : *extracted) {
+        for (auto *ap : autoPatchers) {
+            if (cancelled) return false;
+            if (!ap->patchContents(file.first, &file.second)) {
+                error = ap->error();
+                return false;
+            }
+        }
     }
 
     // TODO Headers are being discarded
 
-    for (auto const &file : files) {
+    for (auto const &file : *extracted) {
         if (cancelled) return false;
 
-        ErrorCode ret;
-
-        if (file == "META-INF/com/google/android/update-binary") {
-            ret = MinizipUtils::addFile(
-                    zf,
-                    "META-INF/com/google/android/update-binary.orig",
-                    temporaryDir + "/" + file);
-        } else {
-            ret = MinizipUtils::addFile(
-                    zf,
-                    file,
-                    temporaryDir + "/" + file);
+        std::string name = file.first;
+        if (name == "META-INF/com/google/android/update-binary") {
+            name = "META-INF/com/google/android/update-binary.orig";
         }
 
-        if (ret == ErrorCode::FileOpenError) {
-            LOGW("File does not exist in temporary directory: %s", file.c_str());
-        } else if (ret != ErrorCode::NoError) {
+        auto ret = MinizipUtils::addFile(
+                zf, name, std::vector<unsigned char>(file.second.begin(),
+                                                     file.second.end()));
+        if (ret != ErrorCode::NoError) {
             error = ret;
             return false;
         }
@@ -491,7 +527,7 @@ bool MultiBootPatcher::Impl::openOutputArchive()
 {
     assert(zOutput == nullptr);
 
-    zOutput = MinizipUtils::openOutputFile(info->outputPath());
+    zOutput = MinizipUtils::openOutputFile(info->outputPath(), true);
 
     if (!zOutput) {
         LOGE("minizip: Failed to open for writing: %s",
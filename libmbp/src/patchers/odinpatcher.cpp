@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include <cassert>
 #include <cinttypes>
@@ -48,6 +49,8 @@
 #include "mbp/patchers/multibootpatcher.h"
 #include "mbp/private/fileutils.h"
 #include "mbp/private/miniziputils.h"
+#include "mbp/private/paralleldeflate.h"
+#include "mbp/private/sparsecompactor.h"
 #include "mbp/private/stringutils.h"
 
 // minizip
@@ -95,6 +98,9 @@ public:
     bool patchTar();
 
     bool processFile(archive *a, archive_entry *entry, bool sparse);
+    bool readData(archive *a, const std::string &name, bool compact,
+                  bool (*cb)(const void *, size_t, void *), void *userData);
+    bool writeDeflated(archive *a, const std::string &name, bool compact);
     bool processContents(archive *a, int depth);
     bool openInputArchive();
     bool closeInputArchive();
@@ -377,7 +383,8 @@ bool OdinPatcher::Impl::processFile(archive *a, archive_entry *entry,
 
     zipFile zf = MinizipUtils::ctxGetZipFile(zOutput);
 
-    // Open file in output zip
+    // Open file in output zip. Deflated data is compressed by us and written
+    // in raw mode.
     int mzRet = zipOpenNewFileInZip2_64(
         zf,                    // file
         zipName.c_str(),       // filename
@@ -389,7 +396,7 @@ bool OdinPatcher::Impl::processFile(archive *a, archive_entry *entry,
         nullptr,               // comment
         Z_DEFLATED,            // method
         Z_DEFAULT_COMPRESSION, // level
-        0,                     // raw
+        1,                     // raw
         zip64                  // zip64
     );
     if (mzRet != ZIP_OK) {
@@ -399,32 +406,108 @@ bool OdinPatcher::Impl::processFile(archive *a, archive_entry *entry,
         return false;
     }
 
+    // Sparse images are re-encoded with SparseCompactor to shrink them before
+    // they are compressed
+    if (!writeDeflated(a, zipName, sparse)) {
+        zipCloseFileInZip(zf);
+        return false;
+    }
+    return true;
+}
+
+static bool writeToZip(const void *data, size_t size, void *userData)
+{
+    zipFile zf = static_cast<zipFile>(userData);
+
+    int mzRet = zipWriteInFileInZip(zf, data, size);
+    if (mzRet != ZIP_OK) {
+        LOGE("minizip: Failed to write data in output zip: %s",
+             MinizipUtils::zipErrorString(mzRet).c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool writeToDeflater(const void *data, size_t size, void *userData)
+{
+    return static_cast<ParallelDeflate *>(userData)->write(data, size);
+}
+
+static bool writeToCompactor(const void *data, size_t size, void *userData)
+{
+    return static_cast<SparseCompactor *>(userData)->write(data, size);
+}
+
+/*!
+ * \brief Pass the data of the current entry to a callback
+ *
+ * If \a compact is true, the data is a sparse image and is re-encoded with
+ * SparseCompactor first.
+ */
+bool OdinPatcher::Impl::readData(archive *a, const std::string &name,
+                                 bool compact,
+                                 bool (*cb)(const void *, size_t, void *),
+                                 void *userData)
+{
+    SparseCompactor compactor(cb, userData);
+    if (compact) {
+        cb = &writeToCompactor;
+        userData = &compactor;
+    }
+
     la_ssize_t nRead;
-    char buf[10240];
-    while ((nRead = archive_read_data(a, buf, sizeof(buf))) > 0) {
+    std::vector<char> buf(1024 * 1024);
+    while ((nRead = archive_read_data(a, buf.data(), buf.size())) > 0) {
         if (cancelled) return false;
 
-        mzRet = zipWriteInFileInZip(zf, buf, nRead);
-        if (mzRet != ZIP_OK) {
-            LOGE("minizip: Failed to write %s in output zip: %s",
-                 zipName.c_str(),
-                 MinizipUtils::zipErrorString(mzRet).c_str());
+        if (!cb(buf.data(), nRead, userData)) {
+            LOGE("Failed to write %s", name.c_str());
             error = ErrorCode::ArchiveWriteDataError;
-            zipCloseFileInZip(zf);
             return false;
         }
     }
 
     if (nRead != 0) {
         LOGE("libarchive: Failed to read %s: %s",
-             name, archive_error_string(a));
+             name.c_str(), archive_error_string(a));
         error = ErrorCode::ArchiveReadDataError;
-        zipCloseFileInZip(zf);
+        return false;
+    }
+
+    if (compact && !compactor.finish()) {
+        LOGE("Failed to compact sparse image %s", name.c_str());
+        error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compress the current entry on all CPUs and write it to the output zip
+ */
+bool OdinPatcher::Impl::writeDeflated(archive *a, const std::string &name,
+                                      bool compact)
+{
+    zipFile zf = MinizipUtils::ctxGetZipFile(zOutput);
+
+    ParallelDeflate deflater(Z_DEFAULT_COMPRESSION,
+                             std::thread::hardware_concurrency(),
+                             &writeToZip, zf);
+
+    if (!readData(a, name, compact, &writeToDeflater, &deflater)) {
+        return false;
+    }
+
+    if (!deflater.finish()) {
+        LOGE("Failed to compress %s", name.c_str());
+        error = ErrorCode::ArchiveWriteDataError;
         return false;
     }
 
     // Close file in output zip
-    mzRet = zipCloseFileInZip(zf);
+    int mzRet = zipCloseFileInZipRaw64(zf, deflater.size(), deflater.crc32());
     if (mzRet != ZIP_OK) {
         LOGE("minizip: Failed to close file in output zip: %s",
              MinizipUtils::zipErrorString(mzRet).c_str());
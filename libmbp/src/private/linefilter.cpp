@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbp/private/linefilter.h"
+
+#include <cstring>
+
+
+namespace mbp
+{
+
+LineFilter::LineFilter(AutoPatcher::LineFilterCallback filterCb,
+                       WriteCallback writeCb, void *userData)
+    : m_filterCb(filterCb)
+    , m_writeCb(writeCb)
+    , m_userData(userData)
+    , m_state(State::Buffering)
+    , m_first(true)
+{
+}
+
+bool LineFilter::write(const char *data, std::size_t size)
+{
+    const char *end = data + size;
+
+    while (data != end) {
+        auto newline = static_cast<const char *>(
+                std::memchr(data, '\n', end - data));
+        const char *lineEnd = newline ? newline : end;
+
+        switch (m_state) {
+        case State::Buffering:
+            m_line.append(data, lineEnd);
+            if (!processLine(newline != nullptr)) {
+                return false;
+            }
+            break;
+        case State::Passing:
+            if (lineEnd != data && !m_writeCb(data, lineEnd - data, m_userData)) {
+                return false;
+            }
+            break;
+        case State::Dropping:
+            break;
+        }
+
+        if (newline) {
+            m_state = State::Buffering;
+            data = newline + 1;
+        } else {
+            data = end;
+        }
+    }
+
+    return true;
+}
+
+bool LineFilter::finish()
+{
+    // The last line does not end with a newline (and may be empty)
+    if (m_state == State::Buffering && !processLine(true)) {
+        return false;
+    }
+
+    m_state = State::Buffering;
+    m_first = true;
+
+    return true;
+}
+
+bool LineFilter::processLine(bool complete)
+{
+    auto action = m_filterCb(&m_line, complete);
+
+    if (action == AutoPatcher::LineAction::NeedMore) {
+        if (!complete) {
+            return true;
+        }
+        action = AutoPatcher::LineAction::Keep;
+    }
+
+    if (action == AutoPatcher::LineAction::Keep) {
+        if (!m_first && !m_writeCb("\n", 1, m_userData)) {
+            return false;
+        }
+        if (!m_line.empty()
+                && !m_writeCb(m_line.data(), m_line.size(), m_userData)) {
+            return false;
+        }
+        m_first = false;
+        m_state = State::Passing;
+    } else {
+        m_state = State::Dropping;
+    }
+
+    m_line.clear();
+
+    return true;
+}
+
+static bool appendToString(const char *data, std::size_t size, void *userData)
+{
+    static_cast<std::string *>(userData)->append(data, size);
+    return true;
+}
+
+/*!
+ * \brief Filter a buffer in a single pass
+ */
+bool LineFilter::filter(AutoPatcher::LineFilterCallback filterCb,
+                        std::string *contents)
+{
+    std::string output;
+    output.reserve(contents->size());
+
+    LineFilter filter(filterCb, &appendToString, &output);
+    if (!filter.write(contents->data(), contents->size()) || !filter.finish()) {
+        return false;
+    }
+
+    contents->swap(output);
+    return true;
+}
+
+}
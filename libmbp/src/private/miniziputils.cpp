@@ -38,6 +38,8 @@
 #include "mbpio/error.h"
 #include "mbpio/path.h"
 
+#include "mbp/private/linefilter.h"
+
 #include "minizip/ioapi_buf.h"
 #include "minizip/minishared.h"
 #if defined(_WIN32)
@@ -194,7 +196,8 @@ MinizipUtils::UnzCtx * MinizipUtils::openInputFile(std::string path)
     return ctx;
 }
 
-MinizipUtils::ZipCtx * MinizipUtils::openOutputFile(std::string path)
+MinizipUtils::ZipCtx * MinizipUtils::openOutputFile(std::string path,
+                                                   bool append)
 {
     ZipCtx *ctx = new(std::nothrow) ZipCtx();
     if (!ctx) {
@@ -220,7 +223,9 @@ MinizipUtils::ZipCtx * MinizipUtils::openOutputFile(std::string path)
 #endif
 
     fill_buffer_filefunc64(&ctx->zFunc, &ctx->buf);
-    ctx->zf = zipOpen2_64(ctx->path.c_str(), 0, nullptr, &ctx->zFunc);
+    ctx->zf = zipOpen2_64(ctx->path.c_str(),
+                          append ? APPEND_STATUS_ADDINZIP : APPEND_STATUS_CREATE,
+                          nullptr, &ctx->zFunc);
     if (!ctx->zf) {
         free(ctx);
         return nullptr;
@@ -778,4 +783,110 @@ ErrorCode MinizipUtils::addFile(zipFile zf,
     return ErrorCode::NoError;
 }
 
+static bool writeToZip(const char *data, std::size_t size, void *userData)
+{
+    zipFile zf = static_cast<zipFile>(userData);
+
+    int ret = zipWriteInFileInZip(zf, data, size);
+    if (ret != ZIP_OK) {
+        LOGE("minizip: Failed to write inner file data: %s",
+             MinizipUtils::zipErrorString(ret).c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Stream the current file in \a uf through a line filter into \a zf
+ *
+ * The file is never fully loaded into memory.
+ */
+ErrorCode MinizipUtils::filterFile(unzFile uf,
+                                   zipFile zf,
+                                   const std::string &name,
+                                   AutoPatcher::LineFilterCallback filter)
+{
+    unz_file_info64 fi;
+
+    if (!getInfo(uf, &fi, nullptr)) {
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    bool zip64 = fi.uncompressed_size >= ((1ull << 32) - 1);
+
+    zip_fileinfo zi;
+    memset(&zi, 0, sizeof(zi));
+    zi.dos_date = fi.dos_date;
+    zi.internal_fa = fi.internal_fa;
+    zi.external_fa = fi.external_fa;
+
+    int ret = unzOpenCurrentFile(uf);
+    if (ret != UNZ_OK) {
+        LOGE("miniunz: Failed to open inner file: %s",
+             unzErrorString(ret).c_str());
+        return ErrorCode::ArchiveReadDataError;
+    }
+
+    ret = zipOpenNewFileInZip2_64(
+        zf,                     // file
+        name.c_str(),           // filename
+        &zi,                    // zip_fileinfo
+        nullptr,                // extrafield_local
+        0,                      // size_extrafield_local
+        nullptr,                // extrafield_global
+        0,                      // size_extrafield_global
+        nullptr,                // comment
+        Z_DEFLATED,             // method
+        Z_DEFAULT_COMPRESSION,  // level
+        0,                      // raw
+        zip64                   // zip64
+    );
+
+    if (ret != ZIP_OK) {
+        LOGE("minizip: Failed to open inner file: %s",
+             zipErrorString(ret).c_str());
+        unzCloseCurrentFile(uf);
+
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    LineFilter lineFilter(filter, &writeToZip, zf);
+    ErrorCode error = ErrorCode::NoError;
+    int n;
+    char buf[32768];
+
+    while ((n = unzReadCurrentFile(uf, buf, sizeof(buf))) > 0) {
+        if (!lineFilter.write(buf, n)) {
+            error = ErrorCode::ArchiveWriteDataError;
+            break;
+        }
+    }
+    if (n < 0) {
+        LOGE("miniunz: Finished before reaching inner file's EOF: %s",
+             unzErrorString(n).c_str());
+        error = ErrorCode::ArchiveReadDataError;
+    }
+
+    if (error == ErrorCode::NoError && !lineFilter.finish()) {
+        error = ErrorCode::ArchiveWriteDataError;
+    }
+
+    ret = unzCloseCurrentFile(uf);
+    if (ret != UNZ_OK && error == ErrorCode::NoError) {
+        LOGE("miniunz: Failed to close inner file: %s",
+             unzErrorString(ret).c_str());
+        error = ErrorCode::ArchiveReadDataError;
+    }
+
+    ret = zipCloseFileInZip(zf);
+    if (ret != ZIP_OK && error == ErrorCode::NoError) {
+        LOGE("minizip: Failed to close inner file: %s",
+             zipErrorString(ret).c_str());
+        error = ErrorCode::ArchiveWriteDataError;
+    }
+
+    return error;
+}
+
 }
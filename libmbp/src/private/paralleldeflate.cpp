@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbp/private/paralleldeflate.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <cstring>
+
+#include <pthread.h>
+
+#include <zlib.h>
+
+#include "mblog/logging.h"
+
+// Size of uncompressed blocks that are compressed independently
+#define BLOCK_SIZE                      (128 * 1024)
+// Size of the deflate window (and the dictionary passed to the next block)
+#define DICT_SIZE                       (32 * 1024)
+// Maximum number of blocks waiting to be compressed or written per thread
+#define MAX_BLOCKS_PER_THREAD           4
+
+
+namespace mbp
+{
+
+struct DeflateJob
+{
+    std::vector<unsigned char> in;
+    std::vector<unsigned char> dict;
+    std::vector<unsigned char> out;
+    uLong crc;
+    bool last;
+    bool done;
+    bool ok;
+};
+
+/*! \cond INTERNAL */
+class ParallelDeflate::Impl
+{
+public:
+    int level;
+    WriteCallback cb;
+    void *userData;
+
+    std::vector<pthread_t> threads;
+    std::mutex mutex;
+    // Signaled when a job is queued or the threads should exit
+    std::condition_variable queueCv;
+    // Signaled when a job is done
+    std::condition_variable doneCv;
+    bool stop = false;
+
+    // Jobs waiting for a worker thread
+    std::deque<DeflateJob *> queue;
+    // Jobs not yet written, in order
+    std::deque<std::unique_ptr<DeflateJob>> pending;
+    std::size_t maxPending;
+
+    std::vector<unsigned char> block;
+    std::vector<unsigned char> dict;
+
+    uLong crc = ::crc32(0L, Z_NULL, 0);
+    uint64_t size = 0;
+    bool failed = false;
+
+    bool submit(bool last);
+    bool writeJob(DeflateJob *job);
+    bool writeDone(bool wait);
+
+    static void * worker(void *userData);
+};
+/*! \endcond */
+
+static bool deflateBlock(int level, DeflateJob *job)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+
+    // Raw deflate stream without a header or trailer
+    int ret = deflateInit2(&strm, level, Z_DEFLATED, -15, 8,
+                           Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        LOGE("zlib: Failed to initialize deflate: %d", ret);
+        return false;
+    }
+
+    if (!job->dict.empty()) {
+        deflateSetDictionary(&strm, job->dict.data(), job->dict.size());
+    }
+
+    job->crc = ::crc32(0L, job->in.data(), job->in.size());
+
+    // Room for the sync flush marker as well
+    job->out.resize(deflateBound(&strm, job->in.size()) + 16);
+
+    strm.next_in = job->in.data();
+    strm.avail_in = job->in.size();
+    strm.next_out = job->out.data();
+    strm.avail_out = job->out.size();
+
+    // All blocks except the last end on a byte boundary so that they can be
+    // concatenated
+    int flush = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+
+    while (true) {
+        if (strm.avail_out == 0) {
+            std::size_t used = job->out.size();
+            job->out.resize(used * 2);
+            strm.next_out = job->out.data() + used;
+            strm.avail_out = job->out.size() - used;
+        }
+
+        ret = deflate(&strm, flush);
+        if (ret == Z_STREAM_ERROR
+                || (ret == Z_BUF_ERROR && strm.avail_out != 0)) {
+            LOGE("zlib: Failed to deflate: %d", ret);
+            deflateEnd(&strm);
+            return false;
+        }
+
+        if (job->last
+                ? ret == Z_STREAM_END
+                : strm.avail_in == 0 && strm.avail_out != 0) {
+            break;
+        }
+    }
+
+    job->out.resize(strm.total_out);
+    deflateEnd(&strm);
+
+    return true;
+}
+
+void * ParallelDeflate::Impl::worker(void *userData)
+{
+    Impl *impl = static_cast<Impl *>(userData);
+    std::unique_lock<std::mutex> lock(impl->mutex);
+
+    while (true) {
+        impl->queueCv.wait(lock, [&]{
+            return impl->stop || !impl->queue.empty();
+        });
+        if (impl->stop) {
+            break;
+        }
+
+        DeflateJob *job = impl->queue.front();
+        impl->queue.pop_front();
+
+        lock.unlock();
+        bool ok = deflateBlock(impl->level, job);
+        lock.lock();
+
+        job->ok = ok;
+        job->done = true;
+        impl->doneCv.notify_all();
+    }
+
+    return nullptr;
+}
+
+bool ParallelDeflate::Impl::writeJob(DeflateJob *job)
+{
+    if (!job->ok) {
+        return false;
+    }
+
+    if (!job->out.empty() && !cb(job->out.data(), job->out.size(), userData)) {
+        return false;
+    }
+
+    crc = crc32_combine(crc, job->crc, job->in.size());
+    size += job->in.size();
+
+    return true;
+}
+
+/*!
+ * \brief Write completed jobs in order
+ *
+ * \param wait Whether to wait until there's room for another job
+ */
+bool ParallelDeflate::Impl::writeDone(bool wait)
+{
+    while (!pending.empty()) {
+        std::unique_ptr<DeflateJob> job;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            DeflateJob *front = pending.front().get();
+
+            if (wait && pending.size() >= maxPending) {
+                doneCv.wait(lock, [&]{ return front->done; });
+            } else if (!front->done) {
+                break;
+            }
+
+            job = std::move(pending.front());
+            pending.pop_front();
+        }
+
+        if (!writeJob(job.get())) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ParallelDeflate::Impl::submit(bool last)
+{
+    std::unique_ptr<DeflateJob> job(new DeflateJob());
+    job->in.swap(block);
+    job->dict = dict;
+    job->last = last;
+    job->done = false;
+    job->ok = false;
+
+    // The last part of this block is the dictionary for the next one
+    std::size_t dictSize = std::min<std::size_t>(job->in.size(), DICT_SIZE);
+    dict.assign(job->in.end() - dictSize, job->in.end());
+
+    block.reserve(BLOCK_SIZE);
+
+    if (threads.empty()) {
+        job->ok = deflateBlock(level, job.get());
+        job->done = true;
+        return writeJob(job.get());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(job.get());
+        pending.push_back(std::move(job));
+    }
+    queueCv.notify_one();
+
+    return writeDone(true);
+}
+
+ParallelDeflate::ParallelDeflate(int level, unsigned int threads,
+                                 WriteCallback cb, void *userData)
+    : m_impl(new Impl())
+{
+    m_impl->level = level;
+    m_impl->cb = cb;
+    m_impl->userData = userData;
+    m_impl->block.reserve(BLOCK_SIZE);
+
+    // If threads cannot be created, the remaining ones just do more work. With
+    // no threads at all, blocks are compressed on the calling thread.
+    for (unsigned int i = 0; i < threads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, &Impl::worker,
+                           m_impl.get()) == 0) {
+            m_impl->threads.push_back(thread);
+        }
+    }
+
+    m_impl->maxPending = std::max<std::size_t>(
+            1, m_impl->threads.size() * MAX_BLOCKS_PER_THREAD);
+}
+
+ParallelDeflate::~ParallelDeflate()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        m_impl->stop = true;
+    }
+    m_impl->queueCv.notify_all();
+
+    for (pthread_t thread : m_impl->threads) {
+        pthread_join(thread, nullptr);
+    }
+}
+
+bool ParallelDeflate::write(const void *data, std::size_t size)
+{
+    if (m_impl->failed) {
+        return false;
+    }
+
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    while (size > 0) {
+        std::size_t n = std::min(size, BLOCK_SIZE - m_impl->block.size());
+        m_impl->block.insert(m_impl->block.end(), ptr, ptr + n);
+        ptr += n;
+        size -= n;
+
+        if (m_impl->block.size() == BLOCK_SIZE && !m_impl->submit(false)) {
+            m_impl->failed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ParallelDeflate::finish()
+{
+    if (m_impl->failed) {
+        return false;
+    }
+
+    // The last block may be empty. It still needs to be written to end the
+    // deflate stream.
+    if (!m_impl->submit(true)) {
+        m_impl->failed = true;
+        return false;
+    }
+
+    while (!m_impl->pending.empty()) {
+        {
+            std::unique_lock<std::mutex> lock(m_impl->mutex);
+            DeflateJob *front = m_impl->pending.front().get();
+            m_impl->doneCv.wait(lock, [&]{ return front->done; });
+        }
+
+        if (!m_impl->writeDone(false)) {
+            m_impl->failed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint32_t ParallelDeflate::crc32() const
+{
+    return static_cast<uint32_t>(m_impl->crc);
+}
+
+uint64_t ParallelDeflate::size() const
+{
+    return m_impl->size;
+}
+
+}
@@ -0,0 +1,499 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbp/private/sparsecompactor.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cinttypes>
+#include <cstring>
+
+#include "mblog/logging.h"
+#include "mbsparse/sparse_header.h"
+
+// Size of the buffer used for writing out the uniform part of a raw chunk
+#define PATTERN_BUF_SIZE                (64 * 1024)
+
+
+namespace mbp
+{
+
+enum class SparseState
+{
+    // Reading the file header
+    FileHeader,
+    // Reading a chunk header
+    ChunkHeader,
+    // Reading the raw data of a chunk
+    RawData,
+    // Reading the 32-bit value of a fill or CRC32 chunk
+    ChunkValue,
+    // All chunks have been read
+    Done,
+};
+
+/*! \cond INTERNAL */
+class SparseCompactor::Impl
+{
+public:
+    WriteCallback cb;
+    void *userData;
+
+    SparseState state = SparseState::FileHeader;
+    bool failed = false;
+
+    // Partially read header or value
+    unsigned char buf[sizeof(SparseHeader)];
+    std::size_t bufSize = 0;
+    // Bytes to discard before continuing in the current state
+    uint64_t skip = 0;
+
+    SparseHeader shdr;
+    ChunkHeader chdr;
+    uint32_t chunksLeft = 0;
+    uint32_t chunksOut = 0;
+    uint64_t blocks = 0;
+
+    // Raw data of the current chunk. The chunk is only written as a raw chunk
+    // once some data is found that does not match the first 32 bits.
+    uint64_t rawLeft;
+    uint64_t rawMatched;
+    bool rawUniform;
+    unsigned char pattern[sizeof(uint32_t)];
+
+    // Chunk that might still be merged with the next chunk
+    bool hasPending = false;
+    ChunkHeader pending;
+    uint32_t pendingFill;
+
+    bool write(const void *data, std::size_t size);
+
+    bool collect(const unsigned char **data, std::size_t *size,
+                 std::size_t needed);
+    bool processFileHeader();
+    bool processChunkHeader();
+    bool processChunkValue();
+    bool processRawData(const unsigned char *data, std::size_t size);
+    bool startRawChunk();
+    void endChunk();
+
+    bool queueChunk(uint16_t type, uint32_t chunkSize, uint32_t fillVal);
+    bool flushPending();
+    bool writeChunkHeader(uint16_t type, uint32_t chunkSize, uint32_t dataSize);
+};
+/*! \endcond */
+
+bool SparseCompactor::Impl::write(const void *data, std::size_t size)
+{
+    return cb(data, size, userData);
+}
+
+/*!
+ * \brief Accumulate bytes into the header buffer
+ *
+ * \return Whether \a needed bytes are available in the buffer
+ */
+bool SparseCompactor::Impl::collect(const unsigned char **data,
+                                    std::size_t *size, std::size_t needed)
+{
+    std::size_t n = std::min(*size, needed - bufSize);
+    memcpy(buf + bufSize, *data, n);
+    bufSize += n;
+    *data += n;
+    *size -= n;
+
+    if (bufSize == needed) {
+        bufSize = 0;
+        return true;
+    }
+    return false;
+}
+
+bool SparseCompactor::Impl::writeChunkHeader(uint16_t type, uint32_t chunkSize,
+                                             uint32_t dataSize)
+{
+    ChunkHeader header;
+    header.chunk_type = type;
+    header.reserved1 = 0;
+    header.chunk_sz = chunkSize;
+    header.total_sz = sizeof(ChunkHeader) + dataSize;
+
+    ++chunksOut;
+    return write(&header, sizeof(header));
+}
+
+bool SparseCompactor::Impl::flushPending()
+{
+    if (!hasPending) {
+        return true;
+    }
+
+    hasPending = false;
+
+    if (pending.chunk_type == CHUNK_TYPE_FILL) {
+        return writeChunkHeader(CHUNK_TYPE_FILL, pending.chunk_sz,
+                                sizeof(pendingFill))
+                && write(&pendingFill, sizeof(pendingFill));
+    } else {
+        return writeChunkHeader(pending.chunk_type, pending.chunk_sz, 0);
+    }
+}
+
+/*!
+ * \brief Write a fill or DONT_CARE chunk, merging it with the previous chunk if
+ *        possible
+ */
+bool SparseCompactor::Impl::queueChunk(uint16_t type, uint32_t chunkSize,
+                                       uint32_t fillVal)
+{
+    if (chunkSize == 0) {
+        return true;
+    }
+
+    if (hasPending && pending.chunk_type == type
+            && (type != CHUNK_TYPE_FILL || pendingFill == fillVal)) {
+        // Cannot overflow since the total is checked against total_blks
+        pending.chunk_sz += chunkSize;
+        return true;
+    }
+
+    if (!flushPending()) {
+        return false;
+    }
+
+    hasPending = true;
+    pending.chunk_type = type;
+    pending.chunk_sz = chunkSize;
+    pendingFill = fillVal;
+
+    return true;
+}
+
+bool SparseCompactor::Impl::processFileHeader()
+{
+    memcpy(&shdr, buf, sizeof(shdr));
+
+    if (shdr.magic != SPARSE_HEADER_MAGIC) {
+        LOGE("Expected magic to be %08x, but got %08x",
+             SPARSE_HEADER_MAGIC, shdr.magic);
+        return false;
+    } else if (shdr.major_version != SPARSE_HEADER_MAJOR_VER) {
+        LOGE("Expected major version to be %u, but got %u",
+             SPARSE_HEADER_MAJOR_VER, shdr.major_version);
+        return false;
+    } else if (shdr.file_hdr_sz < sizeof(SparseHeader)
+            || shdr.chunk_hdr_sz < sizeof(ChunkHeader)) {
+        LOGE("Invalid header sizes (file: %u, chunk: %u)",
+             shdr.file_hdr_sz, shdr.chunk_hdr_sz);
+        return false;
+    } else if (shdr.blk_sz == 0 || shdr.blk_sz % sizeof(uint32_t) != 0) {
+        LOGE("Invalid block size: %" PRIu32, shdr.blk_sz);
+        return false;
+    }
+
+    skip = shdr.file_hdr_sz - sizeof(SparseHeader);
+    chunksLeft = shdr.total_chunks;
+    state = chunksLeft > 0 ? SparseState::ChunkHeader : SparseState::Done;
+
+    SparseHeader header = shdr;
+    header.file_hdr_sz = sizeof(SparseHeader);
+    header.chunk_hdr_sz = sizeof(ChunkHeader);
+
+    return write(&header, sizeof(header));
+}
+
+bool SparseCompactor::Impl::processChunkHeader()
+{
+    memcpy(&chdr, buf, sizeof(chdr));
+
+    if (chdr.total_sz < shdr.chunk_hdr_sz) {
+        LOGE("Chunk size (%" PRIu32 ") is smaller than the chunk header",
+             chdr.total_sz);
+        return false;
+    } else if (chdr.chunk_sz > shdr.total_blks - blocks) {
+        LOGE("Chunks cover more than %" PRIu32 " blocks", shdr.total_blks);
+        return false;
+    }
+
+    uint32_t dataSize = chdr.total_sz - shdr.chunk_hdr_sz;
+    uint64_t chunkSize = static_cast<uint64_t>(chdr.chunk_sz) * shdr.blk_sz;
+
+    skip = shdr.chunk_hdr_sz - sizeof(ChunkHeader);
+    blocks += chdr.chunk_sz;
+
+    switch (chdr.chunk_type) {
+    case CHUNK_TYPE_RAW:
+        if (dataSize != chunkSize) {
+            LOGE("Raw chunk data size (%" PRIu32 ") does not match"
+                 " chunk size (%" PRIu64 ")", dataSize, chunkSize);
+            return false;
+        }
+        rawLeft = dataSize;
+        rawMatched = 0;
+        rawUniform = true;
+        state = SparseState::RawData;
+        if (rawLeft == 0) {
+            endChunk();
+        }
+        return true;
+
+    case CHUNK_TYPE_FILL:
+    case CHUNK_TYPE_CRC32:
+        if (dataSize != sizeof(uint32_t)) {
+            LOGE("Chunk data size (%" PRIu32 ") does not match size of"
+                 " 32-bit integer", dataSize);
+            return false;
+        } else if (chdr.chunk_type == CHUNK_TYPE_CRC32 && chunkSize != 0) {
+            LOGE("CRC32 chunk size (%" PRIu64 ") is not 0", chunkSize);
+            return false;
+        }
+        state = SparseState::ChunkValue;
+        return true;
+
+    case CHUNK_TYPE_DONT_CARE:
+        if (dataSize != 0) {
+            LOGE("DONT_CARE chunk data size (%" PRIu32 ") is not 0",
+                 dataSize);
+            return false;
+        }
+        endChunk();
+        return queueChunk(CHUNK_TYPE_DONT_CARE, chdr.chunk_sz, 0);
+
+    default:
+        LOGE("Unknown chunk type: %u", chdr.chunk_type);
+        return false;
+    }
+}
+
+bool SparseCompactor::Impl::processChunkValue()
+{
+    uint32_t value;
+    memcpy(&value, buf, sizeof(value));
+
+    endChunk();
+
+    // CRC32 chunks are dropped. The checksums are not verified by libmbsparse.
+    if (chdr.chunk_type == CHUNK_TYPE_FILL) {
+        return queueChunk(CHUNK_TYPE_FILL, chdr.chunk_sz, value);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write the header and the already matched data of the current raw
+ *        chunk
+ */
+bool SparseCompactor::Impl::startRawChunk()
+{
+    if (!flushPending() || !writeChunkHeader(
+            CHUNK_TYPE_RAW, chdr.chunk_sz, chdr.total_sz - shdr.chunk_hdr_sz)) {
+        return false;
+    }
+
+    std::vector<unsigned char> patternBuf(std::min<uint64_t>(
+            rawMatched, PATTERN_BUF_SIZE));
+    for (std::size_t i = 0; i < patternBuf.size(); ++i) {
+        patternBuf[i] = pattern[i % sizeof(pattern)];
+    }
+
+    for (uint64_t left = rawMatched; left > 0;) {
+        std::size_t n = std::min<uint64_t>(left, patternBuf.size());
+        if (!write(patternBuf.data(), n)) {
+            return false;
+        }
+        left -= n;
+    }
+
+    rawUniform = false;
+    return true;
+}
+
+bool SparseCompactor::Impl::processRawData(const unsigned char *data,
+                                           std::size_t size)
+{
+    if (rawUniform) {
+        std::size_t i = 0;
+
+        // The first 32 bits define the pattern
+        for (; i < size && rawMatched + i < sizeof(pattern); ++i) {
+            pattern[rawMatched + i] = data[i];
+        }
+
+        // Compare whole words when aligned
+        if ((rawMatched + i) % sizeof(pattern) == 0) {
+            uint32_t value;
+            memcpy(&value, pattern, sizeof(value));
+
+            for (; i + sizeof(value) <= size; i += sizeof(value)) {
+                uint32_t word;
+                memcpy(&word, data + i, sizeof(word));
+                if (word != value) {
+                    break;
+                }
+            }
+        }
+
+        for (; i < size; ++i) {
+            if (data[i] != pattern[(rawMatched + i) % sizeof(pattern)]) {
+                break;
+            }
+        }
+
+        rawMatched += i;
+
+        if (i < size) {
+            if (!startRawChunk()) {
+                return false;
+            }
+            data += i;
+            size -= i;
+        } else {
+            size = 0;
+        }
+    }
+
+    return size == 0 || write(data, size);
+}
+
+void SparseCompactor::Impl::endChunk()
+{
+    --chunksLeft;
+    state = chunksLeft > 0 ? SparseState::ChunkHeader : SparseState::Done;
+}
+
+SparseCompactor::SparseCompactor(WriteCallback cb, void *userData)
+    : m_impl(new Impl())
+{
+    m_impl->cb = cb;
+    m_impl->userData = userData;
+}
+
+SparseCompactor::~SparseCompactor() = default;
+
+bool SparseCompactor::write(const void *data, std::size_t size)
+{
+    Impl *impl = m_impl.get();
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    if (impl->failed) {
+        return false;
+    }
+
+    while (size > 0) {
+        if (impl->skip > 0) {
+            std::size_t n = std::min<uint64_t>(impl->skip, size);
+            impl->skip -= n;
+            ptr += n;
+            size -= n;
+            continue;
+        }
+
+        bool ret = true;
+
+        switch (impl->state) {
+        case SparseState::FileHeader:
+            if (impl->collect(&ptr, &size, sizeof(SparseHeader))) {
+                ret = impl->processFileHeader();
+            }
+            break;
+
+        case SparseState::ChunkHeader:
+            if (impl->collect(&ptr, &size, sizeof(ChunkHeader))) {
+                ret = impl->processChunkHeader();
+            }
+            break;
+
+        case SparseState::ChunkValue:
+            if (impl->collect(&ptr, &size, sizeof(uint32_t))) {
+                ret = impl->processChunkValue();
+            }
+            break;
+
+        case SparseState::RawData: {
+            std::size_t n = std::min<uint64_t>(impl->rawLeft, size);
+            ret = impl->processRawData(ptr, n);
+            impl->rawLeft -= n;
+            ptr += n;
+            size -= n;
+
+            if (ret && impl->rawLeft == 0) {
+                impl->endChunk();
+                if (impl->rawUniform) {
+                    uint32_t value;
+                    memcpy(&value, impl->pattern, sizeof(value));
+                    ret = impl->queueChunk(CHUNK_TYPE_FILL,
+                                           impl->chdr.chunk_sz, value);
+                }
+            }
+            break;
+        }
+
+        case SparseState::Done:
+            LOGE("Unexpected data after the last chunk");
+            ret = false;
+            break;
+        }
+
+        if (!ret) {
+            impl->failed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool SparseCompactor::finish()
+{
+    Impl *impl = m_impl.get();
+
+    if (impl->failed) {
+        return false;
+    }
+
+    if (impl->state != SparseState::Done || impl->skip > 0) {
+        LOGE("Sparse image is truncated");
+        impl->failed = true;
+        return false;
+    } else if (impl->blocks != impl->shdr.total_blks) {
+        LOGE("Chunks cover %" PRIu64 " blocks instead of %" PRIu32,
+             impl->blocks, impl->shdr.total_blks);
+        impl->failed = true;
+        return false;
+    }
+
+    if (!impl->flushPending()) {
+        impl->failed = true;
+        return false;
+    }
+
+    // Every output chunk replaces at least one input chunk
+    while (impl->chunksOut < impl->shdr.total_chunks) {
+        if (!impl->writeChunkHeader(CHUNK_TYPE_DONT_CARE, 0, 0)) {
+            impl->failed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,671 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbp/private/ziprewriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <pthread.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/filename.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/string.h"
+
+#include "mblog/logging.h"
+
+
+#define ZIP_LOCAL_HEADER_SIG            0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG          0x02014b50
+#define ZIP_EOCD_SIG                    0x06054b50
+#define ZIP64_EOCD_SIG                  0x06064b50
+#define ZIP64_EOCD_LOCATOR_SIG          0x07064b50
+
+#define ZIP_LOCAL_HEADER_SIZE           30
+#define ZIP_CENTRAL_HEADER_SIZE         46
+#define ZIP_EOCD_SIZE                   22
+#define ZIP64_EOCD_SIZE                 56
+#define ZIP64_EOCD_LOCATOR_SIZE         20
+#define ZIP_MAX_COMMENT_SIZE            UINT16_MAX
+
+#define ZIP64_EXTRA_ID                  0x0001
+#define ZIP64_VERSION_NEEDED            45
+
+// General purpose flag indicating that sizes follow the data
+#define ZIP_FLAG_DATA_DESCRIPTOR        (1 << 3)
+
+// Number of entries copied at the same time
+#define COPY_THREADS                    4
+// Size of each read/write when copying entry data
+#define COPY_BUFFER_SIZE                (1024 * 1024)
+// How often progress is reported while the copy threads are running
+#define PROGRESS_INTERVAL_MS            100
+
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedMbFile;
+
+namespace mbp
+{
+
+static inline uint16_t readLe16(const unsigned char *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t readLe32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0])
+            | (static_cast<uint32_t>(p[1]) << 8)
+            | (static_cast<uint32_t>(p[2]) << 16)
+            | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline uint64_t readLe64(const unsigned char *p)
+{
+    return static_cast<uint64_t>(readLe32(p))
+            | (static_cast<uint64_t>(readLe32(p + 4)) << 32);
+}
+
+static inline void appendLe16(std::vector<unsigned char> *buf, uint16_t value)
+{
+    buf->push_back(value & 0xff);
+    buf->push_back((value >> 8) & 0xff);
+}
+
+static inline void appendLe32(std::vector<unsigned char> *buf, uint32_t value)
+{
+    appendLe16(buf, value & 0xffff);
+    appendLe16(buf, (value >> 16) & 0xffff);
+}
+
+static inline void appendLe64(std::vector<unsigned char> *buf, uint64_t value)
+{
+    appendLe32(buf, value & 0xffffffff);
+    appendLe32(buf, (value >> 32) & 0xffffffff);
+}
+
+static bool openFile(MbFile *file, const std::string &path, int mode)
+{
+    if (mb_file_open_filename(file, path.c_str(), mode) != MB_FILE_OK) {
+        LOGE("%s: Failed to open file: %s",
+             path.c_str(), mb_file_error_string(file));
+        return false;
+    }
+    return true;
+}
+
+static bool readAt(MbFile *file, uint64_t offset, void *buf, size_t size)
+{
+    size_t n;
+
+    if (mb_file_seek(file, offset, SEEK_SET, nullptr) != MB_FILE_OK) {
+        LOGE("Failed to seek to %" PRIu64 ": %s",
+             offset, mb_file_error_string(file));
+        return false;
+    }
+    if (mb_file_read_fully(file, buf, size, &n) != MB_FILE_OK) {
+        LOGE("Failed to read %" MB_PRIzu " bytes at %" PRIu64 ": %s",
+             size, offset, mb_file_error_string(file));
+        return false;
+    }
+    if (n != size) {
+        LOGE("Unexpected EOF when reading %" MB_PRIzu " bytes at %" PRIu64,
+             size, offset);
+        return false;
+    }
+    return true;
+}
+
+static bool writeAt(MbFile *file, uint64_t offset,
+                    const void *buf, size_t size)
+{
+    size_t n;
+
+    if (mb_file_seek(file, offset, SEEK_SET, nullptr) != MB_FILE_OK) {
+        LOGE("Failed to seek to %" PRIu64 ": %s",
+             offset, mb_file_error_string(file));
+        return false;
+    }
+    if (mb_file_write_fully(file, buf, size, &n) != MB_FILE_OK
+            || n != size) {
+        LOGE("Failed to write %" MB_PRIzu " bytes at %" PRIu64 ": %s",
+             size, offset, mb_file_error_string(file));
+        return false;
+    }
+    return true;
+}
+
+static bool needsZip64(const ZipRewriter::Entry &entry)
+{
+    return entry.compressedSize >= UINT32_MAX
+            || entry.uncompressedSize >= UINT32_MAX;
+}
+
+static std::vector<unsigned char> buildLocalHeader(
+        const ZipRewriter::Entry &entry)
+{
+    bool zip64 = needsZip64(entry);
+    std::vector<unsigned char> buf;
+    buf.reserve(ZIP_LOCAL_HEADER_SIZE + entry.outputName.size() + 20);
+
+    appendLe32(&buf, ZIP_LOCAL_HEADER_SIG);
+    appendLe16(&buf, zip64
+            ? std::max<uint16_t>(entry.versionNeeded, ZIP64_VERSION_NEEDED)
+            : entry.versionNeeded);
+    // The sizes are known, so there is no data descriptor
+    appendLe16(&buf, entry.flags & ~ZIP_FLAG_DATA_DESCRIPTOR);
+    appendLe16(&buf, entry.method);
+    appendLe16(&buf, entry.dosTime);
+    appendLe16(&buf, entry.dosDate);
+    appendLe32(&buf, entry.crc32);
+    appendLe32(&buf, zip64 ? UINT32_MAX : entry.compressedSize);
+    appendLe32(&buf, zip64 ? UINT32_MAX : entry.uncompressedSize);
+    appendLe16(&buf, entry.outputName.size());
+    appendLe16(&buf, zip64 ? 20 : 0);
+    buf.insert(buf.end(), entry.outputName.begin(), entry.outputName.end());
+
+    if (zip64) {
+        appendLe16(&buf, ZIP64_EXTRA_ID);
+        appendLe16(&buf, 16);
+        appendLe64(&buf, entry.uncompressedSize);
+        appendLe64(&buf, entry.compressedSize);
+    }
+
+    return buf;
+}
+
+static void appendCentralHeader(std::vector<unsigned char> *buf,
+                                const ZipRewriter::Entry &entry)
+{
+    bool zip64Uncomp = entry.uncompressedSize >= UINT32_MAX;
+    bool zip64Comp = entry.compressedSize >= UINT32_MAX;
+    bool zip64Offset = entry.outputOffset >= UINT32_MAX;
+    uint16_t extraSize = 8 * (zip64Uncomp + zip64Comp + zip64Offset);
+    bool zip64 = extraSize > 0;
+
+    appendLe32(buf, ZIP_CENTRAL_HEADER_SIG);
+    appendLe16(buf, entry.versionMadeBy);
+    appendLe16(buf, zip64
+            ? std::max<uint16_t>(entry.versionNeeded, ZIP64_VERSION_NEEDED)
+            : entry.versionNeeded);
+    appendLe16(buf, entry.flags & ~ZIP_FLAG_DATA_DESCRIPTOR);
+    appendLe16(buf, entry.method);
+    appendLe16(buf, entry.dosTime);
+    appendLe16(buf, entry.dosDate);
+    appendLe32(buf, entry.crc32);
+    appendLe32(buf, zip64Comp ? UINT32_MAX : entry.compressedSize);
+    appendLe32(buf, zip64Uncomp ? UINT32_MAX : entry.uncompressedSize);
+    appendLe16(buf, entry.outputName.size());
+    appendLe16(buf, zip64 ? extraSize + 4 : 0);
+    appendLe16(buf, 0); // Comment size
+    appendLe16(buf, 0); // Disk number
+    appendLe16(buf, entry.internalAttrs);
+    appendLe32(buf, entry.externalAttrs);
+    appendLe32(buf, zip64Offset ? UINT32_MAX : entry.outputOffset);
+    buf->insert(buf->end(), entry.outputName.begin(), entry.outputName.end());
+
+    if (zip64) {
+        appendLe16(buf, ZIP64_EXTRA_ID);
+        appendLe16(buf, extraSize);
+        if (zip64Uncomp) {
+            appendLe64(buf, entry.uncompressedSize);
+        }
+        if (zip64Comp) {
+            appendLe64(buf, entry.compressedSize);
+        }
+        if (zip64Offset) {
+            appendLe64(buf, entry.outputOffset);
+        }
+    }
+}
+
+static void appendEndOfCentralDirectory(std::vector<unsigned char> *buf,
+                                        uint64_t count, uint64_t cdOffset,
+                                        uint64_t cdSize)
+{
+    bool zip64 = count >= UINT16_MAX || cdOffset >= UINT32_MAX
+            || cdSize >= UINT32_MAX;
+
+    if (zip64) {
+        uint64_t zip64EocdOffset = cdOffset + cdSize;
+
+        appendLe32(buf, ZIP64_EOCD_SIG);
+        appendLe64(buf, ZIP64_EOCD_SIZE - 12);
+        appendLe16(buf, ZIP64_VERSION_NEEDED); // Version made by
+        appendLe16(buf, ZIP64_VERSION_NEEDED); // Version needed
+        appendLe32(buf, 0); // Disk number
+        appendLe32(buf, 0); // Disk with central directory
+        appendLe64(buf, count);
+        appendLe64(buf, count);
+        appendLe64(buf, cdSize);
+        appendLe64(buf, cdOffset);
+
+        appendLe32(buf, ZIP64_EOCD_LOCATOR_SIG);
+        appendLe32(buf, 0); // Disk with zip64 end of central directory
+        appendLe64(buf, zip64EocdOffset);
+        appendLe32(buf, 1); // Total disks
+    }
+
+    appendLe32(buf, ZIP_EOCD_SIG);
+    appendLe16(buf, 0); // Disk number
+    appendLe16(buf, 0); // Disk with central directory
+    appendLe16(buf, zip64 ? UINT16_MAX : count);
+    appendLe16(buf, zip64 ? UINT16_MAX : count);
+    appendLe32(buf, zip64 ? UINT32_MAX : cdSize);
+    appendLe32(buf, zip64 ? UINT32_MAX : cdOffset);
+    appendLe16(buf, 0); // Comment size
+}
+
+static bool parseZip64Extra(const unsigned char *extra, size_t extraSize,
+                            ZipRewriter::Entry *entry, bool hasUncomp,
+                            bool hasComp, bool hasOffset)
+{
+    while (extraSize >= 4) {
+        uint16_t id = readLe16(extra);
+        uint16_t size = readLe16(extra + 2);
+        if (size > extraSize - 4) {
+            return false;
+        }
+
+        if (id == ZIP64_EXTRA_ID) {
+            const unsigned char *p = extra + 4;
+            size_t needed = 8 * (hasUncomp + hasComp + hasOffset);
+            if (size < needed) {
+                return false;
+            }
+
+            if (hasUncomp) {
+                entry->uncompressedSize = readLe64(p);
+                p += 8;
+            }
+            if (hasComp) {
+                entry->compressedSize = readLe64(p);
+                p += 8;
+            }
+            if (hasOffset) {
+                entry->inputOffset = readLe64(p);
+            }
+            return true;
+        }
+
+        extra += 4 + size;
+        extraSize -= 4 + size;
+    }
+
+    return !hasUncomp && !hasComp && !hasOffset;
+}
+
+ErrorCode ZipRewriter::readCentralDirectory(const std::string &path,
+                                            std::vector<Entry> *entries)
+{
+    ScopedMbFile file{mb_file_new(), &mb_file_free};
+    uint64_t fileSize;
+
+    if (!openFile(file.get(), path, MB_FILE_OPEN_READ_ONLY)) {
+        return ErrorCode::ArchiveReadOpenError;
+    }
+
+    if (mb_file_seek(file.get(), 0, SEEK_END, &fileSize) != MB_FILE_OK) {
+        LOGE("%s: Failed to seek: %s",
+             path.c_str(), mb_file_error_string(file.get()));
+        return ErrorCode::ArchiveReadOpenError;
+    }
+
+    // Find the end of central directory record, which is followed by a
+    // comment of up to 64KiB
+    size_t tailSize = std::min<uint64_t>(
+            fileSize, ZIP_EOCD_SIZE + ZIP_MAX_COMMENT_SIZE);
+    std::vector<unsigned char> tail(tailSize);
+    if (tailSize < ZIP_EOCD_SIZE
+            || !readAt(file.get(), fileSize - tailSize, tail.data(), tailSize)) {
+        LOGE("%s: Not a zip file", path.c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    size_t eocdPos = tailSize - ZIP_EOCD_SIZE + 1;
+    do {
+        --eocdPos;
+        if (readLe32(tail.data() + eocdPos) == ZIP_EOCD_SIG) {
+            break;
+        }
+    } while (eocdPos > 0);
+
+    const unsigned char *eocd = tail.data() + eocdPos;
+    if (readLe32(eocd) != ZIP_EOCD_SIG) {
+        LOGE("%s: Failed to find end of central directory", path.c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    if (readLe16(eocd + 4) != 0 || readLe16(eocd + 6) != 0) {
+        LOGE("%s: Multi-disk zip files are not supported", path.c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    uint64_t count = readLe16(eocd + 10);
+    uint64_t cdSize = readLe32(eocd + 12);
+    uint64_t cdOffset = readLe32(eocd + 16);
+
+    if (count == UINT16_MAX || cdSize == UINT32_MAX
+            || cdOffset == UINT32_MAX) {
+        uint64_t eocdOffset = fileSize - tailSize + eocdPos;
+        unsigned char locator[ZIP64_EOCD_LOCATOR_SIZE];
+        unsigned char zip64Eocd[ZIP64_EOCD_SIZE];
+
+        if (eocdOffset < ZIP64_EOCD_LOCATOR_SIZE
+                || !readAt(file.get(), eocdOffset - ZIP64_EOCD_LOCATOR_SIZE,
+                           locator, sizeof(locator))
+                || readLe32(locator) != ZIP64_EOCD_LOCATOR_SIG
+                || !readAt(file.get(), readLe64(locator + 8),
+                           zip64Eocd, sizeof(zip64Eocd))
+                || readLe32(zip64Eocd) != ZIP64_EOCD_SIG) {
+            LOGE("%s: Failed to read zip64 end of central directory",
+                 path.c_str());
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        count = readLe64(zip64Eocd + 32);
+        cdSize = readLe64(zip64Eocd + 40);
+        cdOffset = readLe64(zip64Eocd + 48);
+    }
+
+    if (cdOffset > fileSize || cdSize > fileSize - cdOffset) {
+        LOGE("%s: Invalid central directory location", path.c_str());
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    std::vector<unsigned char> cd(cdSize);
+    if (!readAt(file.get(), cdOffset, cd.data(), cd.size())) {
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    std::vector<Entry> result;
+    result.reserve(count);
+
+    size_t pos = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (cd.size() - pos < ZIP_CENTRAL_HEADER_SIZE
+                || readLe32(cd.data() + pos) != ZIP_CENTRAL_HEADER_SIG) {
+            LOGE("%s: Invalid central directory entry %" PRIu64,
+                 path.c_str(), i);
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        const unsigned char *h = cd.data() + pos;
+        uint16_t nameSize = readLe16(h + 28);
+        uint16_t extraSize = readLe16(h + 30);
+        uint16_t commentSize = readLe16(h + 32);
+
+        if (cd.size() - pos - ZIP_CENTRAL_HEADER_SIZE
+                < static_cast<size_t>(nameSize) + extraSize + commentSize) {
+            LOGE("%s: Truncated central directory entry %" PRIu64,
+                 path.c_str(), i);
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        Entry entry;
+        entry.versionMadeBy = readLe16(h + 4);
+        entry.versionNeeded = readLe16(h + 6);
+        entry.flags = readLe16(h + 8);
+        entry.method = readLe16(h + 10);
+        entry.dosTime = readLe16(h + 12);
+        entry.dosDate = readLe16(h + 14);
+        entry.crc32 = readLe32(h + 16);
+        entry.compressedSize = readLe32(h + 20);
+        entry.uncompressedSize = readLe32(h + 24);
+        entry.internalAttrs = readLe16(h + 36);
+        entry.externalAttrs = readLe32(h + 38);
+        entry.inputOffset = readLe32(h + 42);
+        entry.outputOffset = 0;
+        entry.name.assign(reinterpret_cast<const char *>(
+                h + ZIP_CENTRAL_HEADER_SIZE), nameSize);
+        entry.outputName = entry.name;
+
+        if (!parseZip64Extra(h + ZIP_CENTRAL_HEADER_SIZE + nameSize, extraSize,
+                             &entry,
+                             entry.uncompressedSize == UINT32_MAX,
+                             entry.compressedSize == UINT32_MAX,
+                             entry.inputOffset == UINT32_MAX)) {
+            LOGE("%s: Invalid zip64 extra field: %s",
+                 path.c_str(), entry.name.c_str());
+            return ErrorCode::ArchiveReadHeaderError;
+        }
+
+        result.push_back(std::move(entry));
+
+        pos += ZIP_CENTRAL_HEADER_SIZE + nameSize + extraSize + commentSize;
+    }
+
+    entries->swap(result);
+    return ErrorCode::NoError;
+}
+
+namespace
+{
+
+struct CopyState
+{
+    const std::string *inputPath;
+    const std::string *outputPath;
+    const std::vector<ZipRewriter::Entry> *entries;
+    volatile bool *cancelled;
+
+    std::atomic<size_t> next;
+    // Uncompressed bytes copied, scaled by each entry's compression ratio
+    std::atomic<uint64_t> bytes;
+    std::atomic<bool> failed;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t running;
+};
+
+}
+
+static bool copyEntry(CopyState *state, MbFile *input, MbFile *output,
+                      const ZipRewriter::Entry &entry,
+                      std::vector<unsigned char> *buf)
+{
+    unsigned char lh[ZIP_LOCAL_HEADER_SIZE];
+
+    // The local header's extra field may differ from the central directory's
+    if (!readAt(input, entry.inputOffset, lh, sizeof(lh))
+            || readLe32(lh) != ZIP_LOCAL_HEADER_SIG) {
+        LOGE("%s: Invalid local file header", entry.name.c_str());
+        return false;
+    }
+
+    uint64_t inputDataOffset = entry.inputOffset + ZIP_LOCAL_HEADER_SIZE
+            + readLe16(lh + 26) + readLe16(lh + 28);
+
+    std::vector<unsigned char> header = buildLocalHeader(entry);
+    if (!writeAt(output, entry.outputOffset, header.data(), header.size())) {
+        return false;
+    }
+
+    uint64_t outputDataOffset = entry.outputOffset + header.size();
+    uint64_t remaining = entry.compressedSize;
+    uint64_t reported = 0;
+
+    while (remaining > 0) {
+        if (*state->cancelled || state->failed) {
+            return false;
+        }
+
+        size_t n = std::min<uint64_t>(remaining, buf->size());
+        uint64_t done = entry.compressedSize - remaining;
+
+        if (!readAt(input, inputDataOffset + done, buf->data(), n)
+                || !writeAt(output, outputDataOffset + done, buf->data(), n)) {
+            LOGE("%s: Failed to copy data", entry.name.c_str());
+            return false;
+        }
+
+        remaining -= n;
+
+        // Scale this to the uncompressed size for the purposes of a progress
+        // bar
+        uint64_t scaled = static_cast<double>(entry.compressedSize - remaining)
+                / entry.compressedSize * entry.uncompressedSize;
+        state->bytes += scaled - reported;
+        reported = scaled;
+    }
+
+    state->bytes += entry.uncompressedSize - reported;
+    return true;
+}
+
+static void * copyThread(void *userData)
+{
+    CopyState *state = static_cast<CopyState *>(userData);
+    ScopedMbFile input{mb_file_new(), &mb_file_free};
+    ScopedMbFile output{mb_file_new(), &mb_file_free};
+    std::vector<unsigned char> buf(COPY_BUFFER_SIZE);
+
+    // Every thread has its own handles so that seeking does not race
+    if (!openFile(input.get(), *state->inputPath, MB_FILE_OPEN_READ_ONLY)
+            || !openFile(output.get(), *state->outputPath,
+                         MB_FILE_OPEN_READ_WRITE)) {
+        state->failed = true;
+    } else {
+        size_t i;
+        while (!state->failed && !*state->cancelled
+                && (i = state->next++) < state->entries->size()) {
+            if (!copyEntry(state, input.get(), output.get(),
+                           (*state->entries)[i], &buf)) {
+                state->failed = true;
+            }
+        }
+
+        if (mb_file_close(output.get()) != MB_FILE_OK) {
+            LOGE("%s: Failed to close file: %s", state->outputPath->c_str(),
+                 mb_file_error_string(output.get()));
+            state->failed = true;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    --state->running;
+    state->cv.notify_all();
+
+    return nullptr;
+}
+
+ErrorCode ZipRewriter::copyEntries(const std::string &inputPath,
+                                   const std::string &outputPath,
+                                   std::vector<Entry> *entries,
+                                   ProgressCb cb, void *userData,
+                                   volatile bool *cancelled)
+{
+    // Lay out the output zip
+    uint64_t offset = 0;
+    for (Entry &entry : *entries) {
+        entry.outputOffset = offset;
+        offset += ZIP_LOCAL_HEADER_SIZE + entry.outputName.size()
+                + (needsZip64(entry) ? 20 : 0) + entry.compressedSize;
+    }
+    uint64_t cdOffset = offset;
+
+    // Create (or truncate) the output file before the threads open it
+    ScopedMbFile output{mb_file_new(), &mb_file_free};
+    if (!openFile(output.get(), outputPath, MB_FILE_OPEN_WRITE_ONLY)) {
+        return ErrorCode::ArchiveWriteOpenError;
+    }
+
+    CopyState state;
+    state.inputPath = &inputPath;
+    state.outputPath = &outputPath;
+    state.entries = entries;
+    state.cancelled = cancelled;
+    state.next = 0;
+    state.bytes = 0;
+    state.failed = false;
+    state.running = 0;
+
+    size_t nThreads = std::min<size_t>(COPY_THREADS, entries->size());
+    std::vector<pthread_t> threads;
+
+    for (size_t i = 0; i < nThreads; ++i) {
+        pthread_t thread;
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (pthread_create(&thread, nullptr, &copyThread, &state) == 0) {
+            threads.push_back(thread);
+            ++state.running;
+        }
+    }
+
+    if (nThreads > 0 && threads.empty()) {
+        LOGE("Failed to create copy threads");
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    // Progress callbacks are only invoked from the calling thread
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        while (state.running > 0) {
+            state.cv.wait_for(lock, std::chrono::milliseconds(
+                    PROGRESS_INTERVAL_MS));
+            if (cb) {
+                lock.unlock();
+                cb(state.bytes, userData);
+                lock.lock();
+            }
+        }
+    }
+
+    for (pthread_t thread : threads) {
+        pthread_join(thread, nullptr);
+    }
+
+    if (*cancelled) {
+        return ErrorCode::PatchingCancelled;
+    } else if (state.failed) {
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    // Write the new central directory after the last entry
+    std::vector<unsigned char> cd;
+    for (const Entry &entry : *entries) {
+        appendCentralHeader(&cd, entry);
+    }
+    uint64_t cdSize = cd.size();
+    appendEndOfCentralDirectory(&cd, entries->size(), cdOffset, cdSize);
+
+    if (!writeAt(output.get(), cdOffset, cd.data(), cd.size())) {
+        return ErrorCode::ArchiveWriteHeaderError;
+    }
+
+    if (mb_file_close(output.get()) != MB_FILE_OK) {
+        LOGE("%s: Failed to close file: %s",
+             outputPath.c_str(), mb_file_error_string(output.get()));
+        return ErrorCode::ArchiveCloseError;
+    }
+
+    return ErrorCode::NoError;
+}
+
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "mbpio/delete.h"
+
+#include "mbp/patcherconfig.h"
+#include "mbp/patcherinterface.h"
+#include "mbp/private/fileutils.h"
+
+using namespace mbp;
+
+#define TEST_FILE "META-INF/com/google/android/updater-script"
+
+// Autopatcher that only implements patchFiles()
+class AppendingPatcher : public AutoPatcher
+{
+public:
+    explicit AppendingPatcher(const PatcherConfig * const pc)
+        : AutoPatcher(pc)
+    {
+    }
+
+    std::vector<std::string> directories;
+
+    virtual ErrorCode error() const override
+    {
+        return ErrorCode::NoError;
+    }
+
+    virtual std::string id() const override
+    {
+        return "AppendingPatcher";
+    }
+
+    virtual std::vector<std::string> newFiles() const override
+    {
+        return {};
+    }
+
+    virtual std::vector<std::string> existingFiles() const override
+    {
+        return { TEST_FILE };
+    }
+
+    virtual bool patchFiles(const std::string &directory) override
+    {
+        std::string path = directory + "/" TEST_FILE;
+        std::string contents;
+
+        directories.push_back(directory);
+
+        if (FileUtils::readToString(path, &contents) != ErrorCode::NoError) {
+            return false;
+        }
+        contents += "patched\n";
+        return FileUtils::writeFromString(path, contents) == ErrorCode::NoError;
+    }
+};
+
+struct AutoPatcherTest : testing::Test
+{
+    PatcherConfig _pc;
+    std::string _tempDir;
+
+    virtual void SetUp()
+    {
+        _tempDir = FileUtils::createTemporaryDir(
+                FileUtils::systemTemporaryDir());
+        ASSERT_FALSE(_tempDir.empty());
+        _pc.setTempDirectory(_tempDir);
+    }
+
+    virtual void TearDown()
+    {
+        if (!_tempDir.empty()) {
+            io::deleteRecursively(_tempDir);
+        }
+    }
+};
+
+TEST_F(AutoPatcherTest, DefaultPatchContentsUsesConfiguredTempDir)
+{
+    AppendingPatcher patcher(&_pc);
+    std::string contents = "ui_print(\"a\");\n";
+
+    ASSERT_TRUE(patcher.patchContents(TEST_FILE, &contents));
+    ASSERT_EQ(contents, "ui_print(\"a\");\npatched\n");
+
+    ASSERT_EQ(patcher.directories.size(), 1u);
+    const std::string &directory = patcher.directories[0];
+    ASSERT_GT(directory.size(), _tempDir.size());
+    ASSERT_EQ(directory.compare(0, _tempDir.size(), _tempDir), 0) << directory;
+
+    // The temporary directory is removed afterwards
+    std::string leftover;
+    ASSERT_NE(FileUtils::readToString(directory + "/" TEST_FILE, &leftover),
+              ErrorCode::NoError);
+}
+
+TEST_F(AutoPatcherTest, DefaultPatchContentsSkipsOtherFiles)
+{
+    AppendingPatcher patcher(&_pc);
+    std::string contents = "unchanged";
+
+    ASSERT_TRUE(patcher.patchContents("system/build.prop", &contents));
+    ASSERT_EQ(contents, "unchanged");
+    ASSERT_TRUE(patcher.directories.empty());
+}
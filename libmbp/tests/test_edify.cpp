@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "mbdevice/device.h"
+
+#include "mbp/autopatchers/standardpatcher.h"
+#include "mbp/edify/tokenizer.h"
+#include "mbp/fileinfo.h"
+
+using namespace mbp;
+
+// Unescaped string arguments of every function call, in order
+static std::vector<std::string> callArguments(const EdifyScript &script)
+{
+    std::vector<std::string> args;
+
+    for (auto const &call : script.calls()) {
+        for (auto i = call.leftParen + 1; i != call.rightParen; ++i) {
+            if (script.tokens()[i].type != EdifyTokenType::String) {
+                continue;
+            }
+
+            std::string arg;
+            EXPECT_TRUE(script.unescapedString(script.tokens()[i], &arg));
+            args.push_back(arg);
+        }
+    }
+
+    return args;
+}
+
+TEST(EdifyScriptTest, UnescapeKnownSequences)
+{
+    const std::string text =
+            "ui_print(\"a\\\"b\", \"\\\\\", \"\\n\\t\");\n"
+            "ui_print(\"\\x4a\\x4B\\x7e\\x00end\");\n";
+
+    EdifyScript script;
+    ASSERT_TRUE(script.load(text.data(), text.size()));
+
+    std::vector<std::string> expected{
+        "a\"b", "\\", "\n\t", std::string("JK~\0end", 7),
+    };
+    ASSERT_EQ(callArguments(script), expected);
+}
+
+TEST(EdifyScriptTest, KeepUnknownEscapesLiterally)
+{
+    const std::string text =
+            "run_program(\"/sbin/sh\", \"-c\", \"sed 's/\\./_/' \\$FILE\");\n"
+            "ui_print(\"\\xZZ\", \"\\x4\", \"\\q\");\n";
+
+    EdifyScript script;
+    ASSERT_TRUE(script.load(text.data(), text.size()));
+
+    std::vector<std::string> expected{
+        "/sbin/sh", "-c", "sed 's/\\./_/' \\$FILE",
+        "\\xZZ", "\\x4", "\\q",
+    };
+    ASSERT_EQ(callArguments(script), expected);
+}
+
+TEST(EdifyScriptTest, GenerateWithoutReplacementsIsIdentical)
+{
+    const std::string text =
+            "# Comment with \\ backslash\n"
+            "ifelse(is_mounted(\"/system\"), unmount(\"/system\"));\n"
+            "run_program(\"/sbin/sh\", \"-c\", \"echo \\\"\\$x\\\" | sed 's/\\./_/'\");\n"
+            "set_perm(0, 0, 0755, \"/tmp/a\\x20b\") || abort(\"fail\\q\");\n";
+
+    EdifyScript script;
+    ASSERT_TRUE(script.load(text.data(), text.size()));
+    ASSERT_EQ(script.generate(), text);
+}
+
+TEST(EdifyScriptTest, GenerateOnlyReplacesGivenCalls)
+{
+    const std::string text =
+            "a(\"\\.\"); b(c(\"x\")); d();\n";
+
+    EdifyScript script;
+    ASSERT_TRUE(script.load(text.data(), text.size()));
+    ASSERT_EQ(script.calls().size(), 4u);
+
+    // b() contains c(), so c() is replaced along with it
+    ASSERT_TRUE(script.replace(script.calls()[1], "B"));
+    ASSERT_TRUE(script.replace(script.calls()[3], "D"));
+    ASSERT_EQ(script.generate(), "a(\"\\.\"); B; D;\n");
+}
+
+struct StandardPatcherTest : testing::Test
+{
+    Device *_device;
+    FileInfo _info;
+
+    StandardPatcherTest()
+    {
+        const char *systemDevs[] = { "/dev/block/bootdevice/by-name/system", nullptr };
+        const char *cacheDevs[] = { "/dev/block/bootdevice/by-name/cache", nullptr };
+        const char *dataDevs[] = { "/dev/block/bootdevice/by-name/userdata", nullptr };
+
+        _device = mb_device_new();
+        mb_device_set_system_block_devs(_device, systemDevs);
+        mb_device_set_cache_block_devs(_device, cacheDevs);
+        mb_device_set_data_block_devs(_device, dataDevs);
+        _info.setDevice(_device);
+    }
+
+    virtual ~StandardPatcherTest()
+    {
+        mb_device_free(_device);
+    }
+};
+
+TEST_F(StandardPatcherTest, PatchScriptWithEscapes)
+{
+    std::string contents =
+            "run_program(\"/sbin/sh\", \"-c\", \"sed -i 's/\\.old$/.new/' /tmp/\\$x.prop\");\n"
+            "run_program(\"/sbin/busybox\", \"mount\", \"/sys\\x74em\");\n"
+            "delete_recursive(\"/cache\");\n"
+            "ui_print(\"quote \\\" and \\q\");\n";
+
+    const std::string expected =
+            "run_program(\"/sbin/sh\", \"-c\", \"sed -i 's/\\.old$/.new/' /tmp/\\$x.prop\");\n"
+            "(run_program(\"/update-binary-tool\", \"mount\", \"/system\") == 0);\n"
+            "(run_program(\"/update-binary-tool\", \"format\", \"/cache\") == 0);\n"
+            "ui_print(\"quote \\\" and \\q\");\n";
+
+    StandardPatcher patcher(nullptr, &_info);
+    ASSERT_TRUE(patcher.patchContents(StandardPatcher::UpdaterScript,
+                                      &contents));
+    ASSERT_EQ(contents, expected);
+}
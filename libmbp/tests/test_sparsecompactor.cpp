@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include <cstring>
+
+#include "mbsparse/sparse.h"
+
+#include "mbp/private/sparsecompactor.h"
+
+using namespace mbp;
+
+#define BLOCK_SIZE 16
+
+struct Chunk
+{
+    uint16_t type;
+    uint32_t blocks;
+};
+
+struct SparseCompactorTest : testing::Test
+{
+    std::vector<unsigned char> _input;
+    std::vector<unsigned char> _output;
+    // Expected contents of the expanded image
+    std::vector<unsigned char> _expected;
+    std::mt19937 _rng{1234};
+
+    uint32_t _extraFileHdr = 0;
+    uint32_t _extraChunkHdr = 0;
+    uint32_t _totalChunks = 0;
+
+    static bool cbWrite(const void *data, std::size_t size, void *userData)
+    {
+        auto *output = static_cast<std::vector<unsigned char> *>(userData);
+        auto ptr = static_cast<const unsigned char *>(data);
+        output->insert(output->end(), ptr, ptr + size);
+        return true;
+    }
+
+    void append(const void *data, std::size_t size)
+    {
+        auto ptr = static_cast<const unsigned char *>(data);
+        _input.insert(_input.end(), ptr, ptr + size);
+    }
+
+    void addChunkHeader(uint16_t type, uint32_t blocks, uint32_t dataSize)
+    {
+        ChunkHeader chdr;
+        memset(&chdr, 0, sizeof(chdr));
+        chdr.chunk_type = type;
+        chdr.chunk_sz = blocks;
+        chdr.total_sz = sizeof(ChunkHeader) + _extraChunkHdr + dataSize;
+        append(&chdr, sizeof(chdr));
+        _input.resize(_input.size() + _extraChunkHdr, 0xaa);
+        ++_totalChunks;
+    }
+
+    void addRaw(const std::vector<unsigned char> &data)
+    {
+        ASSERT_EQ(data.size() % BLOCK_SIZE, 0u);
+        addChunkHeader(CHUNK_TYPE_RAW, data.size() / BLOCK_SIZE, data.size());
+        append(data.data(), data.size());
+        _expected.insert(_expected.end(), data.begin(), data.end());
+    }
+
+    void addRandomRaw(uint32_t blocks)
+    {
+        std::vector<unsigned char> data(blocks * BLOCK_SIZE);
+        for (auto &c : data) {
+            c = static_cast<unsigned char>(_rng());
+        }
+        addRaw(data);
+    }
+
+    void addUniformRaw(uint32_t blocks, uint32_t value)
+    {
+        std::vector<unsigned char> data(blocks * BLOCK_SIZE);
+        for (std::size_t i = 0; i < data.size(); i += sizeof(value)) {
+            memcpy(data.data() + i, &value, sizeof(value));
+        }
+        addRaw(data);
+    }
+
+    void addFill(uint32_t blocks, uint32_t value)
+    {
+        addChunkHeader(CHUNK_TYPE_FILL, blocks, sizeof(value));
+        append(&value, sizeof(value));
+        for (std::size_t i = 0; i < blocks * BLOCK_SIZE; i += sizeof(value)) {
+            auto ptr = reinterpret_cast<const unsigned char *>(&value);
+            _expected.insert(_expected.end(), ptr, ptr + sizeof(value));
+        }
+    }
+
+    void addDontCare(uint32_t blocks)
+    {
+        addChunkHeader(CHUNK_TYPE_DONT_CARE, blocks, 0);
+        _expected.resize(_expected.size() + blocks * BLOCK_SIZE, 0);
+    }
+
+    void addCrc32()
+    {
+        uint32_t crc = 0x12345678;
+        addChunkHeader(CHUNK_TYPE_CRC32, 0, sizeof(crc));
+        append(&crc, sizeof(crc));
+    }
+
+    // Prepend the sparse header once all chunks have been added
+    void finishInput()
+    {
+        SparseHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = SPARSE_HEADER_MAGIC;
+        hdr.major_version = SPARSE_HEADER_MAJOR_VER;
+        hdr.file_hdr_sz = sizeof(SparseHeader) + _extraFileHdr;
+        hdr.chunk_hdr_sz = sizeof(ChunkHeader) + _extraChunkHdr;
+        hdr.blk_sz = BLOCK_SIZE;
+        hdr.total_blks = _expected.size() / BLOCK_SIZE;
+        hdr.total_chunks = _totalChunks;
+
+        std::vector<unsigned char> header(hdr.file_hdr_sz, 0xbb);
+        memcpy(header.data(), &hdr, sizeof(hdr));
+        _input.insert(_input.begin(), header.begin(), header.end());
+    }
+
+    // Feed the input to the compactor in pieces of the given size
+    bool compact(std::size_t pieceSize)
+    {
+        _output.clear();
+
+        SparseCompactor compactor(&cbWrite, &_output);
+
+        for (std::size_t i = 0; i < _input.size(); i += pieceSize) {
+            std::size_t n = std::min(pieceSize, _input.size() - i);
+            if (!compactor.write(_input.data() + i, n)) {
+                return false;
+            }
+        }
+
+        return compactor.finish();
+    }
+
+    std::vector<Chunk> outputChunks()
+    {
+        std::vector<Chunk> chunks;
+        SparseHeader hdr;
+        memcpy(&hdr, _output.data(), sizeof(hdr));
+
+        std::size_t pos = hdr.file_hdr_sz;
+        for (uint32_t i = 0; i < hdr.total_chunks; ++i) {
+            ChunkHeader chdr;
+            memcpy(&chdr, _output.data() + pos, sizeof(chdr));
+            chunks.push_back({ chdr.chunk_type, chdr.chunk_sz });
+            pos += chdr.total_sz;
+        }
+        EXPECT_EQ(pos, _output.size());
+
+        return chunks;
+    }
+
+    struct Reader
+    {
+        const std::vector<unsigned char> *data;
+        std::size_t pos;
+    };
+
+    static bool cbRead(void *buf, uint64_t size, uint64_t *bytesRead,
+                       void *userData)
+    {
+        Reader *reader = static_cast<Reader *>(userData);
+        uint64_t n = std::min<uint64_t>(
+                size, reader->data->size() - std::min(reader->pos,
+                                                      reader->data->size()));
+        memcpy(buf, reader->data->data() + reader->pos, n);
+        reader->pos += n;
+        *bytesRead = n;
+        return true;
+    }
+
+    static bool cbSeek(int64_t offset, int whence, void *userData)
+    {
+        Reader *reader = static_cast<Reader *>(userData);
+        switch (whence) {
+        case SEEK_SET:
+            reader->pos = offset;
+            return true;
+        case SEEK_CUR:
+            reader->pos += offset;
+            return true;
+        case SEEK_END:
+            reader->pos = reader->data->size() + offset;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Expand a sparse image with libmbsparse
+    static bool expand(const std::vector<unsigned char> &image,
+                       std::vector<unsigned char> *out)
+    {
+        Reader reader{ &image, 0 };
+        SparseCtx *ctx = sparseCtxNew();
+        bool ret = sparseOpen(ctx, nullptr, nullptr, &cbRead, &cbSeek,
+                              nullptr, &reader);
+
+        out->clear();
+
+        unsigned char buf[37];
+        uint64_t n;
+        while (ret && (ret = sparseRead(ctx, buf, sizeof(buf), &n)) && n > 0) {
+            out->insert(out->end(), buf, buf + n);
+        }
+
+        sparseCtxFree(ctx);
+        return ret;
+    }
+
+    void checkOutput(const std::vector<Chunk> &expectedChunks)
+    {
+        std::vector<unsigned char> expanded;
+        ASSERT_TRUE(expand(_input, &expanded));
+        ASSERT_EQ(expanded, _expected);
+
+        for (std::size_t pieceSize : { 1, 7, 4096, 1 << 20 }) {
+            ASSERT_TRUE(compact(pieceSize)) << pieceSize;
+
+            SparseHeader hdr;
+            ASSERT_GE(_output.size(), sizeof(hdr));
+            memcpy(&hdr, _output.data(), sizeof(hdr));
+            ASSERT_EQ(hdr.file_hdr_sz, sizeof(SparseHeader));
+            ASSERT_EQ(hdr.chunk_hdr_sz, sizeof(ChunkHeader));
+            ASSERT_EQ(hdr.total_chunks, _totalChunks);
+
+            auto chunks = outputChunks();
+            ASSERT_EQ(chunks.size(), expectedChunks.size());
+            for (std::size_t i = 0; i < chunks.size(); ++i) {
+                ASSERT_EQ(chunks[i].type, expectedChunks[i].type) << i;
+                ASSERT_EQ(chunks[i].blocks, expectedChunks[i].blocks) << i;
+            }
+
+            ASSERT_TRUE(expand(_output, &expanded)) << pieceSize;
+            ASSERT_EQ(expanded, _expected) << pieceSize;
+        }
+    }
+};
+
+TEST_F(SparseCompactorTest, MergeDontCareChunks)
+{
+    addDontCare(2);
+    addDontCare(3);
+    addRandomRaw(2);
+    addDontCare(1);
+    addDontCare(4);
+    finishInput();
+
+    checkOutput({
+        { CHUNK_TYPE_DONT_CARE, 5 },
+        { CHUNK_TYPE_RAW, 2 },
+        { CHUNK_TYPE_DONT_CARE, 5 },
+        { CHUNK_TYPE_DONT_CARE, 0 },
+        { CHUNK_TYPE_DONT_CARE, 0 },
+    });
+}
+
+TEST_F(SparseCompactorTest, MergeFillChunksWithSameValue)
+{
+    addFill(2, 0x11223344);
+    addFill(1, 0x11223344);
+    addFill(3, 0x55667788);
+    addFill(1, 0x11223344);
+    finishInput();
+
+    checkOutput({
+        { CHUNK_TYPE_FILL, 3 },
+        { CHUNK_TYPE_FILL, 3 },
+        { CHUNK_TYPE_FILL, 1 },
+        { CHUNK_TYPE_DONT_CARE, 0 },
+    });
+}
+
+TEST_F(SparseCompactorTest, ConvertUniformRawChunksToFill)
+{
+    addUniformRaw(2, 0xdeadbeef);
+    addFill(1, 0xdeadbeef);
+    addUniformRaw(1, 0);
+    addRandomRaw(1);
+    finishInput();
+
+    checkOutput({
+        { CHUNK_TYPE_FILL, 3 },
+        { CHUNK_TYPE_FILL, 1 },
+        { CHUNK_TYPE_RAW, 1 },
+        { CHUNK_TYPE_DONT_CARE, 0 },
+    });
+}
+
+TEST_F(SparseCompactorTest, KeepRawChunksThatAreNotUniform)
+{
+    // Only the last byte differs, so the matched prefix has to be written out
+    // once the mismatch is found
+    std::vector<unsigned char> data(4 * BLOCK_SIZE, 0x5a);
+    data.back() = 0xa5;
+    addRaw(data);
+    // Mismatch within the first 32 bits
+    data.assign(BLOCK_SIZE, 0x5a);
+    data[1] = 0;
+    addRaw(data);
+    finishInput();
+
+    checkOutput({
+        { CHUNK_TYPE_RAW, 4 },
+        { CHUNK_TYPE_RAW, 1 },
+    });
+}
+
+TEST_F(SparseCompactorTest, DropCrc32Chunks)
+{
+    addRandomRaw(1);
+    addCrc32();
+    addDontCare(2);
+    addCrc32();
+    addDontCare(1);
+    finishInput();
+
+    checkOutput({
+        { CHUNK_TYPE_RAW, 1 },
+        { CHUNK_TYPE_DONT_CARE, 3 },
+        { CHUNK_TYPE_DONT_CARE, 0 },
+        { CHUNK_TYPE_DONT_CARE, 0 },
+        { CHUNK_TYPE_DONT_CARE, 0 },
+    });
+}
+
+TEST_F(SparseCompactorTest, DropExtraHeaderBytes)
+{
+    _extraFileHdr = 12;
+    _extraChunkHdr = 8;
+
+    addRandomRaw(3);
+    addFill(2, 0x01020304);
+    addCrc32();
+    addDontCare(1);
+    finishInput();
+
+    checkOutput({
+        { CHUNK_TYPE_RAW, 3 },
+        { CHUNK_TYPE_FILL, 2 },
+        { CHUNK_TYPE_DONT_CARE, 1 },
+        { CHUNK_TYPE_DONT_CARE, 0 },
+    });
+}
+
+TEST_F(SparseCompactorTest, SeekInCompactedImage)
+{
+    addDontCare(2);
+    addUniformRaw(2, 0x0badf00d);
+    addRandomRaw(3);
+    addFill(1, 0x0badf00d);
+    addDontCare(1);
+    addDontCare(2);
+    finishInput();
+
+    ASSERT_TRUE(compact(1 << 20));
+
+    Reader reader{ &_output, 0 };
+    SparseCtx *ctx = sparseCtxNew();
+    ASSERT_TRUE(sparseOpen(ctx, nullptr, nullptr, &cbRead, &cbSeek, nullptr,
+                           &reader));
+
+    uint64_t size;
+    ASSERT_TRUE(sparseSize(ctx, &size));
+    ASSERT_EQ(size, _expected.size());
+
+    // Read backwards one block at a time, which seeks into every chunk
+    // including the empty ones at the end
+    unsigned char buf[BLOCK_SIZE];
+    uint64_t n;
+    for (std::size_t block = _expected.size() / BLOCK_SIZE; block-- > 0;) {
+        ASSERT_TRUE(sparseSeek(ctx, block * BLOCK_SIZE, SEEK_SET));
+        ASSERT_TRUE(sparseRead(ctx, buf, sizeof(buf), &n));
+        ASSERT_EQ(n, sizeof(buf));
+        ASSERT_EQ(memcmp(buf, _expected.data() + block * BLOCK_SIZE,
+                         sizeof(buf)), 0) << block;
+    }
+
+    ASSERT_TRUE(sparseSeek(ctx, 0, SEEK_END));
+    ASSERT_TRUE(sparseRead(ctx, buf, sizeof(buf), &n));
+    ASSERT_EQ(n, 0u);
+
+    sparseCtxFree(ctx);
+}
+
+TEST_F(SparseCompactorTest, RejectTruncatedImage)
+{
+    addRandomRaw(2);
+    addDontCare(1);
+    finishInput();
+
+    _input.resize(_input.size() - sizeof(ChunkHeader) / 2);
+    ASSERT_FALSE(compact(1 << 20));
+}
+
+TEST_F(SparseCompactorTest, RejectChunksCoveringTooManyBlocks)
+{
+    addRandomRaw(2);
+    finishInput();
+
+    SparseHeader hdr;
+    memcpy(&hdr, _input.data(), sizeof(hdr));
+    hdr.total_blks = 1;
+    memcpy(_input.data(), &hdr, sizeof(hdr));
+
+    ASSERT_FALSE(compact(1 << 20));
+}
+
+TEST_F(SparseCompactorTest, RejectInvalidMagic)
+{
+    addDontCare(1);
+    finishInput();
+
+    _input[0] ^= 0xff;
+    ASSERT_FALSE(compact(1 << 20));
+}
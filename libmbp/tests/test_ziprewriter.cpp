@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/filename.h"
+
+#include "mbpio/delete.h"
+
+#include "mbp/private/fileutils.h"
+#include "mbp/private/miniziputils.h"
+#include "mbp/private/ziprewriter.h"
+
+using namespace mbp;
+
+// Slightly larger than 4 GiB, so the entry needs zip64 extra fields
+#define ZIP64_ENTRY_SIZE ((1ull << 32) + 4096)
+
+struct UnzippedEntry
+{
+    std::string name;
+    uint32_t crc32;
+    uint64_t size;
+    // Only filled in for entries that fit in memory
+    std::string data;
+};
+
+struct ZipRewriterTest : testing::Test
+{
+    std::string _dir;
+    std::string _input;
+    std::string _output;
+    volatile bool _cancelled = false;
+
+    virtual void SetUp()
+    {
+        _dir = FileUtils::createTemporaryDir(FileUtils::systemTemporaryDir());
+        ASSERT_FALSE(_dir.empty());
+
+        _input = _dir + "/input.zip";
+        _output = _dir + "/output.zip";
+    }
+
+    virtual void TearDown()
+    {
+        if (!_dir.empty()) {
+            io::deleteRecursively(_dir);
+        }
+    }
+
+    void createZip(const std::string &path, bool append,
+                   const std::vector<std::pair<std::string, std::string>> &files)
+    {
+        MinizipUtils::ZipCtx *ctx = MinizipUtils::openOutputFile(path, append);
+        ASSERT_TRUE(ctx);
+        zipFile zf = MinizipUtils::ctxGetZipFile(ctx);
+
+        for (auto const &file : files) {
+            std::vector<unsigned char> contents(file.second.begin(),
+                                                file.second.end());
+            ASSERT_EQ(MinizipUtils::addFile(zf, file.first, contents),
+                      ErrorCode::NoError);
+        }
+
+        ASSERT_EQ(MinizipUtils::closeOutputFile(ctx), ZIP_OK);
+    }
+
+    // Reads every entry with minizip, which checks the local headers and CRCs
+    void unzipAll(const std::string &path, std::vector<UnzippedEntry> *entries)
+    {
+        MinizipUtils::UnzCtx *ctx = MinizipUtils::openInputFile(path);
+        ASSERT_TRUE(ctx);
+        unzFile uf = MinizipUtils::ctxGetUnzFile(ctx);
+
+        entries->clear();
+
+        int ret = unzGoToFirstFile(uf);
+        while (ret == UNZ_OK) {
+            unz_file_info64 fi;
+            UnzippedEntry entry;
+
+            ASSERT_TRUE(MinizipUtils::getInfo(uf, &fi, &entry.name));
+            entry.crc32 = fi.crc;
+            entry.size = 0;
+
+            ASSERT_EQ(unzOpenCurrentFile(uf), UNZ_OK);
+
+            uLong crc = crc32(0, nullptr, 0);
+            char buf[32768];
+            int n;
+
+            while ((n = unzReadCurrentFile(uf, buf, sizeof(buf))) > 0) {
+                crc = crc32(crc, reinterpret_cast<Bytef *>(buf), n);
+                entry.size += n;
+                if (fi.uncompressed_size <= 1024 * 1024) {
+                    entry.data.append(buf, n);
+                }
+            }
+            ASSERT_EQ(n, 0);
+            ASSERT_EQ(unzCloseCurrentFile(uf), UNZ_OK) << entry.name;
+            ASSERT_EQ(crc, entry.crc32) << entry.name;
+            ASSERT_EQ(entry.size, fi.uncompressed_size) << entry.name;
+
+            entries->push_back(std::move(entry));
+
+            ret = unzGoToNextFile(uf);
+        }
+        ASSERT_EQ(ret, UNZ_END_OF_LIST_OF_FILE);
+
+        ASSERT_EQ(MinizipUtils::closeInputFile(ctx), UNZ_OK);
+    }
+
+    // Rewrites the input, appends a file with minizip, and checks that the
+    // rewritten entries are unchanged in the central directory minizip wrote
+    void rewriteAndAppend(std::vector<ZipRewriter::Entry> *entries)
+    {
+        ASSERT_EQ(ZipRewriter::copyEntries(_input, _output, entries,
+                                           nullptr, nullptr, &_cancelled),
+                  ErrorCode::NoError);
+
+        ASSERT_NO_FATAL_FAILURE(createZip(
+                _output, true, { { "appended.txt", "appended" } }));
+
+        std::vector<ZipRewriter::Entry> result;
+        ASSERT_EQ(ZipRewriter::readCentralDirectory(_output, &result),
+                  ErrorCode::NoError);
+        ASSERT_EQ(result.size(), entries->size() + 1);
+
+        for (size_t i = 0; i < entries->size(); ++i) {
+            const ZipRewriter::Entry &expected = (*entries)[i];
+            ASSERT_EQ(result[i].name, expected.outputName);
+            ASSERT_EQ(result[i].crc32, expected.crc32);
+            ASSERT_EQ(result[i].method, expected.method);
+            ASSERT_EQ(result[i].compressedSize, expected.compressedSize);
+            ASSERT_EQ(result[i].uncompressedSize, expected.uncompressedSize);
+            ASSERT_EQ(result[i].inputOffset, expected.outputOffset);
+        }
+        ASSERT_EQ(result.back().name, "appended.txt");
+    }
+};
+
+TEST_F(ZipRewriterTest, RoundTripSmallEntries)
+{
+    std::string random(256 * 1024, '\0');
+    std::mt19937 rng(1234);
+    for (char &c : random) {
+        c = static_cast<char>(rng());
+    }
+
+    ASSERT_NO_FATAL_FAILURE(createZip(_input, false, {
+        { "META-INF/com/google/android/updater-script", "ui_print(\"a\");\n" },
+        { "system/random.bin", random },
+        { "empty", "" },
+    }));
+
+    std::vector<ZipRewriter::Entry> entries;
+    ASSERT_EQ(ZipRewriter::readCentralDirectory(_input, &entries),
+              ErrorCode::NoError);
+    ASSERT_EQ(entries.size(), 3u);
+    ASSERT_EQ(entries[0].name, "META-INF/com/google/android/updater-script");
+    ASSERT_EQ(entries[1].name, "system/random.bin");
+    ASSERT_EQ(entries[2].name, "empty");
+
+    // Drop the first entry and rename another, like the patchers do
+    entries.erase(entries.begin());
+    entries[0].outputName = "system/renamed.bin";
+
+    ASSERT_NO_FATAL_FAILURE(rewriteAndAppend(&entries));
+
+    std::vector<UnzippedEntry> unzipped;
+    ASSERT_NO_FATAL_FAILURE(unzipAll(_output, &unzipped));
+    ASSERT_EQ(unzipped.size(), 3u);
+    ASSERT_EQ(unzipped[0].name, "system/renamed.bin");
+    ASSERT_EQ(unzipped[0].data, random);
+    ASSERT_EQ(unzipped[1].name, "empty");
+    ASSERT_EQ(unzipped[1].data, "");
+    ASSERT_EQ(unzipped[2].name, "appended.txt");
+    ASSERT_EQ(unzipped[2].data, "appended");
+}
+
+TEST_F(ZipRewriterTest, RoundTripZip64Entry)
+{
+    // The file is sparse, so this only takes space in the compressed form
+    std::string bigPath = _dir + "/big.img";
+    {
+        MbFile *file = mb_file_new();
+        ASSERT_TRUE(file);
+        ASSERT_EQ(mb_file_open_filename(file, bigPath.c_str(),
+                                        MB_FILE_OPEN_WRITE_ONLY), MB_FILE_OK);
+        ASSERT_EQ(mb_file_truncate(file, ZIP64_ENTRY_SIZE), MB_FILE_OK);
+        ASSERT_EQ(mb_file_close(file), MB_FILE_OK);
+        mb_file_free(file);
+    }
+
+    {
+        MinizipUtils::ZipCtx *ctx = MinizipUtils::openOutputFile(_input);
+        ASSERT_TRUE(ctx);
+        zipFile zf = MinizipUtils::ctxGetZipFile(ctx);
+        std::vector<unsigned char> small{ 's', 'm', 'a', 'l', 'l' };
+
+        ASSERT_EQ(MinizipUtils::addFile(zf, "small.txt", small),
+                  ErrorCode::NoError);
+        ASSERT_EQ(MinizipUtils::addFile(zf, "big.img", bigPath),
+                  ErrorCode::NoError);
+        ASSERT_EQ(MinizipUtils::addFile(zf, "after.txt", small),
+                  ErrorCode::NoError);
+        ASSERT_EQ(MinizipUtils::closeOutputFile(ctx), ZIP_OK);
+    }
+
+    std::vector<ZipRewriter::Entry> entries;
+    ASSERT_EQ(ZipRewriter::readCentralDirectory(_input, &entries),
+              ErrorCode::NoError);
+    ASSERT_EQ(entries.size(), 3u);
+    ASSERT_EQ(entries[1].name, "big.img");
+    ASSERT_EQ(entries[1].uncompressedSize, ZIP64_ENTRY_SIZE);
+
+    ASSERT_NO_FATAL_FAILURE(rewriteAndAppend(&entries));
+
+    std::vector<UnzippedEntry> unzipped;
+    ASSERT_NO_FATAL_FAILURE(unzipAll(_output, &unzipped));
+    ASSERT_EQ(unzipped.size(), 4u);
+    ASSERT_EQ(unzipped[0].name, "small.txt");
+    ASSERT_EQ(unzipped[0].data, "small");
+    ASSERT_EQ(unzipped[1].name, "big.img");
+    ASSERT_EQ(unzipped[1].size, ZIP64_ENTRY_SIZE);
+    ASSERT_EQ(unzipped[2].name, "after.txt");
+    ASSERT_EQ(unzipped[2].data, "small");
+    ASSERT_EQ(unzipped[3].name, "appended.txt");
+    ASSERT_EQ(unzipped[3].data, "appended");
+}
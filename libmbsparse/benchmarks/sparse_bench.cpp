@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Throughput of expanding a sparse image and of seeking around in the
+// expanded data. The sparse image is kept in memory and is made of a
+// reproducible mix of raw, fill, and don't care chunks, like the system images
+// that the patcher and mbtool read.
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+#include <benchmark/benchmark.h>
+
+#include "mblog/base_logger.h"
+#include "mblog/logging.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_header.h"
+
+#define BLOCK_SIZE      4096
+#define TOTAL_CHUNKS    1024
+#define MAX_CHUNK_BLKS  32
+#define READ_SIZE       (64 * 1024)
+#define SEEK_READ_SIZE  4096
+#define SEEKS           1024
+
+struct SparseImage
+{
+    std::vector<unsigned char> data;
+    uint64_t expanded_size;
+};
+
+struct Source
+{
+    const std::vector<unsigned char> *data;
+    size_t pos;
+};
+
+// libmbsparse logs every chunk header that it parses. Discard the messages so
+// that the benchmarks don't measure the logger.
+class DiscardLogger : public mb::log::BaseLogger
+{
+public:
+    virtual void log(mb::log::LogLevel prio, const char *fmt,
+                     va_list ap) override
+    {
+        (void) prio;
+        (void) fmt;
+        (void) ap;
+    }
+};
+
+static void append(std::vector<unsigned char> &data, const void *buf,
+                   size_t size)
+{
+    auto const *ptr = static_cast<const unsigned char *>(buf);
+    data.insert(data.end(), ptr, ptr + size);
+}
+
+// std::mt19937 is specified exactly by the standard, so the inputs are the
+// same on every platform and across releases
+static const SparseImage & sparse_image()
+{
+    static SparseImage image;
+
+    if (!image.data.empty()) {
+        return image;
+    }
+
+    mb::log::log_set_logger(std::make_shared<DiscardLogger>());
+
+    std::mt19937 gen(6);
+    std::vector<unsigned char> chunks;
+    uint32_t total_blks = 0;
+
+    for (int i = 0; i < TOTAL_CHUNKS; ++i) {
+        ChunkHeader chdr;
+        memset(&chdr, 0, sizeof(chdr));
+        chdr.chunk_sz = 1 + gen() % MAX_CHUNK_BLKS;
+
+        switch (gen() % 4) {
+        case 0:
+        case 1:
+            chdr.chunk_type = CHUNK_TYPE_RAW;
+            chdr.total_sz = sizeof(chdr) + chdr.chunk_sz * BLOCK_SIZE;
+            append(chunks, &chdr, sizeof(chdr));
+            for (uint32_t j = 0; j < chdr.chunk_sz * BLOCK_SIZE; ++j) {
+                chunks.push_back(static_cast<unsigned char>(gen()));
+            }
+            break;
+        case 2: {
+            uint32_t fill_val = gen();
+            chdr.chunk_type = CHUNK_TYPE_FILL;
+            chdr.total_sz = sizeof(chdr) + sizeof(fill_val);
+            append(chunks, &chdr, sizeof(chdr));
+            append(chunks, &fill_val, sizeof(fill_val));
+            break;
+        }
+        case 3:
+            chdr.chunk_type = CHUNK_TYPE_DONT_CARE;
+            chdr.total_sz = sizeof(chdr);
+            append(chunks, &chdr, sizeof(chdr));
+            break;
+        }
+
+        total_blks += chdr.chunk_sz;
+    }
+
+    SparseHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SPARSE_HEADER_MAGIC;
+    hdr.major_version = SPARSE_HEADER_MAJOR_VER;
+    hdr.minor_version = 0;
+    hdr.file_hdr_sz = sizeof(SparseHeader);
+    hdr.chunk_hdr_sz = sizeof(ChunkHeader);
+    hdr.blk_sz = BLOCK_SIZE;
+    hdr.total_blks = total_blks;
+    hdr.total_chunks = TOTAL_CHUNKS;
+    hdr.image_checksum = 0;
+
+    append(image.data, &hdr, sizeof(hdr));
+    image.data.insert(image.data.end(), chunks.begin(), chunks.end());
+    image.expanded_size = static_cast<uint64_t>(total_blks) * BLOCK_SIZE;
+
+    return image;
+}
+
+static bool cb_read(void *buf, uint64_t size, uint64_t *bytes_read,
+                    void *userdata)
+{
+    Source *src = static_cast<Source *>(userdata);
+    uint64_t n = std::min<uint64_t>(size, src->data->size() - src->pos);
+    memcpy(buf, src->data->data() + src->pos, n);
+    src->pos += n;
+    *bytes_read = n;
+    return true;
+}
+
+static bool cb_seek(int64_t offset, int whence, void *userdata)
+{
+    Source *src = static_cast<Source *>(userdata);
+    int64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = src->pos;
+        break;
+    case SEEK_END:
+        base = src->data->size();
+        break;
+    default:
+        return false;
+    }
+
+    if (base + offset < 0
+            || static_cast<uint64_t>(base + offset) > src->data->size()) {
+        return false;
+    }
+    src->pos = base + offset;
+    return true;
+}
+
+static bool open_sparse(SparseCtx *ctx, Source *src)
+{
+    src->data = &sparse_image().data;
+    src->pos = 0;
+    return sparseOpen(ctx, nullptr, nullptr, &cb_read, &cb_seek, nullptr, src);
+}
+
+static void BM_SparseExpand(benchmark::State &state)
+{
+    const SparseImage &image = sparse_image();
+    std::vector<unsigned char> buf(READ_SIZE);
+    uint64_t total = 0;
+
+    for (auto _ : state) {
+        SparseCtx *ctx = sparseCtxNew();
+        Source src;
+        uint64_t n;
+
+        total = 0;
+
+        if (!open_sparse(ctx, &src)) {
+            state.SkipWithError("Failed to open sparse image");
+            sparseCtxFree(ctx);
+            break;
+        }
+
+        while (sparseRead(ctx, buf.data(), buf.size(), &n) && n > 0) {
+            total += n;
+        }
+
+        sparseCtxFree(ctx);
+    }
+
+    if (total != image.expanded_size) {
+        state.SkipWithError("Expanded size does not match");
+    }
+
+    state.SetBytesProcessed(state.iterations() * image.expanded_size);
+}
+BENCHMARK(BM_SparseExpand)->Unit(benchmark::kMillisecond);
+
+// Arg: 0 for ascending offsets, 1 for descending offsets, 2 for random
+// offsets. Each iteration is one seek followed by a small read.
+static void BM_SparseSeek(benchmark::State &state)
+{
+    const SparseImage &image = sparse_image();
+    std::vector<unsigned char> buf(SEEK_READ_SIZE);
+    std::vector<uint64_t> offsets(SEEKS);
+    uint64_t max_offset = image.expanded_size - SEEK_READ_SIZE;
+
+    std::mt19937_64 gen(7);
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        switch (state.range(0)) {
+        case 0:
+            offsets[i] = max_offset / SEEKS * i;
+            break;
+        case 1:
+            offsets[i] = max_offset / SEEKS * (SEEKS - 1 - i);
+            break;
+        default:
+            offsets[i] = gen() % max_offset;
+            break;
+        }
+    }
+
+    SparseCtx *ctx = sparseCtxNew();
+    Source src;
+    size_t i = 0;
+    uint64_t n;
+
+    if (!open_sparse(ctx, &src)) {
+        state.SkipWithError("Failed to open sparse image");
+        sparseCtxFree(ctx);
+        return;
+    }
+
+    for (auto _ : state) {
+        if (!sparseSeek(ctx, offsets[i], SEEK_SET)
+                || !sparseRead(ctx, buf.data(), buf.size(), &n)) {
+            state.SkipWithError("Failed to seek and read");
+            break;
+        }
+        i = (i + 1) % offsets.size();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * SEEK_READ_SIZE);
+    sparseCtxFree(ctx);
+}
+BENCHMARK(BM_SparseSeek)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(2);
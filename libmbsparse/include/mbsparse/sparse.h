@@ -56,6 +56,7 @@ MB_EXPORT bool sparseRead(struct SparseCtx *ctx, void *buf, uint64_t size,
 MB_EXPORT bool sparseSeek(struct SparseCtx *ctx, int64_t offset, int whence);
 MB_EXPORT bool sparseTell(struct SparseCtx *ctx, uint64_t *offset);
 MB_EXPORT bool sparseSize(struct SparseCtx *ctx, uint64_t *size);
+MB_EXPORT bool sparseSkipHole(struct SparseCtx *ctx, uint64_t *skipped);
 
 #ifdef __cplusplus
 }
@@ -434,10 +434,14 @@ static bool processCrc32Chunk(SparseCtx *ctx, ChunkHeader *chunkHeader,
         return false;
     }
 
+    uint64_t srcBegin = ctx->srcOffset - ctx->shdr.chunk_hdr_sz;
+
     if (!readFully(ctx, &expectedCrc32, sizeof(expectedCrc32))) {
         return false;
     }
 
+    uint64_t srcEnd = ctx->srcOffset;
+
     ctx->expectedCrc32 = expectedCrc32;
 
     ctx->chunks.emplace_back();
@@ -445,8 +449,8 @@ static bool processCrc32Chunk(SparseCtx *ctx, ChunkHeader *chunkHeader,
     chunk.type = chunkHeader->chunk_type;
     chunk.begin = outOffset;
     chunk.end = outOffset;
-    chunk.srcBegin = ctx->srcOffset - ctx->shdr.chunk_hdr_sz;
-    chunk.srcEnd = ctx->srcOffset + dataSize;
+    chunk.srcBegin = srcBegin;
+    chunk.srcEnd = srcEnd;
 
     return true;
 }
@@ -1049,4 +1053,47 @@ bool sparseSize(SparseCtx *ctx, uint64_t *size)
     return true;
 }
 
+/*!
+ * \brief Skip over the "don't care" chunk at the current position
+ *
+ * If the sparse file pointer is inside a "don't care" chunk, it is moved to the
+ * end of the chunk without producing any data. This allows callers that write
+ * the sparse file to a block device to leave those regions untouched instead
+ * of filling them with zeros. Unlike \a sparseSeek(), this does not require a
+ * seek callback.
+ *
+ * \param ctx Sparse context
+ * \param skipped Output pointer for the number of bytes that were skipped. This
+ *                is 0 if the current position is not in a "don't care" chunk.
+ * \return True unless the file is not open or an error occurs
+ */
+bool sparseSkipHole(SparseCtx *ctx, uint64_t *skipped)
+{
+    if (!ctx->isOpen) {
+        return false;
+    }
+
+    OPER("skipHole(*skipped)");
+
+    *skipped = 0;
+
+    if (!tryMoveToChunkForOffset(ctx, ctx->outOffset)) {
+        return false;
+    }
+
+    if (ctx->chunk == ctx->shdr.total_chunks) {
+        OPER("- Found EOF");
+        return true;
+    }
+
+    const ChunkInfo &chunk = ctx->chunks[ctx->chunk];
+    if (chunk.type == CHUNK_TYPE_DONT_CARE && ctx->outOffset >= chunk.begin) {
+        *skipped = chunk.end - ctx->outOffset;
+        ctx->outOffset = chunk.end;
+    }
+
+    OPER("- Skipped %" PRIu64 " bytes", *skipped);
+    return true;
+}
+
 }
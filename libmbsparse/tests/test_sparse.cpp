@@ -115,6 +115,11 @@ struct SparseTest : testing::Test
         return ::sparseTell(_ctx, offset);
     }
 
+    bool sparseSkipHole(uint64_t *skipped)
+    {
+        return ::sparseSkipHole(_ctx, skipped);
+    }
+
     void buildDataHeaderProperSized()
     {
         SparseHeader hdr;
@@ -377,6 +382,37 @@ TEST_F(SparseTest, ReadValidSparseFileNoSeek)
     ASSERT_TRUE(sparseClose());
 }
 
+TEST_F(SparseTest, SkipHoleNoSeek)
+{
+    char buf[1024];
+    uint64_t bytesRead;
+    uint64_t skipped;
+    uint64_t pos;
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseOpenNoSeek());
+
+    // Check that nothing is skipped outside of a "don't care" chunk
+    ASSERT_TRUE(sparseSkipHole(&skipped));
+    ASSERT_EQ(skipped, 0);
+    ASSERT_TRUE(sparseRead(buf, 32, &bytesRead));
+    ASSERT_EQ(bytesRead, 32);
+
+    // Check that the "don't care" chunk is skipped without reading
+    ASSERT_TRUE(sparseSkipHole(&skipped));
+    ASSERT_EQ(skipped, 16);
+    ASSERT_TRUE(sparseTell(&pos));
+    ASSERT_EQ(pos, 48);
+
+    // Check that nothing is skipped at EOF
+    ASSERT_TRUE(sparseSkipHole(&skipped));
+    ASSERT_EQ(skipped, 0);
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 0);
+
+    ASSERT_TRUE(sparseClose());
+}
+
 int main(int argc, char *argv[])
 {
     testing::InitGoogleTest(&argc, argv);
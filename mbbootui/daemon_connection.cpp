@@ -18,6 +18,7 @@
 #include "daemon_connection.h"
 
 #include <cstring>
+#include <memory>
 
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -48,6 +49,8 @@
 // Singleton
 MbtoolConnection mbtool_connection;
 MbtoolInterface *mbtool_interface = nullptr;
+// Must be destroyed before the connection it uses
+MbtoolClient mbtool_client;
 
 namespace v3 = mbtool::daemon::v3;
 namespace fb = flatbuffers;
@@ -425,3 +428,253 @@ MbtoolInterface * MbtoolConnection::interface()
 {
     return _iface;
 }
+
+MbtoolClient::MbtoolClient()
+    : _iface(nullptr)
+    , _started(false)
+    , _stopping(false)
+    , _active(0)
+    , _have_booted_rom_id(false)
+    , _have_installed_roms(false)
+{
+}
+
+MbtoolClient::~MbtoolClient()
+{
+    stop();
+}
+
+bool MbtoolClient::start(MbtoolInterface *iface)
+{
+    if (_started) {
+        return true;
+    }
+
+    _iface = iface;
+    _stopping = false;
+
+    int ret = pthread_create(&_thread, nullptr, &worker_thread, this);
+    if (ret != 0) {
+        LOGW("Failed to start mbtool request thread: %s", strerror(ret));
+        return false;
+    }
+
+    _started = true;
+    return true;
+}
+
+void MbtoolClient::stop()
+{
+    if (!_started) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _stopping = true;
+    }
+    _cond.notify_all();
+
+    pthread_join(_thread, nullptr);
+    _started = false;
+}
+
+void * MbtoolClient::worker_thread(void *cookie)
+{
+    static_cast<MbtoolClient *>(cookie)->run_requests();
+    return nullptr;
+}
+
+void MbtoolClient::run_requests()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+
+    for (;;) {
+        _cond.wait(lock, [this]{
+            return _stopping || !_requests.empty();
+        });
+
+        // Finish queued requests before exiting so that nothing waiting in
+        // call() is left hanging
+        if (_requests.empty()) {
+            break;
+        }
+
+        Request request = std::move(_requests.front());
+        _requests.pop_front();
+        ++_active;
+
+        lock.unlock();
+        request(_iface);
+        lock.lock();
+
+        --_active;
+    }
+}
+
+void MbtoolClient::post(Request request)
+{
+    if (!_started) {
+        request(_iface);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _requests.push_back(std::move(request));
+    }
+    _cond.notify_all();
+}
+
+void MbtoolClient::call(const Request &request)
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+
+    post([&](MbtoolInterface *iface) {
+        request(iface);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cond.notify_all();
+    });
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&]{ return done; });
+}
+
+void MbtoolClient::post_callback(Callback callback)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _callbacks.push_back(std::move(callback));
+}
+
+size_t MbtoolClient::dispatch_callbacks()
+{
+    std::deque<Callback> callbacks;
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        callbacks.swap(_callbacks);
+    }
+
+    // Callbacks may queue new requests, so run them without holding the lock
+    for (auto const &callback : callbacks) {
+        callback();
+    }
+
+    return callbacks.size();
+}
+
+bool MbtoolClient::busy()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return !_requests.empty() || _active > 0 || !_callbacks.empty();
+}
+
+bool MbtoolClient::fetch_booted_rom_id(MbtoolInterface *iface,
+                                       std::string *result)
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (_have_booted_rom_id) {
+            *result = _booted_rom_id;
+            return true;
+        }
+    }
+
+    if (!iface->get_booted_rom_id(result)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_lock);
+    _booted_rom_id = *result;
+    _have_booted_rom_id = true;
+    return true;
+}
+
+bool MbtoolClient::fetch_installed_roms(MbtoolInterface *iface,
+                                        std::vector<Rom> *result)
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (_have_installed_roms) {
+            *result = _installed_roms;
+            return true;
+        }
+    }
+
+    if (!iface->get_installed_roms(result)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_lock);
+    _installed_roms = *result;
+    _have_installed_roms = true;
+    return true;
+}
+
+void MbtoolClient::get_booted_rom_id(BootedRomIdCallback callback)
+{
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        if (_have_booted_rom_id) {
+            std::string rom_id = _booted_rom_id;
+            lock.unlock();
+            callback(true, rom_id);
+            return;
+        }
+    }
+
+    post([this, callback](MbtoolInterface *iface) {
+        auto rom_id = std::make_shared<std::string>();
+        bool ok = fetch_booted_rom_id(iface, rom_id.get());
+
+        post_callback([callback, ok, rom_id]{
+            callback(ok, *rom_id);
+        });
+    });
+}
+
+void MbtoolClient::get_installed_roms(InstalledRomsCallback callback)
+{
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        if (_have_installed_roms) {
+            std::vector<Rom> roms = _installed_roms;
+            lock.unlock();
+            callback(true, roms);
+            return;
+        }
+    }
+
+    post([this, callback](MbtoolInterface *iface) {
+        auto roms = std::make_shared<std::vector<Rom>>();
+        bool ok = fetch_installed_roms(iface, roms.get());
+
+        post_callback([callback, ok, roms]{
+            callback(ok, *roms);
+        });
+    });
+}
+
+bool MbtoolClient::get_booted_rom_id(std::string *result)
+{
+    bool ok = false;
+
+    call([&](MbtoolInterface *iface) {
+        ok = fetch_booted_rom_id(iface, result);
+    });
+
+    return ok;
+}
+
+void MbtoolClient::invalidate_cache()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _have_booted_rom_id = false;
+    _booted_rom_id.clear();
+    _have_installed_roms = false;
+    _installed_roms.clear();
+}
@@ -17,9 +17,15 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include <pthread.h>
+
 #include <flatbuffers/flatbuffers.h>
 
 class Rom
@@ -78,5 +84,83 @@ private:
     MbtoolInterface *_iface;
 };
 
+// Runs mbtool requests on a background thread so that the GUI thread never
+// blocks on the daemon. Requests are executed in order. Callbacks are queued
+// and run on the GUI thread by dispatch_callbacks().
+//
+// The results of get_booted_rom_id() and get_installed_roms() are cached until
+// invalidate_cache() is called.
+class MbtoolClient
+{
+public:
+    typedef std::function<void(MbtoolInterface *iface)> Request;
+    typedef std::function<void()> Callback;
+
+    typedef std::function<void(bool ok, const std::string &rom_id)>
+            BootedRomIdCallback;
+    typedef std::function<void(bool ok, const std::vector<Rom> &roms)>
+            InstalledRomsCallback;
+
+    MbtoolClient();
+    ~MbtoolClient();
+
+    // Start the worker thread. If that fails, requests run synchronously.
+    bool start(MbtoolInterface *iface);
+    void stop();
+
+    // Queue a request for the worker thread
+    void post(Request request);
+    // Queue a request and wait for it to complete. Must not be called from a
+    // request.
+    void call(const Request &request);
+
+    // Queue a callback to be run on the GUI thread
+    void post_callback(Callback callback);
+    // Run all queued callbacks. Returns the number of callbacks run.
+    size_t dispatch_callbacks();
+    // Whether requests or callbacks are still outstanding
+    bool busy();
+
+    // If the result is cached, the callback is run immediately in the calling
+    // thread. Otherwise, it is run on the GUI thread.
+    void get_booted_rom_id(BootedRomIdCallback callback);
+    void get_installed_roms(InstalledRomsCallback callback);
+
+    // Blocking variant for use outside of the GUI thread
+    bool get_booted_rom_id(std::string *result);
+
+    void invalidate_cache();
+
+    MbtoolClient(const MbtoolClient &) = delete;
+    MbtoolClient(MbtoolClient &&) = delete;
+    MbtoolClient & operator=(const MbtoolClient &) & = delete;
+    MbtoolClient & operator=(MbtoolClient &&) & = delete;
+
+private:
+    static void * worker_thread(void *cookie);
+    void run_requests();
+
+    bool fetch_booted_rom_id(MbtoolInterface *iface, std::string *result);
+    bool fetch_installed_roms(MbtoolInterface *iface, std::vector<Rom> *result);
+
+    MbtoolInterface *_iface;
+    pthread_t _thread;
+    bool _started;
+    bool _stopping;
+
+    std::mutex _lock;
+    std::condition_variable _cond;
+    std::deque<Request> _requests;
+    std::deque<Callback> _callbacks;
+    // Number of requests being executed by the worker
+    size_t _active;
+
+    bool _have_booted_rom_id;
+    std::string _booted_rom_id;
+    bool _have_installed_roms;
+    std::vector<Rom> _installed_roms;
+};
+
 extern MbtoolConnection mbtool_connection;
 extern MbtoolInterface *mbtool_interface;
+extern MbtoolClient mbtool_client;
@@ -703,8 +703,9 @@ int GUIAction::switch_rom(const std::string& arg)
 
     operation_start("Switching ROM");
 
+    // This runs in the action thread, so it's fine to wait for mbtool
     std::string current_rom;
-    mbtool_interface->get_booted_rom_id(&current_rom);
+    mbtool_client.get_booted_rom_id(&current_rom);
 
     if (current_rom == arg) {
         // No need to switch if the user picked the current ROM
@@ -744,8 +745,15 @@ int GUIAction::switch_rom(const std::string& arg)
         }
 
         SwitchRomResult result;
-        if (ret == 0 && !mbtool_interface->switch_rom(
-                arg, block_dev, base_dirs, false, &result)) {
+        bool switched = false;
+        if (ret == 0) {
+            mbtool_client.call([&](MbtoolInterface *iface) {
+                switched = iface->switch_rom(
+                        arg, block_dev, base_dirs, false, &result);
+            });
+            mbtool_client.invalidate_cache();
+        }
+        if (ret == 0 && !switched) {
             gui_msg(Msg(msg::kError, "mbtool_connection_error"));
             ret = 1;
         }
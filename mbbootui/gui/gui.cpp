@@ -27,6 +27,7 @@
 #include "mbutil/path.h"
 #include "mbutil/time.h"
 
+#include "daemon_connection.h"
 #include "data.hpp"
 #include "twrp-functions.hpp"
 #include "variables.h"
@@ -436,6 +437,9 @@ static int runPages(const char *page_name, const int stop_on_page_done)
             }
         }
 
+        // Deliver results of mbtool requests made by the GUI
+        mbtool_client.dispatch_callbacks();
+
         if (!gForceRender) {
             int ret = PageManager::Update();
             if (ret == 0) {
@@ -447,6 +451,10 @@ static int runPages(const char *page_name, const int stop_on_page_done)
             }
             // due to possible animation objects, we need to delay activating the input timeout
             input_timeout_ms = idle_frames > 15 ? 1000 : 0;
+            // don't wait for input while mbtool results may still arrive
+            if (mbtool_client.busy()) {
+                input_timeout_ms = 0;
+            }
 
 #ifndef PRINT_RENDER_TIME
             if (ret > 1) {
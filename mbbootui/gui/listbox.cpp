@@ -22,7 +22,8 @@
 #include "data.hpp"
 #include "variables.h"
 
-GUIListBox::GUIListBox(xml_node<>* node) : GUIScrollList(node)
+GUIListBox::GUIListBox(xml_node<>* node)
+    : GUIScrollList(node), mSelf(std::make_shared<GUIListBox *>(this))
 {
     xml_attribute<>* attr;
     xml_node<>* child;
@@ -203,18 +204,17 @@ void GUIListBox::SetPageFocus(int inFocus)
         if (mVariable == TW_ROM_ID) {
             mListItems.clear();
 
-            std::vector<Rom> roms;
-            mbtool_interface->get_installed_roms(&roms);
-
-            for (Rom rom : roms) {
-                ListItem data;
-                // TODO: Read name from config file
-                data.displayName = rom.id;
-                data.variableValue = rom.id;
-                data.action = nullptr;
-                data.selected = (currentValue == rom.id);
-                mListItems.push_back(std::move(data));
-            }
+            // Filled in when mbtool responds (immediately if the ROM list is
+            // cached). The list box may be gone by then if the theme is
+            // reloaded.
+            std::weak_ptr<GUIListBox *> weak_self = mSelf;
+            mbtool_client.get_installed_roms(
+                    [weak_self](bool ok, const std::vector<Rom>& roms) {
+                auto self = weak_self.lock();
+                if (self && ok) {
+                    (*self)->SetRomItems(roms);
+                }
+            });
         }
 
         DataManager::GetValue(mVariable, currentValue);
@@ -222,6 +222,25 @@ void GUIListBox::SetPageFocus(int inFocus)
     }
 }
 
+void GUIListBox::SetRomItems(const std::vector<Rom>& roms)
+{
+    mListItems.clear();
+
+    for (const Rom& rom : roms) {
+        ListItem data;
+        // TODO: Read name from config file
+        data.displayName = rom.id;
+        data.variableValue = rom.id;
+        data.action = nullptr;
+        data.selected = (currentValue == rom.id);
+        mListItems.push_back(std::move(data));
+    }
+
+    DataManager::GetValue(mVariable, currentValue);
+    NotifyVarChange(mVariable, currentValue);
+    mUpdate = 1;
+}
+
 size_t GUIListBox::GetItemCount()
 {
     return mVisibleItems.size();
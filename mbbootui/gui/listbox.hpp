@@ -18,10 +18,14 @@
 
 #pragma once
 
+#include <memory>
+
 #include "gui/scrolllist.hpp"
 
 #include "gui/action.hpp"
 
+class Rom;
+
 class GUIListBox : public GUIScrollList
 {
 public:
@@ -43,6 +47,9 @@ public:
     virtual void RenderItem(size_t itemindex, int yPos, bool selected);
     virtual void NotifySelect(size_t item_selected);
 
+protected:
+    void SetRomItems(const std::vector<Rom>& roms);
+
 protected:
     struct ListItem
     {
@@ -63,4 +70,8 @@ protected:
     ImageResource* mIconUnselected;
     bool isCheckList;
     bool isTextParsed;
+
+private:
+    // Lets asynchronous callbacks check if the list box still exists
+    std::shared_ptr<GUIListBox *> mSelf;
 };
@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/resourcecache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <cstdio>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "mblog/logging.h"
+
+#include "minzip/Zip.h"
+
+#include "config/config.hpp"
+
+#include "gui/gui.h"
+
+// Decoded images that are no longer used are freed once they take up more
+// than this amount of memory
+#define IMAGE_CACHE_MAX_UNUSED_BYTES    (16 * 1024 * 1024)
+
+// Maximum number of threads used for decoding images
+#define IMAGE_DECODE_MAX_THREADS        4
+
+// Compression method of uncompressed zip entries
+#define ZIP_METHOD_STORED               0
+
+ZipEntryData::ZipEntryData() : mData(nullptr), mSize(0)
+{
+}
+
+bool ZipEntryData::Load(const ZipArchive* pZip, const ZipEntry* entry)
+{
+    mBuffer.clear();
+
+    if (entry->compression == ZIP_METHOD_STORED) {
+        mData = pZip->addr + mzGetZipEntryOffset(entry);
+        mSize = mzGetZipEntryUncompLen(entry);
+        return true;
+    }
+
+    mBuffer.resize(mzGetZipEntryUncompLen(entry));
+    if (!mzExtractZipEntryToBuffer(pZip, entry, mBuffer.data())) {
+        mBuffer.clear();
+        mData = nullptr;
+        mSize = 0;
+        return false;
+    }
+
+    mData = mBuffer.data();
+    mSize = mBuffer.size();
+    return true;
+}
+
+namespace
+{
+
+// Location of an image in the theme zip or on disk
+struct ImageSource
+{
+    // Identifies the unscaled image contents
+    std::string key;
+    // Zip entry or nullptr if the image is loaded from a file
+    const ZipEntry* entry;
+    // Entry name or file path
+    std::string path;
+};
+
+struct CacheEntry
+{
+    gr_surface surface;
+    size_t size;
+    int refcount;
+    // Position in the unused list when refcount is 0
+    std::list<std::string>::iterator unused_iter;
+};
+
+struct DecodeJob
+{
+    std::string key;
+    ImageSource source;
+    bool retain_aspect;
+    gr_surface surface;
+};
+
+struct DecodeQueue
+{
+    ZipArchive* zip;
+    std::vector<DecodeJob>* jobs;
+    std::atomic<size_t> next;
+};
+
+}
+
+static std::mutex g_cache_lock;
+static std::unordered_map<std::string, CacheEntry> g_cache;
+static std::unordered_map<gr_surface, std::string> g_cache_owners;
+// Keys of unreferenced entries, least recently released first
+static std::list<std::string> g_unused;
+static size_t g_unused_bytes = 0;
+
+static bool find_image(ZipArchive* pZip, const std::string& file,
+                       ImageSource* source)
+{
+    if (pZip) {
+        // JPG includes the .jpg extension in the filename so also try the
+        // name without adding .png
+        std::string names[] = {
+            "images/" + file + ".png",
+            "images/" + file,
+        };
+
+        for (auto const& name : names) {
+            const ZipEntry* entry = mzFindZipEntry(pZip, name.c_str());
+            if (entry) {
+                char suffix[32];
+                snprintf(suffix, sizeof(suffix), ":%08lx:%ld",
+                         entry->crc32, entry->uncompLen);
+
+                source->key = "zip:" + name + suffix;
+                source->entry = entry;
+                source->path = name;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Same search order as res_create_surface()
+    std::string path = std::string(tw_resource_path) + "/images/" + file + ".png";
+    if (access(path.c_str(), R_OK) != 0) {
+        path = file;
+        if (access(path.c_str(), R_OK) != 0) {
+            return false;
+        }
+    }
+
+    source->key = "file:" + path;
+    source->entry = nullptr;
+    source->path = path;
+    return true;
+}
+
+static bool get_scale(bool retain_aspect, float* scale_w, float* scale_h)
+{
+    if (get_scale_w() == 0 || get_scale_h() == 0) {
+        return false;
+    }
+
+    *scale_w = get_scale_w();
+    *scale_h = get_scale_h();
+    if (retain_aspect) {
+        *scale_w = *scale_h = std::min(*scale_w, *scale_h);
+    }
+    return true;
+}
+
+static std::string cache_key(const ImageSource& source, bool retain_aspect)
+{
+    float scale_w, scale_h;
+    char suffix[64];
+
+    if (get_scale(retain_aspect, &scale_w, &scale_h)) {
+        snprintf(suffix, sizeof(suffix), "@%gx%g", scale_w, scale_h);
+    } else {
+        suffix[0] = '\0';
+    }
+
+    return source.key + suffix;
+}
+
+// Decode and scale an image. This is safe to call from any thread.
+static gr_surface decode_image(ZipArchive* pZip, const ImageSource& source,
+                               bool retain_aspect)
+{
+    gr_surface surface = nullptr;
+    int rc;
+
+    if (source.entry) {
+        ZipEntryData data;
+        if (data.Load(pZip, source.entry)) {
+            rc = res_create_surface_png_mem(data.Data(), data.Size(), &surface);
+        } else {
+            rc = -1;
+        }
+    } else {
+        rc = res_create_surface(source.path.c_str(), &surface);
+    }
+    if (rc != 0) {
+        LOGI("Failed to load image from %s%s, error %d", source.path.c_str(),
+             source.entry ? " (zip)" : "", rc);
+        return nullptr;
+    }
+
+    float scale_w, scale_h;
+    if (get_scale(retain_aspect, &scale_w, &scale_h)) {
+        gr_surface scaled;
+        // res_scale_surface() frees the source surface on success
+        if (res_scale_surface(surface, &scaled, scale_w, scale_h) == 0) {
+            surface = scaled;
+        } else {
+            LOGI("Error scaling image, using regular size.");
+        }
+    }
+
+    return surface;
+}
+
+static void cache_ref(CacheEntry* entry)
+{
+    if (entry->refcount++ == 0) {
+        g_unused.erase(entry->unused_iter);
+        g_unused_bytes -= entry->size;
+    }
+}
+
+static void cache_trim()
+{
+    while (g_unused_bytes > IMAGE_CACHE_MAX_UNUSED_BYTES && !g_unused.empty()) {
+        auto it = g_cache.find(g_unused.front());
+        g_unused.pop_front();
+
+        g_unused_bytes -= it->second.size;
+        g_cache_owners.erase(it->second.surface);
+        res_free_surface(it->second.surface);
+        g_cache.erase(it);
+    }
+}
+
+// Add a surface to the cache, taking ownership of it. If another thread
+// already added the same image, the given surface is freed and the cached
+// one is returned instead.
+static gr_surface cache_insert(const std::string& key, gr_surface surface,
+                               bool referenced)
+{
+    auto it = g_cache.find(key);
+    if (it != g_cache.end()) {
+        res_free_surface(surface);
+        if (referenced) {
+            cache_ref(&it->second);
+        }
+        return it->second.surface;
+    }
+
+    CacheEntry& entry = g_cache[key];
+    entry.surface = surface;
+    entry.size = (size_t) gr_get_width(surface) * gr_get_height(surface) * 4;
+    entry.refcount = referenced ? 1 : 0;
+    if (!referenced) {
+        entry.unused_iter = g_unused.insert(g_unused.end(), key);
+        g_unused_bytes += entry.size;
+    }
+
+    g_cache_owners[surface] = key;
+    return surface;
+}
+
+static void * decode_worker(void* cookie)
+{
+    DecodeQueue* queue = static_cast<DecodeQueue*>(cookie);
+    size_t i;
+
+    while ((i = queue->next++) < queue->jobs->size()) {
+        DecodeJob& job = (*queue->jobs)[i];
+        job.surface = decode_image(queue->zip, job.source, job.retain_aspect);
+    }
+
+    return nullptr;
+}
+
+void ImageCache::Prefetch(ZipArchive* pZip,
+                          const std::vector<Request>& requests)
+{
+    std::vector<DecodeJob> jobs;
+    std::unordered_set<std::string> queued;
+
+    auto add_job = [&](const std::string& file, bool retain_aspect) {
+        ImageSource source;
+        if (!find_image(pZip, file, &source)) {
+            return false;
+        }
+
+        std::string key = cache_key(source, retain_aspect);
+        if (queued.insert(key).second) {
+            std::lock_guard<std::mutex> lock(g_cache_lock);
+            if (g_cache.find(key) == g_cache.end()) {
+                jobs.push_back({ key, source, retain_aspect, nullptr });
+            }
+        }
+        return true;
+    };
+
+    for (auto const& request : requests) {
+        if (request.animation) {
+            int frame = 1;
+            while (add_job(AnimationFrame(request.file, frame),
+                           request.retain_aspect)) {
+                ++frame;
+            }
+        } else {
+            add_job(request.file, request.retain_aspect);
+        }
+    }
+
+    if (jobs.empty()) {
+        return;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = std::min<size_t>(
+            cpus > 0 ? cpus : 1, IMAGE_DECODE_MAX_THREADS);
+    size_t n_threads = std::min(jobs.size(), max_threads);
+
+    DecodeQueue queue;
+    queue.zip = pZip;
+    queue.jobs = &jobs;
+    queue.next = 0;
+
+    // The calling thread is one of the workers. If a thread can't be created,
+    // the remaining ones just handle more of the images.
+    std::vector<pthread_t> threads;
+    for (size_t i = 1; i < n_threads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, &decode_worker, &queue) == 0) {
+            threads.push_back(thread);
+        }
+    }
+
+    decode_worker(&queue);
+
+    for (pthread_t thread : threads) {
+        pthread_join(thread, nullptr);
+    }
+
+    LOGD("Decoded %zu images using %zu threads", jobs.size(), threads.size() + 1);
+
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+    for (auto const& job : jobs) {
+        if (job.surface) {
+            cache_insert(job.key, job.surface, false);
+        }
+    }
+}
+
+gr_surface ImageCache::Acquire(ZipArchive* pZip, const std::string& file,
+                               bool retain_aspect)
+{
+    ImageSource source;
+    if (!find_image(pZip, file, &source)) {
+        return nullptr;
+    }
+
+    std::string key = cache_key(source, retain_aspect);
+
+    {
+        std::lock_guard<std::mutex> lock(g_cache_lock);
+        auto it = g_cache.find(key);
+        if (it != g_cache.end()) {
+            cache_ref(&it->second);
+            return it->second.surface;
+        }
+    }
+
+    gr_surface surface = decode_image(pZip, source, retain_aspect);
+    if (!surface) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+    return cache_insert(key, surface, true);
+}
+
+void ImageCache::Release(gr_surface surface)
+{
+    if (!surface) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+
+    auto owner = g_cache_owners.find(surface);
+    if (owner == g_cache_owners.end()) {
+        LOGE("Releasing surface %p that is not in the image cache", surface);
+        return;
+    }
+
+    CacheEntry& entry = g_cache[owner->second];
+    if (--entry.refcount == 0) {
+        entry.unused_iter = g_unused.insert(g_unused.end(), owner->second);
+        g_unused_bytes += entry.size;
+        cache_trim();
+    }
+}
+
+std::string ImageCache::AnimationFrame(const std::string& file, int frame)
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "%03d", frame);
+    return file + suffix;
+}
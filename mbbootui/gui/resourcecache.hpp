@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "minuitwrp/minui.h"
+
+struct ZipArchive;
+struct ZipEntry;
+
+// Uncompressed contents of a zip entry. Stored entries point directly into
+// the archive's mapping, so the archive must stay open while this is in use.
+class ZipEntryData
+{
+public:
+    ZipEntryData();
+
+    bool Load(const ZipArchive* pZip, const ZipEntry* entry);
+
+    const unsigned char* Data() const
+    {
+        return mData;
+    }
+
+    size_t Size() const
+    {
+        return mSize;
+    }
+
+private:
+    const unsigned char* mData;
+    size_t mSize;
+    std::vector<unsigned char> mBuffer;
+};
+
+// Cache of decoded (and scaled) theme images.
+//
+// Surfaces are reference counted and shared between all resources that use
+// the same image. Unreferenced surfaces are kept around, up to a memory
+// limit, so that reloading a theme does not need to decode everything again.
+// Cached surfaces must never be modified or freed by their users.
+class ImageCache
+{
+public:
+    struct Request
+    {
+        std::string file;
+        bool retain_aspect;
+        // Load "<file>001", "<file>002", ... until a frame is missing
+        bool animation;
+    };
+
+    // Decode all images that aren't in the cache yet on a pool of threads
+    static void Prefetch(ZipArchive* pZip, const std::vector<Request>& requests);
+
+    // Get a new reference to an image, decoding it if it's not cached.
+    // Returns nullptr if the image doesn't exist or fails to load.
+    static gr_surface Acquire(ZipArchive* pZip, const std::string& file,
+                              bool retain_aspect);
+
+    // Drop a reference obtained from Acquire()
+    static void Release(gr_surface surface);
+
+    // Name of the given (1-based) frame of an animation
+    static std::string AnimationFrame(const std::string& file, int frame);
+};
@@ -2,19 +2,12 @@
 
 #include "gui/objects.hpp"
 
-#include <iomanip>
-#include <iostream>
-
-#include <fcntl.h>
-#include <unistd.h>
-
 #include "mblog/logging.h"
 
 #include "twrp-functions.hpp"
 
 #include "gui/gui.h"
-
-#define TMP_RESOURCE_NAME   "/tmp/extract.bin"
+#include "gui/resourcecache.hpp"
 
 Resource::Resource(xml_node<>* node, ZipArchive* pZip __unused)
 {
@@ -23,82 +16,6 @@ Resource::Resource(xml_node<>* node, ZipArchive* pZip __unused)
     }
 }
 
-int Resource::ExtractResource(ZipArchive* pZip,
-                              const std::string& folderName,
-                              const std::string& fileName,
-                              const std::string& fileExtn,
-                              const std::string& destFile)
-{
-    if (!pZip) {
-        return -1;
-    }
-
-    std::string src = folderName + "/" + fileName + fileExtn;
-
-    const ZipEntry* binary = mzFindZipEntry(pZip, src.c_str());
-    if (binary == nullptr) {
-        return -1;
-    }
-
-    unlink(destFile.c_str());
-    int fd = creat(destFile.c_str(), 0666);
-    if (fd < 0) {
-        return -1;
-    }
-
-    int ret = 0;
-    if (!mzExtractZipEntryToFile(pZip, binary, fd)) {
-        ret = -1;
-    }
-
-    close(fd);
-    return ret;
-}
-
-void Resource::LoadImage(ZipArchive* pZip, const std::string& file,
-                         gr_surface* surface)
-{
-    int rc = 0;
-    if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0) {
-        rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-        unlink(TMP_RESOURCE_NAME);
-    } else if (ExtractResource(pZip, "images", file, "", TMP_RESOURCE_NAME) == 0) {
-        // JPG includes the .jpg extension in the filename so extension should be blank
-        rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-        unlink(TMP_RESOURCE_NAME);
-    } else if (!pZip) {
-        // File name in xml may have included .png so try without adding .png
-        rc = res_create_surface(file.c_str(), surface);
-    }
-    if (rc != 0) {
-        LOGI("Failed to load image from %s%s, error %d", file.c_str(), pZip ? " (zip)" : "", rc);
-    }
-}
-
-void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect)
-{
-    if (!source) {
-        *destination = nullptr;
-        return;
-    }
-    if (get_scale_w() != 0 && get_scale_h() != 0) {
-        float scale_w = get_scale_w(), scale_h = get_scale_h();
-        if (retain_aspect) {
-            if (scale_w < scale_h) {
-                scale_h = scale_w;
-            } else {
-                scale_w = scale_h;
-            }
-        }
-        if (res_scale_surface(source, destination, scale_w, scale_h)) {
-            LOGI("Error scaling image, using regular size.");
-            *destination = source;
-        }
-    } else {
-        *destination = source;
-    }
-}
-
 FontResource::FontResource(xml_node<>* node, ZipArchive* pZip)
     : Resource(node, pZip)
 {
@@ -149,10 +66,20 @@ void FontResource::LoadFont(xml_node<>* node, ZipArchive* pZip)
             dpi = atoi(attr->value());
         }
 
-        // we can't use TMP_RESOURCE_NAME here because the ttf subsystem is caching the name and scaling needs to reload the font
-        std::string tmpname = "/tmp/" + file;
-        if (ExtractResource(pZip, "fonts", file, "", tmpname) == 0) {
-            mFont = gr_ttf_loadFont(tmpname.c_str(), font_size, dpi);
+        const ZipEntry* entry = nullptr;
+        ZipEntryData data;
+        if (pZip) {
+            entry = mzFindZipEntry(pZip, ("fonts/" + file).c_str());
+        }
+
+        if (entry && data.Load(pZip, entry)) {
+            // The ttf subsystem caches fonts by name and scaling reloads the
+            // font by name, so the name must identify the contents
+            char name[64];
+            snprintf(name, sizeof(name), "zip:%08lx:%ld:",
+                     entry->crc32, entry->uncompLen);
+            mFont = gr_ttf_loadFontMem((name + file).c_str(), data.Data(),
+                                       data.Size(), font_size, dpi);
         } else {
             file = TWFunc::get_resource_path("fonts/" + file);
             mFont = gr_ttf_loadFont(file.c_str(), font_size, dpi);
@@ -194,7 +121,6 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
     : Resource(node, pZip)
 {
     std::string file;
-    gr_surface temp_surface = nullptr;
 
     mSurface = nullptr;
     if (!node) {
@@ -211,15 +137,12 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
 
     bool retain_aspect = (node->first_attribute("retainaspect") != nullptr);
     // the value does not matter, if retainaspect is present, we assume that we want to retain it
-    LoadImage(pZip, file, &temp_surface);
-    CheckAndScaleImage(temp_surface, &mSurface, retain_aspect);
+    mSurface = ImageCache::Acquire(pZip, file, retain_aspect);
 }
 
 ImageResource::~ImageResource()
 {
-    if (mSurface) {
-        res_free_surface(mSurface);
-    }
+    ImageCache::Release(mSurface);
 }
 
 AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
@@ -242,12 +165,8 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
     bool retain_aspect = (node->first_attribute("retainaspect") != nullptr);
     // the value does not matter, if retainaspect is present, we assume that we want to retain it
     for (;;) {
-        std::ostringstream fileName;
-        fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
-
-        gr_surface surface, temp_surface = nullptr;
-        LoadImage(pZip, fileName.str(), &temp_surface);
-        CheckAndScaleImage(temp_surface, &surface, retain_aspect);
+        gr_surface surface = ImageCache::Acquire(
+                pZip, ImageCache::AnimationFrame(file, fileNum), retain_aspect);
         if (surface) {
             mSurfaces.push_back(surface);
             fileNum++;
@@ -260,7 +179,7 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
 AnimationResource::~AnimationResource()
 {
     for (auto it = mSurfaces.begin(); it != mSurfaces.end(); ++it) {
-        res_free_surface(*it);
+        ImageCache::Release(*it);
     }
 
     mSurfaces.clear();
@@ -364,6 +283,17 @@ void ResourceManager::AddStringResource(std::string resource_source,
     mStrings[resource_name] = res;
 }
 
+static std::string GetResourceType(xml_node<>* node)
+{
+    std::string type = node->name();
+    if (type == "resource") {
+        // legacy format : <resource type="...">
+        xml_attribute<>* attr = node->first_attribute("type");
+        type = attr ? attr->value() : "*unspecified*";
+    }
+    return type;
+}
+
 void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
                                     std::string resource_source)
 {
@@ -371,13 +301,24 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
         return;
     }
 
+    // Decode all images up front on multiple threads. The image and animation
+    // resources below then just take their surfaces from the cache.
+    std::vector<ImageCache::Request> images;
     for (xml_node<>* child = resList->first_node(); child; child = child->next_sibling()) {
-        std::string type = child->name();
-        if (type == "resource") {
-            // legacy format : <resource type="...">
-            xml_attribute<>* attr = child->first_attribute("type");
-            type = attr ? attr->value() : "*unspecified*";
+        std::string type = GetResourceType(child);
+        xml_attribute<>* attr = child->first_attribute("filename");
+        if (attr && (type == "image" || type == "animation")) {
+            images.push_back({
+                attr->value(),
+                child->first_attribute("retainaspect") != nullptr,
+                type == "animation",
+            });
         }
+    }
+    ImageCache::Prefetch(pZip, images);
+
+    for (xml_node<>* child = resList->first_node(); child; child = child->next_sibling()) {
+        std::string type = GetResourceType(child);
 
         bool error = false;
         if (type == "font") {
@@ -453,6 +394,14 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
             }
         }
     }
+
+    // Render the glyphs used by the string resources into the font atlases
+    // now so that drawing doesn't need to call into FreeType
+    for (FontResource* font : mFonts) {
+        for (auto const& str : mStrings) {
+            gr_ttf_preloadGlyphs(font->GetResource(), str.second.value.c_str());
+        }
+    }
 }
 
 ResourceManager::~ResourceManager()
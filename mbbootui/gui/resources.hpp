@@ -24,17 +24,6 @@ public:
 
 private:
     std::string mName;
-
-protected:
-    static int ExtractResource(ZipArchive* pZip,
-                               const std::string& folderName,
-                               const std::string& fileName,
-                               const std::string& fileExtn,
-                               const std::string& destFile);
-    static void LoadImage(ZipArchive* pZip,
-                          const std::string& file, gr_surface* surface);
-    static void CheckAndScaleImage(gr_surface source, gr_surface* destination,
-                                   int retain_aspect);
 };
 
 class FontResource : public Resource
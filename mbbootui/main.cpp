@@ -517,13 +517,20 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
     mbtool_interface = mbtool_connection.interface();
+    mbtool_client.start(mbtool_interface);
+
+    // Query the daemon while the GUI is loading. The results are cached.
+    mbtool_client.get_booted_rom_id([](bool, const std::string &) {});
+    mbtool_client.get_installed_roms([](bool, const std::vector<Rom> &) {});
 
     LOGV("Loading default values...");
     DataManager::SetDefaultValues();
 
     // Set daemon version
     std::string mbtool_version;
-    mbtool_interface->version(&mbtool_version);
+    mbtool_client.call([&](MbtoolInterface *iface) {
+        iface->version(&mbtool_version);
+    });
     DataManager::SetValue(TW_MBTOOL_VERSION, mbtool_version);
 
     LOGV("Loading graphics system...");
@@ -539,7 +546,7 @@ int main(int argc, char *argv[])
     // "ro.multiboot.romid" property and will do some additional checks to
     // ensure that the value is correct.
     std::string rom_id;
-    mbtool_interface->get_booted_rom_id(&rom_id);
+    mbtool_client.get_booted_rom_id(&rom_id);
     if (rom_id.empty()) {
         LOGW("Could not determine ROM ID");
     }
@@ -573,12 +580,16 @@ int main(int argc, char *argv[])
             if (args.size() > 1) {
                 reboot_arg = args[1];
             }
-            bool result;
-            mbtool_interface->reboot(reboot_arg, &result);
+            mbtool_client.call([&](MbtoolInterface *iface) {
+                bool result;
+                iface->reboot(reboot_arg, &result);
+            });
             wait_forever();
         } else if (args[0] == "shutdown") {
-            bool result;
-            mbtool_interface->shutdown(&result);
+            mbtool_client.call([&](MbtoolInterface *iface) {
+                bool result;
+                iface->shutdown(&result);
+            });
             wait_forever();
         }
     }
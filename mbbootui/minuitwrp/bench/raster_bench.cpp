@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2017 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Micro-benchmark for the native rasterizer. Everything is rendered into a
+// malloc'd memory surface laid out like a 1080p framebuffer (with some row
+// padding, as most fbdev drivers have). Before timing, each operation is
+// checked against a straightforward per-byte reference implementation.
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../raster.h"
+
+#define SURFACE_WIDTH   1080
+#define SURFACE_HEIGHT  1920
+#define ROW_PADDING     64
+
+struct Surface
+{
+    int width;
+    int height;
+    size_t stride;
+    std::vector<uint8_t> data;
+
+    Surface(int w, int h, size_t padding)
+        : width(w), height(h), stride(w * 4 + padding), data(stride * h)
+    {
+    }
+
+    uint8_t * at(int x, int y)
+    {
+        return data.data() + y * stride + x * 4;
+    }
+};
+
+static uint8_t ref_blend(uint8_t s, uint8_t d, uint8_t a)
+{
+    return (s * a + d * (255 - a) + 127) / 255;
+}
+
+static void fill_random(std::vector<uint8_t> &buf, unsigned int seed)
+{
+    srand(seed);
+    for (auto &b : buf) {
+        b = rand() & 0xff;
+    }
+}
+
+static bool verify()
+{
+    const int w = 37;
+    const int h = 5;
+    bool ok = true;
+
+    Surface src(w, h, 12);
+    Surface dst(w, h, 20);
+    std::vector<uint8_t> mask(w * h);
+    std::vector<uint8_t> orig;
+
+    fill_random(src.data, 1);
+    fill_random(dst.data, 2);
+    fill_random(mask, 3);
+    orig = dst.data;
+
+    const uint8_t color[4] = { 0x12, 0x9a, 0xf0, 0x80 };
+    uint32_t px;
+    memcpy(&px, color, sizeof(px));
+
+    // The reference uses exact rounding; the rasterizer may be off by one
+    auto check = [&](const char *name, std::function<uint8_t(int, int, int)> fn) {
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                for (int c = 0; c < 4; ++c) {
+                    int expected = fn(x, y, c);
+                    int actual = dst.at(x, y)[c];
+                    if (abs(expected - actual) > 1) {
+                        fprintf(stderr, "%s: mismatch at (%d, %d)[%d]: "
+                                "expected %d, actual %d\n",
+                                name, x, y, c, expected, actual);
+                        ok = false;
+                        return;
+                    }
+                }
+            }
+        }
+    };
+    auto orig_at = [&](int x, int y, int c) {
+        return orig[y * dst.stride + x * 4 + c];
+    };
+
+    raster_fill(dst.data.data(), dst.stride, w, h, px);
+    check("fill", [&](int, int, int c) {
+        return color[c];
+    });
+
+    dst.data = orig;
+    raster_fill_blend(dst.data.data(), dst.stride, w, h, px);
+    check("fill_blend", [&](int x, int y, int c) {
+        return ref_blend(color[c], orig_at(x, y, c), color[3]);
+    });
+
+    dst.data = orig;
+    raster_blit(dst.data.data(), dst.stride, src.data.data(), src.stride, w, h);
+    check("blit", [&](int x, int y, int c) {
+        return src.at(x, y)[c];
+    });
+
+    dst.data = orig;
+    raster_blit_blend(dst.data.data(), dst.stride,
+                      src.data.data(), src.stride, w, h);
+    check("blit_blend", [&](int x, int y, int c) {
+        return ref_blend(src.at(x, y)[c], orig_at(x, y, c), src.at(x, y)[3]);
+    });
+
+    dst.data = orig;
+    raster_mask_blend(dst.data.data(), dst.stride, mask.data(), w, w, h, px);
+    check("mask_blend", [&](int x, int y, int c) {
+        return ref_blend(color[c], orig_at(x, y, c), mask[y * w + x]);
+    });
+
+    return ok;
+}
+
+static void bench(const char *name, int iterations, std::function<void()> fn)
+{
+    // Warm up caches
+    fn();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    double pixels = double(SURFACE_WIDTH) * SURFACE_HEIGHT * iterations;
+
+    printf("%-12s %8.3f ms/frame %10.1f Mpx/s\n",
+           name, secs * 1000 / iterations, pixels / secs / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 200;
+
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+        if (iterations <= 0) {
+            fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("Implementation: %s\n", raster_impl_name());
+
+    if (!verify()) {
+        return EXIT_FAILURE;
+    }
+
+    Surface fb(SURFACE_WIDTH, SURFACE_HEIGHT, ROW_PADDING);
+    Surface opaque(SURFACE_WIDTH, SURFACE_HEIGHT, 0);
+    Surface translucent(SURFACE_WIDTH, SURFACE_HEIGHT, 0);
+    std::vector<uint8_t> glyphs(SURFACE_WIDTH * SURFACE_HEIGHT);
+
+    fill_random(fb.data, 4);
+    fill_random(opaque.data, 5);
+    fill_random(translucent.data, 6);
+
+    // Mostly empty coverage with solid runs, roughly like rendered text
+    for (size_t i = 0; i < glyphs.size(); ++i) {
+        size_t col = i % 24;
+        glyphs[i] = col < 12 ? 0 : col < 20 ? 0xff : (i * 37) & 0xff;
+    }
+
+    const uint8_t color[4] = { 0x33, 0x66, 0x99, 0xff };
+    const uint8_t color_translucent[4] = { 0x33, 0x66, 0x99, 0x80 };
+    uint32_t px;
+    uint32_t px_translucent;
+    memcpy(&px, color, sizeof(px));
+    memcpy(&px_translucent, color_translucent, sizeof(px_translucent));
+
+    bench("fill", iterations, [&] {
+        raster_fill(fb.data.data(), fb.stride, fb.width, fb.height, px);
+    });
+    bench("fill_blend", iterations, [&] {
+        raster_fill_blend(fb.data.data(), fb.stride, fb.width, fb.height,
+                          px_translucent);
+    });
+    bench("blit", iterations, [&] {
+        raster_blit(fb.data.data(), fb.stride, opaque.data.data(),
+                    opaque.stride, fb.width, fb.height);
+    });
+    bench("blit_blend", iterations, [&] {
+        raster_blit_blend(fb.data.data(), fb.stride, translucent.data.data(),
+                          translucent.stride, fb.width, fb.height);
+    });
+    bench("mask_blend", iterations, [&] {
+        raster_mask_blend(fb.data.data(), fb.stride, glyphs.data(),
+                          SURFACE_WIDTH, fb.width, fb.height, px);
+    });
+
+    return EXIT_SUCCESS;
+}
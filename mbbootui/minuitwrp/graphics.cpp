@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +39,7 @@
 #include "backend/backend.h"
 #include "minui.h"
 #include "graphics.h"
+#include "raster.h"
 #include "gui/placement.h"
 
 struct GRFont
@@ -54,7 +57,6 @@ static int overscan_offset_y = 0;
 static unsigned char gr_current_r = 255;
 static unsigned char gr_current_g = 255;
 static unsigned char gr_current_b = 255;
-__attribute__((unused))
 static unsigned char gr_current_a = 255;
 __attribute__((unused))
 static unsigned char rgb_555[2];
@@ -71,6 +73,79 @@ static GGLContext *gr_context = 0;
 GGLSurface gr_mem_surface;
 static int gr_is_curr_clr_opaque = 0;
 
+// Current color as a pixel in the framebuffer's byte order (for raster.cpp)
+static uint32_t gr_current_px = 0xffffffff;
+
+// Current scissor rectangle (mirrors the pixelflinger state)
+static bool gr_clip_enabled = false;
+static int gr_clip_x0 = 0;
+static int gr_clip_y0 = 0;
+static int gr_clip_x1 = 0;
+static int gr_clip_y1 = 0;
+
+// Whether the native rasterizer can draw to the current surface. Only 32bpp
+// formats where pixelflinger stores the color components in order are
+// handled. Everything else goes through pixelflinger.
+static bool gr_can_raster()
+{
+    return gr_draw && gr_draw->pixel_bytes == 4
+            && (gr_mem_surface.format == GGL_PIXEL_FORMAT_RGBA_8888
+                    || gr_mem_surface.format == GGL_PIXEL_FORMAT_RGBX_8888);
+}
+
+// Intersect the destination rectangle with the surface and the scissor
+// rectangle. The source offsets, if any, are adjusted by the same amount.
+// Returns false if nothing is left to draw.
+static bool gr_clip_rect(int *x, int *y, int *w, int *h, int *sx, int *sy)
+{
+    int x0 = *x;
+    int y0 = *y;
+    int x1 = *x + *w;
+    int y1 = *y + *h;
+
+    int cx0 = 0;
+    int cy0 = 0;
+    int cx1 = gr_draw->width;
+    int cy1 = gr_draw->height;
+
+    if (gr_clip_enabled) {
+        cx0 = std::max(cx0, gr_clip_x0);
+        cy0 = std::max(cy0, gr_clip_y0);
+        cx1 = std::min(cx1, gr_clip_x1);
+        cy1 = std::min(cy1, gr_clip_y1);
+    }
+
+    if (x0 < cx0) {
+        if (sx) {
+            *sx += cx0 - x0;
+        }
+        x0 = cx0;
+    }
+    if (y0 < cy0) {
+        if (sy) {
+            *sy += cy0 - y0;
+        }
+        y0 = cy0;
+    }
+    x1 = std::min(x1, cx1);
+    y1 = std::min(y1, cy1);
+
+    if (x1 <= x0 || y1 <= y0) {
+        return false;
+    }
+
+    *x = x0;
+    *y = y0;
+    *w = x1 - x0;
+    *h = y1 - y0;
+    return true;
+}
+
+static inline unsigned char *gr_draw_ptr(int x, int y)
+{
+    return gr_draw->data + y * gr_draw->row_bytes + x * 4;
+}
+
 #if 0 // unused
 static bool outside(int x, int y)
 {
@@ -138,6 +213,12 @@ void gr_clip(int x, int y, int w, int h)
     GGLContext *gl = gr_context;
     gl->scissor(gl, x, y, w, h);
     gl->enable(gl, GGL_SCISSOR_TEST);
+
+    gr_clip_enabled = true;
+    gr_clip_x0 = x;
+    gr_clip_y0 = y;
+    gr_clip_x1 = x + w;
+    gr_clip_y1 = y + h;
 }
 
 void gr_noclip()
@@ -145,6 +226,8 @@ void gr_noclip()
     GGLContext *gl = gr_context;
     gl->scissor(gl, 0, 0, gr_fb_width(), gr_fb_height());
     gl->disable(gl, GGL_SCISSOR_TEST);
+
+    gr_clip_enabled = false;
 }
 
 void gr_line(int x0, int y0, int x1, int y1, int width)
@@ -216,36 +299,57 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
     gl->color4xv(gl, color);
 
     gr_is_curr_clr_opaque = (a == 255);
+
+    gr_current_r = r;
+    gr_current_g = g;
+    gr_current_b = b;
+    gr_current_a = a;
+
+    unsigned char px[4];
+    if (tw_pixel_format == TW_PXFMT_ABGR_8888
+            || tw_pixel_format == TW_PXFMT_BGRA_8888) {
+        px[0] = b;
+        px[2] = r;
+    } else {
+        px[0] = r;
+        px[2] = b;
+    }
+    px[1] = g;
+    px[3] = a;
+    memcpy(&gr_current_px, px, sizeof(gr_current_px));
 }
 
 void gr_clear()
 {
-    if (gr_draw->pixel_bytes == 2) {
+    if (!gr_can_raster()) {
         gr_fill(0, 0, gr_fb_width(), gr_fb_height());
         return;
     }
 
-    // This code only works on 32bpp devices
-    if (gr_current_r == gr_current_g && gr_current_r == gr_current_b) {
-        memset(gr_draw->data, gr_current_r, gr_draw->height * gr_draw->row_bytes);
-    } else {
-        unsigned char* px = gr_draw->data;
-        for (int y = 0; y < gr_draw->height; ++y) {
-            for (int x = 0; x < gr_draw->width; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
-            px += gr_draw->row_bytes - (gr_draw->width * gr_draw->pixel_bytes);
-        }
-    }
+    uint32_t px = gr_current_px;
+    reinterpret_cast<unsigned char *>(&px)[3] = 0xff;
+
+    raster_fill(gr_draw->data, gr_draw->row_bytes,
+                gr_draw->width, gr_draw->height, px);
 }
 
 void gr_fill(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
 
+    if (gr_can_raster()) {
+        if (gr_clip_rect(&x, &y, &w, &h, nullptr, nullptr)) {
+            if (gr_is_curr_clr_opaque) {
+                raster_fill(gr_draw_ptr(x, y), gr_draw->row_bytes, w, h,
+                            gr_current_px);
+            } else {
+                raster_fill_blend(gr_draw_ptr(x, y), gr_draw->row_bytes, w, h,
+                                  gr_current_px);
+            }
+        }
+        return;
+    }
+
     if (gr_is_curr_clr_opaque) {
         gl->disable(gl, GGL_BLEND);
     }
@@ -266,6 +370,29 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     GGLContext *gl = gr_context;
     GGLSurface *surface = (GGLSurface*)source;
 
+    // Native path for in-bounds blits of 32bpp images. Anything that would
+    // rely on pixelflinger's texture wrapping falls through.
+    if (gr_can_raster()
+            && (surface->format == GGL_PIXEL_FORMAT_RGBX_8888
+                    || surface->format == GGL_PIXEL_FORMAT_RGBA_8888)
+            && sx >= 0 && sy >= 0 && w >= 0 && h >= 0
+            && sx + w <= (int) surface->width
+            && sy + h <= (int) surface->height) {
+        if (gr_clip_rect(&dx, &dy, &w, &h, &sx, &sy)) {
+            size_t src_stride = surface->stride * 4;
+            const uint8_t *src = surface->data + sy * src_stride + sx * 4;
+
+            if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
+                raster_blit(gr_draw_ptr(dx, dy), gr_draw->row_bytes,
+                            src, src_stride, w, h);
+            } else {
+                raster_blit_blend(gr_draw_ptr(dx, dy), gr_draw->row_bytes,
+                                  src, src_stride, w, h);
+            }
+        }
+        return;
+    }
+
     if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
         gl->disable(gl, GGL_BLEND);
     }
@@ -284,6 +411,25 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     }
 }
 
+bool gr_blit_mask(const unsigned char *mask, int stride,
+                  int dx, int dy, int w, int h)
+{
+    if (!gr_can_raster()) {
+        return false;
+    }
+
+    int sx = 0;
+    int sy = 0;
+
+    if (gr_clip_rect(&dx, &dy, &w, &h, &sx, &sy)) {
+        raster_mask_blend(gr_draw_ptr(dx, dy), gr_draw->row_bytes,
+                          mask + sy * stride + sx, stride, w, h,
+                          gr_current_px);
+    }
+
+    return true;
+}
+
 unsigned int gr_get_width(gr_surface surface)
 {
     if (surface == nullptr) {
@@ -37,4 +37,11 @@ struct minui_backend
     void (*exit)(minui_backend*);
 };
 
+// Blend an 8-bit coverage mask (eg. rendered text) onto the draw surface in
+// the current color using the native rasterizer. Returns false if the draw
+// surface's format is not supported, in which case the caller must fall back
+// to pixelflinger.
+bool gr_blit_mask(const unsigned char *mask, int stride,
+                  int dx, int dy, int w, int h);
+
 #endif
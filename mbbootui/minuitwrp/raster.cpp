@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2017 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "raster.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#  define RASTER_NEON 1
+#  include <arm_neon.h>
+#elif defined(__SSE2__)
+#  define RASTER_SSE2 1
+#  include <emmintrin.h>
+#endif
+
+// Rounded (x / 255) for x <= 255 * 255
+static inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t load_px(const uint8_t *p)
+{
+    uint32_t px;
+    memcpy(&px, p, sizeof(px));
+    return px;
+}
+
+static inline void store_px(uint8_t *p, uint32_t px)
+{
+    memcpy(p, &px, sizeof(px));
+}
+
+static inline uint32_t alpha_of(uint32_t px)
+{
+    uint8_t bytes[4];
+    memcpy(bytes, &px, sizeof(bytes));
+    return bytes[3];
+}
+
+static inline void blend_px_c(uint8_t *d, const uint8_t *s, uint32_t a)
+{
+    uint32_t ia = 255 - a;
+    d[0] = div255(s[0] * a + d[0] * ia);
+    d[1] = div255(s[1] * a + d[1] * ia);
+    d[2] = div255(s[2] * a + d[2] * ia);
+    d[3] = div255(s[3] * a + d[3] * ia);
+}
+
+#if RASTER_SSE2
+// Blend 4 pixels. 'a' holds each pixel's alpha replicated into all 4 bytes.
+static inline __m128i blend4_sse2(__m128i s, __m128i d, __m128i a)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i c128 = _mm_set1_epi16(128);
+
+    __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+    __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+
+    __m128i lo = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), a_lo),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+                            _mm_sub_epi16(c255, a_lo)));
+    __m128i hi = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), a_hi),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+                            _mm_sub_epi16(c255, a_hi)));
+
+    lo = _mm_add_epi16(lo, c128);
+    hi = _mm_add_epi16(hi, c128);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+    return _mm_packus_epi16(lo, hi);
+}
+
+// Replicate the alpha byte of each pixel into all 4 bytes of that pixel
+static inline __m128i splat_alpha_sse2(__m128i s)
+{
+    __m128i a = _mm_srli_epi32(s, 24);
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+    return _mm_or_si128(a, _mm_slli_epi32(a, 16));
+}
+#endif
+
+#if RASTER_NEON
+// Blend 8 deinterleaved pixels with the per-pixel alpha in 'a'
+static inline uint8x8x4_t blend8_neon(uint8x8x4_t s, uint8x8x4_t d,
+                                      uint8x8_t a)
+{
+    uint8x8_t ia = vmvn_u8(a);
+    uint8x8x4_t r;
+
+    for (int c = 0; c < 4; ++c) {
+        uint16x8_t t = vmull_u8(s.val[c], a);
+        t = vmlal_u8(t, d.val[c], ia);
+        r.val[c] = vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8);
+    }
+
+    return r;
+}
+#endif
+
+extern "C" {
+
+const char * raster_impl_name(void)
+{
+#if RASTER_NEON
+    return "neon";
+#elif RASTER_SSE2
+    return "sse2";
+#else
+    return "c";
+#endif
+}
+
+void raster_fill(uint8_t *dst, size_t dst_stride, int w, int h, uint32_t px)
+{
+    uint8_t bytes[4];
+    memcpy(bytes, &px, sizeof(bytes));
+
+    // Grey (or black/white) colors can be filled with memset
+    if (bytes[0] == bytes[1] && bytes[0] == bytes[2] && bytes[0] == bytes[3]) {
+        for (int y = 0; y < h; ++y, dst += dst_stride) {
+            memset(dst, bytes[0], (size_t) w * 4);
+        }
+        return;
+    }
+
+    for (int y = 0; y < h; ++y, dst += dst_stride) {
+        uint8_t *d = dst;
+        int x = 0;
+
+#if RASTER_NEON
+        uint32x4_t v = vdupq_n_u32(px);
+        for (; x + 4 <= w; x += 4, d += 16) {
+            vst1q_u32(reinterpret_cast<uint32_t *>(d), v);
+        }
+#elif RASTER_SSE2
+        __m128i v = _mm_set1_epi32(static_cast<int>(px));
+        for (; x + 4 <= w; x += 4, d += 16) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d), v);
+        }
+#endif
+
+        for (; x < w; ++x, d += 4) {
+            store_px(d, px);
+        }
+    }
+}
+
+void raster_fill_blend(uint8_t *dst, size_t dst_stride, int w, int h,
+                       uint32_t px)
+{
+    uint32_t a = alpha_of(px);
+
+    if (a == 255) {
+        raster_fill(dst, dst_stride, w, h, px);
+        return;
+    } else if (a == 0) {
+        return;
+    }
+
+    uint8_t s[4];
+    memcpy(s, &px, sizeof(s));
+
+    for (int y = 0; y < h; ++y, dst += dst_stride) {
+        uint8_t *d = dst;
+        int x = 0;
+
+#if RASTER_NEON
+        uint8x8x4_t vs;
+        for (int c = 0; c < 4; ++c) {
+            vs.val[c] = vdup_n_u8(s[c]);
+        }
+        uint8x8_t va = vdup_n_u8(a);
+        for (; x + 8 <= w; x += 8, d += 32) {
+            vst4_u8(d, blend8_neon(vs, vld4_u8(d), va));
+        }
+#elif RASTER_SSE2
+        __m128i vs = _mm_set1_epi32(static_cast<int>(px));
+        __m128i va = _mm_set1_epi8(static_cast<char>(a));
+        for (; x + 4 <= w; x += 4, d += 16) {
+            __m128i vd = _mm_loadu_si128(reinterpret_cast<__m128i *>(d));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d),
+                             blend4_sse2(vs, vd, va));
+        }
+#endif
+
+        for (; x < w; ++x, d += 4) {
+            blend_px_c(d, s, a);
+        }
+    }
+}
+
+void raster_blit(uint8_t *dst, size_t dst_stride,
+                 const uint8_t *src, size_t src_stride, int w, int h)
+{
+    // libc's memcpy is already vectorized on every target we care about
+    if (dst_stride == src_stride && dst_stride == (size_t) w * 4) {
+        memcpy(dst, src, dst_stride * h);
+        return;
+    }
+
+    for (int y = 0; y < h; ++y, dst += dst_stride, src += src_stride) {
+        memcpy(dst, src, (size_t) w * 4);
+    }
+}
+
+void raster_blit_blend(uint8_t *dst, size_t dst_stride,
+                       const uint8_t *src, size_t src_stride, int w, int h)
+{
+    for (int y = 0; y < h; ++y, dst += dst_stride, src += src_stride) {
+        uint8_t *d = dst;
+        const uint8_t *s = src;
+        int x = 0;
+
+#if RASTER_NEON
+        for (; x + 8 <= w; x += 8, d += 32, s += 32) {
+            uint8x8x4_t vs = vld4_u8(s);
+            vst4_u8(d, blend8_neon(vs, vld4_u8(d), vs.val[3]));
+        }
+#elif RASTER_SSE2
+        for (; x + 4 <= w; x += 4, d += 16, s += 16) {
+            __m128i vs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+            __m128i vd = _mm_loadu_si128(reinterpret_cast<__m128i *>(d));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d),
+                             blend4_sse2(vs, vd, splat_alpha_sse2(vs)));
+        }
+#endif
+
+        for (; x < w; ++x, d += 4, s += 4) {
+            uint32_t a = s[3];
+            if (a == 255) {
+                memcpy(d, s, 4);
+            } else if (a != 0) {
+                blend_px_c(d, s, a);
+            }
+        }
+    }
+}
+
+void raster_mask_blend(uint8_t *dst, size_t dst_stride,
+                       const uint8_t *mask, size_t mask_stride, int w, int h,
+                       uint32_t px)
+{
+    uint8_t s[4];
+    memcpy(s, &px, sizeof(s));
+
+    for (int y = 0; y < h; ++y, dst += dst_stride, mask += mask_stride) {
+        uint8_t *d = dst;
+        const uint8_t *m = mask;
+        int x = 0;
+
+#if RASTER_NEON
+        uint8x8x4_t vs;
+        for (int c = 0; c < 4; ++c) {
+            vs.val[c] = vdup_n_u8(s[c]);
+        }
+        for (; x + 8 <= w; x += 8, d += 32, m += 8) {
+            uint8x8_t va = vld1_u8(m);
+            // Skip fully transparent runs (the gaps between glyphs)
+            if (vget_lane_u64(vreinterpret_u64_u8(va), 0) == 0) {
+                continue;
+            }
+            vst4_u8(d, blend8_neon(vs, vld4_u8(d), va));
+        }
+#elif RASTER_SSE2
+        __m128i vs = _mm_set1_epi32(static_cast<int>(px));
+        for (; x + 4 <= w; x += 4, d += 16, m += 4) {
+            uint32_t m4 = load_px(m);
+            // Skip fully transparent runs (the gaps between glyphs)
+            if (m4 == 0) {
+                continue;
+            }
+            __m128i va = _mm_cvtsi32_si128(static_cast<int>(m4));
+            va = _mm_unpacklo_epi8(va, va);
+            va = _mm_unpacklo_epi16(va, va);
+            __m128i vd = _mm_loadu_si128(reinterpret_cast<__m128i *>(d));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d),
+                             blend4_sse2(vs, vd, va));
+        }
+#endif
+
+        for (; x < w; ++x, d += 4, ++m) {
+            uint32_t a = *m;
+            if (a != 0) {
+                blend_px_c(d, s, a);
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Native software rasterizer for 32bpp surfaces.
+//
+// All functions operate on 4-byte pixels where the fourth byte in memory is
+// the alpha channel. The order of the color channels does not matter as long
+// as the source and destination agree. Strides are in bytes. Callers are
+// responsible for clipping: every pixel in the w x h rectangle must be valid.
+//
+// Blending uses the same equation as pixelflinger with
+// blendFunc(GGL_SRC_ALPHA, GGL_ONE_MINUS_SRC_ALPHA), applied to all four
+// channels: dst = (src * a + dst * (255 - a)) / 255.
+
+extern "C" {
+
+// Name of the code path selected at compile time ("neon", "sse2", or "c")
+const char * raster_impl_name(void);
+
+// Fill rectangle with an opaque pixel value
+void raster_fill(uint8_t *dst, size_t dst_stride, int w, int h, uint32_t px);
+
+// Blend a translucent pixel value over the rectangle using px's alpha
+void raster_fill_blend(uint8_t *dst, size_t dst_stride, int w, int h,
+                       uint32_t px);
+
+// Copy an opaque (RGBX) source rectangle
+void raster_blit(uint8_t *dst, size_t dst_stride,
+                 const uint8_t *src, size_t src_stride, int w, int h);
+
+// Blend an RGBA source rectangle using the per-pixel source alpha
+void raster_blit_blend(uint8_t *dst, size_t dst_stride,
+                       const uint8_t *src, size_t src_stride, int w, int h);
+
+// Blend px over the rectangle using an 8-bit coverage mask (eg. a rendered
+// glyph run) as the alpha. px's own alpha is ignored, matching pixelflinger's
+// GGL_REPLACE texture environment for GGL_PIXEL_FORMAT_A_8 textures.
+void raster_mask_blend(uint8_t *dst, size_t dst_stride,
+                       const uint8_t *mask, size_t mask_stride, int w, int h,
+                       uint32_t px);
+
+}
@@ -54,93 +54,6 @@ static GGLSurface* malloc_surface(size_t data_size)
     return surface;
 }
 
-static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
-                    png_uint_32* width, png_uint_32* height, png_byte* channels, FILE** fpp)
-{
-    char resPath[256];
-    unsigned char header[8];
-    int result = 0;
-    int color_type, bit_depth;
-    size_t bytesRead;
-
-    snprintf(resPath, sizeof(resPath)-1, "%s/images/%s.png", tw_resource_path, name);
-    resPath[sizeof(resPath)-1] = '\0';
-    FILE* fp = fopen(resPath, "rb");
-    if (fp == nullptr) {
-        fp = fopen(name, "rb");
-        if (fp == nullptr) {
-            result = -1;
-            goto exit;
-        }
-    }
-
-    bytesRead = fread(header, 1, sizeof(header), fp);
-    if (bytesRead != sizeof(header)) {
-        result = -2;
-        goto exit;
-    }
-
-    if (png_sig_cmp(header, 0, sizeof(header))) {
-        result = -3;
-        goto exit;
-    }
-
-    *png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    if (!*png_ptr) {
-        result = -4;
-        goto exit;
-    }
-
-    *info_ptr = png_create_info_struct(*png_ptr);
-    if (!*info_ptr) {
-        result = -5;
-        goto exit;
-    }
-
-    if (setjmp(png_jmpbuf(*png_ptr))) {
-        result = -6;
-        goto exit;
-    }
-
-    png_init_io(*png_ptr, fp);
-    png_set_sig_bytes(*png_ptr, sizeof(header));
-    png_read_info(*png_ptr, *info_ptr);
-
-    png_get_IHDR(*png_ptr, *info_ptr, width, height, &bit_depth,
-            &color_type, nullptr, nullptr, nullptr);
-
-    *channels = png_get_channels(*png_ptr, *info_ptr);
-
-    if (bit_depth == 8 && *channels == 3 && color_type == PNG_COLOR_TYPE_RGB) {
-        // 8-bit RGB images: great, nothing to do.
-    } else if (bit_depth <= 8 && *channels == 1 && color_type == PNG_COLOR_TYPE_GRAY) {
-        // 1-, 2-, 4-, or 8-bit gray images: expand to 8-bit gray.
-        png_set_expand_gray_1_2_4_to_8(*png_ptr);
-    } else if (bit_depth <= 8 && *channels == 1 && color_type == PNG_COLOR_TYPE_PALETTE) {
-        // paletted images: expand to 8-bit RGB.  Note that we DON'T
-        // currently expand the tRNS chunk (if any) to an alpha
-        // channel, because minui doesn't support alpha channels in
-        // general.
-        png_set_palette_to_rgb(*png_ptr);
-        *channels = 3;
-    } else if (color_type == PNG_COLOR_TYPE_PALETTE) {
-        png_set_palette_to_rgb(*png_ptr);
-    }
-
-    *fpp = fp;
-    return result;
-
-  exit:
-    if (result < 0) {
-        png_destroy_read_struct(png_ptr, info_ptr, nullptr);
-    }
-    if (fp != nullptr) {
-        fclose(fp);
-    }
-
-    return result;
-}
-
 // "display" surfaces are transformed into the framebuffer's required
 // pixel format (currently only RGBX is supported) at load time, so
 // gr_blit() can be nothing more than a memcpy() for each row.  The
@@ -211,23 +124,89 @@ static void transform_rgb_to_draw(unsigned char* input_row,
     }
 }
 
-int res_create_surface_png(const char* name, gr_surface* pSurface)
+// Source of PNG data for libpng's read callback
+struct PngMemReader
 {
-    GGLSurface* surface = nullptr;
-    int result = 0;
+    const unsigned char* data;
+    size_t size;
+    size_t offset;
+};
+
+static void png_read_mem(png_structp png_ptr, png_bytep out, png_size_t length)
+{
+    PngMemReader* reader = reinterpret_cast<PngMemReader*>(png_get_io_ptr(png_ptr));
+    if (length > reader->size - reader->offset) {
+        png_error(png_ptr, "Read past end of PNG data");
+    }
+    memcpy(out, reader->data + reader->offset, length);
+    reader->offset += length;
+}
+
+static void png_init_file_io(png_structp png_ptr, void* cookie)
+{
+    png_init_io(png_ptr, reinterpret_cast<FILE*>(cookie));
+}
+
+static void png_init_mem_io(png_structp png_ptr, void* cookie)
+{
+    png_set_read_fn(png_ptr, cookie, &png_read_mem);
+}
+
+// Decode a PNG into a new display surface. 'init_io' attaches the data source
+// to libpng. The source must be positioned right after the PNG signature.
+static int decode_png(void (*init_io)(png_structp, void*), void* cookie,
+                      gr_surface* pSurface)
+{
+    // Modified after setjmp(), so these must be volatile
+    GGLSurface* volatile surface = nullptr;
+    unsigned char* volatile p_row = nullptr;
+    volatile int result = 0;
     png_structp png_ptr = nullptr;
     png_infop info_ptr = nullptr;
     png_uint_32 width, height;
     png_byte channels;
-    FILE* fp;
-    unsigned char* p_row;
+    int color_type, bit_depth;
     unsigned int y;
 
-    *pSurface = nullptr;
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png_ptr) {
+        return -4;
+    }
 
-    result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels, &fp);
-    if (result < 0) {
-        return result;
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        result = -5;
+        goto exit;
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        result = -6;
+        goto exit;
+    }
+
+    init_io(png_ptr, cookie);
+    png_set_sig_bytes(png_ptr, 8);
+    png_read_info(png_ptr, info_ptr);
+
+    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth,
+            &color_type, nullptr, nullptr, nullptr);
+
+    channels = png_get_channels(png_ptr, info_ptr);
+
+    if (bit_depth == 8 && channels == 3 && color_type == PNG_COLOR_TYPE_RGB) {
+        // 8-bit RGB images: great, nothing to do.
+    } else if (bit_depth <= 8 && channels == 1 && color_type == PNG_COLOR_TYPE_GRAY) {
+        // 1-, 2-, 4-, or 8-bit gray images: expand to 8-bit gray.
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    } else if (bit_depth <= 8 && channels == 1 && color_type == PNG_COLOR_TYPE_PALETTE) {
+        // paletted images: expand to 8-bit RGB.  Note that we DON'T
+        // currently expand the tRNS chunk (if any) to an alpha
+        // channel, because minui doesn't support alpha channels in
+        // general.
+        png_set_palette_to_rgb(png_ptr);
+        channels = 3;
+    } else if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
     }
 
     surface = init_display_surface(width, height);
@@ -250,7 +229,6 @@ int res_create_surface_png(const char* name, gr_surface* pSurface)
         png_read_row(png_ptr, p_row, nullptr);
         transform_rgb_to_draw(p_row, surface->data + y * width * 4, channels, width);
     }
-    free(p_row);
 
     if (channels == 3) {
         surface->format = GGL_PIXEL_FORMAT_RGBX_8888;
@@ -261,7 +239,7 @@ int res_create_surface_png(const char* name, gr_surface* pSurface)
     *pSurface = (gr_surface) surface;
 
 exit:
-    fclose(fp);
+    free(p_row);
     png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
     if (result < 0 && surface != nullptr) {
         free(surface);
@@ -269,6 +247,55 @@ exit:
     return result;
 }
 
+int res_create_surface_png(const char* name, gr_surface* pSurface)
+{
+    char resPath[256];
+    unsigned char header[8];
+    int result;
+    FILE* fp;
+
+    *pSurface = nullptr;
+
+    snprintf(resPath, sizeof(resPath)-1, "%s/images/%s.png", tw_resource_path, name);
+    resPath[sizeof(resPath)-1] = '\0';
+    fp = fopen(resPath, "rb");
+    if (fp == nullptr) {
+        fp = fopen(name, "rb");
+        if (fp == nullptr) {
+            return -1;
+        }
+    }
+
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header)) {
+        result = -2;
+    } else if (png_sig_cmp(header, 0, sizeof(header))) {
+        result = -3;
+    } else {
+        result = decode_png(&png_init_file_io, fp, pSurface);
+    }
+
+    fclose(fp);
+    return result;
+}
+
+int res_create_surface_png_mem(const void* data, size_t size, gr_surface* pSurface)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+    *pSurface = nullptr;
+
+    if (size < 8) {
+        return -2;
+    }
+
+    if (png_sig_cmp(const_cast<png_bytep>(bytes), 0, 8)) {
+        return -3;
+    }
+
+    PngMemReader reader = { bytes, size, 8 };
+    return decode_png(&png_init_mem_io, &reader, pSurface);
+}
+
 #ifdef TW_INCLUDE_JPEG
 int res_create_surface_jpg(const char* name, gr_surface* pSurface)
 {
@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include "minui.h"
+#include "graphics.h"
 
 #include <cutils/hashmap.h>
 #include <ft2build.h>
@@ -15,16 +16,51 @@
 #include <pixelflinger/pixelflinger.h>
 #include <pthread.h>
 
-#define STRING_CACHE_MAX_ENTRIES 400
-#define STRING_CACHE_TRUNCATE_ENTRIES 150
+// Memory limit for the shaped string cache of each font. Least recently used
+// strings are evicted once the limit is reached.
+#define STRING_CACHE_MAX_BYTES (256 * 1024)
+
+// Width of the per-font glyph atlas. The height grows as needed.
+#define ATLAS_WIDTH 1024
+#define ATLAS_INITIAL_HEIGHT 64
+
+// Glyphs that are rendered into the atlas when a font is loaded
+#define ATLAS_PRELOAD_FIRST ' '
+#define ATLAS_PRELOAD_LAST '~'
+
+// Copy of a font file that was loaded from memory. FreeType reads from it for
+// as long as any face created from it exists.
+typedef struct
+{
+    int refcount;
+    size_t size;
+    FT_Byte data[];
+} TrueTypeFontData;
 
 typedef struct
 {
     int size;
     int dpi;
     char *path;
+    // Only set for fonts loaded from memory, in which case path is just a name
+    TrueTypeFontData *data;
 } TrueTypeFontKey;
 
+// All glyphs of a font are packed into one contiguous 8-bit alpha texture
+// using simple shelf packing. Glyphs are never removed.
+typedef struct
+{
+    uint8_t *data;
+    int width;
+    int height;
+    int shelf_x;
+    int shelf_y;
+    int shelf_height;
+    // pixelflinger view of the atlas for when the native rasterizer can't
+    // draw to the framebuffer
+    GGLSurface surface;
+} GlyphAtlas;
+
 typedef struct
 {
     int type;
@@ -36,8 +72,10 @@ typedef struct
     FT_Face face;
     Hashmap *glyph_cache;
     Hashmap *string_cache;
+    size_t string_cache_bytes;
     struct StringCacheEntry *string_cache_head;
     struct StringCacheEntry *string_cache_tail;
+    GlyphAtlas atlas;
     pthread_mutex_t mutex;
     TrueTypeFontKey *key;
 } TrueTypeFont;
@@ -45,9 +83,22 @@ typedef struct
 typedef struct
 {
     FT_BBox bbox;
-    FT_BitmapGlyph glyph;
+    int left;
+    int top;
+    int advance;
+    // Location of the bitmap in the atlas
+    int atlas_x;
+    int atlas_y;
+    int width;
+    int rows;
 } TrueTypeCacheEntry;
 
+typedef struct
+{
+    TrueTypeCacheEntry *glyph;
+    int x;
+} ShapedGlyph;
+
 typedef struct
 {
     char *text;
@@ -56,8 +107,11 @@ typedef struct
 
 struct StringCacheEntry
 {
-    GGLSurface surface;
+    ShapedGlyph *glyphs;
+    int glyphs_len;
+    int width;
     int rendered_bytes; // number of bytes from C string rendered, not number of UTF8 characters!
+    size_t mem_size;
     StringCacheKey *key;
     struct StringCacheEntry *prev;
     struct StringCacheEntry *next;
@@ -81,6 +135,8 @@ static FontData font_data = {
 #define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
 #define MAX(X,Y) ((X) > (Y) ? (X) : (Y))
 
+static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index);
+
 // 32bit FNV-1a hash algorithm
 // http://isthe.com/chongo/tech/comp/fnv/#FNV-1a
 static const uint32_t FNV_prime = 16777619U;
@@ -161,6 +217,13 @@ static int gr_ttf_string_cache_hash(void *key)
     return fnv_hash(k->text, strlen(k->text));
 }
 
+static void gr_ttf_unrefFontData(TrueTypeFontData *data)
+{
+    if (data && --data->refcount == 0) {
+        free(data);
+    }
+}
+
 static bool gr_ttf_font_cache_equals(void *keyA, void *keyB)
 {
     TrueTypeFontKey *a = (TrueTypeFontKey *)keyA;
@@ -178,7 +241,13 @@ static int gr_ttf_font_cache_hash(void *key)
     return hash;
 }
 
-void *gr_ttf_loadFont(const char *filename, int size, int dpi)
+// Load a font from a file or from memory. In-memory fonts are either copied
+// from mem or share an existing copy (data). The font cache is keyed by
+// filename in all cases.
+static void *gr_ttf_loadFontInternal(const char *filename,
+                                     TrueTypeFontData *data,
+                                     const void *mem, size_t mem_size,
+                                     int size, int dpi)
 {
     int error;
     TrueTypeFont *res = nullptr;
@@ -190,7 +259,8 @@ void *gr_ttf_loadFont(const char *filename, int size, int dpi)
         TrueTypeFontKey k = {
             .size = size,
             .dpi = dpi,
-            .path = (char*)filename
+            .path = (char*)filename,
+            .data = nullptr,
         };
 
         res = (TrueTypeFont *)hashmapGet(font_data.fonts, &k);
@@ -208,10 +278,28 @@ void *gr_ttf_loadFont(const char *filename, int size, int dpi)
         }
     }
 
+    if (mem) {
+        data = (TrueTypeFontData *) malloc(sizeof(TrueTypeFontData) + mem_size);
+        if (!data) {
+            goto exit;
+        }
+        data->refcount = 0;
+        data->size = mem_size;
+        memcpy(data->data, mem, mem_size);
+    }
+
     FT_Face face;
-    error = FT_New_Face(font_data.ft_library, filename, 0, &face);
+    if (data) {
+        error = FT_New_Memory_Face(font_data.ft_library, data->data,
+                                   data->size, 0, &face);
+    } else {
+        error = FT_New_Face(font_data.ft_library, filename, 0, &face);
+    }
     if (error) {
         fprintf(stderr, "Failed to load truetype face %s: %d\n", filename, error);
+        if (mem) {
+            free(data);
+        }
         goto exit;
     }
 
@@ -219,6 +307,9 @@ void *gr_ttf_loadFont(const char *filename, int size, int dpi)
     if (error) {
          fprintf(stderr, "Failed to set truetype face size to %d, dpi %d: %d\n", size, dpi, error);
          FT_Done_Face(face);
+         if (mem) {
+             free(data);
+         }
          goto exit;
     }
 
@@ -231,8 +322,9 @@ void *gr_ttf_loadFont(const char *filename, int size, int dpi)
     res->max_height = -1;
     res->base = -1;
     res->refcount = 1;
-    res->glyph_cache = hashmapCreate(32, hashmapIntHash, hashmapIntEquals);
+    res->glyph_cache = hashmapCreate(128, hashmapIntHash, hashmapIntEquals);
     res->string_cache = hashmapCreate(128, gr_ttf_string_cache_hash, gr_ttf_string_cache_equals);
+    res->atlas.width = ATLAS_WIDTH;
     pthread_mutex_init(&res->mutex, 0);
 
     if (!font_data.fonts) {
@@ -244,16 +336,37 @@ void *gr_ttf_loadFont(const char *filename, int size, int dpi)
     key->path = strdup(filename);
     key->size = size;
     key->dpi = dpi;
+    key->data = data;
+    if (data) {
+        ++data->refcount;
+    }
 
     res->key = key;
 
     hashmapPut(font_data.fonts, key, res);
 
+    // Render the printable ASCII range up front so that the common case
+    // never has to call into FreeType while drawing
+    for (int c = ATLAS_PRELOAD_FIRST; c <= ATLAS_PRELOAD_LAST; ++c) {
+        gr_ttf_glyph_cache_get(res, FT_Get_Char_Index(face, c));
+    }
+
 exit:
     pthread_mutex_unlock(&font_data.mutex);
     return res;
 }
 
+void *gr_ttf_loadFont(const char *filename, int size, int dpi)
+{
+    return gr_ttf_loadFontInternal(filename, nullptr, nullptr, 0, size, dpi);
+}
+
+void *gr_ttf_loadFontMem(const char *name, const void *data, size_t data_size,
+                         int size, int dpi)
+{
+    return gr_ttf_loadFontInternal(name, nullptr, data, data_size, size, dpi);
+}
+
 void *gr_ttf_scaleFont(void *font, int max_width, int measured_width)
 {
     if (!font) {
@@ -268,14 +381,13 @@ void *gr_ttf_scaleFont(void *font, int max_width, int measured_width)
     }
     const char* file = f->key->path;
     int dpi = f->dpi;
-    return gr_ttf_loadFont(file, new_size, dpi);
+    return gr_ttf_loadFontInternal(file, f->key->data, nullptr, 0,
+                                   new_size, dpi);
 }
 
 static bool gr_ttf_freeFontCache(void *key, void *value, void *context __unused)
 {
-    TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
-    FT_Done_Glyph((FT_Glyph)e->glyph);
-    free(e);
+    free(value);
     free(key);
     return true;
 }
@@ -287,7 +399,7 @@ static bool gr_ttf_freeStringCache(void *key, void *value, void *context __unuse
     free(k);
 
     StringCacheEntry *e = (StringCacheEntry *)value;
-    free(e->surface.data);
+    free(e->glyphs);
     free(e);
     return true;
 }
@@ -306,14 +418,17 @@ void gr_ttf_freeFont(void *font)
             font_data.fonts = nullptr;
         }
 
+        FT_Done_Face(d->face);
+
+        gr_ttf_unrefFontData(d->key->data);
         free(d->key->path);
         free(d->key);
 
-        FT_Done_Face(d->face);
         hashmapForEach(d->string_cache, gr_ttf_freeStringCache, nullptr);
         hashmapFree(d->string_cache);
         hashmapForEach(d->glyph_cache, gr_ttf_freeFontCache, nullptr);
         hashmapFree(d->glyph_cache);
+        free(d->atlas.data);
         pthread_mutex_destroy(&d->mutex);
         free(d);
     }
@@ -326,6 +441,53 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_peek(TrueTypeFont *font, int char_
     return (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
 }
 
+// Reserve a w x h rectangle in the atlas, growing it if needed
+static bool gr_ttf_atlas_alloc(GlyphAtlas *atlas, int w, int h, int *x, int *y)
+{
+    if (w > atlas->width) {
+        return false;
+    }
+
+    // Start a new shelf if the glyph doesn't fit on the current one
+    if (atlas->shelf_x + w > atlas->width) {
+        atlas->shelf_y += atlas->shelf_height;
+        atlas->shelf_x = 0;
+        atlas->shelf_height = 0;
+    }
+
+    int needed = atlas->shelf_y + h;
+    if (needed > atlas->height) {
+        int new_height = atlas->height ? atlas->height : ATLAS_INITIAL_HEIGHT;
+        while (new_height < needed) {
+            new_height *= 2;
+        }
+
+        uint8_t *data = (uint8_t *) realloc(
+                atlas->data, (size_t) atlas->width * new_height);
+        if (!data) {
+            return false;
+        }
+        memset(data + (size_t) atlas->width * atlas->height, 0,
+               (size_t) atlas->width * (new_height - atlas->height));
+
+        atlas->data = data;
+        atlas->height = new_height;
+
+        atlas->surface.version = sizeof(atlas->surface);
+        atlas->surface.width = atlas->width;
+        atlas->surface.height = atlas->height;
+        atlas->surface.stride = atlas->width;
+        atlas->surface.data = (GGLubyte *) atlas->data;
+        atlas->surface.format = GGL_PIXEL_FORMAT_A_8;
+    }
+
+    *x = atlas->shelf_x;
+    *y = atlas->shelf_y;
+    atlas->shelf_x += w;
+    atlas->shelf_height = MAX(atlas->shelf_height, h);
+    return true;
+}
+
 static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index)
 {
     TrueTypeCacheEntry *res = (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
@@ -336,17 +498,43 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_i
             return nullptr;
         }
 
-        FT_BitmapGlyph glyph;
-        error = FT_Get_Glyph(font->face->glyph, (FT_Glyph*)&glyph);
-        if (error) {
-            fprintf(stderr, "Failed to copy glyph %d: %d\n", char_index, error);
-            return nullptr;
-        }
+        FT_GlyphSlot slot = font->face->glyph;
 
         res = (TrueTypeCacheEntry *)malloc(sizeof(TrueTypeCacheEntry));
         memset(res, 0, sizeof(TrueTypeCacheEntry));
-        res->glyph = glyph;
-        FT_Glyph_Get_CBox((FT_Glyph)glyph, FT_GLYPH_BBOX_PIXELS, &res->bbox);
+        res->left = slot->bitmap_left;
+        res->top = slot->bitmap_top;
+        res->advance = slot->advance.x >> 6;
+        res->bbox.xMin = slot->bitmap_left;
+        res->bbox.xMax = slot->bitmap_left + (int) slot->bitmap.width;
+        res->bbox.yMin = slot->bitmap_top - (int) slot->bitmap.rows;
+        res->bbox.yMax = slot->bitmap_top;
+
+        // Glyphs that can't be stored keep their metrics, but draw nothing
+        if (slot->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
+            fprintf(stderr, "Unsupported pixel mode in glyph %d: %d\n",
+                    char_index, slot->bitmap.pixel_mode);
+        } else if (slot->bitmap.width > 0 && slot->bitmap.rows > 0) {
+            int w = slot->bitmap.width;
+            int h = slot->bitmap.rows;
+
+            if (gr_ttf_atlas_alloc(&font->atlas, w, h, &res->atlas_x, &res->atlas_y)) {
+                const uint8_t *src_itr = slot->bitmap.buffer;
+                uint8_t *dest_itr = font->atlas.data
+                        + res->atlas_y * font->atlas.width + res->atlas_x;
+
+                for (int y = 0; y < h; ++y) {
+                    memcpy(dest_itr, src_itr, w);
+                    src_itr += slot->bitmap.pitch;
+                    dest_itr += font->atlas.width;
+                }
+
+                res->width = w;
+                res->rows = h;
+            } else {
+                fprintf(stderr, "Failed to add glyph %d to atlas\n", char_index);
+            }
+        }
 
         int *key = (int *)malloc(sizeof(int));
         *key = char_index;
@@ -357,33 +545,6 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_i
     return res;
 }
 
-static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base)
-{
-    unsigned y;
-    uint8_t *src_itr = glyph->bitmap.buffer;
-    uint8_t *dest_itr = dest->data;
-
-    if (glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
-        fprintf(stderr, "Unsupported pixel mode in FT_BitmapGlyph %d\n", glyph->bitmap.pixel_mode);
-        return -1;
-    }
-
-    dest_itr += (offY + base - glyph->top)*dest->stride + (offX + glyph->left);
-
-    // FIXME: if glyph->left is negative and everything else is 0 (e.g. letter 'j' in Roboto-Regular),
-    // the result might end up being before the buffer - I'm not sure how to properly handle this.
-    if (dest_itr < dest->data) {
-        dest_itr = dest->data;
-    }
-
-    for (y = 0; y < glyph->bitmap.rows; ++y) {
-        memcpy(dest_itr, src_itr, glyph->bitmap.width);
-        src_itr += glyph->bitmap.pitch;
-        dest_itr += dest->stride;
-    }
-    return 0;
-}
-
 static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
 {
     char c;
@@ -435,23 +596,34 @@ static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
     f->base += f->size / 4;
 }
 
-// returns number of bytes from const char *text rendered to fit max_width, not number of UTF8 characters!
-static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const char *text, int max_width)
+// Lays out text as a list of glyphs and pen positions. Returns number of
+// bytes from const char *text rendered to fit max_width, not number of UTF8
+// characters!
+static int gr_ttf_shape_text(TrueTypeFont *font, StringCacheEntry *entry, const char *text, int max_width)
 {
     TrueTypeFont *f = font;
     TrueTypeCacheEntry *ent;
     int bytes_rendered = 0, total_w = 0;
     int utf_bytes = 0;
     unsigned int unicode = 0;
-    int i, x, diff, char_idx, prev_idx = 0;
-    int height;
+    int kern, char_idx, prev_idx = 0;
     FT_Vector delta;
-    uint8_t *data = nullptr;
     const char *text_itr = text;
-    int *char_idxs;
-    int char_idxs_len = 0;
+    ShapedGlyph *glyphs;
+    int glyphs_len = 0;
 
-    char_idxs = (int *) malloc(strlen(text) * sizeof(int));
+    if (font->max_height == -1) {
+        gr_ttf_calcMaxFontHeight(font);
+    }
+
+    if (font->max_height == -1) {
+        return -1;
+    }
+
+    glyphs = (ShapedGlyph *) malloc((strlen(text) + 1) * sizeof(ShapedGlyph));
+    if (!glyphs) {
+        return -1;
+    }
 
     while (*text_itr) {
         utf_bytes = utf8_to_unicode(text_itr, &unicode);
@@ -459,68 +631,91 @@ static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const cha
         bytes_rendered += utf_bytes;
 
         char_idx = FT_Get_Char_Index(f->face, unicode);
-        char_idxs[char_idxs_len] = char_idx;
 
         ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (ent) {
-            diff = ent->glyph->root.advance.x >> 16;
+            kern = 0;
 
             if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
                 FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-                diff += delta.x >> 6;
+                kern = delta.x >> 6;
             }
 
-            if (max_width != -1 && total_w + diff > max_width) {
+            if (max_width != -1 && total_w + kern + ent->advance > max_width) {
                 break;
             }
 
-            total_w += diff;
+            glyphs[glyphs_len].glyph = ent;
+            glyphs[glyphs_len].x = total_w + kern;
+            ++glyphs_len;
+
+            total_w += kern + ent->advance;
         }
         prev_idx = char_idx;
-        ++char_idxs_len;
     }
 
-    if (font->max_height == -1) {
-        gr_ttf_calcMaxFontHeight(font);
+    if (glyphs_len > 0) {
+        ShapedGlyph *shrunk = (ShapedGlyph *) realloc(
+                glyphs, glyphs_len * sizeof(ShapedGlyph));
+        if (shrunk) {
+            glyphs = shrunk;
+        }
     }
 
-    if (font->max_height == -1) {
-        free(char_idxs);
-        return -1;
-    }
+    entry->glyphs = glyphs;
+    entry->glyphs_len = glyphs_len;
+    entry->width = total_w;
+    entry->mem_size = sizeof(StringCacheEntry) + sizeof(StringCacheKey)
+            + glyphs_len * sizeof(ShapedGlyph) + strlen(text) + 1;
 
-    height = font->max_height;
+    return bytes_rendered;
+}
 
-    data = (uint8_t *) malloc(total_w*height);
-    memset(data, 0, total_w*height);
-    x = 0;
-    prev_idx = 0;
+static void gr_ttf_string_cache_unlink(TrueTypeFont *font, StringCacheEntry *ent)
+{
+    if (ent->prev) {
+        ent->prev->next = ent->next;
+    } else {
+        font->string_cache_head = ent->next;
+    }
 
-    surface->version = sizeof(*surface);
-    surface->width = total_w;
-    surface->height = height;
-    surface->stride = total_w;
-    surface->data = (GGLubyte*)data;
-    surface->format = GGL_PIXEL_FORMAT_A_8;
+    if (ent->next) {
+        ent->next->prev = ent->prev;
+    } else {
+        font->string_cache_tail = ent->prev;
+    }
 
-    for (i = 0; i < char_idxs_len; ++i) {
-        char_idx = char_idxs[i];
-        if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
-            FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-            x += delta.x >> 6;
-        }
+    ent->prev = nullptr;
+    ent->next = nullptr;
+}
 
-        ent = gr_ttf_glyph_cache_get(f, char_idx);
-        if (ent) {
-            gr_ttf_copy_glyph_to_surface(surface, ent->glyph, x, 0, font->base);
-            x += ent->glyph->root.advance.x >> 16;
-        }
+static void gr_ttf_string_cache_append(TrueTypeFont *font, StringCacheEntry *ent)
+{
+    ent->prev = font->string_cache_tail;
+    ent->next = nullptr;
 
-        prev_idx = char_idx;
+    if (font->string_cache_tail) {
+        font->string_cache_tail->next = ent;
+    } else {
+        font->string_cache_head = ent;
     }
+    font->string_cache_tail = ent;
+}
 
-    free(char_idxs);
-    return bytes_rendered;
+// Evict least recently used strings until the cache fits in its memory limit.
+// The most recently used entry is always kept.
+static void gr_ttf_string_cache_trim(TrueTypeFont *font)
+{
+    while (font->string_cache_bytes > STRING_CACHE_MAX_BYTES
+            && font->string_cache_head != font->string_cache_tail) {
+        StringCacheEntry *ent = font->string_cache_head;
+
+        gr_ttf_string_cache_unlink(font, ent);
+        hashmapRemove(font->string_cache, ent->key);
+        font->string_cache_bytes -= ent->mem_size;
+
+        gr_ttf_freeStringCache(ent->key, ent, nullptr);
+    }
 }
 
 static StringCacheEntry *gr_ttf_string_cache_peek(TrueTypeFont *font, const char *text, int max_width)
@@ -545,7 +740,7 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
     if (!res) {
         res = (StringCacheEntry *)malloc(sizeof(StringCacheEntry));
         memset(res, 0, sizeof(StringCacheEntry));
-        res->rendered_bytes = gr_ttf_render_text(font, &res->surface, text, max_width);
+        res->rendered_bytes = gr_ttf_shape_text(font, res, text, max_width);
         if (res->rendered_bytes < 0) {
             free(res);
             return nullptr;
@@ -558,48 +753,16 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
 
         res->key = new_key;
 
-        if (font->string_cache_tail) {
-            res->prev = font->string_cache_tail;
-            res->prev->next = res;
-        } else {
-            font->string_cache_head = res;
-        }
-        font->string_cache_tail = res;
-
+        gr_ttf_string_cache_append(font, res);
         hashmapPut(font->string_cache, new_key, res);
+        font->string_cache_bytes += res->mem_size;
+
+        gr_ttf_string_cache_trim(font);
     } else if (res->next) {
         // move this entry to the tail of the linked list
         // if it isn't already there
-        if (res->prev) {
-            res->prev->next = res->next;
-        }
-
-        res->next->prev = res->prev;
-
-        if (!res->prev) {
-            font->string_cache_head = res->next;
-        }
-
-        res->next = nullptr;
-        res->prev = font->string_cache_tail;
-        res->prev->next = res;
-        font->string_cache_tail = res;
-
-        // truncate old entries
-        if (hashmapSize(font->string_cache) >= STRING_CACHE_MAX_ENTRIES) {
-            printf("Truncating string cache entries.\n");
-            int i;
-            StringCacheEntry *ent;
-            for (i = 0; i < STRING_CACHE_TRUNCATE_ENTRIES; ++i) {
-                ent = font->string_cache_head;
-                font->string_cache_head = ent->next;
-                font->string_cache_head->prev = nullptr;
-
-                hashmapRemove(font->string_cache, ent->key);
-
-                gr_ttf_freeStringCache(ent->key, ent, nullptr);
-            }
-        }
+        gr_ttf_string_cache_unlink(font, res);
+        gr_ttf_string_cache_append(font, res);
     }
     return res;
 }
@@ -612,7 +775,7 @@ int gr_ttf_measureEx(const char *s, void *font)
     pthread_mutex_lock(&f->mutex);
     StringCacheEntry *e = gr_ttf_string_cache_get(f, s, -1);
     if (e) {
-        res = e->surface.width;
+        res = e->width;
     }
     pthread_mutex_unlock(&f->mutex);
 
@@ -661,7 +824,7 @@ int gr_ttf_maxExW(const char *s, void *font, int max_width)
             continue;
         }
 
-        total_w += ent->glyph->root.advance.x >> 16;
+        total_w += ent->advance;
         max_bytes += utf_bytes;
     }
     pthread_mutex_unlock(&f->mutex);
@@ -689,7 +852,8 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
         return -1;
     }
 
-    int y_bottom = y + e->surface.height;
+    int y_bottom = y + font->max_height;
+    int x_right = x + e->width;
     int res = e->rendered_bytes;
 
     if (max_height != -1 && max_height < y_bottom) {
@@ -700,20 +864,80 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
         }
     }
 
-    gl->bindTexture(gl, &e->surface);
-    gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
-    gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
-    gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    GlyphAtlas *atlas = &font->atlas;
+    bool gl_bound = false;
+
+    for (int i = 0; i < e->glyphs_len; ++i) {
+        TrueTypeCacheEntry *ent = e->glyphs[i].glyph;
+        int gx = x + e->glyphs[i].x + ent->left;
+        int gy = y + font->base - ent->top;
+        int ax = ent->atlas_x;
+        int ay = ent->atlas_y;
+        int w = ent->width;
+        int h = ent->rows;
+
+        // Clip to the string's bounding box
+        if (gx < x) {
+            ax += x - gx;
+            w -= x - gx;
+            gx = x;
+        }
+        if (gy < y) {
+            ay += y - gy;
+            h -= y - gy;
+            gy = y;
+        }
+        w = MIN(w, x_right - gx);
+        h = MIN(h, y_bottom - gy);
+        if (w <= 0 || h <= 0) {
+            continue;
+        }
 
-    gl->enable(gl, GGL_TEXTURE_2D);
-    gl->texCoord2i(gl, -x, -y);
-    gl->recti(gl, x, y, x + e->surface.width, y_bottom);
-    gl->disable(gl, GGL_TEXTURE_2D);
+        if (gr_blit_mask(atlas->data + ay * atlas->width + ax, atlas->width,
+                         gx, gy, w, h)) {
+            continue;
+        }
+
+        if (!gl_bound) {
+            gl->bindTexture(gl, &atlas->surface);
+            gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
+            gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+            gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+            gl->enable(gl, GGL_TEXTURE_2D);
+            gl_bound = true;
+        }
+
+        gl->texCoord2i(gl, ax - gx, ay - gy);
+        gl->recti(gl, gx, gy, gx + w, gy + h);
+    }
+
+    if (gl_bound) {
+        gl->disable(gl, GGL_TEXTURE_2D);
+    }
 
     pthread_mutex_unlock(&font->mutex);
     return res;
 }
 
+void gr_ttf_preloadGlyphs(void *font, const char *s)
+{
+    TrueTypeFont *f = (TrueTypeFont *)font;
+    unsigned int unicode;
+
+    if (!f || !s) {
+        return;
+    }
+
+    pthread_mutex_lock(&f->mutex);
+
+    while (*s) {
+        s += utf8_to_unicode(s, &unicode);
+        gr_ttf_glyph_cache_get(f, FT_Get_Char_Index(f->face, unicode));
+    }
+
+    pthread_mutex_unlock(&f->mutex);
+}
+
 int gr_ttf_getMaxFontHeight(void *font)
 {
     int res;
@@ -734,7 +958,7 @@ static bool gr_ttf_dump_stats_count_string_cache(void *key __unused, void *value
 {
     int *string_cache_size = (int *) context;
     StringCacheEntry *e = (StringCacheEntry *) value;
-    *string_cache_size += e->surface.height*e->surface.width + sizeof(StringCacheEntry);
+    *string_cache_size += e->mem_size;
     return true;
 }
 
@@ -754,10 +978,13 @@ static bool gr_ttf_dump_stats_font(void *key, void *value, void *context)
            "    max_height: %d\n"
            "    base: %d\n"
            "    glyph_cache: %zu entries\n"
+           "    atlas: %dx%d (%.2f kB)\n"
            "    string_cache: %zu entries (%.2f kB)\n",
            k->path, k->size, k->dpi,
            f->refcount, f->max_height, f->base,
            hashmapSize(f->glyph_cache),
+           f->atlas.width, f->atlas.height,
+           ((double)f->atlas.width * f->atlas.height)/1024,
            hashmapSize(f->string_cache), ((double)string_cache_size)/1024);
 
     pthread_mutex_unlock(&f->mutex);
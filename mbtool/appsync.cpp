@@ -22,9 +22,11 @@
 #include <algorithm>
 
 #include <cassert>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 
 #include <fcntl.h>
 #include <getopt.h>
@@ -80,8 +82,11 @@
 #define INSTALLD_SOCKET_CONTEXT         "u:object_r:installd_socket:s0"
 
 #define COMMAND_BUF_SIZE                1024
+// Number of proxied commands between latency stats dumps
+#define COMMAND_STATS_INTERVAL          1000
 
 #define PACKAGES_XML_PATH_FMT           "%s/system/packages.xml"
+#define PACKAGES_CACHE_DIR              "/data/multiboot/_appsync/packages"
 
 namespace mb
 {
@@ -114,6 +119,11 @@ static bool load_config_files()
             continue;
         }
 
+        std::string cache_path(PACKAGES_CACHE_DIR);
+        cache_path += "/";
+        cache_path += rom->id;
+        cache_path += ".cache";
+
         cfg_pkgs_list.emplace_back();
         cfg_pkgs_list.back().rom = rom;
 
@@ -124,7 +134,8 @@ static bool load_config_files()
             LOGW("%s: Failed to load config for ROM %s",
                  config_path.c_str(), rom->id.c_str());
         }
-        if (!rom_packages.load_xml(packages_path)) {
+        // Only the package names and UIDs are needed
+        if (!rom_packages.load_uids_cached(packages_path, cache_path)) {
             LOGW("%s: Failed to load packages for ROM %s",
                  packages_path, rom->id.c_str());
         }
@@ -310,63 +321,64 @@ static int create_new_socket()
  */
 
 /*!
- * \brief Receive a message from a socket
+ * \brief Socket message
+ *
+ * The message is kept along with its header (the async command ID, if present,
+ * and the size) so that it can be forwarded as-is with a single write.
  */
-static bool receive_message(int fd, char *buf, std::size_t size,
-                            bool is_async, int *async_id)
+struct Message
 {
-    unsigned short count;
+    char buf[sizeof(int32_t) + sizeof(uint16_t) + COMMAND_BUF_SIZE];
+    std::size_t header_size;
+    std::size_t data_size;
 
-    if (is_async) {
-        assert(async_id != nullptr);
-
-        if (!util::socket_read_int32(fd, async_id)) {
-            LOGE("Failed to receive async command ID: %s", strerror(errno));
-            return false;
-        }
+    char * data()
+    {
+        return buf + header_size;
     }
+};
+
+/*!
+ * \brief Receive a message from a socket
+ */
+static bool receive_message(int fd, Message *msg, bool is_async)
+{
+    uint16_t count;
 
-    if (!util::socket_read_uint16(fd, &count)) {
-        LOGE("Failed to read command size: %s", strerror(errno));
+    msg->header_size = sizeof(count) + (is_async ? sizeof(int32_t) : 0);
+
+    if (util::socket_read(fd, msg->buf, msg->header_size)
+            != static_cast<ssize_t>(msg->header_size)) {
+        LOGE("Failed to read command header: %s", strerror(errno));
         return false;
     }
 
-    if (count < 1 || count >= size) {
+    memcpy(&count, msg->buf + msg->header_size - sizeof(count), sizeof(count));
+
+    if (count < 1 || count >= COMMAND_BUF_SIZE) {
         LOGE("Invalid size %u", count);
         return false;
     }
 
-    if (util::socket_read(fd, buf, count) != count) {
+    if (util::socket_read(fd, msg->data(), count) != count) {
         LOGE("Failed to read command: %s", strerror(errno));
         return false;
     }
 
-    buf[count] = 0;
+    msg->data()[count] = 0;
+    msg->data_size = count;
 
     return true;
 }
 
 /*!
- * \brief Send a message to a socket
+ * \brief Forward a message to a socket
  */
-static bool send_message(int fd, const char *command,
-                         bool is_async, int async_id)
+static bool send_message(int fd, const Message &msg)
 {
-    unsigned short count = strlen(command);
-
-    if (is_async) {
-        if (!util::socket_write_int32(fd, async_id)) {
-            LOGE("Failed to write async command ID: %s", strerror(errno));
-            return false;
-        }
-    }
+    std::size_t size = msg.header_size + msg.data_size;
 
-    if (!util::socket_write_uint16(fd, count)) {
-        LOGE("Failed to write command size: %s", strerror(errno));
-        return false;
-    }
-
-    if (util::socket_write(fd, command, count) != count) {
+    if (util::socket_write(fd, msg.buf, size) != static_cast<ssize_t>(size)) {
         LOGE("Failed to write command: %s", strerror(errno));
         return false;
     }
@@ -461,19 +473,6 @@ static std::vector<std::string> parse_args(const char *cmdline)
     return args;
 }
 
-static std::string args_to_string(const std::vector<std::string> &args)
-{
-    std::string output("[");
-    for (size_t i = 0; i < args.size(); ++i) {
-        if (i != 0) {
-            output += ", ";
-        }
-        output += args[i];
-    }
-    output += "]";
-    return output;
-}
-
 static bool do_remove(const std::vector<std::string> &args)
 {
 #define TAG "[remove] "
@@ -523,65 +522,174 @@ static struct CommandInfo cmds[] = {
     { "remove",  2, do_remove }
 };
 
-static void handle_command(const std::vector<std::string> &args)
+/*!
+ * \brief Find the hook for a command without tokenizing it
+ */
+static const CommandInfo * find_hook(const char *cmdline)
 {
+    std::size_t len = strcspn(cmdline, " ");
+
     for (std::size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); ++i) {
-        if (args[0] == cmds[i].name) {
-            if (args.size() - 1 != cmds[i].nargs) {
-                LOGE("%s requires %u arguments (%zu given)",
-                     cmds[i].name, cmds[i].nargs, args.size() - 1);
-                LOGE("%s command won't be hooked", cmds[i].name);
-            } else {
-                LOGD("Hooking %s command", cmds[i].name);
-                cmds[i].func(std::vector<std::string>(
-                        args.begin() + 1, args.end()));
-            }
+        if (strncmp(cmds[i].name, cmdline, len) == 0
+                && cmds[i].name[len] == '\0') {
+            return &cmds[i];
         }
     }
+
+    return nullptr;
 }
 
-static bool handle_installd_event(int client_fd, int installd_fd,
-                                  bool is_async)
+static void run_hook(const CommandInfo *cmd, const char *cmdline)
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    std::vector<std::string> args = parse_args(cmdline);
 
-    uint64_t time_start, time_stop;
-    uint64_t time_start_installd, time_stop_installd;
-    uint64_t time_start_send, time_stop_send;
+    if (args.size() - 1 != cmd->nargs) {
+        LOGE("%s requires %u arguments (%zu given)",
+             cmd->name, cmd->nargs, args.size() - 1);
+        LOGE("%s command won't be hooked", cmd->name);
+    } else {
+        LOGD("Hooking %s command", cmd->name);
+        cmd->func(std::vector<std::string>(args.begin() + 1, args.end()));
+    }
+}
 
-    int async_id;
+enum class CommandLog
+{
+    // Don't log the command or the reply
+    None,
+    // Only log the command name
+    Name,
+    // Log the full command and the reply
+    Full,
+};
 
-    time_start = util::current_time_ms();
+struct ProxyCommand
+{
+    const char *name;
+    CommandLog log;
+};
+
+// Commands are matched by name only. Commands that are not hooked are
+// forwarded to installd without being tokenized.
+static ProxyCommand proxy_cmds[] = {
+    // Unimportant commands
+    { "ping",             CommandLog::Name },
+    { "freecache",        CommandLog::Name },
+    // Get size is so annoying we don't want it to show... EVER!
+    { "getsize",          CommandLog::None },
+    // CyanogenMod-specific commands
+    { "aapt",             CommandLog::Full },
+    { "aapt_with_common", CommandLog::Full },
+    // Touchwiz-specific commands
+    { "rmrcl",            CommandLog::Full },
+    { "asyncDexopt",      CommandLog::Full },
+    { "changeDexOwner",   CommandLog::Full },
+    // AOSP commands
+    { "install",          CommandLog::Full },
+    { "dexopt",           CommandLog::Full },
+    { "markbootcomplete", CommandLog::Full },
+    { "movedex",          CommandLog::Full },
+    { "rmdex",            CommandLog::Full },
+    { "remove",           CommandLog::Full },
+    { "rename",           CommandLog::Full },
+    { "fixuid",           CommandLog::Full },
+    { "rmcache",          CommandLog::Full },
+    { "rmcodecache",      CommandLog::Full },
+    { "rmuserdata",       CommandLog::Full },
+    { "movefiles",        CommandLog::Full },
+    { "linklib",          CommandLog::Full },
+    { "mkuserdata",       CommandLog::Full },
+    { "mkuserconfig",     CommandLog::Full },
+    { "rmuser",           CommandLog::Full },
+    { "idmap",            CommandLog::Full },
+    { "restorecondata",   CommandLog::Full },
+    { "patchoat",         CommandLog::Full },
+    // Unrecognized commands (must be last)
+    { nullptr,            CommandLog::Full },
+};
 
-    time_start_installd = util::current_time_ms();
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, &async_id)) {
+#define PROXY_CMDS_COUNT (sizeof(proxy_cmds) / sizeof(proxy_cmds[0]))
+
+/*!
+ * \brief Latency of the round trip through installd for each command type
+ */
+struct CommandStats
+{
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+};
+
+static CommandStats proxy_stats[PROXY_CMDS_COUNT];
+static uint64_t proxy_stats_total;
+
+static uint64_t current_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static std::size_t find_proxy_command(const char *cmdline)
+{
+    std::size_t len = strcspn(cmdline, " ");
+    std::size_t i = 0;
+
+    for (; proxy_cmds[i].name; ++i) {
+        if (strncmp(proxy_cmds[i].name, cmdline, len) == 0
+                && proxy_cmds[i].name[len] == '\0') {
+            break;
+        }
+    }
+
+    return i;
+}
+
+static void dump_command_stats()
+{
+    LOGD("Command latency stats (%" PRIu64 " commands):", proxy_stats_total);
+
+    for (std::size_t i = 0; i < PROXY_CMDS_COUNT; ++i) {
+        const CommandStats &stats = proxy_stats[i];
+        if (stats.count == 0) {
+            continue;
+        }
+
+        LOGD("- %-16s %6" PRIu64 " calls, avg %8" PRIu64 "us,"
+             " max %8" PRIu64 "us",
+             proxy_cmds[i].name ? proxy_cmds[i].name : "(unrecognized)",
+             stats.count, stats.total_us / stats.count, stats.max_us);
+    }
+}
+
+static void record_command_stats(std::size_t index, uint64_t time_us)
+{
+    CommandStats &stats = proxy_stats[index];
+    ++stats.count;
+    stats.total_us += time_us;
+    stats.max_us = std::max(stats.max_us, time_us);
+
+    if (++proxy_stats_total % COMMAND_STATS_INTERVAL == 0) {
+        dump_command_stats();
+    }
+}
+
+static bool handle_installd_event(int client_fd, int installd_fd,
+                                  bool is_async)
+{
+    Message msg;
+
+    if (!receive_message(installd_fd, &msg, is_async)) {
         LOGE("Failed to receive reply from installd");
         return false;
     }
-    time_stop_installd = util::current_time_ms();
 
-    std::vector<std::string> args = parse_args(buf);
-    LOGD("Received async (probably) reply: %s", args_to_string(args).c_str());
+    LOGD("Received async (probably) reply: %s", msg.data());
 
-    time_start_send = util::current_time_ms();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
+    if (!send_message(client_fd, msg)) {
         LOGE("Failed to send reply to client");
         return false;
     }
-    time_stop_send = util::current_time_ms();
-
-    time_stop = util::current_time_ms();
-
-    LOGD("Command stats:");
-    LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-         time_stop_send - time_start_send);
-    LOGD("- Time to receive reply from installd: %" PRIu64 "ms",
-         time_stop_installd - time_start_installd);
-    LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-         time_stop - time_start);
-    LOGD("---");
 
     return true;
 }
@@ -589,123 +697,69 @@ static bool handle_installd_event(int client_fd, int installd_fd,
 static bool handle_android_event(int client_fd, int installd_fd,
                                  bool can_appsync, bool is_async)
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    Message msg;
 
     uint64_t time_start, time_stop;
     uint64_t time_start_installd, time_stop_installd;
     uint64_t time_start_hook = 0, time_stop_hook = 0;
-    uint64_t time_start_send, time_stop_send;
 
-    int async_id;
-
-    if (!receive_message(client_fd, buf, sizeof(buf), is_async, &async_id)) {
+    if (!receive_message(client_fd, &msg, is_async)) {
         LOGE("Failed to receive request from client");
         return false;
     }
 
-    time_start = util::current_time_ms();
+    time_start = current_time_us();
 
-    std::vector<std::string> args = parse_args(buf);
+    std::size_t index = find_proxy_command(msg.data());
+    const ProxyCommand &cmd = proxy_cmds[index];
 
-    bool log_result = true;
+    if (!cmd.name) {
+        LOGW("Unrecognized command: %s", msg.data());
+    } else if (cmd.log == CommandLog::Name) {
+        LOGD("Received unimportant command: [%s, ...]", cmd.name);
+    } else if (cmd.log == CommandLog::Full) {
+        LOGD("Received command: %s", msg.data());
+    }
 
-    if (args.empty()) {
-        LOGE("Invalid command (empty message)");
-    } else {
-        const std::string &cmd = args[0];
-
-        if (cmd == "ping"
-                || cmd == "freecache") {
-            LOGD("Received unimportant command: [%s, ...]", cmd.c_str());
-        } else if (cmd == "aapt"
-                || cmd == "aapt_with_common") {
-            LOGD("Received CyanogenMod-specific command: %s",
-                 args_to_string(args).c_str());
-        } else if (cmd == "rmrcl"
-                || cmd == "asyncDexopt"
-                || cmd == "changeDexOwner") {
-            LOGD("Received Touchwiz-specific command: %s",
-                 args_to_string(args).c_str());
-            if (cmd == "asyncDexopt") {
-                LOGD("Expecting future installd reply for 'asyncDexopt'");
-            }
-        } else if (cmd == "getsize") {
-            // Get size is so annoying we don't want it to show... EVER!
-            log_result = false;
-        } else if (cmd == "install"
-                || cmd == "dexopt"
-                || cmd == "markbootcomplete"
-                || cmd == "movedex"
-                || cmd == "rmdex"
-                || cmd == "remove"
-                || cmd == "rename"
-                || cmd == "fixuid"
-                || cmd == "rmcache"
-                || cmd == "rmcodecache"
-                || cmd == "rmuserdata"
-                || cmd == "movefiles"
-                || cmd == "linklib"
-                || cmd == "mkuserdata"
-                || cmd == "mkuserconfig"
-                || cmd == "rmuser"
-                || cmd == "idmap"
-                || cmd == "restorecondata"
-                || cmd == "patchoat") {
-            LOGD("Received command: %s", args_to_string(args).c_str());
-
-            if (can_appsync) {
-                time_start_hook = util::current_time_ms();
-                handle_command(args);
-                time_stop_hook = util::current_time_ms();
-            }
-        } else {
-            LOGW("Unrecognized command: %s", args_to_string(args).c_str());
-        }
+    // Only hooked commands are tokenized
+    const CommandInfo *hook;
+    if (can_appsync && (hook = find_hook(msg.data()))) {
+        time_start_hook = current_time_us();
+        run_hook(hook, msg.data());
+        time_stop_hook = current_time_us();
     }
 
-    time_start_installd = util::current_time_ms();
-    if (!send_message(installd_fd, buf, is_async, async_id)) {
+    time_start_installd = current_time_us();
+    if (!send_message(installd_fd, msg)) {
         LOGE("Failed to send request to installd");
         return false;
     }
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, &async_id)) {
+    if (!receive_message(installd_fd, &msg, is_async)) {
         LOGE("Failed to receive reply from installd");
         return false;
     }
-    time_stop_installd = util::current_time_ms();
-
-    args = parse_args(buf);
+    time_stop_installd = current_time_us();
 
-    if (log_result) {
-        LOGD("Sending reply: %s", args_to_string(args).c_str());
+    if (cmd.log != CommandLog::None) {
+        LOGD("Sending reply: %s", msg.data());
     }
 
-    time_start_send = util::current_time_ms();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
+    if (!send_message(client_fd, msg)) {
         LOGE("Failed to send reply to client");
         return false;
     }
-    time_stop_send = util::current_time_ms();
 
-    time_stop = util::current_time_ms();
+    time_stop = current_time_us();
 
-    if (log_result) {
-        LOGD("Command stats:");
-        LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-             time_stop_send - time_start_send);
-        LOGD("- Time to complete installd command:   %" PRIu64 "ms",
-             time_stop_installd - time_start_installd);
-        if (can_appsync) {
-            LOGD("- Time to hook installd command:       %" PRIu64 "ms",
-                 time_stop_hook - time_start_hook);
-        }
-        LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-             time_stop - time_start);
-        LOGD("---");
+    if (cmd.log != CommandLog::None) {
+        LOGD("Command took %" PRIu64 "us (installd: %" PRIu64 "us,"
+             " hook: %" PRIu64 "us)", time_stop - time_start,
+             time_stop_installd - time_start_installd,
+             time_stop_hook - time_start_hook);
     }
 
+    record_command_stats(index, time_stop_installd - time_start_installd);
+
     return true;
 }
 
@@ -739,6 +793,7 @@ static bool proxy_process(int fd, bool can_appsync)
         auto close_client_fd = util::finally([&]{
             LOGD("Closing client connection");
             close(client_fd);
+            dump_command_stats();
         });
 
         LOGD("Accepted new client connection");
@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpio_file.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include <archive.h>
+
+#include "mblog/logging.h"
+
+#include "mbutil/file.h"
+
+typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
+
+namespace mb
+{
+
+static std::string normalize_path(const char *path)
+{
+    while (true) {
+        if (path[0] == '/') {
+            ++path;
+        } else if (path[0] == '.' && path[1] == '/') {
+            path += 2;
+        } else {
+            break;
+        }
+    }
+
+    std::string result(path);
+    while (!result.empty() && result.back() == '/') {
+        result.pop_back();
+    }
+
+    return result;
+}
+
+CpioFile::CpioFile() : _format(ARCHIVE_FORMAT_CPIO_SVR4_NOCRC)
+{
+}
+
+CpioFile::~CpioFile()
+{
+}
+
+/*!
+ * \brief Load all entries from a cpio archive in memory
+ *
+ * The existing entries are discarded.
+ */
+bool CpioFile::load(const void *data, size_t size)
+{
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    archive_entry *entry;
+    int ret;
+
+    if (!a) {
+        LOGE("Failed to allocate archive reader instance");
+        return false;
+    }
+
+    archive_read_support_filter_gzip(a.get());
+    archive_read_support_filter_lzop(a.get());
+    archive_read_support_filter_lz4(a.get());
+    archive_read_support_filter_lzma(a.get());
+    archive_read_support_filter_xz(a.get());
+    archive_read_support_format_cpio(a.get());
+
+    if (archive_read_open_memory(a.get(), data, size) != ARCHIVE_OK) {
+        LOGE("Failed to open cpio archive: %s", archive_error_string(a.get()));
+        return false;
+    }
+
+    _entries.clear();
+
+    while (true) {
+        ret = archive_read_next_header(a.get(), &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("Failed to read header: %s", archive_error_string(a.get()));
+            return false;
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        if (!path || !*path) {
+            LOGE("Header has null or empty filename");
+            return false;
+        }
+
+        std::string relpath = normalize_path(path);
+        if (relpath.empty() || relpath == ".") {
+            // Skip the root of the directory tree
+            continue;
+        }
+
+        Entry item{{archive_entry_clone(entry), archive_entry_free}, {}};
+        if (!item.entry) {
+            LOGE("Failed to allocate archive entry");
+            return false;
+        }
+
+        archive_entry_set_pathname(item.entry.get(), relpath.c_str());
+
+        if (archive_entry_filetype(entry) == AE_IFREG) {
+            char buf[10240];
+            la_ssize_t n;
+
+            while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
+                item.data.insert(item.data.end(), buf, buf + n);
+            }
+
+            if (n < 0) {
+                LOGE("%s: Failed to read archive entry data: %s",
+                     relpath.c_str(), archive_error_string(a.get()));
+                return false;
+            }
+        }
+
+        _entries.push_back(std::move(item));
+    }
+
+    // Save format
+    _format = archive_format(a.get());
+    _filters.clear();
+    for (int i = 0; i < archive_filter_count(a.get()); ++i) {
+        int code = archive_filter_code(a.get(), i);
+        if (code != ARCHIVE_FILTER_NONE) {
+            _filters.push_back(code);
+        }
+    }
+
+    if (archive_read_close(a.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close cpio archive: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    return true;
+}
+
+static la_ssize_t write_to_vector(archive *a, void *userdata,
+                                  const void *buf, size_t size)
+{
+    (void) a;
+
+    auto data = static_cast<std::vector<unsigned char> *>(userdata);
+    auto ptr = static_cast<const unsigned char *>(buf);
+    data->insert(data->end(), ptr, ptr + size);
+
+    return size;
+}
+
+/*!
+ * \brief Write all entries to a new cpio archive in memory
+ *
+ * The archive is compressed with the same filters as the loaded archive.
+ */
+bool CpioFile::save(std::vector<unsigned char> *data_out) const
+{
+    ScopedArchive a(archive_write_new(), archive_write_free);
+    std::vector<unsigned char> data;
+
+    if (!a) {
+        LOGE("Failed to allocate archive writer instance");
+        return false;
+    }
+
+    if (archive_write_set_format(a.get(), _format) != ARCHIVE_OK) {
+        LOGE("Failed to set output archive format: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+    for (const int &filter : _filters) {
+        if (archive_write_add_filter(a.get(), filter) != ARCHIVE_OK) {
+            LOGE("Failed to add output archive filter: %s",
+                 archive_error_string(a.get()));
+            return false;
+        }
+    }
+
+    archive_write_set_bytes_per_block(a.get(), 512);
+
+    if (archive_write_open(a.get(), &data, nullptr, &write_to_vector, nullptr)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open cpio archive for writing: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    for (const Entry &item : _entries) {
+        archive_entry *entry = item.entry.get();
+
+        if (archive_entry_filetype(entry) == AE_IFREG) {
+            archive_entry_set_size(entry, item.data.size());
+        } else {
+            archive_entry_set_size(entry, 0);
+        }
+
+        if (archive_write_header(a.get(), entry) != ARCHIVE_OK) {
+            LOGE("%s: Failed to write header: %s",
+                 archive_entry_pathname(entry), archive_error_string(a.get()));
+            return false;
+        }
+
+        if (!item.data.empty() && archive_write_data(
+                a.get(), item.data.data(), item.data.size())
+                != static_cast<la_ssize_t>(item.data.size())) {
+            LOGE("%s: Failed to write archive entry data: %s",
+                 archive_entry_pathname(entry), archive_error_string(a.get()));
+            return false;
+        }
+    }
+
+    if (archive_write_close(a.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close cpio archive: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    data_out->swap(data);
+
+    return true;
+}
+
+CpioFile::Entry * CpioFile::find(const std::string &path)
+{
+    for (Entry &item : _entries) {
+        if (path == archive_entry_pathname(item.entry.get())) {
+            return &item;
+        }
+    }
+
+    return nullptr;
+}
+
+const CpioFile::Entry * CpioFile::find(const std::string &path) const
+{
+    return const_cast<CpioFile *>(this)->find(path);
+}
+
+/*!
+ * \brief Create entries for the parent directories of a path if needed
+ */
+bool CpioFile::add_parents(const std::string &path)
+{
+    std::size_t pos = 0;
+
+    while ((pos = path.find('/', pos)) != std::string::npos) {
+        std::string parent = path.substr(0, pos++);
+        const Entry *item = find(parent);
+
+        if (!item) {
+            if (!add_entry(parent, AE_IFDIR | 0755)) {
+                return false;
+            }
+        } else if (archive_entry_filetype(item->entry.get()) != AE_IFDIR) {
+            LOGE("%s: Parent is not a directory", path.c_str());
+            errno = ENOTDIR;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Append a new entry owned by root
+ */
+CpioFile::Entry * CpioFile::add_entry(const std::string &path, mode_t mode)
+{
+    Entry item{{archive_entry_new(), archive_entry_free}, {}};
+    if (!item.entry) {
+        LOGE("Failed to allocate archive entry");
+        return nullptr;
+    }
+
+    archive_entry_set_pathname(item.entry.get(), path.c_str());
+    archive_entry_set_mode(item.entry.get(), mode);
+    archive_entry_set_uid(item.entry.get(), 0);
+    archive_entry_set_gid(item.entry.get(), 0);
+    archive_entry_set_nlink(item.entry.get(), 1);
+
+    _entries.push_back(std::move(item));
+    return &_entries.back();
+}
+
+bool CpioFile::exists(const std::string &path) const
+{
+    return find(path) != nullptr;
+}
+
+bool CpioFile::is_regular_file(const std::string &path) const
+{
+    const Entry *item = find(path);
+    return item && archive_entry_filetype(item->entry.get()) == AE_IFREG;
+}
+
+/*!
+ * \brief Get the contents of a regular file
+ */
+bool CpioFile::contents(const std::string &path,
+                        std::vector<unsigned char> *data_out) const
+{
+    const Entry *item = find(path);
+    if (!item) {
+        LOGE("%s: File does not exist in cpio archive", path.c_str());
+        errno = ENOENT;
+        return false;
+    } else if (archive_entry_filetype(item->entry.get()) != AE_IFREG) {
+        LOGE("%s: Not a regular file", path.c_str());
+        errno = EINVAL;
+        return false;
+    }
+
+    *data_out = item->data;
+    return true;
+}
+
+/*!
+ * \brief Set the contents of a regular file
+ *
+ * If the file exists, its metadata is kept. Otherwise, a new file (and its
+ * parent directories) will be created with 0644 permissions. Non-regular files
+ * at \p path are replaced.
+ */
+bool CpioFile::set_contents(const std::string &path,
+                            std::vector<unsigned char> data)
+{
+    Entry *item = find(path);
+
+    if (item && archive_entry_filetype(item->entry.get()) != AE_IFREG) {
+        if (!remove(path)) {
+            return false;
+        }
+        item = nullptr;
+    }
+
+    if (!item) {
+        if (!add_parents(path)) {
+            return false;
+        }
+
+        item = add_entry(path, AE_IFREG | 0644);
+        if (!item) {
+            return false;
+        }
+    }
+
+    item->data.swap(data);
+    return true;
+}
+
+/*!
+ * \brief Add or replace a regular file with the contents of a file on disk
+ */
+bool CpioFile::add_file(const std::string &path, const std::string &source)
+{
+    std::vector<unsigned char> data;
+
+    if (!util::file_read_all(source, &data)) {
+        LOGE("%s: Failed to read file: %s", source.c_str(), strerror(errno));
+        return false;
+    }
+
+    return set_contents(path, std::move(data));
+}
+
+/*!
+ * \brief Add or replace a symlink
+ */
+bool CpioFile::add_symlink(const std::string &path, const std::string &target)
+{
+    if (exists(path) && !remove(path)) {
+        return false;
+    }
+
+    if (!add_parents(path)) {
+        return false;
+    }
+
+    Entry *item = add_entry(path, AE_IFLNK | 0777);
+    if (!item) {
+        return false;
+    }
+
+    archive_entry_set_symlink(item->entry.get(), target.c_str());
+    return true;
+}
+
+bool CpioFile::set_perms(const std::string &path, mode_t perms)
+{
+    Entry *item = find(path);
+    if (!item) {
+        LOGE("%s: File does not exist in cpio archive", path.c_str());
+        errno = ENOENT;
+        return false;
+    }
+
+    archive_entry_set_perm(item->entry.get(), perms);
+    return true;
+}
+
+/*!
+ * \brief Rename a file
+ *
+ * Only non-directory entries can be renamed. The target must not exist.
+ */
+bool CpioFile::rename(const std::string &old_path,
+                      const std::string &new_path)
+{
+    Entry *item = find(old_path);
+    if (!item) {
+        LOGE("%s: File does not exist in cpio archive", old_path.c_str());
+        errno = ENOENT;
+        return false;
+    } else if (archive_entry_filetype(item->entry.get()) == AE_IFDIR) {
+        LOGE("%s: Cannot rename directory", old_path.c_str());
+        errno = EISDIR;
+        return false;
+    } else if (exists(new_path)) {
+        LOGE("%s: File already exists in cpio archive", new_path.c_str());
+        errno = EEXIST;
+        return false;
+    }
+
+    archive_entry_set_pathname(item->entry.get(), new_path.c_str());
+    return true;
+}
+
+/*!
+ * \brief Remove a file
+ *
+ * Only non-directory entries can be removed.
+ */
+bool CpioFile::remove(const std::string &path)
+{
+    for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+        if (path != archive_entry_pathname(it->entry.get())) {
+            continue;
+        }
+
+        if (archive_entry_filetype(it->entry.get()) == AE_IFDIR) {
+            LOGE("%s: Cannot remove directory", path.c_str());
+            errno = EISDIR;
+            return false;
+        }
+
+        _entries.erase(it);
+        return true;
+    }
+
+    LOGE("%s: File does not exist in cpio archive", path.c_str());
+    errno = ENOENT;
+    return false;
+}
+
+}
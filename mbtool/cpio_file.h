@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <archive_entry.h>
+
+namespace mb
+{
+
+/*!
+ * \brief In-memory cpio archive
+ *
+ * The entries of a (possibly compressed) cpio archive are loaded into memory
+ * so that they can be modified without extracting the archive to disk. When
+ * the archive is written, the compression format and filters of the original
+ * archive are used.
+ *
+ * Paths are relative to the root of the archive and do not have a leading
+ * "./" or "/".
+ */
+class CpioFile
+{
+public:
+    CpioFile();
+    ~CpioFile();
+
+    bool load(const void *data, size_t size);
+    bool save(std::vector<unsigned char> *data_out) const;
+
+    bool exists(const std::string &path) const;
+    bool is_regular_file(const std::string &path) const;
+
+    bool contents(const std::string &path,
+                  std::vector<unsigned char> *data_out) const;
+    bool set_contents(const std::string &path,
+                      std::vector<unsigned char> data);
+    bool add_file(const std::string &path, const std::string &source);
+    bool add_symlink(const std::string &path, const std::string &target);
+    bool set_perms(const std::string &path, mode_t perms);
+    bool rename(const std::string &old_path, const std::string &new_path);
+    bool remove(const std::string &path);
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<archive_entry, decltype(archive_entry_free) *> entry;
+        std::vector<unsigned char> data;
+    };
+
+    std::vector<Entry> _entries;
+    int _format;
+    std::vector<int> _filters;
+
+    Entry * find(const std::string &path);
+    const Entry * find(const std::string &path) const;
+    Entry * add_entry(const std::string &path, mode_t mode);
+    bool add_parents(const std::string &path);
+
+    CpioFile(const CpioFile &) = delete;
+    CpioFile & operator=(const CpioFile &) = delete;
+};
+
+}
@@ -583,7 +583,13 @@ bool Installer::extract_multiboot_files()
         });
     }
 
-    if (!util::extract_files2(_zip_file, files)) {
+    bool extracted;
+    if (_zip_index.is_open()) {
+        extracted = _zip_index.extract_files(files);
+    } else {
+        extracted = util::extract_files2(_zip_file, files);
+    }
+    if (!extracted) {
         LOGE("Failed to extract all multiboot files");
         return false;
     }
@@ -1269,7 +1275,19 @@ Installer::ProceedState Installer::install_stage_initialize()
         { "system.img", false },
         { "system.img.sparse", false },
     };
-    if (!util::archive_exists(_zip_file, info)) {
+    // Read the zip's central directory once so that later stages can find and
+    // extract files without reading through the entire zip
+    if (!_zip_index.open(_zip_file)) {
+        LOGW("Failed to index zip file; falling back to sequential reads");
+    }
+
+    bool read_ok;
+    if (_zip_index.is_open()) {
+        read_ok = _zip_index.exists_files(info);
+    } else {
+        read_ok = util::archive_exists(_zip_file, info);
+    }
+    if (!read_ok) {
         LOGE("Failed to read zip file");
     } else {
         _has_block_image = false;
@@ -1323,6 +1341,9 @@ Installer::ProceedState Installer::install_stage_set_up_environment()
         return ProceedState::Fail;
     }
 
+    // Nothing else reads from the zip directly
+    _zip_index.close();
+
     // Load info.prop
     if (!util::file_get_all_properties(_temp + "/info.prop", &_prop)) {
         display_msg("Failed to read multiboot/info.prop");
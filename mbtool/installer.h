@@ -28,6 +28,7 @@
 #include "mbutil/hash.h"
 
 #include "roms.h"
+#include "zip_index.h"
 
 namespace mb
 {
@@ -75,6 +76,8 @@ protected:
     virtual void on_cleanup(ProceedState ret);
 
     std::string _zip_file;
+    // Central directory index of _zip_file shared by the installation stages
+    ZipIndex _zip_index;
     std::string _chroot;
     std::string _temp;
     int _interface;
@@ -19,302 +19,122 @@
 
 #include "installer_util.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <sys/stat.h>
 
-#include <archive.h>
-#include <archive_entry.h>
-
 #include "mbbootimg/entry.h"
-#include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
+#include "mbbootimg/transform.h"
 #include "mbbootimg/writer.h"
 
-#include "mbcommon/file.h"
-#include "mbcommon/file_util.h"
-#include "mbcommon/file/filename.h"
-#include "mbcommon/string.h"
+#include "mbcommon/libc/string.h"
 
 #include "mblog/logging.h"
 
-#include "mbutil/delete.h"
-#include "mbutil/finally.h"
-#include "mbutil/path.h"
-
-#include "bootimg_util.h"
+#include "cpio_file.h"
 #include "multiboot.h"
 
-typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
-typedef std::unique_ptr<archive_entry, decltype(archive_entry_free) *> ScopedArchiveEntry;
 typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
-typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedMbFile;
 typedef std::unique_ptr<MbBiReader, decltype(mb_bi_reader_free) *> ScopedReader;
 typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
 
 namespace mb
 {
 
-bool InstallerUtil::unpack_ramdisk(const std::string &input_file,
-                                   const std::string &output_dir,
-                                   int &format_out,
-                                   std::vector<int> &filters_out)
+/*!
+ * \brief Replace a malloc()'d entry buffer with the contents of a vector
+ */
+static bool replace_buffer(const std::vector<unsigned char> &buf,
+                           void **data, size_t *size)
 {
-    ScopedArchive ain(archive_read_new(), archive_read_free);
-    ScopedArchive aout(archive_write_disk_new(), archive_write_free);
-    archive_entry *entry;
-    std::string target_path;
-    int ret;
-
-    if (!ain || !aout) {
-        LOGE("Failed to allocate archive reader or writer instance");
+    void *new_data = realloc(*data, std::max<size_t>(buf.size(), 1));
+    if (!new_data) {
+        LOGE("Failed to allocate entry buffer: %s", strerror(errno));
         return false;
     }
 
-    archive_read_support_filter_gzip(ain.get());
-    archive_read_support_filter_lzop(ain.get());
-    archive_read_support_filter_lz4(ain.get());
-    archive_read_support_filter_lzma(ain.get());
-    archive_read_support_filter_xz(ain.get());
-    archive_read_support_format_cpio(ain.get());
-
-    // Set up disk writer parameters
-    archive_write_disk_set_standard_lookup(aout.get());
-    archive_write_disk_set_options(aout.get(),
-                                   ARCHIVE_EXTRACT_TIME
-                                 | ARCHIVE_EXTRACT_SECURE_SYMLINKS
-                                 | ARCHIVE_EXTRACT_SECURE_NODOTDOT
-                                 | ARCHIVE_EXTRACT_OWNER
-                                 | ARCHIVE_EXTRACT_PERM);
-
-    if (archive_read_open_filename(ain.get(), input_file.c_str(), 10240)
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    while (true) {
-        ret = archive_read_next_header(ain.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            continue;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read header: %s",
-                 input_file.c_str(), archive_error_string(ain.get()));
-            return false;
-        }
-
-        const char *path = archive_entry_pathname(entry);
-        if (!path || !*path) {
-            LOGE("%s: Header has null or empty filename", input_file.c_str());
-            return false;
-        }
-
-        // Build path
-        target_path = output_dir;
-        if (!target_path.empty() && target_path.back() != '/' && *path != '/') {
-            target_path += '/';
-        }
-        target_path += path;
-
-        archive_entry_set_pathname(entry, target_path.c_str());
-
-        // Extract file
-        ret = archive_read_extract2(ain.get(), entry, aout.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", archive_entry_pathname(entry),
-                 archive_error_string(ain.get()));
-            return false;
-        }
-    }
-
-    // Save format
-    format_out = archive_format(ain.get());
-    filters_out.clear();
-    for (int i = 0; i < archive_filter_count(ain.get()); ++i) {
-        int code = archive_filter_code(ain.get(), i);
-        if (code != ARCHIVE_FILTER_NONE) {
-            filters_out.push_back(code);
-        }
-    }
-
-    if (archive_read_close(ain.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
+    memcpy(new_data, buf.data(), buf.size());
+    *data = new_data;
+    *size = buf.size();
 
     return true;
 }
 
-static int metadata_filter(archive *a, void *data, archive_entry *entry)
-{
-    (void) data;
-    (void) entry;
-
-    if (archive_read_disk_can_descend(a)) {
-        archive_read_disk_descend(a);
-    }
-    return 1;
-}
-
-bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
-                                 const std::string &output_file,
-                                 int format,
-                                 const std::vector<int> &filters)
+/*!
+ * \brief Read a file into a malloc()'d buffer for mb_bi_transform()
+ */
+static bool read_file_to_buffer(const char *path, void **data, size_t *size)
 {
-    ScopedArchive ain(archive_read_disk_new(), archive_read_free);
-    ScopedArchive aout(archive_write_new(), archive_write_free);
-    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
-    std::string full_path;
-    int ret;
-
-    if (!ain || !aout || !entry) {
-        LOGE("Failed to allocate archive reader, writer, or entry instance");
-        return false;
-    }
-
-    // Set up disk reader parameters
-    archive_read_disk_set_symlink_physical(ain.get());
-    archive_read_disk_set_metadata_filter_callback(
-            ain.get(), metadata_filter, nullptr);
-    // We don't want to look up usernames and group names on Android
-    //archive_read_disk_set_standard_lookup(in.get());
-
-    if (archive_write_set_format(aout.get(), format) != ARCHIVE_OK) {
-        LOGE("Failed to set output archive format: %s",
-             archive_error_string(aout.get()));
+    ScopedFILE fp(fopen(path, "rb"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for reading: %s", path, strerror(errno));
         return false;
     }
-    for (const int &filter : filters) {
-        if (archive_write_add_filter(aout.get(), filter) != ARCHIVE_OK) {
-            LOGE("Failed to add output archive filter: %s",
-                 archive_error_string(aout.get()));
-            return false;
-        }
-    }
 
-    archive_write_set_bytes_per_block(aout.get(), 512);
+    std::vector<unsigned char> buf;
+    unsigned char chunk[10240];
+    size_t n;
 
-    // Open output file
-    if (archive_write_open_filename(aout.get(), output_file.c_str())
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), archive_error_string(aout.get()));
-        return false;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp.get())) > 0) {
+        buf.insert(buf.end(), chunk, chunk + n);
     }
 
-    ret = archive_read_disk_open(ain.get(), input_dir.c_str());
-    if (ret != ARCHIVE_OK) {
-        LOGE("%s: %s", input_dir.c_str(), archive_error_string(ain.get()));
+    if (ferror(fp.get())) {
+        LOGE("%s: Failed to read file: %s", path, strerror(errno));
         return false;
     }
 
-    while (true) {
-        // libarchive doesn't clear the entry automatically
-        archive_entry_clear(entry.get());
+    return replace_buffer(buf, data, size);
+}
 
-        ret = archive_read_next_header2(ain.get(), entry.get());
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read next header: %s", input_dir.c_str(),
-                 archive_error_string(ain.get()));
-            return false;
-        }
+static int patch_boot_image_entry(int type, void **data, size_t *size,
+                                  void *userdata)
+{
+    auto rps = static_cast<std::vector<std::function<RamdiskPatcherFn>> *>(
+            userdata);
 
-        if (archive_entry_filetype(entry.get()) != AE_IFREG) {
-            archive_entry_set_size(entry.get(), 0);
-        }
+    if (type == MB_BI_ENTRY_ABOOT) {
+        // Special case for loki aboot
+        free(*data);
+        *data = nullptr;
+        *size = 0;
 
-        const char *curpath = archive_entry_pathname(entry.get());
-        if (curpath && !input_dir.empty()) {
-            std::string relpath;
-            if (!util::relative_path(curpath, input_dir, &relpath)) {
-                LOGE("Failed to compute relative path of %s starting at %s: %s",
-                     curpath, input_dir.c_str(), strerror(errno));
-                return false;
-            }
-            if (relpath.empty()) {
-                // If the relative path is empty, then the current path is
-                // the root of the directory tree. We don't need that, so
-                // skip it.
-                continue;
-            }
-            archive_entry_set_pathname(entry.get(), relpath.c_str());
+        if (!read_file_to_buffer(ABOOT_PARTITION, data, size)) {
+            return MB_BI_FAILED;
         }
-
-        ret = archive_write_header(aout.get(), entry.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", output_file.c_str(),
-                 archive_error_string(aout.get()));
-            return false;
+    } else if (!*data) {
+        LOGV("Skipping non existent boot image entry: %d", type);
+    } else if (type == MB_BI_ENTRY_RAMDISK) {
+        auto ptr = static_cast<unsigned char *>(*data);
+        std::vector<unsigned char> ramdisk(ptr, ptr + *size);
+
+        if (!InstallerUtil::patch_ramdisk(ramdisk, 0, *rps)
+                || !replace_buffer(ramdisk, data, size)) {
+            return MB_BI_FAILED;
         }
-
-        char buf[10240];
-        la_ssize_t n;
-
-        if (archive_entry_size(entry.get()) > 0) {
-            while ((n = archive_read_data(ain.get(), buf, sizeof(buf))) > 0) {
-                if (archive_write_data(aout.get(), buf, n) != n) {
-                    LOGE("Failed to write archive entry data: %s",
-                         archive_error_string(aout.get()));
-                    return false;
-                }
-            }
-
-            if (n < 0) {
-                LOGE("Failed to read archive entry data: %s",
-                     archive_error_string(ain.get()));
-                return false;
-            }
+    } else if (type == MB_BI_ENTRY_KERNEL) {
+        if (!InstallerUtil::patch_kernel_rkp(*data, *size)) {
+            return MB_BI_FAILED;
         }
     }
 
-    archive_read_close(ain.get());
-
-    if (archive_write_close(aout.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
-    return true;
+    return MB_BI_OK;
 }
 
 bool InstallerUtil::patch_boot_image(const std::string &input_file,
                                      const std::string &output_file,
                                      std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
-    char *tmpdir = mb_format("%s.XXXXXX", output_file.c_str());
-    if (!tmpdir) {
-        LOGE("Out of memory");
-        return false;
-    }
-
-    auto free_temp_dir = util::finally([&]{
-        free(tmpdir);
-    });
-
-    if (!mkdtemp(tmpdir)) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto delete_temp_dir = util::finally([&]{
-        util::delete_recursive(tmpdir);
-    });
-
     ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
     ScopedWriter biw(mb_bi_writer_new(), &mb_bi_writer_free);
-    MbBiHeader *header;
-    MbBiEntry *in_entry;
-    MbBiEntry *out_entry;
     int ret;
 
     if (!bir || !biw) {
@@ -357,102 +177,19 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
     LOGD("- Output: %s", output_file.c_str());
     LOGD("- Format: %s", mb_bi_reader_format_name(bir.get()));
 
-    // Copy header
-    ret = mb_bi_reader_read_header(bir.get(), &header);
+    // The kernel and ramdisk are patched in memory and all other entries are
+    // copied directly
+    ret = mb_bi_transform(bir.get(), biw.get(),
+                          MB_BI_ENTRY_KERNEL
+                        | MB_BI_ENTRY_RAMDISK
+                        | MB_BI_ENTRY_ABOOT,
+                          &patch_boot_image_entry, &rps);
     if (ret != MB_BI_OK) {
-        LOGE("%s: Failed to read header: %s",
-             input_file.c_str(), mb_bi_reader_error_string(bir.get()));
-        return false;
-    }
-    ret = mb_bi_writer_write_header(biw.get(), header);
-    if (ret != MB_BI_OK) {
-        LOGE("%s: Failed to write header: %s",
+        LOGE("%s: Failed to patch boot image: %s",
              output_file.c_str(), mb_bi_writer_error_string(biw.get()));
         return false;
     }
 
-    // Write entries
-    while ((ret = mb_bi_writer_get_entry(biw.get(), &out_entry)) == MB_BI_OK) {
-        int type = mb_bi_entry_type(out_entry);
-
-        // Write entry metadata
-        ret = mb_bi_writer_write_entry(biw.get(), out_entry);
-        if (ret != MB_BI_OK) {
-            LOGE("%s: Failed to write entry: %s",
-                 output_file.c_str(), mb_bi_writer_error_string(biw.get()));
-            return false;
-        }
-
-        // Special case for loki aboot
-        if (type == MB_BI_ENTRY_ABOOT) {
-            if (bi_copy_file_to_data(ABOOT_PARTITION, biw.get())) {
-                return false;
-            }
-        } else {
-            ret = mb_bi_reader_go_to_entry(bir.get(), &in_entry, type);
-            if (ret == MB_BI_EOF) {
-                LOGV("Skipping non existent boot image entry: %d", type);
-                continue;
-            } else if (ret != MB_BI_OK) {
-                LOGE("%s: Failed to go to entry: %d: %s",
-                     input_file.c_str(), type,
-                     mb_bi_reader_error_string(bir.get()));
-                return false;
-            }
-
-            if (type == MB_BI_ENTRY_RAMDISK) {
-                std::string ramdisk_in(tmpdir);
-                ramdisk_in += "/ramdisk.in";
-                std::string ramdisk_out(tmpdir);
-                ramdisk_out += "/ramdisk.out";
-
-                auto delete_temp_files = util::finally([&]{
-                    unlink(ramdisk_in.c_str());
-                    unlink(ramdisk_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(bir.get(), ramdisk_in)) {
-                    return false;
-                }
-
-                if (!patch_ramdisk(ramdisk_in, ramdisk_out, 0, rps)) {
-                    return false;
-                }
-
-                if (!bi_copy_file_to_data(ramdisk_out, biw.get())) {
-                    return false;
-                }
-            } else if (type == MB_BI_ENTRY_KERNEL) {
-                std::string kernel_in(tmpdir);
-                kernel_in += "/kernel.in";
-                std::string kernel_out(tmpdir);
-                kernel_out += "/kernel.out";
-
-                auto delete_temp_files = util::finally([&]{
-                    unlink(kernel_in.c_str());
-                    unlink(kernel_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(bir.get(), kernel_in)) {
-                    return false;
-                }
-
-                if (!patch_kernel_rkp(kernel_in, kernel_out)) {
-                    return false;
-                }
-
-                if (!bi_copy_file_to_data(kernel_out, biw.get())) {
-                    return false;
-                }
-            } else {
-                // Copy entry directly
-                if (!bi_copy_data_to_data(bir.get(), biw.get())) {
-                    return false;
-                }
-            }
-        }
-    }
-
     if (mb_bi_writer_close(biw.get()) != MB_BI_OK) {
         LOGE("%s: Failed to close boot image: %s",
              output_file.c_str(), mb_bi_writer_error_string(biw.get()));
@@ -462,8 +199,7 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
     return true;
 }
 
-bool InstallerUtil::patch_ramdisk(const std::string &input_file,
-                                  const std::string &output_file,
+bool InstallerUtil::patch_ramdisk(std::vector<unsigned char> &data,
                                   unsigned int depth,
                                   std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
@@ -472,58 +208,33 @@ bool InstallerUtil::patch_ramdisk(const std::string &input_file,
         return true;
     }
 
-    char *tmpdir = mb_format("%s.XXXXXX", output_file.c_str());
-    if (!tmpdir) {
-        LOGE("Out of memory");
-        return false;
-    }
-
-    auto free_temp_dir = util::finally([&]{
-        free(tmpdir);
-    });
-
-    if (!mkdtemp(tmpdir)) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto delete_temp_dir = util::finally([&]{
-        util::delete_recursive(tmpdir);
-    });
+    CpioFile cpio;
 
-    int format;
-    std::vector<int> filters;
-
-    // Extract ramdisk
-    if (!unpack_ramdisk(input_file, tmpdir, format, filters)) {
+    if (!cpio.load(data.data(), data.size())) {
         return false;
     }
 
     // Patch ramdisk
-    std::string nested(tmpdir);
-    nested += "/sbin/ramdisk.cpio";
-    struct stat sb;
-    bool ret;
+    if (cpio.is_regular_file("sbin/ramdisk.cpio")) {
+        std::vector<unsigned char> nested;
 
-    if (stat(nested.c_str(), &sb) == 0) {
-        ret = patch_ramdisk(nested, nested, depth + 1, rps);
-    } else {
-        ret = patch_ramdisk_dir(tmpdir, rps);
-    }
-
-    // Pack ramdisk
-    if (!pack_ramdisk(tmpdir, output_file, format, filters)) {
+        if (!cpio.contents("sbin/ramdisk.cpio", &nested)
+                || !patch_ramdisk(nested, depth + 1, rps)
+                || !cpio.set_contents("sbin/ramdisk.cpio", std::move(nested))) {
+            return false;
+        }
+    } else if (!patch_ramdisk_cpio(cpio, rps)) {
         return false;
     }
 
-    return ret;
+    return cpio.save(&data);
 }
 
-bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                      std::vector<std::function<RamdiskPatcherFn>> &rps)
+bool InstallerUtil::patch_ramdisk_cpio(CpioFile &cpio,
+                                       std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
     for (auto const &rp : rps) {
-        if (!rp(ramdisk_dir)) {
+        if (!rp(cpio)) {
             return false;
         }
     }
@@ -531,8 +242,7 @@ bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
     return true;
 }
 
-bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
-                                     const std::string &output_file)
+bool InstallerUtil::patch_kernel_rkp(void *data, size_t size)
 {
     // We'll use SuperSU's patch for negating the effects of
     // CONFIG_RKP_NS_PROT=y in newer Samsung kernels. This kernel feature
@@ -558,93 +268,16 @@ bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
         0x40, 0xB9, 0x1F, 0xA0, 0x0F, 0x71, 0x81, 0x01, 0x00, 0x54,
     };
 
-    ScopedMbFile fin(mb_file_new(), &mb_file_free);
-    ScopedMbFile fout(mb_file_new(), &mb_file_free);
-    // TODO: Replace with std::optional after switching to C++17
-    std::pair<bool, uint64_t> offset;
-    int ret;
-
-    if (!fin || !fout) {
-        LOGE("Failed to allocate input or output MbFile handle");
-        return false;
-    }
-
-    // Open input file
-    if (mb_file_open_filename(fin.get(), input_file.c_str(),
-                              MB_FILE_OPEN_READ_ONLY) != MB_FILE_OK) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), mb_file_error_string(fin.get()));
-        return false;
-    }
-
-    // Open output file
-    if (mb_file_open_filename(fout.get(), output_file.c_str(),
-                              MB_FILE_OPEN_WRITE_ONLY) != MB_FILE_OK) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), mb_file_error_string(fout.get()));
-        return false;
-    }
-
-    // Replace pattern
-    auto result_cb = [](MbFile *file, void *userdata, uint64_t offset) -> int {
-        (void) file;
-        std::pair<bool, uint64_t> *ptr =
-                static_cast<std::pair<bool, uint64_t> *>(userdata);
-        ptr->first = true;
-        ptr->second = offset;
-        return MB_FILE_OK;
-    };
-
-    ret = mb_file_search(fin.get(), -1, -1, 0, source_pattern,
-                         sizeof(source_pattern), 1, result_cb, &offset);
-    if (ret < 0) {
-        LOGE("%s: Error when searching for pattern: %s",
-             input_file.c_str(), mb_file_error_string(fin.get()));
-        return false;
-    }
-
-    // Copy data
-    ret = mb_file_seek(fin.get(), 0, SEEK_SET, nullptr);
-    if (ret != MB_FILE_OK) {
-        LOGE("%s: Failed to seek to beginning: %s",
-             input_file.c_str(), mb_file_error_string(fin.get()));
-        return false;
-    }
-
-    if (offset.first) {
-        LOGD("RKP pattern found at offset: 0x%" PRIx64, offset.second);
-
-        if (!copy_file_to_file(fin.get(), fout.get(), offset.second)) {
-            return false;
-        }
-
-        ret = mb_file_seek(fin.get(), sizeof(source_pattern), SEEK_CUR,
-                           nullptr);
-        if (ret != MB_FILE_OK) {
-            LOGE("%s: Failed to skip pattern: %s",
-                 input_file.c_str(), mb_file_error_string(fin.get()));
-            return false;
-        }
-
-        size_t n;
-        ret = mb_file_write_fully(fout.get(), target_pattern,
-                                  sizeof(target_pattern), &n);
-        if (ret != MB_FILE_OK || n != sizeof(target_pattern)) {
-            LOGE("%s: Failed to write target pattern: %s",
-                 output_file.c_str(), mb_file_error_string(fout.get()));
-            return false;
-        }
-    }
-
-    if (!copy_file_to_file_eof(fin.get(), fout.get())) {
-        return false;
-    }
+    // The patterns have the same size, so the kernel is patched in place
+    void *match = mb_memmem(data, size, source_pattern,
+                            sizeof(source_pattern));
+    if (match) {
+        LOGD("RKP pattern found at offset: 0x%" PRIx64,
+             static_cast<uint64_t>(
+                     static_cast<unsigned char *>(match)
+                     - static_cast<unsigned char *>(data)));
 
-    ret = mb_file_close(fout.get());
-    if (ret != MB_FILE_OK) {
-        LOGE("%s: Failed to close file: %s",
-             output_file.c_str(), mb_file_error_string(fout.get()));
-        return false;
+        memcpy(match, target_pattern, sizeof(target_pattern));
     }
 
     return true;
@@ -686,58 +319,4 @@ bool InstallerUtil::replace_file(const std::string &replace,
     return true;
 }
 
-bool InstallerUtil::copy_file_to_file(MbFile *fin, MbFile *fout,
-                                      uint64_t to_copy)
-{
-    char buf[10240];
-    size_t n;
-    int ret;
-
-    while (to_copy > 0) {
-        size_t to_read = std::min<uint64_t>(to_copy, sizeof(buf));
-
-        ret = mb_file_read_fully(fin, buf, to_read, &n);
-        if (ret != MB_FILE_OK || n != to_read) {
-            LOGE("Failed to read data: %s", mb_file_error_string(fin));
-            return false;
-        }
-
-        ret = mb_file_write_fully(fout, buf, to_read, &n);
-        if (ret != MB_FILE_OK || n != to_read) {
-            LOGE("Failed to write data: %s", mb_file_error_string(fout));
-            return false;
-        }
-
-        to_copy -= to_read;
-    }
-
-    return true;
-}
-
-bool InstallerUtil::copy_file_to_file_eof(MbFile *fin, MbFile *fout)
-{
-    char buf[10240];
-    size_t n_read;
-    size_t n_written;
-    int ret;
-
-    while (true) {
-        ret = mb_file_read_fully(fin, buf, sizeof(buf), &n_read);
-        if (ret != MB_FILE_OK) {
-            LOGE("Failed to read data: %s", mb_file_error_string(fin));
-            return false;
-        } else if (n_read == 0) {
-            break;
-        }
-
-        ret = mb_file_write_fully(fout, buf, n_read, &n_written);
-        if (ret != MB_FILE_OK || n_written != n_read) {
-            LOGE("Failed to write data: %s", mb_file_error_string(fout));
-            return false;
-        }
-    }
-
-    return true;
-}
-
 }
@@ -22,11 +22,9 @@
 #include <string>
 #include <vector>
 
-#include "ramdisk_patcher.h"
+#include <cstddef>
 
-struct MbBiReader;
-struct MbBiWriter;
-struct MbFile;
+#include "ramdisk_patcher.h"
 
 namespace mb
 {
@@ -34,33 +32,18 @@ namespace mb
 class InstallerUtil
 {
 public:
-    static bool unpack_ramdisk(const std::string &input_file,
-                               const std::string &output_dir,
-                               int &format_out,
-                               std::vector<int> &filters_out);
-    static bool pack_ramdisk(const std::string &input_dir,
-                             const std::string &output_file,
-                             int format,
-                             const std::vector<int> &filters);
-
     static bool patch_boot_image(const std::string &input_file,
                                  const std::string &output_file,
                                  std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk(const std::string &input_file,
-                              const std::string &output_file,
+    static bool patch_ramdisk(std::vector<unsigned char> &data,
                               unsigned int depth,
                               std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                  std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_kernel_rkp(const std::string &input_file,
-                                 const std::string &output_file);
+    static bool patch_ramdisk_cpio(CpioFile &cpio,
+                                   std::vector<std::function<RamdiskPatcherFn>> &rps);
+    static bool patch_kernel_rkp(void *data, size_t size);
 
     static bool replace_file(const std::string &replace,
                              const std::string &with);
-
-private:
-    static bool copy_file_to_file(MbFile *fin, MbFile *fout, uint64_t to_copy);
-    static bool copy_file_to_file_eof(MbFile *fin, MbFile *fout);
 };
 
 }
@@ -22,13 +22,25 @@
 #include <algorithm>
 
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 
+#include <sys/stat.h>
+
 #include <pugixml.hpp>
 
 #include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/finally.h"
+
+#define XML_READ_BUF_SIZE               16384
+
+#define PACKAGES_CACHE_MAGIC            "MBPKGCC\0"
+#define PACKAGES_CACHE_VERSION          1
 
 
 namespace mb
@@ -558,6 +570,600 @@ static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs)
     return true;
 }
 
+// Streaming parser for load_xml_uids(). Only the tags are scanned, so no DOM
+// is built for the (potentially multi-megabyte) file.
+
+static bool is_xml_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+enum class XmlTagType
+{
+    Start,
+    End,
+    Empty,
+};
+
+struct XmlTag
+{
+    XmlTagType type;
+    std::string name;
+    // Raw attributes. Only valid until the next call to XmlTagReader::next()
+    const char *attrs;
+    size_t attrs_size;
+};
+
+class XmlTagReader
+{
+public:
+    explicit XmlTagReader(FILE *fp) : _fp(fp), _pos(0), _eof(false),
+            _error(false)
+    {
+    }
+
+    bool next(XmlTag *tag);
+
+    bool error() const
+    {
+        return _error;
+    }
+
+private:
+    FILE *_fp;
+    std::string _buf;
+    size_t _pos;
+    bool _eof;
+    bool _error;
+
+    bool fill();
+    size_t find(const char *delim, size_t from);
+    size_t find_tag_end();
+};
+
+/*!
+ * \brief Append more data from the file to the buffer
+ *
+ * \return Whether any data was added
+ */
+bool XmlTagReader::fill()
+{
+    if (_eof) {
+        return false;
+    }
+
+    char buf[XML_READ_BUF_SIZE];
+    size_t n = fread(buf, 1, sizeof(buf), _fp);
+    if (n < sizeof(buf)) {
+        _eof = true;
+        if (ferror(_fp)) {
+            LOGE("Failed to read XML file: %s", strerror(errno));
+            _error = true;
+            return false;
+        }
+    }
+
+    _buf.append(buf, n);
+    return n > 0;
+}
+
+size_t XmlTagReader::find(const char *delim, size_t from)
+{
+    size_t delim_size = strlen(delim);
+
+    while (true) {
+        size_t pos = _buf.find(delim, from);
+        if (pos != std::string::npos) {
+            return pos;
+        }
+
+        if (_buf.size() >= delim_size) {
+            from = std::max(from, _buf.size() - delim_size + 1);
+        }
+
+        if (!fill()) {
+            return std::string::npos;
+        }
+    }
+}
+
+/*!
+ * \brief Find the '>' that ends the tag at the beginning of the buffer
+ *
+ * '>' characters inside quoted attribute values are skipped.
+ */
+size_t XmlTagReader::find_tag_end()
+{
+    char quote = '\0';
+
+    for (size_t i = 1;; ++i) {
+        if (i == _buf.size() && !fill()) {
+            return std::string::npos;
+        }
+
+        char c = _buf[i];
+        if (quote) {
+            if (c == quote) {
+                quote = '\0';
+            }
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '>') {
+            return i;
+        }
+    }
+}
+
+/*!
+ * \brief Read the next start, end, or empty-element tag
+ *
+ * Text, comments, CDATA sections, processing instructions, and declarations
+ * are skipped.
+ *
+ * \return True if a tag was read. False if EOF was reached or an error
+ *         occurred, which can be distinguished with error().
+ */
+bool XmlTagReader::next(XmlTag *tag)
+{
+    _buf.erase(0, _pos);
+    _pos = 0;
+
+    while (true) {
+        size_t begin = _buf.find('<');
+        if (begin == std::string::npos) {
+            _buf.clear();
+            if (!fill()) {
+                return false;
+            }
+            continue;
+        }
+        _buf.erase(0, begin);
+
+        // Enough bytes to identify "<![CDATA["
+        while (_buf.size() < 9) {
+            if (!fill()) {
+                break;
+            }
+        }
+
+        const char *skip_until = nullptr;
+        if (_buf.compare(0, 4, "<!--") == 0) {
+            skip_until = "-->";
+        } else if (_buf.compare(0, 9, "<![CDATA[") == 0) {
+            skip_until = "]]>";
+        } else if (_buf.compare(0, 2, "<?") == 0) {
+            skip_until = "?>";
+        } else if (_buf.compare(0, 2, "<!") == 0) {
+            skip_until = ">";
+        }
+
+        if (skip_until) {
+            size_t end = find(skip_until, 2);
+            if (end == std::string::npos) {
+                _error = true;
+                return false;
+            }
+            _buf.erase(0, end + strlen(skip_until));
+            continue;
+        }
+
+        size_t end = find_tag_end();
+        if (end == std::string::npos) {
+            _error = true;
+            return false;
+        }
+        _pos = end + 1;
+
+        // Contents between '<' and '>'
+        const char *ptr = _buf.data() + 1;
+        const char *ptr_end = _buf.data() + end;
+
+        if (ptr != ptr_end && *ptr == '/') {
+            tag->type = XmlTagType::End;
+            ++ptr;
+        } else if (ptr != ptr_end && *(ptr_end - 1) == '/') {
+            tag->type = XmlTagType::Empty;
+            --ptr_end;
+        } else {
+            tag->type = XmlTagType::Start;
+        }
+
+        const char *name_end = ptr;
+        while (name_end != ptr_end && !is_xml_space(*name_end)) {
+            ++name_end;
+        }
+
+        if (name_end == ptr) {
+            _error = true;
+            return false;
+        }
+
+        tag->name.assign(ptr, name_end);
+        tag->attrs = name_end;
+        tag->attrs_size = ptr_end - name_end;
+
+        return true;
+    }
+}
+
+static void append_utf8(std::string *out, unsigned long c)
+{
+    if (c < 0x80) {
+        *out += static_cast<char>(c);
+    } else if (c < 0x800) {
+        *out += static_cast<char>(0xc0 | (c >> 6));
+        *out += static_cast<char>(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        *out += static_cast<char>(0xe0 | (c >> 12));
+        *out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+        *out += static_cast<char>(0x80 | (c & 0x3f));
+    } else {
+        *out += static_cast<char>(0xf0 | (c >> 18));
+        *out += static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+        *out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+        *out += static_cast<char>(0x80 | (c & 0x3f));
+    }
+}
+
+static std::string xml_unescape(const char *ptr, size_t size)
+{
+    static const struct {
+        const char *name;
+        char c;
+    } entities[] = {
+        { "lt;", '<' },
+        { "gt;", '>' },
+        { "amp;", '&' },
+        { "quot;", '"' },
+        { "apos;", '\'' },
+    };
+
+    std::string result;
+    result.reserve(size);
+
+    const char *end = ptr + size;
+    while (ptr != end) {
+        if (*ptr != '&') {
+            result += *ptr++;
+            continue;
+        }
+
+        const char *semicolon = static_cast<const char *>(
+                memchr(ptr, ';', end - ptr));
+        if (!semicolon) {
+            result.append(ptr, end);
+            break;
+        }
+
+        bool matched = false;
+
+        if (ptr[1] == '#') {
+            char *num_end;
+            unsigned long c = ptr[2] == 'x'
+                    ? strtoul(ptr + 3, &num_end, 16)
+                    : strtoul(ptr + 2, &num_end, 10);
+            if (num_end == semicolon && c <= 0x10ffff) {
+                append_utf8(&result, c);
+                matched = true;
+            }
+        } else {
+            for (auto const &entity : entities) {
+                size_t n = strlen(entity.name);
+                if (static_cast<size_t>(semicolon - ptr) == n
+                        && memcmp(ptr + 1, entity.name, n) == 0) {
+                    result += entity.c;
+                    matched = true;
+                    break;
+                }
+            }
+        }
+
+        if (matched) {
+            ptr = semicolon + 1;
+        } else {
+            result += *ptr++;
+        }
+    }
+
+    return result;
+}
+
+/*!
+ * \brief Parse the attributes of a <package> tag into \a pkg
+ *
+ * Only the fields needed for mapping package names to UIDs are parsed.
+ */
+static bool parse_package_uid_attrs(const char *ptr, const char *end,
+                                    Package *pkg)
+{
+    while (true) {
+        while (ptr != end && is_xml_space(*ptr)) {
+            ++ptr;
+        }
+        if (ptr == end) {
+            return true;
+        }
+
+        const char *name = ptr;
+        while (ptr != end && *ptr != '=' && !is_xml_space(*ptr)) {
+            ++ptr;
+        }
+        size_t name_size = ptr - name;
+
+        while (ptr != end && is_xml_space(*ptr)) {
+            ++ptr;
+        }
+        if (ptr == end || *ptr != '=') {
+            return false;
+        }
+        ++ptr;
+        while (ptr != end && is_xml_space(*ptr)) {
+            ++ptr;
+        }
+        if (ptr == end || (*ptr != '"' && *ptr != '\'')) {
+            return false;
+        }
+
+        const char *value = ptr + 1;
+        const char *value_end = static_cast<const char *>(
+                memchr(value, *ptr, end - value));
+        if (!value_end) {
+            return false;
+        }
+        ptr = value_end + 1;
+
+        auto name_is = [&](const char *attr) {
+            return strlen(attr) == name_size
+                    && memcmp(name, attr, name_size) == 0;
+        };
+
+        if (name_is(ATTR_NAME)) {
+            pkg->name = xml_unescape(value, value_end - value);
+        } else if (name_is(ATTR_SHARED_USER_ID)) {
+            pkg->shared_user_id = strtol(value, nullptr, 10);
+            pkg->is_shared_user = 1;
+        } else if (name_is(ATTR_USER_ID)) {
+            pkg->user_id = strtol(value, nullptr, 10);
+            pkg->is_shared_user = 0;
+        }
+    }
+}
+
+/*!
+ * \brief Load only the package names and UIDs from packages.xml
+ *
+ * Unlike load_xml(), the file is parsed as a stream of tags without building
+ * a DOM. Other package fields and the signatures are not loaded.
+ */
+bool Packages::load_xml_uids(const std::string &path)
+{
+    pkgs.clear();
+    sigs.clear();
+
+    FILE *fp = fopen(path.c_str(), "rbe");
+    if (!fp) {
+        LOGE("%s: Failed to open: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fp = util::finally([&]{
+        fclose(fp);
+    });
+
+    XmlTagReader reader(fp);
+    XmlTag tag;
+    std::vector<std::string> stack;
+
+    while (reader.next(&tag)) {
+        if (tag.type == XmlTagType::End) {
+            if (stack.empty() || stack.back() != tag.name) {
+                LOGE("%s: Unexpected closing tag: </%s>",
+                     path.c_str(), tag.name.c_str());
+                return false;
+            }
+            stack.pop_back();
+            continue;
+        }
+
+        if (stack.size() == 1 && stack[0] == TAG_PACKAGES
+                && tag.name == TAG_PACKAGE) {
+            std::shared_ptr<Package> pkg(new Package());
+
+            if (!parse_package_uid_attrs(tag.attrs, tag.attrs + tag.attrs_size,
+                                         pkg.get())) {
+                LOGE("%s: Malformed attributes in <%s>",
+                     path.c_str(), TAG_PACKAGE);
+                return false;
+            }
+
+            pkgs.push_back(std::move(pkg));
+        }
+
+        if (tag.type == XmlTagType::Start) {
+            stack.push_back(std::move(tag.name));
+        }
+    }
+
+    if (reader.error()) {
+        LOGE("%s: Failed to parse XML file", path.c_str());
+        return false;
+    } else if (!stack.empty()) {
+        LOGE("%s: Unclosed tag: <%s>", path.c_str(), stack.back().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Cache for load_uids_cached(). All integers are in host byte order since the
+// cache never leaves the device.
+
+struct PackagesCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t xml_size;
+    int64_t xml_mtime_sec;
+    int64_t xml_mtime_nsec;
+};
+
+struct PackagesCacheEntry
+{
+    int32_t user_id;
+    int32_t shared_user_id;
+    uint32_t is_shared_user;
+    uint32_t name_size;
+    // Followed by name (not NULL-terminated)
+};
+
+static void fill_cache_header(PackagesCacheHeader *header,
+                              const struct stat &sb, uint32_t count)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, PACKAGES_CACHE_MAGIC, sizeof(header->magic));
+    header->version = PACKAGES_CACHE_VERSION;
+    header->count = count;
+    header->xml_size = sb.st_size;
+    header->xml_mtime_sec = sb.st_mtim.tv_sec;
+    header->xml_mtime_nsec = sb.st_mtim.tv_nsec;
+}
+
+static bool read_packages_cache(const std::string &cache_path,
+                                const struct stat &sb, Packages *pkgs)
+{
+    std::vector<unsigned char> data;
+    if (!util::file_read_all(cache_path, &data)) {
+        return false;
+    }
+
+    PackagesCacheHeader expected;
+    PackagesCacheHeader header;
+
+    if (data.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    fill_cache_header(&expected, sb, header.count);
+    if (memcmp(&header, &expected, sizeof(header)) != 0) {
+        return false;
+    }
+
+    std::vector<std::shared_ptr<Package>> result;
+    result.reserve(header.count);
+
+    size_t pos = sizeof(header);
+
+    for (uint32_t i = 0; i < header.count; ++i) {
+        PackagesCacheEntry entry;
+
+        if (data.size() - pos < sizeof(entry)) {
+            return false;
+        }
+        memcpy(&entry, data.data() + pos, sizeof(entry));
+        pos += sizeof(entry);
+
+        if (data.size() - pos < entry.name_size) {
+            return false;
+        }
+
+        std::shared_ptr<Package> pkg(new Package());
+        pkg->name.assign(reinterpret_cast<const char *>(data.data() + pos),
+                         entry.name_size);
+        pkg->user_id = entry.user_id;
+        pkg->shared_user_id = entry.shared_user_id;
+        pkg->is_shared_user = entry.is_shared_user;
+        pos += entry.name_size;
+
+        result.push_back(std::move(pkg));
+    }
+
+    if (pos != data.size()) {
+        return false;
+    }
+
+    pkgs->pkgs.swap(result);
+    pkgs->sigs.clear();
+    return true;
+}
+
+static bool write_packages_cache(const std::string &cache_path,
+                                 const struct stat &sb, const Packages &pkgs)
+{
+    std::string data;
+
+    PackagesCacheHeader header;
+    fill_cache_header(&header, sb, pkgs.pkgs.size());
+    data.append(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    for (auto const &pkg : pkgs.pkgs) {
+        PackagesCacheEntry entry;
+        entry.user_id = pkg->user_id;
+        entry.shared_user_id = pkg->shared_user_id;
+        entry.is_shared_user = pkg->is_shared_user;
+        entry.name_size = pkg->name.size();
+
+        data.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        data += pkg->name;
+    }
+
+    // Replace atomically so that a partially written cache is never used
+    std::string temp_path(cache_path);
+    temp_path += ".tmp";
+
+    if (!util::mkdir_parent(cache_path, 0700)
+            || !util::file_write_data(temp_path, data.data(), data.size())) {
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), cache_path.c_str()) < 0) {
+        remove(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Load the package names and UIDs using a cache
+ *
+ * The cache at \a cache_path is used if it was created from a packages.xml
+ * file with the same size and modification time. Otherwise, the file is
+ * loaded with load_xml_uids() and the cache is rewritten.
+ */
+bool Packages::load_uids_cached(const std::string &path,
+                                const std::string &cache_path)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (read_packages_cache(cache_path, sb, this)) {
+        LOGD("%s: Loaded %zu packages from cache",
+             path.c_str(), pkgs.size());
+        return true;
+    }
+
+    if (!load_xml_uids(path)) {
+        return false;
+    }
+
+    // Don't cache the result if the file changed while it was being parsed
+    struct stat sb2;
+    if (stat(path.c_str(), &sb2) == 0
+            && sb2.st_size == sb.st_size
+            && sb2.st_mtim.tv_sec == sb.st_mtim.tv_sec
+            && sb2.st_mtim.tv_nsec == sb.st_mtim.tv_nsec
+            && !write_packages_cache(cache_path, sb, *this)) {
+        LOGW("%s: Failed to write packages cache", cache_path.c_str());
+    }
+
+    return true;
+}
+
 std::shared_ptr<Package> Packages::find_by_uid(uid_t uid) const
 {
     auto it = std::find_if(pkgs.begin(), pkgs.end(),
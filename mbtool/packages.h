@@ -153,6 +153,9 @@ public:
     std::unordered_map<std::string, std::string> sigs;
 
     bool load_xml(const std::string &path);
+    bool load_xml_uids(const std::string &path);
+    bool load_uids_cached(const std::string &path,
+                          const std::string &cache_path);
 
     std::shared_ptr<Package> find_by_uid(uid_t uid) const;
     std::shared_ptr<Package> find_by_pkg(const std::string &pkg_id) const;
@@ -19,56 +19,24 @@
 
 #include "ramdisk_patcher.h"
 
-#include <cerrno>
-#include <cstdio>
+#include <algorithm>
+
 #include <cstdlib>
 #include <cstring>
 
-#include <sys/stat.h>
-#include <unistd.h>
-
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/copy.h"
 
-#include "installer_util.h"
+#include "cpio_file.h"
 
 namespace mb
 {
 
-static bool _rp_write_rom_id(const std::string &dir, const std::string &rom_id)
+static bool _rp_write_rom_id(CpioFile &cpio, const std::string &rom_id)
 {
-    std::string path(dir);
-    path += "/romid";
-
-    FILE *fp = fopen(path.c_str(), "wb");
-    if (!fp) {
-        LOGE("%s: Failed to open for writing: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    if (fputs(rom_id.c_str(), fp) == EOF) {
-        LOGE("%s: Failed to write ROM ID: %s",
-             path.c_str(), strerror(errno));
-        fclose(fp);
-        return false;
-    }
-
-    if (fchmod(fileno(fp), 0664) < 0) {
-        LOGE("%s: Failed to chmod: %s",
-             path.c_str(), strerror(errno));
-        fclose(fp);
-        return false;
-    }
-
-    if (fclose(fp) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    return true;
+    return cpio.set_contents("romid", std::vector<unsigned char>(
+                    rom_id.begin(), rom_id.end()))
+            && cpio.set_perms("romid", 0664);
 }
 
 std::function<RamdiskPatcherFn>
@@ -79,105 +47,50 @@ rp_write_rom_id(const std::string &rom_id)
     return std::bind(_rp_write_rom_id, _1, rom_id);
 }
 
-static bool _rp_patch_default_prop(const std::string &dir,
+static bool _rp_patch_default_prop(CpioFile &cpio,
                                    const std::string &device_id,
                                    bool use_fuse_exfat)
 {
-    char *tmp_path = nullptr;
-    int tmp_fd = -1;
-    FILE *fp_in = nullptr;
-    FILE *fp_out = nullptr;
-    char *buf = nullptr;
-    size_t buf_size = 0;
-    ssize_t n;
-    bool ret = false;
-
-    std::string path(dir);
-    path += "/default.prop";
-
-    tmp_path = mb_format("%s.XXXXXX", path.c_str());
-    if (!tmp_path) {
-        LOGE("Out of memory");
-        goto done;
-    }
-
-    tmp_fd = mkstemp(tmp_path);
-    if (tmp_fd < 0) {
-        LOGE("%s: Failed to create temporary file: %s",
-             path.c_str(), strerror(errno));
-        goto done;
-    }
+    std::vector<unsigned char> data;
+    std::vector<unsigned char> new_data;
 
-    fp_in = fopen(path.c_str(), "rb");
-    if (!fp_in) {
-        LOGE("%s: Failed to open for reading: %s",
-             path.c_str(), strerror(errno));
-        goto done;
+    if (!cpio.contents("default.prop", &data)) {
+        return false;
     }
 
-    fp_out = fdopen(tmp_fd, "wb");
-    if (!fp_out) {
-        LOGE("%s: Failed to open for writing: %s",
-             tmp_path, strerror(errno));
-        goto done;
-    }
+    new_data.reserve(data.size() + 128);
 
-    tmp_fd = -1;
+    auto begin = data.begin();
+    while (begin != data.end()) {
+        auto end = std::find(begin, data.end(), '\n');
+        if (end != data.end()) {
+            ++end;
+        }
 
-    while ((n = getline(&buf, &buf_size, fp_in)) >= 0) {
         // Remove old multiboot properties
-        if (mb_starts_with(buf, "ro.patcher.")) {
-            continue;
+        static const char prefix[] = "ro.patcher.";
+        if (static_cast<std::size_t>(end - begin) < sizeof(prefix) - 1
+                || !std::equal(prefix, prefix + sizeof(prefix) - 1, begin)) {
+            new_data.insert(new_data.end(), begin, end);
         }
 
-        if (fwrite(buf, 1, n, fp_out) != static_cast<size_t>(n)) {
-            LOGE("%s: Failed to write file: %s",
-                 tmp_path, strerror(errno));
-            goto done;
-        }
+        begin = end;
     }
 
     // Write new properties
-    if (fputc('\n', fp_out) == EOF
-            || fprintf(fp_out, "ro.patcher.device=%s\n", device_id.c_str()) < 0
-            || fprintf(fp_out, "ro.patcher.use_fuse_exfat=%s\n",
-                       use_fuse_exfat ? "true" : "false") < 0) {
-        LOGE("%s: Failed to write properties: %s",
-             tmp_path, strerror(errno));
-        goto done;
-    }
-
-    if (fclose(fp_out) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             tmp_path, strerror(errno));
-        goto done;
-    }
-
-    fp_out = nullptr;
-
-    if (!InstallerUtil::replace_file(path.c_str(), tmp_path)) {
-        goto done;
-    }
-
-    ret = true;
-
-done:
-    if (tmp_fd >= 0) {
-        close(tmp_fd);
-    }
-    if (fp_in) {
-        fclose(fp_in);
-    }
-    if (fp_out) {
-        fclose(fp_out);
+    char *props = mb_format("\nro.patcher.device=%s\n"
+                            "ro.patcher.use_fuse_exfat=%s\n",
+                            device_id.c_str(),
+                            use_fuse_exfat ? "true" : "false");
+    if (!props) {
+        LOGE("Out of memory");
+        return false;
     }
 
-    unlink(tmp_path);
-
-    free(tmp_path);
-    free(buf);
+    new_data.insert(new_data.end(), props, props + strlen(props));
+    free(props);
 
-    return ret;
+    return cpio.set_contents("default.prop", std::move(new_data));
 }
 
 std::function<RamdiskPatcherFn>
@@ -188,7 +101,7 @@ rp_patch_default_prop(const std::string &device_id, bool use_fuse_exfat)
     return std::bind(_rp_patch_default_prop, _1, device_id, use_fuse_exfat);
 }
 
-static bool _rp_add_binaries(const std::string &dir,
+static bool _rp_add_binaries(CpioFile &cpio,
                              const std::string &binaries_dir)
 {
     struct CopySpec
@@ -213,15 +126,9 @@ static bool _rp_add_binaries(const std::string &dir,
         std::string source(binaries_dir);
         source += "/";
         source += item.from;
-        std::string target(dir);
-        target += "/";
-        target += item.to;
 
-        if (!util::copy_file(source, target, 0)) {
-            return false;
-        }
-        if (chmod(target.c_str(), item.perm) < 0) {
-            LOGE("%s: Failed to chmod: %s", target.c_str(), strerror(errno));
+        if (!cpio.add_file(item.to, source)
+                || !cpio.set_perms(item.to, item.perm)) {
             return false;
         }
     }
@@ -237,18 +144,11 @@ rp_add_binaries(const std::string &binaries_dir)
     return std::bind(_rp_add_binaries, _1, binaries_dir);
 }
 
-static bool _rp_symlink_fuse_exfat(const std::string &dir)
+static bool _rp_symlink_fuse_exfat(CpioFile &cpio)
 {
-    std::string fsck_exfat(dir);
-    fsck_exfat += "/sbin/fsck.exfat";
-    std::string fsck_exfat_sig(fsck_exfat);
-    fsck_exfat_sig += ".sig";
-
-    if ((unlink(fsck_exfat.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat", fsck_exfat.c_str()) < 0
-            || (unlink(fsck_exfat_sig.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat.sig", fsck_exfat_sig.c_str()) < 0) {
-        LOGE("Failed to symlink exfat fsck binaries: %s", strerror(errno));
+    if (!cpio.add_symlink("sbin/fsck.exfat", "mount.exfat")
+            || !cpio.add_symlink("sbin/fsck.exfat.sig", "mount.exfat.sig")) {
+        LOGE("Failed to symlink exfat fsck binaries");
         return false;
     }
 
@@ -261,30 +161,16 @@ rp_symlink_fuse_exfat()
     return _rp_symlink_fuse_exfat;
 }
 
-static bool _rp_symlink_init(const std::string &dir)
+static bool _rp_symlink_init(CpioFile &cpio)
 {
     // Symlink init
-    std::string init(dir);
-    init += "/init";
-    std::string init_orig(init);
-    init_orig += ".orig";
-
-    if (access(init_orig.c_str(), R_OK) < 0) {
-        if (errno != ENOENT) {
-            LOGE("%s: Failed to access file: %s",
-                 init_orig.c_str(), strerror(errno));
-            return false;
-        }
-
-        if (rename(init.c_str(), init_orig.c_str()) < 0) {
-            LOGE("%s: Failed to rename file: %s",
-                 init.c_str(), strerror(errno));
+    if (!cpio.exists("init.orig")) {
+        if (!cpio.rename("init", "init.orig")) {
             return false;
         }
 
-        if (symlink("mbtool", init.c_str()) < 0) {
-            LOGE("%s: Failed to symlink mbtool: %s",
-                 init.c_str(), strerror(errno));
+        if (!cpio.add_symlink("init", "mbtool")) {
+            LOGE("init: Failed to symlink mbtool");
             return false;
         }
     }
@@ -298,23 +184,11 @@ rp_symlink_init()
     return _rp_symlink_init;
 }
 
-static bool _rp_add_device_json(const std::string &dir,
+static bool _rp_add_device_json(CpioFile &cpio,
                                 const std::string &device_json_file)
 {
-    std::string device_json(dir);
-    device_json += "/device.json";
-
-    if (!util::copy_file(device_json_file, device_json, 0)) {
-        return false;
-    }
-
-    if (chmod(device_json.c_str(), 0644) < 0) {
-        LOGE("%s: Failed to chmod file: %s",
-             device_json.c_str(), strerror(errno));
-        return false;
-    }
-
-    return true;
+    return cpio.add_file("device.json", device_json_file)
+            && cpio.set_perms("device.json", 0644);
 }
 
 std::function<RamdiskPatcherFn>
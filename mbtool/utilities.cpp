@@ -32,6 +32,7 @@
 
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mbdevice/database.h"
 #include "mbdevice/device.h"
 #include "mbdevice/validate.h"
 #include "mbdevice/json.h"
@@ -57,17 +58,10 @@ namespace mb
 
 const char *devices_file = nullptr;
 
-static Device * get_device(const char *path)
+static Device * find_device_in_json(const char *path,
+                                    const char *product_device,
+                                    const char *build_product)
 {
-    char prop_product_device[PROP_VALUE_MAX];
-    char prop_build_product[PROP_VALUE_MAX];
-
-    util::property_get("ro.product.device", prop_product_device, "");
-    util::property_get("ro.build.product", prop_build_product, "");
-
-    LOGD("ro.product.device = %s", prop_product_device);
-    LOGD("ro.build.product = %s", prop_build_product);
-
     std::vector<unsigned char> contents;
     if (!util::file_read_all(path, &contents)) {
         LOGE("%s: Failed to read file: %s", path, strerror(errno));
@@ -86,18 +80,19 @@ static Device * get_device(const char *path)
     Device *device = nullptr;
 
     for (auto it = devices; *it; ++it) {
-        if (mb_device_validate(*it) != 0) {
+        if (device) {
+            // Already found a match
+        } else if (mb_device_validate(*it) != 0) {
             LOGW("Skipping invalid device");
-            continue;
-        }
-
-        auto codenames = mb_device_codenames(*it);
-
-        for (auto it2 = codenames; *it2; ++it2) {
-            if (strcmp(*it2, prop_product_device) == 0
-                    || strcmp(*it2, prop_build_product) == 0) {
-                device = *it;
-                break;
+        } else {
+            auto codenames = mb_device_codenames(*it);
+
+            for (auto it2 = codenames; *it2; ++it2) {
+                if (strcmp(*it2, product_device) == 0
+                        || strcmp(*it2, build_product) == 0) {
+                    device = *it;
+                    break;
+                }
             }
         }
 
@@ -109,6 +104,47 @@ static Device * get_device(const char *path)
 
     free(devices);
 
+    return device;
+}
+
+static Device * get_device(const char *path)
+{
+    char prop_product_device[PROP_VALUE_MAX];
+    char prop_build_product[PROP_VALUE_MAX];
+
+    util::property_get("ro.product.device", prop_product_device, "");
+    util::property_get("ro.build.product", prop_build_product, "");
+
+    LOGD("ro.product.device = %s", prop_product_device);
+    LOGD("ro.build.product = %s", prop_build_product);
+
+    Device *device = nullptr;
+
+    // Prefer the compiled database, which only needs to parse the matching
+    // device. Fall back to parsing the JSON file if the file is not a database.
+    // Like the JSON lookup, this returns the first valid device that matches
+    // either property and skips invalid devices.
+    MbDeviceDatabase *db = mb_device_database_open(path);
+    if (db) {
+        const char *codenames[] = {
+            prop_product_device,
+            prop_build_product,
+            nullptr
+        };
+
+        device = mb_device_database_find_valid(db, codenames);
+        if (!device && errno != ENOENT) {
+            LOGE("%s: Failed to load device: %s", path, strerror(errno));
+        }
+        mb_device_database_close(db);
+    } else if (errno == EINVAL) {
+        device = find_device_in_json(path, prop_product_device,
+                                     prop_build_product);
+    } else {
+        LOGE("%s: Failed to open file: %s", path, strerror(errno));
+        return nullptr;
+    }
+
     if (!device) {
         LOGE("Unknown device: %s", prop_product_device);
         return nullptr;
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "zip_index.h"
+
+#include <unordered_map>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "minizip/ioandroid.h"
+#include "minizip/ioapi_buf.h"
+#include "minizip/unzip.h"
+
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/finally.h"
+
+// Host system value for Unix in the "version made by" field
+#define ZIP_HOST_UNIX           3
+
+// Permissions used when the zip does not store Unix permissions. This matches
+// what libarchive's zip reader uses.
+#define ZIP_DEFAULT_FILE_MODE   0664
+
+namespace mb
+{
+
+struct ZipIndexCtx
+{
+    unzFile uf;
+    zlib_filefunc64_def zFunc;
+    ourbuffer_t buf;
+    std::string path;
+    std::unordered_map<std::string, unz64_file_pos> entries;
+};
+
+static bool get_current_name(unzFile uf, unz_file_info64 *fi,
+                             std::string *name)
+{
+    // Almost every name fits, so avoid querying the size first
+    char buf[256];
+
+    int ret = unzGetCurrentFileInfo64(uf, fi, buf, sizeof(buf),
+                                      nullptr, 0, nullptr, 0);
+    if (ret != UNZ_OK) {
+        return false;
+    }
+
+    if (fi->size_filename < sizeof(buf)) {
+        name->assign(buf, fi->size_filename);
+        return true;
+    }
+
+    std::vector<char> large_buf(fi->size_filename + 1);
+
+    ret = unzGetCurrentFileInfo64(uf, fi, large_buf.data(), large_buf.size(),
+                                  nullptr, 0, nullptr, 0);
+    if (ret != UNZ_OK) {
+        return false;
+    }
+
+    name->assign(large_buf.data(), fi->size_filename);
+    return true;
+}
+
+static bool write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+ZipIndex::ZipIndex() = default;
+
+ZipIndex::~ZipIndex()
+{
+    close();
+}
+
+bool ZipIndex::open(const std::string &path)
+{
+    close();
+
+    std::unique_ptr<ZipIndexCtx> ctx(new ZipIndexCtx());
+    ctx->path = path;
+
+    memset(&ctx->zFunc, 0, sizeof(ctx->zFunc));
+    memset(&ctx->buf, 0, sizeof(ctx->buf));
+
+    fill_android_filefunc64(&ctx->buf.filefunc64);
+    fill_buffer_filefunc64(&ctx->zFunc, &ctx->buf);
+
+    // This reads the end of central directory record
+    ctx->uf = unzOpen2_64(ctx->path.c_str(), &ctx->zFunc);
+    if (!ctx->uf) {
+        LOGE("%s: Failed to open zip", path.c_str());
+        return false;
+    }
+
+    auto close_on_error = util::finally([&]{
+        if (ctx) {
+            unzClose(ctx->uf);
+        }
+    });
+
+    unz_global_info64 gi;
+    if (unzGetGlobalInfo64(ctx->uf, &gi) == UNZ_OK) {
+        ctx->entries.reserve(gi.number_entry);
+    }
+
+    // Walk the central directory without touching any of the file data
+    unz_file_info64 fi;
+    unz64_file_pos pos;
+    std::string name;
+    int ret;
+
+    for (ret = unzGoToFirstFile(ctx->uf); ret == UNZ_OK;
+            ret = unzGoToNextFile(ctx->uf)) {
+        if (!get_current_name(ctx->uf, &fi, &name)
+                || unzGetFilePos64(ctx->uf, &pos) != UNZ_OK) {
+            LOGE("%s: Failed to read central directory entry", path.c_str());
+            return false;
+        }
+
+        // Match the streaming reader, where later entries overwrite earlier
+        // entries with the same name
+        ctx->entries[name] = pos;
+    }
+
+    if (ret != UNZ_END_OF_LIST_OF_FILE) {
+        LOGE("%s: Failed to read central directory: error %d",
+             path.c_str(), ret);
+        return false;
+    }
+
+    LOGD("%s: Indexed %zu zip entries", path.c_str(), ctx->entries.size());
+
+    _ctx = std::move(ctx);
+    return true;
+}
+
+void ZipIndex::close()
+{
+    if (_ctx) {
+        unzClose(_ctx->uf);
+        _ctx.reset();
+    }
+}
+
+bool ZipIndex::is_open() const
+{
+    return !!_ctx;
+}
+
+bool ZipIndex::exists(const std::string &name) const
+{
+    return _ctx && _ctx->entries.find(name) != _ctx->entries.end();
+}
+
+bool ZipIndex::extract(const std::string &name, const std::string &target)
+{
+    if (!_ctx) {
+        return false;
+    }
+
+    auto it = _ctx->entries.find(name);
+    if (it == _ctx->entries.end()) {
+        LOGE("%s: File not found in zip", name.c_str());
+        return false;
+    }
+
+    unzFile uf = _ctx->uf;
+    unz_file_info64 fi;
+    int ret;
+
+    if ((ret = unzGoToFilePos64(uf, &it->second)) != UNZ_OK
+            || (ret = unzGetCurrentFileInfo64(uf, &fi, nullptr, 0,
+                                              nullptr, 0, nullptr, 0)) != UNZ_OK
+            || (ret = unzOpenCurrentFile(uf)) != UNZ_OK) {
+        LOGE("%s: Failed to open file in zip: error %d", name.c_str(), ret);
+        return false;
+    }
+
+    bool inner_open = true;
+    auto close_inner_file = util::finally([&]{
+        if (inner_open) {
+            unzCloseCurrentFile(uf);
+        }
+    });
+
+    mode_t mode = ZIP_DEFAULT_FILE_MODE;
+    if ((fi.version >> 8) == ZIP_HOST_UNIX && (fi.external_fa >> 16) != 0) {
+        mode = (fi.external_fa >> 16) & 07777;
+    }
+
+    // Same as ARCHIVE_EXTRACT_UNLINK and libarchive's automatic creation of
+    // parent directories
+    if (unlink(target.c_str()) < 0 && errno != ENOENT) {
+        LOGW("%s: Failed to unlink: %s", target.c_str(), strerror(errno));
+    }
+    util::mkdir_parent(target, 0755);
+
+    int fd = ::open(target.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+                    mode);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for writing: %s",
+             target.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = util::finally([&]{
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    });
+
+    char buf[32768];
+    int n;
+
+    while ((n = unzReadCurrentFile(uf, buf, sizeof(buf))) > 0) {
+        if (!write_all(fd, buf, n)) {
+            LOGE("%s: Failed to write data: %s",
+                 target.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    if (n != 0) {
+        LOGE("%s: Failed before reaching inner file's EOF: error %d",
+             name.c_str(), n);
+        return false;
+    }
+
+    // Ignore umask like ARCHIVE_EXTRACT_PERM does
+    if (fchmod(fd, mode) < 0) {
+        LOGE("%s: Failed to chmod: %s", target.c_str(), strerror(errno));
+        return false;
+    }
+
+    int saved_fd = fd;
+    fd = -1;
+    if (::close(saved_fd) < 0) {
+        LOGE("%s: Error when closing file: %s",
+             target.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Reports CRC mismatches
+    inner_open = false;
+    ret = unzCloseCurrentFile(uf);
+    if (ret != UNZ_OK) {
+        LOGE("%s: Failed to verify file in zip: error %d", name.c_str(), ret);
+        return false;
+    }
+
+    return true;
+}
+
+bool ZipIndex::extract_files(const std::vector<util::extract_info> &files)
+{
+    if (files.empty()) {
+        return false;
+    }
+
+    for (auto const &info : files) {
+        if (!exists(info.from)) {
+            LOGE("Not all specified files were extracted");
+            return false;
+        }
+    }
+
+    for (auto const &info : files) {
+        if (!extract(info.from, info.to)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ZipIndex::exists_files(std::vector<util::exists_info> &files) const
+{
+    if (files.empty() || !_ctx) {
+        return false;
+    }
+
+    for (util::exists_info &info : files) {
+        info.exists = exists(info.path);
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mbutil/archive.h"
+
+namespace mb
+{
+
+struct ZipIndexCtx;
+
+/*!
+ * \brief Random access reader for zip files
+ *
+ * The central directory is read once when the zip is opened and every entry's
+ * location is stored in a hash table. Looking up or extracting an entry then
+ * seeks directly to it instead of reading the zip from the beginning.
+ */
+class ZipIndex
+{
+public:
+    ZipIndex();
+    ~ZipIndex();
+
+    ZipIndex(const ZipIndex &) = delete;
+    ZipIndex & operator=(const ZipIndex &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+    bool is_open() const;
+
+    bool exists(const std::string &name) const;
+    bool extract(const std::string &name, const std::string &target);
+
+    // Same semantics as util::extract_files2() and util::archive_exists()
+    bool extract_files(const std::vector<util::extract_info> &files);
+    bool exists_files(std::vector<util::exists_info> &files) const;
+
+private:
+    std::unique_ptr<ZipIndexCtx> _ctx;
+};
+
+}
@@ -30,6 +30,7 @@
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 // libmbsparse
 #include "mbsparse/sparse.h"
@@ -422,7 +423,7 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
 
     set_progress(0);
 
-    while ((sparse_ret = sparseRead(ctx.get(), buf, sizeof(buf), &n)) && n > 0) {
+    while (true) {
         // Rate limit: update progress only after difference exceeds 0.1%
         old_ratio = (double) old_bytes / max_bytes;
         new_ratio = (double) cur_bytes / max_bytes;
@@ -431,6 +432,24 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
             old_bytes = cur_bytes;
         }
 
+        // Leave "don't care" regions untouched instead of writing zeros
+        if (!(sparse_ret = sparseSkipHole(ctx.get(), &n))) {
+            break;
+        } else if (n > 0) {
+            if (lseek64(fd, n, SEEK_CUR) < 0) {
+                error("%s: Failed to seek: %s",
+                      out_filename, strerror(errno));
+                return ExtractResult::ERROR;
+            }
+            cur_bytes += n;
+            continue;
+        }
+
+        if (!(sparse_ret = sparseRead(ctx.get(), buf, sizeof(buf), &n))
+                || n == 0) {
+            break;
+        }
+
         char *out_ptr = buf;
         ssize_t nwritten;
 
@@ -451,6 +470,18 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return ExtractResult::ERROR;
     }
 
+    // Extend the output if it is a regular file that ends with a hole. It is
+    // never shrunk.
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        error("%s: Failed to stat: %s", out_filename, strerror(errno));
+        return ExtractResult::ERROR;
+    } else if (S_ISREG(sb.st_mode) && (uint64_t) sb.st_size < cur_bytes
+            && ftruncate64(fd, cur_bytes) < 0) {
+        error("%s: Failed to extend: %s", out_filename, strerror(errno));
+        return ExtractResult::ERROR;
+    }
+
     return ExtractResult::OK;
 }
 